@@ -1,128 +1,585 @@
-/*
- * This code is provided solely for the personal and private use of students
- * taking the CSC369H course at the University of Toronto. Copying for purposes
- * other than this use is expressly prohibited. All forms of distribution of
- * this code, including but not limited to public repositories on GitHub,
- * GitLab, Bitbucket, or any other online platform, whether as given or with
- * any changes, are expressly prohibited.
- *
- * Authors: Alexey Khrabrov, Karen Reid
- *
- * All of the files in this directory and all subdirectories are:
- * Copyright (c) 2019 Karen Reid
- */
-
-/**
- * CSC369 Assignment 1 - a1fs types, constants, and data structures header file.
- */
-
-#pragma once
-
-#include <assert.h>
-#include <stdint.h>
-#include <limits.h>
-#include <sys/stat.h>
-
-
-/**
- * a1fs block size in bytes. You are not allowed to change this value.
- *
- * The block size is the unit of space allocation. Each file (and directory)
- * must occupy an integral number of blocks. Each of the file systems metadata
- * partitions, e.g. superblock, inode/block bitmaps, inode table (but not an
- * individual inode) must also occupy an integral number of blocks.
- */
-#define A1FS_BLOCK_SIZE 4096
-
-/** Block number (block pointer) type. */
-typedef uint32_t a1fs_blk_t;
-
-/** Inode number type. */
-typedef uint32_t a1fs_ino_t;
-
-
-/** Magic value that can be used to identify an a1fs image. */
-#define A1FS_MAGIC 0xC5C369A1C5C369A1ul
-
-/** a1fs superblock. */
-typedef struct a1fs_superblock {
-	/** Must match A1FS_MAGIC. */
-	uint64_t magic;
-	/** File system size in bytes. */
-	uint64_t size;
-	
-//## ANNOTATION 2: Why are we using pointers? In the case of block indices, all we need is an offset from 0.  ##
-	int inode_bmp;
-	int datablock_bmp;
-	int inode_table;
-	int data_table;
-//## END ANNOTATION 2 ##
-	
-//## ANNOTATION 1: It is better to use unsigned integer types.  ##
-	unsigned int num_inodes;
-	unsigned int num_blocks;
-	unsigned int num_unused_inodes;
-	unsigned int num_unused_blocks;
-//## END ANNOTATION 1 ##
-
-	//TODO
-
-} a1fs_superblock;
-
-// Superblock must fit into a single block
-static_assert(sizeof(a1fs_superblock) <= A1FS_BLOCK_SIZE,
-              "superblock is too large");
-
-
-/** Extent - a contiguous range of blocks. */
-typedef struct a1fs_extent {
-	/** Starting block of the extent. */
-	a1fs_blk_t start;
-	/** Number of blocks in the extent. */
-	a1fs_blk_t count;
-
-} a1fs_extent;
-
-
-/** a1fs inode. */
-typedef struct a1fs_inode {
-	/** File mode. */
-	mode_t mode;
-	/** Reference count (number of hard links). */
-	uint32_t links;
-	/** File size in bytes. */
-	uint64_t size;
-	/** Last modification timestamp. */
-	struct timespec mtime;
-
-	//TODO
-	//
-		
-	int * overflow_pointer;
-	char overflow_flag;
-	int i_blocks[15];
-	a1fs_extent extent_array[8];
-	char garbage[83]; // THIS IS EXTRA STUFF TO KEEP A VALID INODE SIZE
-
-} a1fs_inode;
-
-// A single block must fit an integral number of inodes
-static_assert(A1FS_BLOCK_SIZE % sizeof(a1fs_inode) == 0, "invalid inode size");
-
-
-/** Maximum file name (path component) length. */
-#define A1FS_NAME_MAX 252
-
-/** Maximum file path length. */
-#define A1FS_PATH_MAX PATH_MAX
-
-/** Fixed-size directory entry structure. */
-typedef struct a1fs_dentry {
-	/** Inode number. */
-	a1fs_ino_t ino;
-	/** File name. A null-terminated string. */
-	char name[A1FS_NAME_MAX];
-
-} a1fs_dentry;
-
-static_assert(sizeof(a1fs_dentry) == 256, "invalid dentry size");
+/*
+ * This code is provided solely for the personal and private use of students
+ * taking the CSC369H course at the University of Toronto. Copying for purposes
+ * other than this use is expressly prohibited. All forms of distribution of
+ * this code, including but not limited to public repositories on GitHub,
+ * GitLab, Bitbucket, or any other online platform, whether as given or with
+ * any changes, are expressly prohibited.
+ *
+ * Authors: Alexey Khrabrov, Karen Reid
+ *
+ * All of the files in this directory and all subdirectories are:
+ * Copyright (c) 2019 Karen Reid
+ */
+
+/**
+ * CSC369 Assignment 1 - a1fs types, constants, and data structures header file.
+ */
+
+#pragma once
+
+#include <assert.h>
+#include <stdint.h>
+#include <limits.h>
+#include <sys/ioctl.h>
+#include <sys/stat.h>
+
+
+/**
+ * a1fs block size in bytes. You are not allowed to change this value.
+ *
+ * The block size is the unit of space allocation. Each file (and directory)
+ * must occupy an integral number of blocks. Each of the file systems metadata
+ * partitions, e.g. superblock, inode/block bitmaps, inode table (but not an
+ * individual inode) must also occupy an integral number of blocks.
+ */
+#define A1FS_BLOCK_SIZE 4096
+
+/** Block number (block pointer) type. */
+typedef uint32_t a1fs_blk_t;
+
+/** Inode number type. */
+typedef uint32_t a1fs_ino_t;
+
+/**
+ * Root directory inode number. Inode 0 holds the single "/" entry that points
+ * to it.
+ */
+#define A1FS_ROOT_INO 1
+
+
+/** Magic value that can be used to identify an a1fs image. */
+#define A1FS_MAGIC 0xC5C369A1C5C369A1ul
+
+/**
+ * Feature flag: the last partial block of small files is packed into a tail
+ * block shared with other files (see a1fs_tail_header). Set by mkfs -t.
+ */
+#define A1FS_FEATURE_TAILS 0x1
+
+/** a1fs superblock. */
+typedef struct a1fs_superblock {
+	/** Must match A1FS_MAGIC. */
+	uint64_t magic;
+	/** File system size in bytes. */
+	uint64_t size;
+	
+//## ANNOTATION 2: Why are we using pointers? In the case of block indices, all we need is an offset from 0.  ##
+	int inode_bmp;
+	int datablock_bmp;
+	int inode_table;
+	int data_table;
+//## END ANNOTATION 2 ##
+	
+//## ANNOTATION 1: It is better to use unsigned integer types.  ##
+	unsigned int num_inodes;
+	unsigned int num_blocks;
+	unsigned int num_unused_inodes;
+	unsigned int num_unused_blocks;
+//## END ANNOTATION 1 ##
+
+	/** First block of the data block reference count table. */
+	int refcount_table;
+
+	/** First block of the dedup index, or 0 if the index is disabled. */
+	int dedup_index;
+	/** Number of dedup index slots (a power of 2). */
+	unsigned int dedup_slots;
+	/** First block of the bitmap of data blocks that are in the dedup index. */
+	int dedup_bmp;
+
+	/**
+	 * Number of data blocks that the data bitmap, the refcount table and the
+	 * dedup bitmap have room for. The file system can grow up to this many
+	 * data blocks without moving any of the metadata.
+	 */
+	unsigned int max_blocks;
+
+	/** Number of snapshots (see a1fs_snapshot). */
+	unsigned int num_snapshots;
+	/** Data block that holds the snapshot list, if there are any snapshots. */
+	a1fs_blk_t snapshot_list;
+
+	/**
+	 * Current generation. Each inode records the generation it was last
+	 * modified in; taking a snapshot starts a new generation, so the inodes
+	 * modified since a snapshot are those with a later generation than it.
+	 */
+	uint64_t generation;
+
+	/** Number of quotas (see a1fs_quota). */
+	unsigned int num_quotas;
+	/** Data block that holds the quota table, if there are any quotas. */
+	a1fs_blk_t quota_table;
+
+	/**
+	 * Nonzero if the file system was unmounted cleanly. Cleared when it is
+	 * mounted and set again on unmount, so it stays clear after a crash. The
+	 * checkpoint is only valid while this is set.
+	 */
+	unsigned int clean;
+	/** First data block of the checkpoint (see a1fs_checkpoint). */
+	a1fs_blk_t checkpoint;
+	/** Number of data blocks in the checkpoint; 0 if there is none. */
+	a1fs_blk_t checkpoint_blocks;
+	/**
+	 * CRC32C of the superblock with this field set to 0, written together with
+	 * the clean flag; 0 if the checkpoint has no checksums (see
+	 * a1fs_checkpoint).
+	 */
+	uint32_t checksum;
+
+	/** A1FS_FEATURE_* flags, chosen when the file system is created. */
+	unsigned int features;
+
+	//TODO
+
+} a1fs_superblock;
+
+// Superblock must fit into a single block
+static_assert(sizeof(a1fs_superblock) <= A1FS_BLOCK_SIZE,
+              "superblock is too large");
+
+
+/** Extent - a contiguous range of blocks. */
+typedef struct a1fs_extent {
+	/** Starting block of the extent. */
+	a1fs_blk_t start;
+	/** Number of blocks in the extent. */
+	a1fs_blk_t count;
+	/** File block number (offset in blocks) of the first block in the extent. */
+	a1fs_blk_t lblk;
+
+} a1fs_extent;
+
+/**
+ * Data block reference count - the number of file blocks that map the data
+ * block, counting the files of the snapshots as well. Blocks shared between
+ * files by cloning or with snapshots have a count greater than 1.
+ */
+typedef uint32_t a1fs_refcount_t;
+
+/** Number of reference counts stored in one block of the refcount table. */
+#define A1FS_REFCOUNTS_PER_BLOCK (A1FS_BLOCK_SIZE / sizeof(a1fs_refcount_t))
+
+
+/**
+ * Dedup index slot. The index is an open addressing hash table keyed by the
+ * content hash of data blocks; hash 0 marks an empty slot.
+ */
+typedef struct a1fs_dedup_entry {
+	/** Content hash of the block. */
+	uint64_t hash;
+	/** Data block number. */
+	a1fs_blk_t blk;
+	uint32_t padding;
+
+} a1fs_dedup_entry;
+
+/** Number of dedup index slots stored in one block. */
+#define A1FS_DEDUP_ENTRIES_PER_BLOCK (A1FS_BLOCK_SIZE / sizeof(a1fs_dedup_entry))
+
+
+/** Number of extents stored directly in an inode. */
+#define A1FS_INODE_EXTENTS 8
+
+
+/** Size of a compression cluster in bytes. */
+#define A1FS_CLUSTER_SIZE (64 * 1024)
+
+/**
+ * Cluster map entry of a compressed file. Each A1FS_CLUSTER_SIZE bytes of the
+ * file are compressed separately with LZ4 and stored in a contiguous run of
+ * data blocks.
+ */
+typedef struct a1fs_cluster {
+	/** First data block of the cluster. */
+	a1fs_blk_t start;
+	/**
+	 * Size of the stored cluster in bytes: 0 for a hole; A1FS_CLUSTER_SIZE if
+	 * the data didn't compress and is stored as is.
+	 */
+	uint32_t size;
+
+} a1fs_cluster;
+
+/** Number of cluster map entries stored in one block. */
+#define A1FS_CLUSTERS_PER_BLOCK (A1FS_BLOCK_SIZE / sizeof(a1fs_cluster))
+
+/**
+ * Inode flag: file data is stored in compressed clusters. The extents of such
+ * an inode map its cluster map rather than the file data.
+ */
+#define A1FS_INODE_COMPRESSED 0x1
+/** Inode flag: the inode has a shared extended attribute block. */
+#define A1FS_INODE_XATTR_BLOCK 0x2
+/**
+ * Inode flag: the last partial block of the file is stored in a tail block
+ * (see a1fs_inode.tail) rather than mapped by the extents.
+ */
+#define A1FS_INODE_TAIL 0x4
+
+/** Size of the extended attribute area in an inode in bytes. */
+#define A1FS_INODE_XATTR_SIZE 104
+
+
+/** Size of the units that tail blocks are divided into, in bytes. */
+#define A1FS_TAIL_UNIT 64
+/** Number of units in a tail block. */
+#define A1FS_TAIL_UNITS (A1FS_BLOCK_SIZE / A1FS_TAIL_UNIT)
+
+/**
+ * Header at the start of a tail block. The rest of the block holds the tails
+ * of files, each in a run of units. A tail is never modified once written, so
+ * the copies of an inode in snapshots share it with the file.
+ */
+typedef struct a1fs_tail_header {
+	/** Bitmap of the units in use, including the ones taken by the header. */
+	uint64_t used;
+	/**
+	 * Number of inodes (counting the copies in snapshots) whose tail starts at
+	 * each unit; 0 if no tail starts there. The reference count of the block
+	 * is the sum of these.
+	 */
+	uint8_t refs[A1FS_TAIL_UNITS];
+
+} a1fs_tail_header;
+
+static_assert(A1FS_TAIL_UNITS <= 64, "tail block bitmap is too small");
+
+/** Number of units at the start of a tail block taken by the header. */
+#define A1FS_TAIL_HEADER_UNITS \
+	((sizeof(a1fs_tail_header) + A1FS_TAIL_UNIT - 1) / A1FS_TAIL_UNIT)
+
+/** Location of the tail of a file in a tail block. */
+typedef struct a1fs_tail {
+	/** The tail block. */
+	a1fs_blk_t block;
+	/** Offset of the tail in the block in bytes; a multiple of A1FS_TAIL_UNIT. */
+	uint16_t offset;
+	/** Length of the tail in bytes: the file size modulo A1FS_BLOCK_SIZE. */
+	uint16_t len;
+
+} a1fs_tail;
+
+/** Size of the extended attribute area in an inode with A1FS_FEATURE_TAILS. */
+#define A1FS_INODE_XATTR_SIZE_TAILS (A1FS_INODE_XATTR_SIZE - sizeof(a1fs_tail))
+
+
+/** a1fs inode. */
+typedef struct a1fs_inode {
+	/** File mode. */
+	mode_t mode;
+	/** Reference count (number of hard links). */
+	uint32_t links;
+	/** File size in bytes. */
+	uint64_t size;
+	/** Last modification timestamp. */
+	struct timespec mtime;
+
+	/**
+	 * File data extents sorted by lblk. Unused slots have count == 0 and follow
+	 * all used ones. File blocks not covered by any extent are holes: they are
+	 * never allocated and read as zeros.
+	 */
+	a1fs_extent extent_array[A1FS_INODE_EXTENTS];
+	/** A1FS_INODE_* flags. */
+	uint32_t flags;
+	/**
+	 * Data block with the extended attributes that don't fit into the inode.
+	 * Valid if A1FS_INODE_XATTR_BLOCK is set. Inodes with the same attributes
+	 * share the block; its reference count is the number of such inodes.
+	 */
+	a1fs_blk_t xattr_block;
+	/** Generation of the last change to the inode or its data. */
+	uint64_t generation;
+	/** User ID of the owner. */
+	uint32_t uid;
+	/** Quota table slot + 1 of the owner's user quota; 0 if there is none. */
+	uint16_t user_quota;
+	/**
+	 * Quota table slot + 1 of the quota of the nearest directory (including
+	 * this one) that has a quota; 0 if there is none.
+	 */
+	uint16_t dir_quota;
+	/**
+	 * Extended attributes stored in the inode itself: a list of entries (see
+	 * a1fs_xattr_entry), so that small attributes are read without a separate
+	 * block access. With A1FS_FEATURE_TAILS, the area is only
+	 * A1FS_INODE_XATTR_SIZE_TAILS bytes long and is followed by the tail.
+	 */
+	union {
+		unsigned char xattr[A1FS_INODE_XATTR_SIZE];
+		struct {
+			unsigned char xattr_tails[A1FS_INODE_XATTR_SIZE_TAILS];
+			/** Location of the tail; valid if A1FS_INODE_TAIL is set. */
+			a1fs_tail tail;
+		};
+	};
+
+} a1fs_inode;
+
+// A single block must fit an integral number of inodes
+static_assert(A1FS_BLOCK_SIZE % sizeof(a1fs_inode) == 0, "invalid inode size");
+
+
+/**
+ * Extended attribute entry header. An entry list is a sequence of entries,
+ * each followed by the name (without a terminating null character) and the
+ * value, with no padding. The list ends at an entry with name_len == 0 or at
+ * the end of the area that holds it (the inode or the xattr block). Entries in
+ * an xattr block are sorted by name.
+ */
+typedef struct a1fs_xattr_entry {
+	/** Length of the name in bytes. */
+	uint8_t name_len;
+	uint8_t padding;
+	/** Length of the value in bytes. */
+	uint16_t value_len;
+
+} a1fs_xattr_entry;
+
+/** Maximum extended attribute name length. */
+#define A1FS_XATTR_NAME_MAX 255
+
+
+/** Maximum file name (path component) length. */
+#define A1FS_NAME_MAX 252
+
+/** Maximum file path length. */
+#define A1FS_PATH_MAX PATH_MAX
+
+/** Fixed-size directory entry structure. */
+typedef struct a1fs_dentry {
+	/** Inode number. */
+	a1fs_ino_t ino;
+	/** File name. A null-terminated string. */
+	char name[A1FS_NAME_MAX];
+
+} a1fs_dentry;
+
+static_assert(sizeof(a1fs_dentry) == 256, "invalid dentry size");
+
+
+/** Path of the virtual directory that holds the snapshots. */
+#define A1FS_SNAPSHOTS_PATH "/.snapshots"
+
+/**
+ * Snapshot - a read-only view of the file system at the time it was taken.
+ *
+ * A snapshot is a copy of the inode bitmap and the inode table, stored in
+ * contiguous data blocks: the bitmap followed by the table. File data is not
+ * copied; the snapshot holds a reference to each data block of each of its
+ * files, and shared blocks are copied before the file system modifies them.
+ * The metadata itself is not copy-on-write: every snapshot takes the full size
+ * of the inode bitmap and table, and taking or deleting one walks every inode.
+ * Each snapshot appears as a directory /.snapshots/NAME; mkdir() there takes
+ * a snapshot and rmdir() deletes it.
+ */
+typedef struct a1fs_snapshot {
+	/** Snapshot name. A null-terminated string. */
+	char name[A1FS_NAME_MAX];
+	/** First data block of the copy of the inode bitmap and table. */
+	a1fs_blk_t start;
+	/** Number of data blocks in the copy. */
+	a1fs_blk_t count;
+	/** Time the snapshot was taken. */
+	struct timespec time;
+	/** File system generation that the snapshot ended. */
+	uint64_t generation;
+
+} a1fs_snapshot;
+
+/** Maximum number of snapshots: as many as fit into the snapshot list block. */
+#define A1FS_SNAPSHOTS_MAX (A1FS_BLOCK_SIZE / sizeof(a1fs_snapshot))
+
+// A tail is referenced by its file and at most every snapshot
+static_assert(A1FS_SNAPSHOTS_MAX < UINT8_MAX, "tail reference counts are too small");
+
+
+/** Quota types. */
+enum {
+	/** Unused quota table slot. */
+	A1FS_QUOTA_NONE,
+	/** Limits the files owned by a user. */
+	A1FS_QUOTA_USER,
+	/**
+	 * Limits the files in a directory tree, other than those in subtrees with
+	 * a quota of their own.
+	 */
+	A1FS_QUOTA_DIR,
+};
+
+/**
+ * Quota - limits on the data blocks and inodes used by a set of files, and
+ * their current usage.
+ *
+ * Usage is updated whenever a file gains or drops a data block reference, so
+ * limits are checked without scanning the files. A file uses the blocks it
+ * maps (the same ones that st_blocks counts): blocks shared with clones and
+ * snapshots count towards each file that maps them. Each quota is kept in a
+ * slot of the quota table, a single data block; inodes refer to their quotas
+ * by slot.
+ */
+typedef struct a1fs_quota {
+	/** A1FS_QUOTA_* type. */
+	uint32_t type;
+	/** User ID, or the inode number of the directory. */
+	uint32_t id;
+	/** Maximum number of data blocks; 0 for no limit. */
+	uint64_t block_limit;
+	/** Maximum number of inodes; 0 for no limit. */
+	uint64_t inode_limit;
+	/** Number of data blocks in use. */
+	uint64_t blocks;
+	/** Number of inodes in use. */
+	uint64_t inodes;
+
+} a1fs_quota;
+
+/** Maximum number of quotas: as many as fit into the quota table block. */
+#define A1FS_QUOTAS_MAX (A1FS_BLOCK_SIZE / sizeof(a1fs_quota))
+
+
+/** Must match a1fs_checkpoint.magic. */
+#define A1FS_CHECKPOINT_MAGIC 0xC5C369A1C4EC0002ul
+
+/**
+ * Checkpoint of the in-memory indexes that are otherwise rebuilt by scanning
+ * the image at mount. It is written on clean unmount into a run of data
+ * blocks that starts with this header, loaded at the next mount in time
+ * proportional to its size, and then freed.
+ *
+ * The header is followed by the xattr block index entries, then (with
+ * --checksums) the CRC32C of each bitmap block [inode_bmp, refcount_table)
+ * and each inode table block [inode_table, data_table) in this order, and
+ * then the checksums of the directories sorted by inode number.
+ */
+typedef struct a1fs_checkpoint {
+	/** Must match A1FS_CHECKPOINT_MAGIC. */
+	uint64_t magic;
+	/** Superblock generation at unmount. */
+	uint64_t generation;
+	/** Number of xattr block index entries. */
+	uint64_t num_xattr_shares;
+	/** Number of bitmap and inode table block checksums; 0 if there are none. */
+	uint64_t num_block_crcs;
+	/** Number of directory checksums. */
+	uint64_t num_dir_crcs;
+
+} a1fs_checkpoint;
+
+/** Xattr block index entry in a checkpoint. */
+typedef struct a1fs_checkpoint_xattr {
+	/** Hash of the block contents (see dedup_hash()). */
+	uint64_t hash;
+	/** Xattr block number. */
+	a1fs_blk_t blk;
+	uint32_t padding;
+
+} a1fs_checkpoint_xattr;
+
+/**
+ * Directory checksum in a checkpoint: CRC32C of the directory entries, i.e.
+ * the first size bytes of the directory data in file order.
+ */
+typedef struct a1fs_checkpoint_dir {
+	/** Inode number of the directory. */
+	a1fs_ino_t ino;
+	/** The checksum. */
+	uint32_t crc;
+
+} a1fs_checkpoint_dir;
+
+
+/**
+ * a1fs ioctl commands. The argument is a file offset in bytes; on success it is
+ * replaced with the offset lseek() would return for SEEK_DATA or SEEK_HOLE.
+ *
+ * These are private ioctls for programs written against this header. FUSE 2.9
+ * has no lseek() callback, so lseek() itself with SEEK_DATA or SEEK_HOLE gets
+ * the kernel's default answer (all data, one hole at EOF), and tools such as
+ * cp --sparse and tar -S don't see the holes through it.
+ */
+#define A1FS_IOC_SEEK_DATA _IOWR('a', 0, int64_t)
+#define A1FS_IOC_SEEK_HOLE _IOWR('a', 1, int64_t)
+
+/**
+ * Argument of the A1FS_IOC_CLONE_RANGE ioctl. Same as struct file_clone_range
+ * used by FICLONERANGE, except that the source is a path within the a1fs file
+ * system: FUSE can't resolve file descriptors of the calling process.
+ */
+typedef struct a1fs_clone_range {
+	/** Offset of the range in the source file. Must be block-aligned. */
+	int64_t src_offset;
+	/** Length of the range; 0 means up to the end of the source file. */
+	int64_t src_length;
+	/** Offset of the range in the destination file. Must be block-aligned. */
+	int64_t dest_offset;
+	/** Source file path. */
+	char src_path[A1FS_PATH_MAX];
+
+} a1fs_clone_range;
+
+/**
+ * Share the data blocks of a range of the source file with the file the ioctl
+ * is called on (reflink). Blocks are copied on the first write to either file.
+ * Cloning a whole file (as FICLONE does) is a clone of range 0 with length 0.
+ */
+#define A1FS_IOC_CLONE_RANGE _IOW('a', 2, a1fs_clone_range)
+
+/**
+ * Grow the file system to the given image size in bytes while it is mounted.
+ * Can be called on any file or directory of the file system, by root or the
+ * user that mounted it.
+ */
+#define A1FS_IOC_RESIZE _IOW('a', 3, uint64_t)
+
+/**
+ * Argument of the A1FS_IOC_SET_QUOTA and A1FS_IOC_REMOVE_QUOTA ioctls. A
+ * directory quota applies to the directory that the ioctl is called on.
+ */
+typedef struct a1fs_quota_limits {
+	/** A1FS_QUOTA_USER or A1FS_QUOTA_DIR. */
+	uint32_t type;
+	/** User ID of a user quota; ignored for a directory quota. */
+	uint32_t id;
+	/** Maximum number of data blocks; 0 for no limit. */
+	uint64_t block_limit;
+	/** Maximum number of inodes; 0 for no limit. */
+	uint64_t inode_limit;
+
+} a1fs_quota_limits;
+
+/**
+ * Set the limits of a quota. If there is no such quota, it is created and the
+ * current usage is counted by scanning the files it covers.
+ */
+#define A1FS_IOC_SET_QUOTA _IOW('a', 4, a1fs_quota_limits)
+
+/** Remove a quota. The limits in the argument are ignored. */
+#define A1FS_IOC_REMOVE_QUOTA _IOW('a', 5, a1fs_quota_limits)
+
+/** Only report the fragmentation of the file, without moving its blocks. */
+#define A1FS_DEFRAG_CHECK 0x1
+
+/** Argument of the A1FS_IOC_DEFRAG ioctl. */
+typedef struct a1fs_defrag_args {
+	/** A1FS_DEFRAG_* flags. */
+	uint32_t flags;
+	/** Out: number of contiguous runs of data blocks before and after. */
+	uint32_t runs_before;
+	uint32_t runs_after;
+	/** Out: number of data blocks moved. */
+	uint64_t blocks_moved;
+
+} a1fs_defrag_args;
+
+/**
+ * Move the data blocks of the file or directory the ioctl is called on into
+ * one contiguous run, so that it is read sequentially. Blocks shared with
+ * clones or snapshots are left in place (moving them would take up space for
+ * a copy), and so are compressed files. Fails with ENOSPC if there is no free
+ * run large enough.
+ */
+#define A1FS_IOC_DEFRAG _IOWR('a', 6, a1fs_defrag_args)
@@ -0,0 +1,719 @@
+/*
+ * This code is provided solely for the personal and private use of students
+ * taking the CSC369H course at the University of Toronto. Copying for purposes
+ * other than this use is expressly prohibited. All forms of distribution of
+ * this code, including but not limited to public repositories on GitHub,
+ * GitLab, Bitbucket, or any other online platform, whether as given or with
+ * any changes, are expressly prohibited.
+ *
+ * Authors: Alexey Khrabrov, Karen Reid
+ *
+ * All of the files in this directory and all subdirectories are:
+ * Copyright (c) 2019 Karen Reid
+ */
+
+
+/**
+ * CSC369 Assignment 1 - a1fs on the FUSE low-level API.
+ *
+ * Serves the same file system as a1fs through the inode-based low-level API.
+ * The kernel passes inode numbers instead of paths, so an operation no longer
+ * resolves its path from the root directory on every call; only lookup()
+ * searches a directory, once per name the kernel caches. The inode numbers of
+ * a1fs are used as the FUSE node IDs (the root inode is FUSE_ROOT_ID).
+ *
+ * The kernel counts the lookups of each node it knows, and drops them with
+ * forget(). A file removed while the kernel still knows it (e.g. an open file)
+ * keeps its inode and data until the count drops to 0, so that it stays
+ * readable and its inode number is not reused under the kernel. Such orphans
+ * are left on the image if a1fs_ll is killed, and are freed on the next mount.
+ *
+ * The statistics file is served at a node ID past the inode numbers. Snapshots
+ * are only served by a1fs: their files have no node IDs of their own.
+ *
+ * The requests are served with the inode-based operations in fs_ops.c
+ * (file_pread(), dir_mkfile() etc.).
+ */
+
+#define FUSE_USE_VERSION 29
+#include <fuse.h>
+#include <fuse_lowlevel.h>
+
+#include <errno.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+
+#include "fs_ops.h"
+
+
+/** Node ID of the statistics file; never an a1fs inode number. */
+#define LL_STATS_INO ((fuse_ino_t)UINT32_MAX + 1)
+
+/** How long the kernel may cache attributes and entries, in seconds. */
+#define LL_TIMEOUT 1.0
+
+/** Low-level front end state. */
+typedef struct ll_ctx {
+	/** The file system. */
+	fs_ctx fs;
+	/** Number of lookups the kernel holds on each inode. */
+	uint64_t *lookups;
+
+} ll_ctx;
+
+static ll_ctx *get_ll(fuse_req_t req)
+{
+	return (ll_ctx*)fuse_req_userdata(req);
+}
+
+/**
+ * Start serving a request: record the caller for the quota and ownership code
+ * in fs_ops.c.
+ *
+ * @return  start time for ll_end().
+ */
+static uint64_t ll_begin(fuse_req_t req)
+{
+	const struct fuse_ctx *ctx = fuse_req_ctx(req);
+	fs_ctx *fs = &get_ll(req)->fs;
+	fs->caller_uid = ctx->uid;
+	fs->caller_pid = ctx->pid;
+	return stats_now();
+}
+
+/**
+ * Finish serving a request: record its latency, and the request itself into
+ * the trace with --trace (see a1fs_trace_record for offset and size).
+ *
+ * @param fs      file system context.
+ * @param op      operation.
+ * @param start   start time returned by ll_begin().
+ * @param ret     result: >= 0 on success; -errno on error.
+ * @param ino     node ID of the file, or of the parent for name operations.
+ * @param name    entry or attribute name; may be NULL.
+ * @param offset  operation-specific.
+ * @param size    operation-specific.
+ */
+static void ll_end(fs_ctx *fs, a1fs_stats_op op, uint64_t start, int ret,
+                   fuse_ino_t ino, const char *name, uint64_t offset, uint64_t size)
+{
+	stats_record_op(&fs->stats, op, start);
+	if (fs->trace != NULL) {
+		trace_op(fs, op, start, ret, ino, NULL, name, offset, size);
+	}
+}
+
+/** Reply with an error code, or success if ret is 0. */
+static void ll_reply_err(fuse_req_t req, int ret)
+{
+	fuse_reply_err(req, -ret);
+}
+
+/** Whether a node ID refers to a used a1fs inode. */
+static bool ll_valid_ino(ll_ctx *ll, fuse_ino_t ino)
+{
+	const a1fs_superblock *sb = get_sb(&ll->fs);
+	const uint8_t *bmp = ll->fs.image + sb->inode_bmp * A1FS_BLOCK_SIZE;
+	return (ino < sb->num_inodes) && bitmap_test(bmp, ino);
+}
+
+/** Delete an inode once it has neither links nor lookups left. */
+static void ll_release_inode(ll_ctx *ll, a1fs_ino_t ino)
+{
+	if ((get_inode(&ll->fs, ino)->links == 0) && (ll->lookups[ino] == 0)) {
+		inode_delete(&ll->fs, ino);
+	}
+}
+
+/** Delete the orphans: inodes that lost their last link while still looked up. */
+static void ll_delete_orphans(ll_ctx *ll)
+{
+	const a1fs_superblock *sb = get_sb(&ll->fs);
+	const uint8_t *bmp = ll->fs.image + sb->inode_bmp * A1FS_BLOCK_SIZE;
+	for (a1fs_ino_t ino = 0; ino < sb->num_inodes; ino++) {
+		if (bitmap_test(bmp, ino) && (get_inode(&ll->fs, ino)->links == 0)) {
+			inode_delete(&ll->fs, ino);
+		}
+	}
+}
+
+/** Fill in an entry for a reply and count the lookup. */
+static void ll_entry(ll_ctx *ll, a1fs_ino_t ino, struct fuse_entry_param *e)
+{
+	memset(e, 0, sizeof(*e));
+	e->ino = ino;
+	inode_getattr(&ll->fs, get_inode(&ll->fs, ino), &e->attr);
+	e->attr.st_ino = ino;
+	e->attr_timeout = LL_TIMEOUT;
+	e->entry_timeout = LL_TIMEOUT;
+	ll->lookups[ino]++;
+}
+
+
+static void ll_init(void *userdata, struct fuse_conn_info *conn)
+{
+	fs_conn_init(&((ll_ctx*)userdata)->fs, conn);
+}
+
+static void ll_destroy(void *userdata)
+{
+	ll_ctx *ll = (ll_ctx*)userdata;
+	// The kernel doesn't hold the nodes any more
+	ll_delete_orphans(ll);
+	free(ll->lookups);
+	ll->lookups = NULL;
+	a1fs_destroy(&ll->fs);
+}
+
+static void ll_lookup(fuse_req_t req, fuse_ino_t parent, const char *name)
+{
+	uint64_t start = ll_begin(req);
+	ll_ctx *ll = get_ll(req);
+	fs_ctx *fs = &ll->fs;
+	struct fuse_entry_param e;
+	a1fs_ino_t ino;
+	int ret = 0;
+
+	if ((parent == A1FS_ROOT_INO) && (strcmp(name, A1FS_STATS_PATH + 1) == 0)) {
+		memset(&e, 0, sizeof(e));
+		e.ino = LL_STATS_INO;
+		ret = stats_file_getattr(fs, &e.attr);
+		e.attr.st_ino = LL_STATS_INO;
+		// The size changes all the time
+		e.entry_timeout = LL_TIMEOUT;
+	} else if (strlen(name) >= A1FS_NAME_MAX) {
+		ret = -ENAMETOOLONG;
+	} else if (!S_ISDIR(get_inode(fs, parent)->mode)) {
+		ret = -ENOTDIR;
+	} else if ((ret = dir_lookup(fs, get_inode(fs, parent), name, &ino)) == 0) {
+		ll_entry(ll, ino, &e);
+	}
+	if (ret == 0) {
+		fuse_reply_entry(req, &e);
+	} else {
+		ll_reply_err(req, ret);
+	}
+	ll_end(fs, A1FS_OP_LOOKUP, start, ret, parent, name, 0, (ret == 0) ? e.ino : 0);
+}
+
+/** Drop lookups of a node; the inode is deleted if it was an orphan. */
+static void ll_forget_one(ll_ctx *ll, fuse_ino_t ino, uint64_t nlookup)
+{
+	if (!ll_valid_ino(ll, ino)) return;
+	assert(ll->lookups[ino] >= nlookup);
+	ll->lookups[ino] -= nlookup;
+	ll_release_inode(ll, ino);
+}
+
+static void ll_forget(fuse_req_t req, fuse_ino_t ino, unsigned long nlookup)
+{
+	uint64_t start = ll_begin(req);
+	ll_ctx *ll = get_ll(req);
+	ll_forget_one(ll, ino, nlookup);
+	fuse_reply_none(req);
+	ll_end(&ll->fs, A1FS_OP_FORGET, start, 0, ino, NULL, 0, nlookup);
+}
+
+static void ll_forget_multi(fuse_req_t req, size_t count,
+                            struct fuse_forget_data *forgets)
+{
+	uint64_t start = ll_begin(req);
+	ll_ctx *ll = get_ll(req);
+	for (size_t i = 0; i < count; i++) {
+		ll_forget_one(ll, forgets[i].ino, forgets[i].nlookup);
+	}
+	fuse_reply_none(req);
+	ll_end(&ll->fs, A1FS_OP_FORGET, start, 0, 0, NULL, 0, count);
+}
+
+static void ll_getattr(fuse_req_t req, fuse_ino_t ino, struct fuse_file_info *fi)
+{
+	(void)fi;// unused
+	uint64_t start = ll_begin(req);
+	fs_ctx *fs = &get_ll(req)->fs;
+	struct stat st;
+	memset(&st, 0, sizeof(st));
+	int ret = 0;
+	if (ino == LL_STATS_INO) {
+		ret = stats_file_getattr(fs, &st);
+	} else {
+		inode_getattr(fs, get_inode(fs, ino), &st);
+	}
+	st.st_ino = ino;
+	if (ret == 0) {
+		fuse_reply_attr(req, &st, LL_TIMEOUT);
+	} else {
+		ll_reply_err(req, ret);
+	}
+	ll_end(fs, A1FS_OP_GETATTR, start, ret, ino, NULL, 0, 0);
+}
+
+/**
+ * Change the size or the modification time of a file. Like in a1fs, the mode
+ * and the owner can't be changed, and access times are not stored.
+ */
+static void ll_setattr(fuse_req_t req, fuse_ino_t ino, struct stat *attr,
+                       int to_set, struct fuse_file_info *fi)
+{
+	(void)fi;// unused
+	uint64_t start = ll_begin(req);
+	fs_ctx *fs = &get_ll(req)->fs;
+	int ret = 0;
+	if (ino == LL_STATS_INO) {
+		ret = -EACCES;
+	} else if (to_set & (FUSE_SET_ATTR_MODE | FUSE_SET_ATTR_UID | FUSE_SET_ATTR_GID)) {
+		ret = -ENOSYS;
+	}
+
+	a1fs_inode *inode = (ret == 0) ? get_inode(fs, ino) : NULL;
+	if ((ret == 0) && (to_set & FUSE_SET_ATTR_SIZE)) {
+		ret = S_ISDIR(inode->mode) ? -EISDIR : file_truncate(fs, ino, inode, attr->st_size);
+	}
+	if ((ret == 0) && (to_set & FUSE_SET_ATTR_MTIME_NOW)) {
+		inode_touch(fs, inode);
+	} else if ((ret == 0) && (to_set & FUSE_SET_ATTR_MTIME)) {
+		fs_lazy_mtime_take(fs, ino, NULL);
+		inode->mtime = attr->st_mtim;
+		inode_stamp(fs, inode);
+	}
+
+	if (ret == 0) {
+		struct stat st;
+		memset(&st, 0, sizeof(st));
+		inode_getattr(fs, inode, &st);
+		st.st_ino = ino;
+		fuse_reply_attr(req, &st, LL_TIMEOUT);
+	} else {
+		ll_reply_err(req, ret);
+	}
+	ll_end(fs, A1FS_OP_SETATTR, start, ret, ino, NULL, attr->st_size,
+	       ((to_set & FUSE_SET_ATTR_SIZE) ? A1FS_TRACE_SET_SIZE : 0) |
+	       ((to_set & (FUSE_SET_ATTR_MTIME | FUSE_SET_ATTR_MTIME_NOW))
+	        ? A1FS_TRACE_SET_MTIME : 0));
+}
+
+static void ll_readdir(fuse_req_t req, fuse_ino_t ino, size_t size, off_t off,
+                       struct fuse_file_info *fi)
+{
+	(void)fi;// unused
+	uint64_t start = ll_begin(req);
+	fs_ctx *fs = &get_ll(req)->fs;
+	const a1fs_inode *dir = get_inode(fs, ino);
+	char *buf = malloc(size);
+	if (buf == NULL) {
+		fuse_reply_err(req, ENOMEM);
+		ll_end(fs, A1FS_OP_READDIR, start, -ENOMEM, ino, NULL, off, size);
+		return;
+	}
+
+	// The offset of an entry is its index + 1: where the next readdir resumes
+	size_t len = 0;
+	dir_verify(fs, dir);
+	uint64_t n = dir->size / sizeof(a1fs_dentry);
+	for (uint64_t i = off; i < n; i++) {
+		const a1fs_dentry *d = dir_entry(fs, dir, i);
+		struct stat st;
+		memset(&st, 0, sizeof(st));
+		st.st_ino = d->ino;
+		st.st_mode = get_inode(fs, d->ino)->mode;
+		size_t entry = fuse_add_direntry(req, buf + len, size - len, d->name, &st, i + 1);
+		if (entry > size - len) break;
+		len += entry;
+	}
+	fuse_reply_buf(req, buf, len);
+	free(buf);
+	ll_end(fs, A1FS_OP_READDIR, start, len, ino, NULL, off, size);
+}
+
+static void ll_mkdir(fuse_req_t req, fuse_ino_t parent, const char *name,
+                     mode_t mode)
+{
+	uint64_t start = ll_begin(req);
+	ll_ctx *ll = get_ll(req);
+	a1fs_ino_t ino;
+	int ret = (strlen(name) >= A1FS_NAME_MAX) ? -ENAMETOOLONG
+	          : dir_mkdir(&ll->fs, parent, name, mode, &ino);
+	if (ret == 0) {
+		struct fuse_entry_param e;
+		ll_entry(ll, ino, &e);
+		fuse_reply_entry(req, &e);
+	} else {
+		ll_reply_err(req, ret);
+	}
+	ll_end(&ll->fs, A1FS_OP_MKDIR, start, ret, parent, name, mode,
+	       (ret == 0) ? ino : 0);
+}
+
+static void ll_rmdir(fuse_req_t req, fuse_ino_t parent, const char *name)
+{
+	uint64_t start = ll_begin(req);
+	ll_ctx *ll = get_ll(req);
+	a1fs_ino_t ino;
+	int ret = dir_rmdir(&ll->fs, parent, name, &ino);
+	if (ret == 0) ll_release_inode(ll, ino);
+	ll_reply_err(req, ret);
+	ll_end(&ll->fs, A1FS_OP_RMDIR, start, ret, parent, name, 0, 0);
+}
+
+static void ll_create(fuse_req_t req, fuse_ino_t parent, const char *name,
+                      mode_t mode, struct fuse_file_info *fi)
+{
+	uint64_t start = ll_begin(req);
+	ll_ctx *ll = get_ll(req);
+	a1fs_ino_t ino;
+	int ret = (strlen(name) >= A1FS_NAME_MAX) ? -ENAMETOOLONG
+	          : dir_mkfile(&ll->fs, parent, name, mode, &ino);
+	if (ret == 0) {
+		struct fuse_entry_param e;
+		ll_entry(ll, ino, &e);
+		open_cache_policy(&ll->fs, ino, get_inode(&ll->fs, ino), fi);
+		fuse_reply_create(req, &e, fi);
+	} else {
+		ll_reply_err(req, ret);
+	}
+	ll_end(&ll->fs, A1FS_OP_CREATE, start, ret, parent, name, mode,
+	       (ret == 0) ? ino : 0);
+}
+
+static void ll_unlink(fuse_req_t req, fuse_ino_t parent, const char *name)
+{
+	uint64_t start = ll_begin(req);
+	ll_ctx *ll = get_ll(req);
+	a1fs_ino_t ino;
+	int ret = ((parent == A1FS_ROOT_INO) && (strcmp(name, A1FS_STATS_PATH + 1) == 0))
+	          ? -EPERM : dir_unlink(&ll->fs, parent, name, &ino);
+	if (ret == 0) ll_release_inode(ll, ino);
+	ll_reply_err(req, ret);
+	ll_end(&ll->fs, A1FS_OP_UNLINK, start, ret, parent, name, 0, 0);
+}
+
+static void ll_open(fuse_req_t req, fuse_ino_t ino, struct fuse_file_info *fi)
+{
+	uint64_t start = ll_begin(req);
+	fs_ctx *fs = &get_ll(req)->fs;
+	int ret = 0;
+	if (ino != LL_STATS_INO) {
+		open_cache_policy(fs, ino, get_inode(fs, ino), fi);
+	} else if ((fi->flags & O_ACCMODE) != O_RDONLY) {
+		ret = -EACCES;
+	} else {
+		// Same as a1fs_open(): all reads see one snapshot of the statistics
+		char *report = fs_stats_report(fs);
+		if (report == NULL) {
+			ret = -ENOMEM;
+		} else {
+			fi->fh = (uintptr_t)report;
+			fi->direct_io = 1;
+		}
+	}
+	if (ret == 0) {
+		fuse_reply_open(req, fi);
+	} else {
+		ll_reply_err(req, ret);
+	}
+	ll_end(fs, A1FS_OP_OPEN, start, ret, ino, NULL, fi->flags, 0);
+}
+
+static void ll_release(fuse_req_t req, fuse_ino_t ino, struct fuse_file_info *fi)
+{
+	uint64_t start = ll_begin(req);
+	ll_ctx *ll = get_ll(req);
+	if (ino == LL_STATS_INO) {
+		free((char*)(uintptr_t)fi->fh);
+	} else {
+		a1fs_inode *inode = get_inode(&ll->fs, ino);
+		if (inode->links != 0) tail_pack(&ll->fs, inode);
+	}
+	fuse_reply_err(req, 0);
+	ll_end(&ll->fs, A1FS_OP_RELEASE, start, 0, ino, NULL, 0, 0);
+}
+
+/**
+ * Read data from a file. A range that lies within one extent of an
+ * uncompressed file is passed to the kernel straight from the mapped image,
+ * without copying it into a buffer first.
+ */
+static void ll_read(fuse_req_t req, fuse_ino_t ino, size_t size, off_t off,
+                    struct fuse_file_info *fi)
+{
+	uint64_t start = ll_begin(req);
+	fs_ctx *fs = &get_ll(req)->fs;
+	if (ino == LL_STATS_INO) {
+		char *buf = malloc(size);
+		int ret = (buf != NULL) ? stats_file_read(fs, buf, size, off, fi) : -ENOMEM;
+		if (ret >= 0) {
+			fuse_reply_buf(req, buf, ret);
+		} else {
+			ll_reply_err(req, ret);
+		}
+		free(buf);
+		ll_end(fs, A1FS_OP_READ, start, ret, ino, NULL, off, size);
+		return;
+	}
+
+	const a1fs_inode *inode = get_inode(fs, ino);
+	if ((uint64_t)off >= inode->size) {
+		size = 0;
+	} else if (size > inode->size - off) {
+		size = inode->size - off;
+	}
+	size_t blk_off = off % A1FS_BLOCK_SIZE;
+	a1fs_blk_t pblk, len;
+	if ((size > 0) && !inode_compressed(inode) &&
+	    extent_map(inode, off / A1FS_BLOCK_SIZE, &pblk, &len) &&
+	    (blk_off + size <= (size_t)len * A1FS_BLOCK_SIZE))
+	{
+		fuse_reply_buf(req, get_block(fs, pblk) + blk_off, size);
+		stats_count(&fs->stats, A1FS_STAT_BLOCKS_READ,
+		            (blk_off + size + A1FS_BLOCK_SIZE - 1) / A1FS_BLOCK_SIZE);
+		ll_end(fs, A1FS_OP_READ, start, size, ino, NULL, off, size);
+		return;
+	}
+
+	char *buf = malloc(size + 1);
+	int ret = (buf != NULL) ? file_pread(fs, ino, inode, buf, size, off) : -ENOMEM;
+	if (ret >= 0) {
+		fuse_reply_buf(req, buf, ret);
+	} else {
+		ll_reply_err(req, ret);
+	}
+	free(buf);
+	ll_end(fs, A1FS_OP_READ, start, ret, ino, NULL, off, size);
+}
+
+static void ll_write(fuse_req_t req, fuse_ino_t ino, const char *buf, size_t size,
+                     off_t off, struct fuse_file_info *fi)
+{
+	uint64_t start = ll_begin(req);
+	fs_ctx *fs = &get_ll(req)->fs;
+	int ret = (ino == LL_STATS_INO) ? -EACCES
+	          : file_pwrite(fs, ino, get_inode(fs, ino), buf, size, off,
+	                        fi->fh == A1FS_FH_DIRECT_IO);
+	if (ret >= 0) {
+		fuse_reply_write(req, ret);
+	} else {
+		ll_reply_err(req, ret);
+	}
+	ll_end(fs, A1FS_OP_WRITE, start, ret, ino, NULL, off, size);
+}
+
+static void ll_flush(fuse_req_t req, fuse_ino_t ino, struct fuse_file_info *fi)
+{
+	(void)ino;// unused
+	(void)fi;// unused
+	uint64_t start = ll_begin(req);
+	// Nothing is kept outside of the mapped image (see a1fs_flush())
+	fuse_reply_err(req, 0);
+	ll_end(&get_ll(req)->fs, A1FS_OP_FLUSH, start, 0, ino, NULL, 0, 0);
+}
+
+static void ll_fsync(fuse_req_t req, fuse_ino_t ino, int datasync,
+                     struct fuse_file_info *fi)
+{
+	(void)datasync;// unused
+	(void)fi;// unused
+	uint64_t start = ll_begin(req);
+	fs_ctx *fs = &get_ll(req)->fs;
+	int ret = (ino == LL_STATS_INO) ? 0 : file_fsync(fs, get_inode(fs, ino));
+	ll_reply_err(req, ret);
+	ll_end(fs, A1FS_OP_FSYNC, start, ret, ino, NULL, 0, 0);
+}
+
+static void ll_statfs(fuse_req_t req, fuse_ino_t ino)
+{
+	(void)ino;// unused
+	uint64_t start = ll_begin(req);
+	struct statvfs st;
+	fs_statfs(&get_ll(req)->fs, &st);
+	fuse_reply_statfs(req, &st);
+	ll_end(&get_ll(req)->fs, A1FS_OP_STATFS, start, 0, ino, NULL, 0, 0);
+}
+
+static void ll_setxattr(fuse_req_t req, fuse_ino_t ino, const char *name,
+                        const char *value, size_t size, int flags)
+{
+	uint64_t start = ll_begin(req);
+	fs_ctx *fs = &get_ll(req)->fs;
+	int ret = (ino == LL_STATS_INO) ? -EPERM
+	          : inode_setxattr(fs, get_inode(fs, ino), name, value, size, flags);
+	ll_reply_err(req, ret);
+	ll_end(fs, A1FS_OP_SETXATTR, start, ret, ino, name, flags, size);
+}
+
+/** Reply to getxattr() or listxattr() given the result for a buffer of size bytes. */
+static void ll_reply_xattr(fuse_req_t req, const char *buf, size_t size, int ret)
+{
+	if (ret < 0) {
+		ll_reply_err(req, ret);
+	} else if (size == 0) {
+		fuse_reply_xattr(req, ret);
+	} else {
+		fuse_reply_buf(req, buf, ret);
+	}
+}
+
+static void ll_getxattr(fuse_req_t req, fuse_ino_t ino, const char *name,
+                        size_t size)
+{
+	uint64_t start = ll_begin(req);
+	fs_ctx *fs = &get_ll(req)->fs;
+	char *buf = malloc(size + 1);
+	int ret = (buf == NULL) ? -ENOMEM : (ino == LL_STATS_INO) ? -ENODATA
+	          : inode_getxattr(fs, get_inode(fs, ino), name, buf, size);
+	ll_reply_xattr(req, buf, size, ret);
+	free(buf);
+	ll_end(fs, A1FS_OP_GETXATTR, start, ret, ino, name, 0, size);
+}
+
+static void ll_listxattr(fuse_req_t req, fuse_ino_t ino, size_t size)
+{
+	uint64_t start = ll_begin(req);
+	fs_ctx *fs = &get_ll(req)->fs;
+	char *buf = malloc(size + 1);
+	int ret = (buf == NULL) ? -ENOMEM : (ino == LL_STATS_INO) ? 0
+	          : inode_listxattr(fs, get_inode(fs, ino), buf, size);
+	ll_reply_xattr(req, buf, size, ret);
+	free(buf);
+	ll_end(fs, A1FS_OP_LISTXATTR, start, ret, ino, NULL, 0, size);
+}
+
+static void ll_removexattr(fuse_req_t req, fuse_ino_t ino, const char *name)
+{
+	uint64_t start = ll_begin(req);
+	fs_ctx *fs = &get_ll(req)->fs;
+	int ret = (ino == LL_STATS_INO) ? -EPERM
+	          : inode_removexattr(fs, get_inode(fs, ino), name);
+	ll_reply_err(req, ret);
+	ll_end(fs, A1FS_OP_REMOVEXATTR, start, ret, ino, name, 0, 0);
+}
+
+/**
+ * Perform a file-specific control operation (see a1fs_ioctl()). The kernel
+ * copies the argument in and out as the size and direction encoded in the
+ * command say.
+ */
+static void ll_ioctl(fuse_req_t req, fuse_ino_t ino, int cmd, void *arg,
+                     struct fuse_file_info *fi, unsigned flags,
+                     const void *in_buf, size_t in_bufsz, size_t out_bufsz)
+{
+	(void)arg;// unused
+	(void)fi;// unused
+	uint64_t start = ll_begin(req);
+	fs_ctx *fs = &get_ll(req)->fs;
+	size_t size = _IOC_SIZE((unsigned int)cmd);
+	void *data = calloc(1, size + 1);
+	int ret = 0;
+	if (flags & FUSE_IOCTL_COMPAT) {
+		ret = -ENOSYS;
+	} else if (ino == LL_STATS_INO) {
+		ret = -ENOTTY;
+	} else if ((data == NULL) || (in_bufsz > size) || (out_bufsz > size)) {
+		ret = (data == NULL) ? -ENOMEM : -EINVAL;
+	} else {
+		memcpy(data, in_buf, in_bufsz);
+		ret = file_ioctl(fs, ino, get_inode(fs, ino), false, cmd, data);
+	}
+	if (ret == 0) {
+		fuse_reply_ioctl(req, 0, data, out_bufsz);
+	} else {
+		ll_reply_err(req, ret);
+	}
+	free(data);
+	ll_end(fs, A1FS_OP_IOCTL, start, ret, ino, NULL, (unsigned int)cmd, 0);
+}
+
+
+static const struct fuse_lowlevel_ops ll_ops = {
+	.init         = ll_init,
+	.destroy      = ll_destroy,
+	.lookup       = ll_lookup,
+	.forget       = ll_forget,
+	.forget_multi = ll_forget_multi,
+	.getattr      = ll_getattr,
+	.setattr      = ll_setattr,
+	.readdir      = ll_readdir,
+	.mkdir        = ll_mkdir,
+	.rmdir        = ll_rmdir,
+	.create       = ll_create,
+	.unlink       = ll_unlink,
+	.open         = ll_open,
+	.release      = ll_release,
+	.read         = ll_read,
+	.write        = ll_write,
+	.flush        = ll_flush,
+	.fsync        = ll_fsync,
+	.statfs       = ll_statfs,
+	.setxattr     = ll_setxattr,
+	.getxattr     = ll_getxattr,
+	.listxattr    = ll_listxattr,
+	.removexattr  = ll_removexattr,
+	.ioctl        = ll_ioctl,
+};
+
+/**
+ * Set up the low-level front end on a mounted file system context: the lookup
+ * counts start at 0, and orphans left by an earlier crash are deleted (a clean
+ * unmount leaves none, see ll_destroy()).
+ *
+ * @return  true on success; false if out of memory.
+ */
+static bool ll_ctx_init(ll_ctx *ll)
+{
+	ll->lookups = calloc(get_sb(&ll->fs)->num_inodes, sizeof(uint64_t));
+	if (ll->lookups == NULL) return false;
+	if (!ll->fs.was_clean) ll_delete_orphans(ll);
+	return true;
+}
+
+int main(int argc, char *argv[])
+{
+	a1fs_opts opts = {0};// defaults are all 0
+	struct fuse_args args = FUSE_ARGS_INIT(argc, argv);
+	if (!a1fs_opt_parse(&args, &opts)) return 1;
+
+	char *mountpoint;
+	int foreground;
+	if (fuse_parse_cmdline(&args, &mountpoint, NULL, &foreground) != 0) return 1;
+	if (opts.help || opts.version) return 0;
+	if (mountpoint == NULL) {
+		fprintf(stderr, "Missing mount point\n");
+		return 1;
+	}
+
+	ll_ctx ll = {0};
+	if (!a1fs_init(&ll.fs, &opts) || !ll_ctx_init(&ll)) {
+		fprintf(stderr, "Failed to mount the file system\n");
+		return 1;
+	}
+	// Only the FUSE front ends record their calls; liba1fs doesn't
+	if ((opts.trace != NULL) && ((ll.fs.trace = trace_open(opts.trace)) == NULL)) {
+		ll_destroy(&ll);
+		fprintf(stderr, "Failed to mount the file system\n");
+		return 1;
+	}
+
+	int ret = 1;
+	struct fuse_chan *ch = fuse_mount(mountpoint, &args);
+	if (ch == NULL) goto end;
+	struct fuse_session *se = fuse_lowlevel_new(&args, &ll_ops, sizeof(ll_ops), &ll);
+	if (se != NULL) {
+		if (fuse_set_signal_handlers(se) == 0) {
+			fuse_session_add_chan(se, ch);
+			if (fuse_daemonize(foreground) == 0) ret = fuse_session_loop(se) ? 1 : 0;
+			fuse_remove_signal_handlers(se);
+			fuse_session_remove_chan(ch);
+		}
+		// Calls ll_destroy() if the session was initialized
+		fuse_session_destroy(se);
+	}
+	fuse_unmount(mountpoint, ch);
+
+end:
+	// Not destroyed by the session if it never started
+	if (ll.lookups != NULL) ll_destroy(&ll);
+	free(mountpoint);
+	fuse_opt_free_args(&args);
+	return ret;
+}
@@ -0,0 +1,439 @@
+/*
+ * This code is provided solely for the personal and private use of students
+ * taking the CSC369H course at the University of Toronto. Copying for purposes
+ * other than this use is expressly prohibited. All forms of distribution of
+ * this code, including but not limited to public repositories on GitHub,
+ * GitLab, Bitbucket, or any other online platform, whether as given or with
+ * any changes, are expressly prohibited.
+ *
+ * Authors: Alexey Khrabrov, Karen Reid
+ *
+ * All of the files in this directory and all subdirectories are:
+ * Copyright (c) 2019 Karen Reid
+ */
+
+/**
+ * CSC369 Assignment 1 - a1fs microbenchmarks.
+ *
+ * Drives the a1fs FUSE callbacks directly, without mounting. For each image
+ * size and directory fan-out, a temporary image is formatted with mkfs(), the
+ * file system context is set up the same way a1fs_init() does, and the
+ * operations are called through the a1fs_ops table. Each operation is timed
+ * individually to report throughput and p50/p99 latency.
+ *
+ * The callbacks are linked from fuse_ops.c. mkfs.c is compiled into this file
+ * so that its static mkfs() can be called.
+ */
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+#include <unistd.h>
+
+#include "fuse_ops.h"
+
+#define main mkfs_main
+#include "mkfs.c"
+#undef main
+
+
+// The callbacks get the file system context from here instead of a FUSE
+// session; bench.a1fs links without libfuse
+static struct fuse_context bench_context;
+
+struct fuse_context *fuse_get_context(void)
+{
+	return &bench_context;
+}
+
+
+/** Maximum number of image sizes or fan-outs given on the command line. */
+#define MAX_CONFIGS 8
+
+/** Size of a single read or write in bytes. */
+#define IO_SIZE A1FS_BLOCK_SIZE
+
+/** Maximum size of the data file used by the read and write benchmarks. */
+#define MAX_DATA_SIZE (64ul * 1024 * 1024)
+
+/** Command line options. */
+typedef struct bench_opts {
+	/** Image sizes in bytes. */
+	size_t sizes[MAX_CONFIGS];
+	int n_sizes;
+	/** Numbers of files in the benchmark directory. */
+	unsigned int fanouts[MAX_CONFIGS];
+	int n_fanouts;
+	/** Number of operations for the getattr, readdir, random I/O and truncate
+	 * benchmarks. */
+	unsigned int n_ops;
+	/** Directory for the temporary images. */
+	const char *dir;
+	/** Image mapping options, as given to a1fs. */
+	map_opts map;
+	/** Prefault the metadata regions, as a1fs --populate does. */
+	bool populate;
+	/** Run with metadata checksums to verify, as after a1fs --checksums. */
+	bool checksums;
+
+	/** Print help and exit. */
+	bool help;
+
+} bench_opts;
+
+static const char *bench_help_str = "\
+Usage: %s [options]\n\
+\n\
+Run a1fs microbenchmarks on temporary images. Options -s and -f can be given\n\
+several times; every combination of image size and fan-out is measured.\n\
+\n\
+Options:\n\
+    -s MiB  image size (default: 64 and 1024)\n\
+    -f num  number of files in the benchmark directory (default: 16, 256, 2048)\n\
+    -n num  operations per benchmark (default: 10000)\n\
+    -d dir  directory for temporary images (default: $TMPDIR or /tmp)\n\
+    -H      map the images with huge pages (a1fs --hugepages)\n\
+    -N      interleave the images across NUMA nodes (a1fs --numa_interleave)\n\
+    -P      prefault the metadata of the images (a1fs --populate)\n\
+    -C      save metadata checksums before the benchmarks and verify them as\n\
+            they run (a1fs --checksums)\n\
+    -h      print help and exit\n\
+";
+
+static bool bench_parse_args(int argc, char *argv[], bench_opts *opts)
+{
+	int o;
+	while ((o = getopt(argc, argv, "s:f:n:d:HNPCh")) != -1) {
+		switch (o) {
+			case 's':
+				if (opts->n_sizes == MAX_CONFIGS) return false;
+				opts->sizes[opts->n_sizes++] = strtoul(optarg, NULL, 10) << 20;
+				break;
+			case 'f':
+				if (opts->n_fanouts == MAX_CONFIGS) return false;
+				opts->fanouts[opts->n_fanouts++] = strtoul(optarg, NULL, 10);
+				break;
+			case 'n': opts->n_ops = strtoul(optarg, NULL, 10); break;
+			case 'd': opts->dir = optarg; break;
+			case 'H': opts->map.hugepages = true; break;
+			case 'N': opts->map.numa_interleave = true; break;
+			case 'P': opts->populate = true; break;
+			case 'C': opts->checksums = true; break;
+
+			case 'h': opts->help = true; return true;// skip other arguments
+
+			case '?': return false;
+			default : assert(false);
+		}
+	}
+
+	if (opts->n_sizes == 0) {
+		opts->sizes[opts->n_sizes++] = 64ul << 20;
+		opts->sizes[opts->n_sizes++] = 1024ul << 20;
+	}
+	if (opts->n_fanouts == 0) {
+		opts->fanouts[opts->n_fanouts++] = 16;
+		opts->fanouts[opts->n_fanouts++] = 256;
+		opts->fanouts[opts->n_fanouts++] = 2048;
+	}
+	if (opts->n_ops == 0) opts->n_ops = 10000;
+	if (opts->dir == NULL) opts->dir = getenv("TMPDIR");
+	if (opts->dir == NULL) opts->dir = "/tmp";
+
+	for (int i = 0; i < opts->n_sizes; i++) {
+		if (opts->sizes[i] == 0) {
+			fprintf(stderr, "Invalid image size\n");
+			return false;
+		}
+	}
+	for (int i = 0; i < opts->n_fanouts; i++) {
+		if (opts->fanouts[i] == 0) {
+			fprintf(stderr, "Invalid fan-out\n");
+			return false;
+		}
+	}
+	return true;
+}
+
+
+/** State of a benchmark run on one image. */
+typedef struct bench_run {
+	/** Image size in bytes. */
+	size_t size;
+	/** Number of files in the benchmark directory. */
+	unsigned int fanout;
+	/** Latency of each operation of the current benchmark in nanoseconds. */
+	uint64_t *samples;
+	size_t n_samples;
+	/** I/O buffer of IO_SIZE bytes. */
+	char *buf;
+
+} bench_run;
+
+static uint64_t now_ns(void)
+{
+	struct timespec ts;
+	clock_gettime(CLOCK_MONOTONIC, &ts);
+	return ts.tv_sec * 1000000000ul + ts.tv_nsec;
+}
+
+static int cmp_u64(const void *a, const void *b)
+{
+	uint64_t x = *(const uint64_t*)a, y = *(const uint64_t*)b;
+	return (x > y) - (x < y);
+}
+
+/** Print the results of a benchmark and reset the samples. */
+static void report(bench_run *run, const char *op)
+{
+	size_t n = run->n_samples;
+	if (n == 0) return;
+	uint64_t total = 0;
+	for (size_t i = 0; i < n; i++) total += run->samples[i];
+	qsort(run->samples, n, sizeof(uint64_t), cmp_u64);
+
+	printf("%6zu MiB  %7u  %-12s %12.0f %10.2f %10.2f\n",
+	       run->size >> 20, run->fanout, op, n / (total / 1e9),
+	       run->samples[n / 2] / 1e3, run->samples[n * 99 / 100] / 1e3);
+	run->n_samples = 0;
+}
+
+/** Time a single call; evaluates to the call's return value. */
+#define TIMED(run, call) ({                                     \
+	uint64_t start_ = now_ns();                             \
+	int ret_ = (call);                                      \
+	(run)->samples[(run)->n_samples++] = now_ns() - start_; \
+	ret_;                                                   \
+})
+
+static void file_path(char *path, unsigned int i)
+{
+	sprintf(path, "/d/f%u", i);
+}
+
+static int count_filler(void *buf, const char *name, const struct stat *st,
+                        off_t off)
+{
+	(void)name;
+	(void)st;
+	(void)off;
+	(*(unsigned int*)buf)++;
+	return 0;
+}
+
+/**
+ * Scan the metadata the way a mount-time or statfs-style pass does: the inode
+ * bitmap and table, the data bitmap and the refcount table.
+ *
+ * @return  a checksum of what was read, so that the scan is not optimized out.
+ */
+static int metadata_scan(fs_ctx *fs)
+{
+	const a1fs_superblock *sb = get_sb(fs);
+	const uint8_t *inode_bmp = fs->image + sb->inode_bmp * A1FS_BLOCK_SIZE;
+	const uint8_t *data_bmp = fs->image + sb->datablock_bmp * A1FS_BLOCK_SIZE;
+	const a1fs_refcount_t *refcount = fs->image + sb->refcount_table * A1FS_BLOCK_SIZE;
+	uint64_t sum = 0;
+	for (a1fs_ino_t ino = 0; ino < sb->num_inodes; ino++) {
+		if (bitmap_test(inode_bmp, ino)) sum += inode_blocks(fs, get_inode(fs, ino));
+	}
+	for (a1fs_blk_t blk = 0; blk < sb->num_blocks; blk++) {
+		sum += bitmap_test(data_bmp, blk) + refcount[blk];
+	}
+	return (int)(sum & 1);
+}
+
+/**
+ * Run all benchmarks on a freshly formatted file system.
+ *
+ * @return  true on success; false if an operation failed.
+ */
+static bool run_benchmarks(bench_run *run, unsigned int n_ops)
+{
+	const struct fuse_operations *ops = &a1fs_ops;
+	char path[64];
+	struct stat st;
+
+	if (ops->mkdir("/d", 0755) != 0) return false;
+
+	for (unsigned int i = 0; i < run->fanout; i++) {
+		file_path(path, i);
+		if (TIMED(run, ops->create(path, S_IFREG | 0644, NULL)) != 0) return false;
+	}
+	report(run, "create");
+
+	for (unsigned int i = 0; i < n_ops; i++) {
+		file_path(path, rand() % run->fanout);
+		if (TIMED(run, ops->getattr(path, &st)) != 0) return false;
+	}
+	report(run, "getattr");
+
+	for (unsigned int i = 0; i < n_ops; i++) {
+		unsigned int count = 0;
+		if (TIMED(run, ops->readdir("/d", &count, count_filler, 0, NULL)) != 0) return false;
+		// Entries of the files, ".", ".." and nothing else
+		if (count != run->fanout + 2) return false;
+	}
+	report(run, "readdir");
+
+	// The data file takes up to a quarter of the image
+	size_t data_size = run->size / 4;
+	if (data_size > MAX_DATA_SIZE) data_size = MAX_DATA_SIZE;
+	size_t n_blocks = data_size / IO_SIZE;
+	if ((n_blocks == 0) || (ops->create("/d/data", S_IFREG | 0644, NULL) != 0)) {
+		return false;
+	}
+	memset(run->buf, 'a', IO_SIZE);
+
+	for (size_t i = 0; i < n_blocks; i++) {
+		if (TIMED(run, ops->write("/d/data", run->buf, IO_SIZE, i * IO_SIZE, NULL)) != IO_SIZE) {
+			return false;
+		}
+	}
+	report(run, "seq write");
+
+	for (size_t i = 0; i < n_blocks; i++) {
+		if (TIMED(run, ops->read("/d/data", run->buf, IO_SIZE, i * IO_SIZE, NULL)) != IO_SIZE) {
+			return false;
+		}
+	}
+	report(run, "seq read");
+
+	for (unsigned int i = 0; i < n_ops; i++) {
+		off_t offset = (off_t)(rand() % n_blocks) * IO_SIZE;
+		if (TIMED(run, ops->write("/d/data", run->buf, IO_SIZE, offset, NULL)) != IO_SIZE) {
+			return false;
+		}
+	}
+	report(run, "rand write");
+
+	for (unsigned int i = 0; i < n_ops; i++) {
+		off_t offset = (off_t)(rand() % n_blocks) * IO_SIZE;
+		if (TIMED(run, ops->read("/d/data", run->buf, IO_SIZE, offset, NULL)) != IO_SIZE) {
+			return false;
+		}
+	}
+	report(run, "rand read");
+
+	// Each truncate frees the blocks written before it
+	for (unsigned int i = 0; i < n_ops; i++) {
+		for (int j = 0; j < 16; j++) {
+			if (ops->write("/d/data", run->buf, IO_SIZE, j * IO_SIZE, NULL) != IO_SIZE) {
+				return false;
+			}
+		}
+		if (TIMED(run, ops->truncate("/d/data", (i % 2) ? 0 : IO_SIZE / 2)) != 0) return false;
+	}
+	report(run, "truncate");
+
+	for (unsigned int i = 0; i < n_ops; i++) {
+		volatile int sum = TIMED(run, metadata_scan(bench_context.private_data));
+		(void)sum;
+	}
+	report(run, "meta scan");
+
+	for (unsigned int i = 0; i < run->fanout; i++) {
+		file_path(path, i);
+		if (TIMED(run, ops->unlink(path)) != 0) return false;
+	}
+	report(run, "unlink");
+	return true;
+}
+
+/**
+ * Mount and unmount a freshly formatted image, so that its metadata checksums
+ * are saved and the benchmarks then run with them loaded (-C).
+ *
+ * @return  true on success; false on failure.
+ */
+static bool save_checksums(void *image, size_t size, a1fs_opts *fs_opts)
+{
+	fs_ctx fs = {0};
+	if (!fs_ctx_init(&fs, image, size, fs_opts)) return false;
+	fs_ctx_destroy(&fs);
+	return true;
+}
+
+/**
+ * Format a temporary image of given size and run the benchmarks on it.
+ *
+ * @return  true on success; false on failure.
+ */
+static bool bench_image(const bench_opts *opts, size_t size, unsigned int fanout)
+{
+	char img_path[PATH_MAX];
+	snprintf(img_path, sizeof(img_path), "%s/a1fs-bench-XXXXXX", opts->dir);
+	int fd = mkstemp(img_path);
+	if (fd < 0) {
+		perror(img_path);
+		return false;
+	}
+	bool ok = ftruncate(fd, size) == 0;
+	if (!ok) perror("ftruncate");
+	close(fd);
+
+	size_t image_size;
+	void *image = ok ? map_file_opts(img_path, A1FS_BLOCK_SIZE, &image_size, &opts->map)
+	                 : NULL;
+	// The image is only needed while it is mapped
+	unlink(img_path);
+	if (image == NULL) return false;
+
+	// A few spare inodes for the directory and the data file
+	mkfs_opts m_opts = { .img_path = img_path, .n_inodes = fanout + 16 };
+	a1fs_opts fs_opts = { .populate = opts->populate, .checksums = opts->checksums };
+	fs_ctx fs = {0};
+	bench_run run = { .size = size, .fanout = fanout };
+	size_t max_samples = MAX_DATA_SIZE / IO_SIZE;
+	if (max_samples < opts->n_ops) max_samples = opts->n_ops;
+	if (max_samples < fanout) max_samples = fanout;
+	run.samples = malloc(max_samples * sizeof(uint64_t));
+	run.buf = malloc(IO_SIZE);
+
+	ok = false;
+	if ((run.samples == NULL) || (run.buf == NULL)) {
+		perror("malloc");
+	} else if (!mkfs(image, image_size, &m_opts)) {
+		fprintf(stderr, "Failed to format the image\n");
+	} else if ((opts->checksums && !save_checksums(image, image_size, &fs_opts)) ||
+	           !fs_ctx_init(&fs, image, image_size, &fs_opts)) {
+		fprintf(stderr, "Failed to initialize file system context\n");
+	} else {
+		bench_context.private_data = &fs;
+		ok = run_benchmarks(&run, opts->n_ops);
+		if (!ok) fprintf(stderr, "Benchmark operation failed\n");
+		fs_ctx_destroy(&fs);
+	}
+
+	free(run.samples);
+	free(run.buf);
+	munmap(image, image_size);
+	return ok;
+}
+
+
+int main(int argc, char *argv[])
+{
+	bench_opts opts = {0};// defaults are all 0
+	if (!bench_parse_args(argc, argv, &opts)) {
+		// Invalid arguments, print help to stderr
+		fprintf(stderr, bench_help_str, argv[0]);
+		return 1;
+	}
+	if (opts.help) {
+		// Help requested, print it to stdout
+		printf(bench_help_str, argv[0]);
+		return 0;
+	}
+
+	srand(1);
+	printf("%10s  %7s  %-12s %12s %10s %10s\n", "image", "fan-out", "operation",
+	       "ops/s", "p50 (us)", "p99 (us)");
+	for (int i = 0; i < opts.n_sizes; i++) {
+		for (int j = 0; j < opts.n_fanouts; j++) {
+			if (!bench_image(&opts, opts.sizes[i], opts.fanouts[j])) return 1;
+		}
+	}
+	return 0;
+}
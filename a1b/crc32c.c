@@ -0,0 +1,83 @@
+/*
+ * This code is provided solely for the personal and private use of students
+ * taking the CSC369H course at the University of Toronto. Copying for purposes
+ * other than this use is expressly prohibited. All forms of distribution of
+ * this code, including but not limited to public repositories on GitHub,
+ * GitLab, Bitbucket, or any other online platform, whether as given or with
+ * any changes, are expressly prohibited.
+ *
+ * Authors: Alexey Khrabrov, Karen Reid
+ *
+ * All of the files in this directory and all subdirectories are:
+ * Copyright (c) 2019 Karen Reid
+ */
+
+
+/**
+ * CSC369 Assignment 1 - CRC32C (Castagnoli) checksum implementation.
+ */
+
+#include <stdbool.h>
+#include <string.h>
+
+#if defined(__x86_64__)
+#include <nmmintrin.h>
+#endif
+
+#include "crc32c.h"
+
+
+/** CRC32C polynomial, bit-reversed. */
+#define CRC32C_POLY 0x82F63B78u
+
+/** Table for the byte-at-a-time fallback. */
+static uint32_t crc_table[256];
+
+/** Whether the CPU has the SSE4.2 crc32 instruction. */
+static bool has_sse42;
+
+// Runs before main(), so that threads never race to fill in the table
+__attribute__((constructor))
+static void crc32c_init(void)
+{
+	for (uint32_t i = 0; i < 256; i++) {
+		uint32_t c = i;
+		for (int k = 0; k < 8; k++) c = (c & 1) ? (c >> 1) ^ CRC32C_POLY : c >> 1;
+		crc_table[i] = c;
+	}
+#if defined(__x86_64__)
+	has_sse42 = __builtin_cpu_supports("sse4.2");
+#endif
+}
+
+static uint32_t crc32c_sw(uint32_t crc, const unsigned char *p, size_t size)
+{
+	for (; size > 0; size--) crc = crc_table[(crc ^ *p++) & 0xFF] ^ (crc >> 8);
+	return crc;
+}
+
+#if defined(__x86_64__)
+__attribute__((target("sse4.2")))
+static uint32_t crc32c_hw(uint32_t crc, const unsigned char *p, size_t size)
+{
+	uint64_t c = crc;
+	for (; size >= sizeof(uint64_t); size -= sizeof(uint64_t), p += sizeof(uint64_t)) {
+		uint64_t v;
+		memcpy(&v, p, sizeof(v));
+		c = _mm_crc32_u64(c, v);
+	}
+	crc = (uint32_t)c;
+	for (; size > 0; size--) crc = _mm_crc32_u8(crc, *p++);
+	return crc;
+}
+#endif
+
+uint32_t crc32c(uint32_t crc, const void *data, size_t size)
+{
+	const unsigned char *p = data;
+	crc = ~crc;
+#if defined(__x86_64__)
+	if (has_sse42) return ~crc32c_hw(crc, p, size);
+#endif
+	return ~crc32c_sw(crc, p, size);
+}
@@ -0,0 +1,39 @@
+/*
+ * This code is provided solely for the personal and private use of students
+ * taking the CSC369H course at the University of Toronto. Copying for purposes
+ * other than this use is expressly prohibited. All forms of distribution of
+ * this code, including but not limited to public repositories on GitHub,
+ * GitLab, Bitbucket, or any other online platform, whether as given or with
+ * any changes, are expressly prohibited.
+ *
+ * Authors: Alexey Khrabrov, Karen Reid
+ *
+ * All of the files in this directory and all subdirectories are:
+ * Copyright (c) 2019 Karen Reid
+ */
+
+
+/**
+ * CSC369 Assignment 1 - CRC32C (Castagnoli) checksum header file.
+ *
+ * Used for the metadata checksums. Runs on the SSE4.2 crc32 instruction when
+ * the CPU has it, and falls back to a table-driven implementation otherwise;
+ * both produce the same values as the iSCSI/ext4 CRC32C.
+ */
+
+#pragma once
+
+#include <stddef.h>
+#include <stdint.h>
+
+
+/**
+ * Compute the CRC32C of a buffer.
+ *
+ * @param crc   CRC32C of the data that precedes the buffer, to continue from;
+ *              0 to start a new checksum.
+ * @param data  input data.
+ * @param size  input size in bytes.
+ * @return      CRC32C value.
+ */
+uint32_t crc32c(uint32_t crc, const void *data, size_t size);
@@ -0,0 +1,351 @@
+/*
+ * This code is provided solely for the personal and private use of students
+ * taking the CSC369H course at the University of Toronto. Copying for purposes
+ * other than this use is expressly prohibited. All forms of distribution of
+ * this code, including but not limited to public repositories on GitHub,
+ * GitLab, Bitbucket, or any other online platform, whether as given or with
+ * any changes, are expressly prohibited.
+ *
+ * Authors: Alexey Khrabrov, Karen Reid
+ *
+ * All of the files in this directory and all subdirectories are:
+ * Copyright (c) 2019 Karen Reid
+ */
+
+/**
+ * CSC369 Assignment 1 - a1fs offline deduplication tool.
+ *
+ * Scans all regular files of an unmounted image, maps file blocks with equal
+ * contents to a single data block (sharing it the same way reflink clones do)
+ * and frees the duplicates. If the image has a dedup index, it is rebuilt so
+ * that later writes deduplicate against the surviving blocks.
+ */
+
+#include <stdbool.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
+
+#include "a1fs.h"
+#include "dedup_index.h"
+#include "fs_ctx.h"
+#include "map.h"
+
+
+/** Command line options. */
+typedef struct dedup_opts {
+	/** File system image file path. */
+	const char *img_path;
+
+	/** Print help and exit. */
+	bool help;
+	/** Only report what would be deduplicated; don't modify the image. */
+	bool dry_run;
+	/** Sync memory-mapped image file contents to disk. */
+	bool sync;
+	/** Verbose output. If false, the program must only print errors. */
+	bool verbose;
+
+} dedup_opts;
+
+static const char *help_str = "\
+Usage: %s options image\n\
+\n\
+Deduplicate data blocks of an unmounted a1fs image.\n\
+\n\
+Options:\n\
+    -h      print help and exit\n\
+    -n      dry run - report duplicates but don't modify the image\n\
+    -s      sync image file contents to disk\n\
+    -v      verbose output\n\
+";
+
+static void print_help(FILE *f, const char *progname)
+{
+	fprintf(f, help_str, progname);
+}
+
+static bool parse_args(int argc, char *argv[], dedup_opts *opts)
+{
+	int o;
+	while ((o = getopt(argc, argv, "hnsv")) != -1) {
+		switch (o) {
+			case 'h': opts->help    = true; return true;// skip other arguments
+			case 'n': opts->dry_run = true; break;
+			case 's': opts->sync    = true; break;
+			case 'v': opts->verbose = true; break;
+
+			case '?': return false;
+			default : assert(false);
+		}
+	}
+
+	if (optind >= argc) {
+		fprintf(stderr, "Missing image path\n");
+		return false;
+	}
+	opts->img_path = argv[optind];
+	return true;
+}
+
+
+static a1fs_superblock *get_sb(fs_ctx *fs)
+{
+	return (a1fs_superblock*)fs->image;
+}
+
+static a1fs_inode *get_inode(fs_ctx *fs, a1fs_ino_t ino)
+{
+	if (fs->block_crcs != NULL) fs_verify_inode(fs, ino);
+	return (a1fs_inode*)(fs->image + get_sb(fs)->inode_table * A1FS_BLOCK_SIZE)
+	       + ino;
+}
+
+static const void *get_block(fs_ctx *fs, a1fs_blk_t blk)
+{
+	return fs->image + (size_t)(get_sb(fs)->data_table + blk) * A1FS_BLOCK_SIZE;
+}
+
+static a1fs_refcount_t *get_refcount(fs_ctx *fs, a1fs_blk_t blk)
+{
+	return (a1fs_refcount_t*)(fs->image + get_sb(fs)->refcount_table * A1FS_BLOCK_SIZE)
+	       + blk;
+}
+
+static bool bitmap_test(const uint8_t *bmp, uint32_t i)
+{
+	return (bmp[i / 8] >> (i % 8)) & 1;
+}
+
+/** Drop a reference to a data block, freeing it if it is no longer used. */
+static void block_put(fs_ctx *fs, a1fs_blk_t blk)
+{
+	a1fs_superblock *sb = get_sb(fs);
+	uint8_t *bmp = fs->image + sb->datablock_bmp * A1FS_BLOCK_SIZE;
+	if (--(*get_refcount(fs, blk)) == 0) {
+		bmp[blk / 8] &= ~(1 << (blk % 8));
+		sb->num_unused_blocks++;
+	}
+}
+
+
+/**
+ * In-memory table of the distinct block contents seen so far: content hash to
+ * the first data block found with that content. Uses linear probing.
+ */
+typedef struct block_table {
+	a1fs_dedup_entry *entries;
+	uint64_t mask;
+
+} block_table;
+
+static bool block_table_init(block_table *t, unsigned int num_blocks)
+{
+	uint64_t slots = 1;
+	while (slots < 2 * (uint64_t)num_blocks) slots *= 2;
+	t->entries = calloc(slots, sizeof(a1fs_dedup_entry));
+	t->mask = slots - 1;
+	return t->entries != NULL;
+}
+
+/**
+ * Find the canonical data block with the same contents as blk, making blk
+ * canonical if there is none.
+ */
+static a1fs_blk_t block_table_canonical(fs_ctx *fs, block_table *t,
+                                        a1fs_blk_t blk, uint64_t *hash)
+{
+	const void *data = get_block(fs, blk);
+	*hash = dedup_hash(data);
+	for (uint64_t i = *hash & t->mask; ; i = (i + 1) & t->mask) {
+		a1fs_dedup_entry *e = &t->entries[i];
+		if (e->hash == 0) {
+			e->hash = *hash;
+			e->blk = blk;
+			return blk;
+		}
+		if ((e->hash == *hash) &&
+		    ((e->blk == blk) || (memcmp(get_block(fs, e->blk), data, A1FS_BLOCK_SIZE) == 0)))
+		{
+			return e->blk;
+		}
+	}
+}
+
+
+/** Deduplication statistics. */
+typedef struct dedup_stats {
+	/** Number of files scanned. */
+	unsigned int files;
+	/** Number of file blocks remapped to another data block. */
+	uint64_t remapped;
+	/** Number of files that could not be remapped (too many extents). */
+	unsigned int skipped;
+
+} dedup_stats;
+
+/**
+ * Deduplicate the blocks of a file against the blocks seen so far.
+ *
+ * The new mapping of the file is only applied if it fits into the inode's
+ * extents; blocks shared with other files get merged into the same runs.
+ */
+static void dedup_file(fs_ctx *fs, block_table *t, a1fs_ino_t ino,
+                       const dedup_opts *opts, dedup_stats *stats)
+{
+	a1fs_inode *inode = get_inode(fs, ino);
+	a1fs_extent new_ext[A1FS_INODE_EXTENTS];
+	int n = 0;
+	uint64_t remapped = 0;
+	bool fits = true;
+
+	for (int i = 0; (i < A1FS_INODE_EXTENTS) && (inode->extent_array[i].count != 0); i++) {
+		const a1fs_extent *ext = &inode->extent_array[i];
+		for (a1fs_blk_t j = 0; j < ext->count; j++) {
+			uint64_t hash;
+			a1fs_blk_t blk = block_table_canonical(fs, t, ext->start + j, &hash);
+			if (blk != ext->start + j) remapped++;
+
+			a1fs_extent *last = (n > 0) ? &new_ext[n - 1] : NULL;
+			if (last && (last->lblk + last->count == ext->lblk + j) &&
+			    (last->start + last->count == blk))
+			{
+				last->count++;
+			} else if (n < A1FS_INODE_EXTENTS) {
+				new_ext[n++] = (a1fs_extent){ .start = blk, .count = 1,
+				                              .lblk = ext->lblk + j };
+			} else {
+				fits = false;
+			}
+		}
+	}
+
+	stats->files++;
+	if (remapped == 0) return;
+	if (!fits) {
+		stats->skipped++;
+		if (opts->verbose) {
+			printf("inode %u: %lu duplicate blocks, too fragmented to remap\n",
+			       ino, remapped);
+		}
+		return;
+	}
+	stats->remapped += remapped;
+	if (opts->verbose) printf("inode %u: %lu duplicate blocks\n", ino, remapped);
+	if (opts->dry_run) return;
+
+	// Take the new references before dropping the old ones, so that blocks
+	// mapped by both stay allocated
+	for (int i = 0; i < n; i++) {
+		for (a1fs_blk_t j = 0; j < new_ext[i].count; j++) {
+			(*get_refcount(fs, new_ext[i].start + j))++;
+		}
+	}
+	for (int i = 0; (i < A1FS_INODE_EXTENTS) && (inode->extent_array[i].count != 0); i++) {
+		const a1fs_extent *ext = &inode->extent_array[i];
+		for (a1fs_blk_t j = 0; j < ext->count; j++) block_put(fs, ext->start + j);
+	}
+	memset(inode->extent_array, 0, sizeof(inode->extent_array));
+	memcpy(inode->extent_array, new_ext, n * sizeof(a1fs_extent));
+}
+
+/** Replace the contents of the dedup index with the canonical blocks. */
+static void rebuild_index(fs_ctx *fs, const block_table *t)
+{
+	a1fs_superblock *sb = get_sb(fs);
+	memset(fs->image + sb->dedup_bmp * A1FS_BLOCK_SIZE, 0,
+	       (size_t)(sb->dedup_index - sb->dedup_bmp) * A1FS_BLOCK_SIZE);
+	memset(fs->image + sb->dedup_index * A1FS_BLOCK_SIZE, 0,
+	       (size_t)sb->dedup_slots * sizeof(a1fs_dedup_entry));
+
+	for (uint64_t i = 0; i <= t->mask; i++) {
+		const a1fs_dedup_entry *e = &t->entries[i];
+		if (e->hash != 0) dedup_index_add(fs, e->blk, e->hash);
+	}
+}
+
+static bool dedup(fs_ctx *fs, const dedup_opts *opts)
+{
+	a1fs_superblock *sb = get_sb(fs);
+	block_table t;
+	if (!block_table_init(&t, sb->num_blocks)) {
+		perror("calloc");
+		return false;
+	}
+
+	unsigned int unused_before = sb->num_unused_blocks;
+	dedup_stats stats = {0};
+	const uint8_t *inode_bmp = fs->image + sb->inode_bmp * A1FS_BLOCK_SIZE;
+	for (a1fs_ino_t ino = 0; ino < sb->num_inodes; ino++) {
+		if (!bitmap_test(inode_bmp, ino)) continue;
+		a1fs_inode *inode = get_inode(fs, ino);
+		// Compressed clusters and directories are never shared
+		if (!S_ISREG(inode->mode) || (inode->flags & A1FS_INODE_COMPRESSED)) continue;
+		dedup_file(fs, &t, ino, opts, &stats);
+	}
+
+	if (!opts->dry_run && dedup_index_enabled(fs)) rebuild_index(fs, &t);
+
+	if (opts->verbose || opts->dry_run) {
+		printf("%u files scanned, %lu blocks %s, %u files skipped\n",
+		       stats.files, stats.remapped,
+		       opts->dry_run ? "can be deduplicated" : "deduplicated",
+		       stats.skipped);
+		if (!opts->dry_run) {
+			printf("%u blocks freed\n", sb->num_unused_blocks - unused_before);
+		}
+	}
+	free(t.entries);
+	return true;
+}
+
+
+int main(int argc, char *argv[])
+{
+	dedup_opts opts = {0};// defaults are all 0
+	if (!parse_args(argc, argv, &opts)) {
+		// Invalid arguments, print help to stderr
+		print_help(stderr, argv[0]);
+		return 1;
+	}
+	if (opts.help) {
+		// Help requested, print it to stdout
+		print_help(stdout, argv[0]);
+		return 0;
+	}
+
+	// Map image file into memory
+	size_t size;
+	void *image = map_file(opts.img_path, A1FS_BLOCK_SIZE, &size);
+	if (image == NULL) return 1;
+
+	int ret = 1;
+	a1fs_opts fs_opts = {0};
+	fs_ctx fs;
+	if (((a1fs_superblock*)image)->magic != A1FS_MAGIC) {
+		fprintf(stderr, "Image does not contain a1fs\n");
+		goto end;
+	}
+	if (!fs_ctx_init(&fs, image, size, &fs_opts)) {
+		fprintf(stderr, "Failed to initialize file system context\n");
+		goto end;
+	}
+
+	bool ok = dedup(&fs, &opts);
+	fs_ctx_destroy(&fs);
+	if (!ok) goto end;
+
+	// Sync to disk if requested
+	if (opts.sync && (msync(image, size, MS_SYNC) < 0)) {
+		perror("msync");
+		goto end;
+	}
+
+	ret = 0;
+end:
+	munmap(image, size);
+	return ret;
+}
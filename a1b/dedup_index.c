@@ -0,0 +1,147 @@
+/*
+ * This code is provided solely for the personal and private use of students
+ * taking the CSC369H course at the University of Toronto. Copying for purposes
+ * other than this use is expressly prohibited. All forms of distribution of
+ * this code, including but not limited to public repositories on GitHub,
+ * GitLab, Bitbucket, or any other online platform, whether as given or with
+ * any changes, are expressly prohibited.
+ *
+ * Authors: Alexey Khrabrov, Karen Reid
+ *
+ * All of the files in this directory and all subdirectories are:
+ * Copyright (c) 2019 Karen Reid
+ */
+
+/**
+ * CSC369 Assignment 1 - Block deduplication index implementation.
+ */
+
+#include <string.h>
+
+#include "dedup_index.h"
+#include "xxhash.h"
+
+
+// The index uses linear probing. Entries are never further than MAX_PROBE
+// slots from their home slot, which bounds the cost of lookups; deletion
+// shifts entries back instead of leaving tombstones.
+#define MAX_PROBE 32
+
+
+static a1fs_superblock *get_sb(fs_ctx *fs)
+{
+	return (a1fs_superblock*)fs->image;
+}
+
+static a1fs_dedup_entry *get_table(fs_ctx *fs)
+{
+	return (a1fs_dedup_entry*)(fs->image + get_sb(fs)->dedup_index * A1FS_BLOCK_SIZE);
+}
+
+static uint8_t *get_bitmap(fs_ctx *fs)
+{
+	return fs->image + get_sb(fs)->dedup_bmp * A1FS_BLOCK_SIZE;
+}
+
+static const void *get_block(fs_ctx *fs, a1fs_blk_t blk)
+{
+	return fs->image + (size_t)(get_sb(fs)->data_table + blk) * A1FS_BLOCK_SIZE;
+}
+
+static bool is_indexed(fs_ctx *fs, a1fs_blk_t blk)
+{
+	return (get_bitmap(fs)[blk / 8] >> (blk % 8)) & 1;
+}
+
+static void set_indexed(fs_ctx *fs, a1fs_blk_t blk, bool value)
+{
+	if (value) {
+		get_bitmap(fs)[blk / 8] |= 1 << (blk % 8);
+	} else {
+		get_bitmap(fs)[blk / 8] &= ~(1 << (blk % 8));
+	}
+}
+
+
+bool dedup_index_enabled(fs_ctx *fs)
+{
+	return get_sb(fs)->dedup_index != 0;
+}
+
+uint64_t dedup_hash(const void *block)
+{
+	uint64_t hash = xxh64(block, A1FS_BLOCK_SIZE, 0);
+	// 0 marks empty slots
+	return (hash != 0) ? hash : 1;
+}
+
+bool dedup_index_find(fs_ctx *fs, const void *data, uint64_t hash,
+                      a1fs_blk_t *blk)
+{
+	a1fs_dedup_entry *table = get_table(fs);
+	uint64_t mask = get_sb(fs)->dedup_slots - 1;
+
+	for (uint64_t i = 0; i < MAX_PROBE; i++) {
+		a1fs_dedup_entry *e = &table[(hash + i) & mask];
+		if (e->hash == 0) return false;
+		if ((e->hash == hash) &&
+		    (memcmp(get_block(fs, e->blk), data, A1FS_BLOCK_SIZE) == 0))
+		{
+			*blk = e->blk;
+			return true;
+		}
+	}
+	return false;
+}
+
+void dedup_index_add(fs_ctx *fs, a1fs_blk_t blk, uint64_t hash)
+{
+	if (is_indexed(fs, blk)) return;
+
+	a1fs_dedup_entry *table = get_table(fs);
+	uint64_t mask = get_sb(fs)->dedup_slots - 1;
+	for (uint64_t i = 0; i < MAX_PROBE; i++) {
+		a1fs_dedup_entry *e = &table[(hash + i) & mask];
+		if (e->hash == 0) {
+			e->hash = hash;
+			e->blk = blk;
+			set_indexed(fs, blk, true);
+			return;
+		}
+	}
+}
+
+void dedup_index_forget(fs_ctx *fs, a1fs_blk_t blk)
+{
+	if (!is_indexed(fs, blk)) return;
+	set_indexed(fs, blk, false);
+
+	// The block hasn't changed since it was indexed, so its hash leads to it
+	a1fs_dedup_entry *table = get_table(fs);
+	uint64_t mask = get_sb(fs)->dedup_slots - 1;
+	uint64_t hash = dedup_hash(get_block(fs, blk));
+	uint64_t i = hash & mask;
+	uint64_t n = 0;
+	while ((table[i].hash != 0) && (table[i].blk != blk)) {
+		i = (i + 1) & mask;
+		if (++n == MAX_PROBE) return;
+	}
+	if (table[i].hash == 0) return;
+
+	// Shift back the following entries that may move closer to their home
+	uint64_t j = i;
+	while (true) {
+		j = (j + 1) & mask;
+		if (table[j].hash == 0) break;
+		uint64_t home = table[j].hash & mask;
+		// The entry can fill the hole only if its home is not in (i, j]
+		bool stays = (i <= j) ? ((i < home) && (home <= j))
+		                      : ((i < home) || (home <= j));
+		if (!stays) {
+			table[i] = table[j];
+			i = j;
+		}
+	}
+	table[i].hash = 0;
+	table[i].blk = 0;
+}
@@ -0,0 +1,71 @@
+/*
+ * This code is provided solely for the personal and private use of students
+ * taking the CSC369H course at the University of Toronto. Copying for purposes
+ * other than this use is expressly prohibited. All forms of distribution of
+ * this code, including but not limited to public repositories on GitHub,
+ * GitLab, Bitbucket, or any other online platform, whether as given or with
+ * any changes, are expressly prohibited.
+ *
+ * Authors: Alexey Khrabrov, Karen Reid
+ *
+ * All of the files in this directory and all subdirectories are:
+ * Copyright (c) 2019 Karen Reid
+ */
+
+/**
+ * CSC369 Assignment 1 - Block deduplication index header file.
+ *
+ * The dedup index is an on-image hash table that maps the content hash of a
+ * data block to the block number, and is allocated by mkfs (-d option). A
+ * separate bitmap marks the data blocks that are in the index.
+ *
+ * Only blocks whose contents can't change behind the index's back are indexed:
+ * a block must be removed from the index (dedup_index_forget()) before it is
+ * modified in place or freed. Lookups also compare the block contents, so hash
+ * collisions are harmless.
+ */
+
+#pragma once
+
+#include <stdbool.h>
+#include <stdint.h>
+
+#include "a1fs.h"
+#include "fs_ctx.h"
+
+
+/** Whether the file system has a dedup index. */
+bool dedup_index_enabled(fs_ctx *fs);
+
+/** Compute the content hash of a data block (never 0). */
+uint64_t dedup_hash(const void *block);
+
+/**
+ * Find an indexed data block with given contents.
+ *
+ * @param fs    file system context.
+ * @param data  A1FS_BLOCK_SIZE bytes of data.
+ * @param hash  content hash of data.
+ * @param blk   pointer to the variable that receives the data block number.
+ * @return      true if found; false otherwise.
+ */
+bool dedup_index_find(fs_ctx *fs, const void *data, uint64_t hash,
+                      a1fs_blk_t *blk);
+
+/**
+ * Add a data block to the dedup index.
+ *
+ * Best effort: the block is not added if the index is too crowded around the
+ * hash value or the block is already indexed.
+ *
+ * @param fs    file system context.
+ * @param blk   data block number.
+ * @param hash  content hash of the block.
+ */
+void dedup_index_add(fs_ctx *fs, a1fs_blk_t blk, uint64_t hash);
+
+/**
+ * Remove a data block from the dedup index if it is there. Must be called
+ * before the block is modified in place or freed.
+ */
+void dedup_index_forget(fs_ctx *fs, a1fs_blk_t blk);
@@ -0,0 +1,175 @@
+/*
+ * This code is provided solely for the personal and private use of students
+ * taking the CSC369H course at the University of Toronto. Copying for purposes
+ * other than this use is expressly prohibited. All forms of distribution of
+ * this code, including but not limited to public repositories on GitHub,
+ * GitLab, Bitbucket, or any other online platform, whether as given or with
+ * any changes, are expressly prohibited.
+ *
+ * Authors: Alexey Khrabrov, Karen Reid
+ *
+ * All of the files in this directory and all subdirectories are:
+ * Copyright (c) 2019 Karen Reid
+ */
+
+
+/**
+ * CSC369 Assignment 1 - a1fs online defragmentation tool.
+ *
+ * Walks directory trees of a mounted a1fs and moves the blocks of each file
+ * and directory into one contiguous run through the A1FS_IOC_DEFRAG ioctl.
+ */
+
+// For nftw() flags
+#define _GNU_SOURCE
+
+#include <errno.h>
+#include <fcntl.h>
+#include <ftw.h>
+#include <stdbool.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/ioctl.h>
+#include <unistd.h>
+
+#include "a1fs.h"
+#include "util.h"
+
+
+/** Maximum number of file descriptors used by nftw(). */
+#define DEFRAG_NFTW_FDS 16
+
+
+/** Command line options. */
+typedef struct defrag_opts {
+	/** Only report fragmentation, without moving any blocks. */
+	bool check;
+	/** Print help and exit. */
+	bool help;
+	/** Print the results for each file. */
+	bool verbose;
+
+} defrag_opts;
+
+static const char *help_str = "\
+Usage: %s options path...\n\
+\n\
+Defragment the files and directories of a mounted a1fs in the directory\n\
+trees at the given paths. Snapshots, compressed files and blocks shared with\n\
+clones are left as they are.\n\
+\n\
+Options:\n\
+    -c  only report fragmentation\n\
+    -h  print help and exit\n\
+    -v  print the results for each file\n\
+";
+
+static void print_help(FILE *f, const char *progname)
+{
+	fprintf(f, help_str, progname);
+}
+
+static bool parse_args(int argc, char *argv[], defrag_opts *opts)
+{
+	int o;
+	while ((o = getopt(argc, argv, "chv")) != -1) {
+		switch (o) {
+			case 'c': opts->check = true; break;
+			case 'h': opts->help = true; return true;// skip other arguments
+			case 'v': opts->verbose = true; break;
+
+			case '?': return false;
+			default : assert(false);
+		}
+	}
+
+	if (optind >= argc) {
+		fprintf(stderr, "Missing path\n");
+		return false;
+	}
+	return true;
+}
+
+
+// nftw() callbacks have no argument for the caller's state
+static defrag_opts opts;
+
+/** Totals over all the files. */
+static struct {
+	uint64_t files;
+	uint64_t fragmented;
+	uint64_t runs_before;
+	uint64_t runs_after;
+	uint64_t blocks_moved;
+	uint64_t errors;
+} totals;
+
+static int defrag_one(const char *path, const struct stat *st, int type,
+                      struct FTW *ftw)
+{
+	(void)ftw;// unused
+	if ((type != FTW_F) && (type != FTW_D)) return FTW_CONTINUE;
+	if (!S_ISREG(st->st_mode) && !S_ISDIR(st->st_mode)) return FTW_CONTINUE;
+
+	int fd = open(path, O_RDONLY | O_NOFOLLOW);
+	if (fd < 0) {
+		perror(path);
+		totals.errors++;
+		return FTW_CONTINUE;
+	}
+	a1fs_defrag_args args = {0};
+	if (opts.check) args.flags |= A1FS_DEFRAG_CHECK;
+	int ret = ioctl(fd, A1FS_IOC_DEFRAG, &args);
+	int err = errno;
+	close(fd);
+
+	if (ret < 0) {
+		// Snapshots are read-only; there is nothing to do in them
+		if ((err == EROFS) && (type == FTW_D)) return FTW_SKIP_SUBTREE;
+		fprintf(stderr, "%s: %s\n", path, strerror(err));
+		totals.errors++;
+		return FTW_CONTINUE;
+	}
+
+	totals.files++;
+	if (args.runs_before > 1) totals.fragmented++;
+	totals.runs_before += args.runs_before;
+	totals.runs_after += args.runs_after;
+	totals.blocks_moved += args.blocks_moved;
+	if (opts.verbose && (args.runs_before > 1)) {
+		printf("%s: %u -> %u runs, %lu blocks moved\n", path, args.runs_before,
+		       args.runs_after, (unsigned long)args.blocks_moved);
+	}
+	return FTW_CONTINUE;
+}
+
+
+int main(int argc, char *argv[])
+{
+	if (!parse_args(argc, argv, &opts)) {
+		// Invalid arguments, print help to stderr
+		print_help(stderr, argv[0]);
+		return 1;
+	}
+	if (opts.help) {
+		// Help requested, print it to stdout
+		print_help(stdout, argv[0]);
+		return 0;
+	}
+
+	for (int i = optind; i < argc; i++) {
+		if (nftw(argv[i], defrag_one, DEFRAG_NFTW_FDS,
+		         FTW_PHYS | FTW_MOUNT | FTW_ACTIONRETVAL) < 0)
+		{
+			perror(argv[i]);
+			totals.errors++;
+		}
+	}
+
+	printf("%lu files, %lu fragmented: %lu -> %lu runs, %lu blocks moved\n",
+	       (unsigned long)totals.files, (unsigned long)totals.fragmented,
+	       (unsigned long)totals.runs_before, (unsigned long)totals.runs_after,
+	       (unsigned long)totals.blocks_moved);
+	return (totals.errors != 0) ? 1 : 0;
+}
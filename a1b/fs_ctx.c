@@ -1,37 +1,800 @@
-/*
- * This code is provided solely for the personal and private use of students
- * taking the CSC369H course at the University of Toronto. Copying for purposes
- * other than this use is expressly prohibited. All forms of distribution of
- * this code, including but not limited to public repositories on GitHub,
- * GitLab, Bitbucket, or any other online platform, whether as given or with
- * any changes, are expressly prohibited.
- *
- * Authors: Alexey Khrabrov, Karen Reid
- *
- * All of the files in this directory and all subdirectories are:
- * Copyright (c) 2019 Karen Reid
- */
-
-/**
- * CSC369 Assignment 1 - File system runtime context implementation.
- */
-
-#include "fs_ctx.h"
-
-
-bool fs_ctx_init(fs_ctx *fs, void *image, size_t size, a1fs_opts *opts)
-{
-	fs->image = image;
-	fs->size = size;
-	fs->opts = opts;
-	fs->current_inode_offset = 0;
-	fs->n_inodes = 0;
-	//TODO
-	return true;
-}
-
-void fs_ctx_destroy(fs_ctx *fs)
-{
-	//TODO
-	(void)fs;
-}
+/*
+ * This code is provided solely for the personal and private use of students
+ * taking the CSC369H course at the University of Toronto. Copying for purposes
+ * other than this use is expressly prohibited. All forms of distribution of
+ * this code, including but not limited to public repositories on GitHub,
+ * GitLab, Bitbucket, or any other online platform, whether as given or with
+ * any changes, are expressly prohibited.
+ *
+ * Authors: Alexey Khrabrov, Karen Reid
+ *
+ * All of the files in this directory and all subdirectories are:
+ * Copyright (c) 2019 Karen Reid
+ */
+
+/**
+ * CSC369 Assignment 1 - File system runtime context implementation.
+ */
+
+// For mremap()
+#define _GNU_SOURCE
+
+#include <errno.h>
+#include <fcntl.h>
+#include <limits.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
+
+#include "crc32c.h"
+#include "dedup_index.h"
+#include "fs_ctx.h"
+#include "map.h"
+
+
+/** Initial number of xattr block index slots. */
+#define XATTR_SHARES_INIT_SIZE 64
+
+/** Get a pointer to a data block. */
+static void *data_block(fs_ctx *fs, a1fs_blk_t blk)
+{
+	const a1fs_superblock *sb = (const a1fs_superblock*)fs->image;
+	return fs->image + (size_t)(sb->data_table + blk) * A1FS_BLOCK_SIZE;
+}
+
+/** Add the xattr blocks of all the inodes to the index. */
+static bool xattr_shares_load(fs_ctx *fs)
+{
+	const a1fs_superblock *sb = (const a1fs_superblock*)fs->image;
+	const uint8_t *bmp = fs->image + sb->inode_bmp * A1FS_BLOCK_SIZE;
+	const a1fs_inode *table = fs->image + sb->inode_table * A1FS_BLOCK_SIZE;
+
+	for (a1fs_ino_t ino = 0; ino < sb->num_inodes; ino++) {
+		if (!((bmp[ino / 8] >> (ino % 8)) & 1)) continue;
+		if (!(table[ino].flags & A1FS_INODE_XATTR_BLOCK)) continue;
+
+		a1fs_blk_t blk = table[ino].xattr_block;
+		const void *data = data_block(fs, blk);
+		uint64_t hash = dedup_hash(data);
+		a1fs_blk_t found;
+		if (!fs_xattr_share_find(fs, hash, data, &found) &&
+		    !fs_xattr_share_add(fs, hash, blk))
+		{
+			return false;
+		}
+	}
+	return true;
+}
+
+/** Empty the xattr block index. */
+static void xattr_shares_clear(fs_ctx *fs)
+{
+	memset(fs->xattr_shares, 0, fs->xattr_shares_size * sizeof(xattr_share));
+	fs->xattr_shares_used = 0;
+}
+
+
+/** Number of bitmap blocks covered by the checksums in a checkpoint. */
+static uint64_t crc_bitmap_blocks(const a1fs_superblock *sb)
+{
+	return sb->refcount_table - sb->inode_bmp;
+}
+
+/** Number of bitmap and inode table blocks covered by the checksums. */
+static uint64_t crc_blocks(const a1fs_superblock *sb)
+{
+	return crc_bitmap_blocks(sb) + (sb->data_table - sb->inode_table);
+}
+
+/** Get a pointer to the i-th block covered by the checksums. */
+static const void *crc_block(fs_ctx *fs, uint64_t i)
+{
+	const a1fs_superblock *sb = (const a1fs_superblock*)fs->image;
+	uint64_t bmp_blocks = crc_bitmap_blocks(sb);
+	uint64_t blk = (i < bmp_blocks) ? sb->inode_bmp + i
+	                                : sb->inode_table + (i - bmp_blocks);
+	return fs->image + blk * A1FS_BLOCK_SIZE;
+}
+
+/** Checksum of the superblock with its checksum field set to 0. */
+static uint32_t sb_checksum(const a1fs_superblock *sb)
+{
+	a1fs_superblock copy;
+	memcpy(&copy, sb, sizeof(copy));
+	copy.checksum = 0;
+	return crc32c(0, &copy, sizeof(copy));
+}
+
+/** Checksum of the entries of a directory (see a1fs_checkpoint_dir). */
+static uint32_t dir_checksum(fs_ctx *fs, const a1fs_inode *dir)
+{
+	const a1fs_superblock *sb = (const a1fs_superblock*)fs->image;
+	uint32_t crc = 0;
+	for (int i = 0; (i < A1FS_INODE_EXTENTS) && (dir->extent_array[i].count != 0); i++) {
+		const a1fs_extent *ext = &dir->extent_array[i];
+		uint64_t offset = (uint64_t)ext->lblk * A1FS_BLOCK_SIZE;
+		// A damaged extent is left for fsck to report
+		if ((offset >= dir->size) || ((uint64_t)ext->start + ext->count > sb->num_blocks)) {
+			break;
+		}
+		uint64_t len = (uint64_t)ext->count * A1FS_BLOCK_SIZE;
+		if (len > dir->size - offset) len = dir->size - offset;
+		crc = crc32c(crc, data_block(fs, ext->start), len);
+	}
+	return crc;
+}
+
+/**
+ * Compute the checksums of all the directories.
+ *
+ * @param fs     file system context.
+ * @param dirs   pointer to the variable that receives the array of checksums
+ *               sorted by inode number; must be freed by the caller.
+ * @param count  pointer to the variable that receives the number of them.
+ * @return       true on success; false if out of memory.
+ */
+static bool dir_checksums(fs_ctx *fs, a1fs_checkpoint_dir **dirs, uint64_t *count)
+{
+	const a1fs_superblock *sb = (const a1fs_superblock*)fs->image;
+	const uint8_t *bmp = fs->image + sb->inode_bmp * A1FS_BLOCK_SIZE;
+	const a1fs_inode *table = fs->image + sb->inode_table * A1FS_BLOCK_SIZE;
+
+	uint64_t n = 0;
+	for (a1fs_ino_t ino = 0; ino < sb->num_inodes; ino++) {
+		if (((bmp[ino / 8] >> (ino % 8)) & 1) && S_ISDIR(table[ino].mode)) n++;
+	}
+	*dirs = malloc(n * sizeof(a1fs_checkpoint_dir) + 1);
+	if (*dirs == NULL) return false;
+	*count = 0;
+	for (a1fs_ino_t ino = 0; ino < sb->num_inodes; ino++) {
+		if (!((bmp[ino / 8] >> (ino % 8)) & 1) || !S_ISDIR(table[ino].mode)) continue;
+		(*dirs)[(*count)++] = (a1fs_checkpoint_dir){
+			.ino = ino, .crc = dir_checksum(fs, &table[ino]) };
+	}
+	return true;
+}
+
+/** Free the checksums loaded from the checkpoint. */
+static void checksums_clear(fs_ctx *fs)
+{
+	free(fs->block_crcs);
+	fs->block_crcs = NULL;
+	free(fs->table_verified);
+	fs->table_verified = NULL;
+	free(fs->dir_crcs);
+	fs->dir_crcs = NULL;
+	fs->num_dir_crcs = 0;
+	free(fs->dir_verified);
+	fs->dir_verified = NULL;
+}
+
+/**
+ * Load the checksums that follow the xattr block index entries in a valid
+ * checkpoint.
+ *
+ * @return  true on success; false if they are invalid or out of memory.
+ */
+static bool checksums_load(fs_ctx *fs, const a1fs_checkpoint *cp)
+{
+	const a1fs_superblock *sb = (const a1fs_superblock*)fs->image;
+	if (cp->num_block_crcs == 0) return cp->num_dir_crcs == 0;
+
+	const uint32_t *crcs = (const uint32_t*)((const a1fs_checkpoint_xattr*)(cp + 1)
+	                                         + cp->num_xattr_shares);
+	const a1fs_checkpoint_dir *dirs = (const a1fs_checkpoint_dir*)(crcs + cp->num_block_crcs);
+	uint64_t table_blocks = sb->data_table - sb->inode_table;
+	fs->block_crcs = malloc(cp->num_block_crcs * sizeof(uint32_t));
+	fs->table_verified = calloc((table_blocks + CHAR_BIT - 1) / CHAR_BIT, 1);
+	fs->dir_crcs = malloc(cp->num_dir_crcs * sizeof(a1fs_checkpoint_dir) + 1);
+	fs->dir_verified = calloc((sb->num_inodes + CHAR_BIT - 1) / CHAR_BIT, 1);
+	if ((fs->block_crcs == NULL) || (fs->table_verified == NULL) ||
+	    (fs->dir_crcs == NULL) || (fs->dir_verified == NULL))
+	{
+		return false;
+	}
+	memcpy(fs->block_crcs, crcs, cp->num_block_crcs * sizeof(uint32_t));
+	for (uint64_t i = 0; i < cp->num_dir_crcs; i++) {
+		// fs_verify_dir() looks them up with a binary search
+		if ((dirs[i].ino >= sb->num_inodes) || ((i > 0) && (dirs[i].ino <= dirs[i - 1].ino))) {
+			return false;
+		}
+		fs->dir_crcs[i] = dirs[i];
+	}
+	fs->num_dir_crcs = cp->num_dir_crcs;
+	return true;
+}
+
+/**
+ * Verify the checksums of the bitmaps, which are modified in many places and
+ * so can't be verified lazily.
+ *
+ * @return  true if they match; false otherwise (reported on stderr).
+ */
+static bool verify_bitmaps(fs_ctx *fs)
+{
+	const a1fs_superblock *sb = (const a1fs_superblock*)fs->image;
+	for (uint64_t i = 0; i < crc_bitmap_blocks(sb); i++) {
+		if (crc32c(0, crc_block(fs, i), A1FS_BLOCK_SIZE) != fs->block_crcs[i]) {
+			fprintf(stderr, "Checksum mismatch in bitmap block %lu; run fsck.a1fs\n",
+			        sb->inode_bmp + i);
+			return false;
+		}
+	}
+	return true;
+}
+
+
+/**
+ * Load the indexes from the checkpoint of a cleanly unmounted file system.
+ *
+ * @return  true on success; false if the checkpoint is invalid or out of
+ *          memory (the indexes are then left empty).
+ */
+static bool checkpoint_load(fs_ctx *fs)
+{
+	const a1fs_superblock *sb = (const a1fs_superblock*)fs->image;
+	if (sb->checkpoint_blocks == 0) return true;
+	if ((uint64_t)sb->checkpoint + sb->checkpoint_blocks > sb->num_blocks) return false;
+
+	const a1fs_checkpoint *cp = data_block(fs, sb->checkpoint);
+	const a1fs_checkpoint_xattr *xattrs = (const a1fs_checkpoint_xattr*)(cp + 1);
+	uint64_t capacity = (uint64_t)sb->checkpoint_blocks * A1FS_BLOCK_SIZE - sizeof(*cp);
+	if ((cp->magic != A1FS_CHECKPOINT_MAGIC) || (cp->generation != sb->generation) ||
+	    (cp->num_xattr_shares > capacity) || (cp->num_dir_crcs > capacity) ||
+	    ((cp->num_block_crcs != 0) && (cp->num_block_crcs != crc_blocks(sb))) ||
+	    (cp->num_xattr_shares * sizeof(*xattrs) + cp->num_block_crcs * sizeof(uint32_t)
+	     + cp->num_dir_crcs * sizeof(a1fs_checkpoint_dir) > capacity))
+	{
+		return false;
+	}
+	if (!checksums_load(fs, cp)) {
+		checksums_clear(fs);
+		return false;
+	}
+
+	// Size the table up front, so that it is not rehashed while loading
+	size_t size = fs->xattr_shares_size;
+	while ((cp->num_xattr_shares + 1) * 2 > size) size *= 2;
+	if (size != fs->xattr_shares_size) {
+		xattr_share *shares = calloc(size, sizeof(xattr_share));
+		if (shares == NULL) return false;
+		free(fs->xattr_shares);
+		fs->xattr_shares = shares;
+		fs->xattr_shares_size = size;
+	}
+	for (uint64_t i = 0; i < cp->num_xattr_shares; i++) {
+		if ((xattrs[i].hash == 0) || (xattrs[i].blk >= sb->num_blocks) ||
+		    !fs_xattr_share_add(fs, xattrs[i].hash, xattrs[i].blk))
+		{
+			xattr_shares_clear(fs);
+			checksums_clear(fs);
+			return false;
+		}
+	}
+	return true;
+}
+
+/**
+ * Mark the file system as mounted: clear the clean flag and free the blocks of
+ * the checkpoint, which is no longer needed once the indexes are loaded.
+ */
+static void checkpoint_release(fs_ctx *fs)
+{
+	a1fs_superblock *sb = (a1fs_superblock*)fs->image;
+	uint8_t *bmp = fs->image + sb->datablock_bmp * A1FS_BLOCK_SIZE;
+	a1fs_refcount_t *refcount = fs->image + sb->refcount_table * A1FS_BLOCK_SIZE;
+	a1fs_blk_t count = sb->checkpoint_blocks;
+	// A damaged superblock is left for fsck to report
+	if ((uint64_t)sb->checkpoint + count > sb->num_blocks) count = 0;
+	for (a1fs_blk_t blk = sb->checkpoint; blk < sb->checkpoint + count; blk++) {
+		bmp[blk / 8] &= ~(1 << (blk % 8));
+		refcount[blk] = 0;
+	}
+
+	a1fs_superblock new_sb = *sb;
+	new_sb.clean = 0;
+	new_sb.checkpoint = 0;
+	new_sb.checkpoint_blocks = 0;
+	new_sb.checksum = 0;
+	new_sb.num_unused_blocks += count;
+	memcpy(sb, &new_sb, sizeof(new_sb));
+}
+
+/**
+ * Allocate a run of contiguous data blocks for a checkpoint.
+ *
+ * @return  true on success; false if there is no free run that long.
+ */
+static bool checkpoint_alloc(fs_ctx *fs, a1fs_blk_t count, a1fs_blk_t *start)
+{
+	a1fs_superblock *sb = (a1fs_superblock*)fs->image;
+	uint8_t *bmp = fs->image + sb->datablock_bmp * A1FS_BLOCK_SIZE;
+	a1fs_refcount_t *refcount = fs->image + sb->refcount_table * A1FS_BLOCK_SIZE;
+	if (sb->num_unused_blocks < count) return false;
+
+	a1fs_blk_t run = 0;
+	for (a1fs_blk_t blk = 0; blk < sb->num_blocks; blk++) {
+		run = ((bmp[blk / 8] >> (blk % 8)) & 1) ? 0 : run + 1;
+		if (run < count) continue;
+
+		*start = blk - count + 1;
+		for (a1fs_blk_t b = *start; b <= blk; b++) {
+			bmp[b / 8] |= 1 << (b % 8);
+			refcount[b] = 1;
+		}
+		return true;
+	}
+	return false;
+}
+
+/**
+ * Save the indexes (and with --checksums, the checksums of the metadata) into
+ * a checkpoint and mark the file system as cleanly unmounted. If there is no
+ * room for the checkpoint, the clean flag stays clear.
+ */
+static void checkpoint_save(fs_ctx *fs)
+{
+	a1fs_superblock *sb = (a1fs_superblock*)fs->image;
+	a1fs_checkpoint_dir *dirs = NULL;
+	uint64_t num_block_crcs = 0, num_dir_crcs = 0;
+	// Computed from scratch, so the metadata need not be tracked while mounted
+	if (fs->opts->checksums) {
+		if (!dir_checksums(fs, &dirs, &num_dir_crcs)) return;
+		num_block_crcs = crc_blocks(sb);
+	}
+
+	a1fs_blk_t start = 0, count = 0;
+	if ((fs->xattr_shares_used != 0) || (num_block_crcs != 0)) {
+		size_t size = sizeof(a1fs_checkpoint)
+		            + fs->xattr_shares_used * sizeof(a1fs_checkpoint_xattr)
+		            + num_block_crcs * sizeof(uint32_t)
+		            + num_dir_crcs * sizeof(a1fs_checkpoint_dir);
+		count = (size + A1FS_BLOCK_SIZE - 1) / A1FS_BLOCK_SIZE;
+		if (!checkpoint_alloc(fs, count, &start)) {
+			free(dirs);
+			return;
+		}
+
+		a1fs_checkpoint *cp = data_block(fs, start);
+		a1fs_checkpoint_xattr *xattrs = (a1fs_checkpoint_xattr*)(cp + 1);
+		cp->magic = A1FS_CHECKPOINT_MAGIC;
+		cp->generation = sb->generation;
+		cp->num_xattr_shares = 0;
+		for (size_t i = 0; i < fs->xattr_shares_size; i++) {
+			const xattr_share *e = &fs->xattr_shares[i];
+			if (e->hash == 0) continue;
+			xattrs[cp->num_xattr_shares++] = (a1fs_checkpoint_xattr){
+				.hash = e->hash, .blk = e->blk };
+		}
+
+		// After the allocation, so that the data bitmap checksums cover it
+		uint32_t *crcs = (uint32_t*)(xattrs + cp->num_xattr_shares);
+		for (uint64_t i = 0; i < num_block_crcs; i++) {
+			crcs[i] = crc32c(0, crc_block(fs, i), A1FS_BLOCK_SIZE);
+		}
+		cp->num_block_crcs = num_block_crcs;
+		memcpy(crcs + num_block_crcs, dirs, num_dir_crcs * sizeof(a1fs_checkpoint_dir));
+		cp->num_dir_crcs = num_dir_crcs;
+	}
+	free(dirs);
+
+	// The checkpoint becomes valid together with the clean flag
+	a1fs_superblock new_sb = *sb;
+	new_sb.clean = 1;
+	new_sb.checkpoint = start;
+	new_sb.checkpoint_blocks = count;
+	new_sb.num_unused_blocks -= count;
+	new_sb.checksum = 0;
+	memcpy(sb, &new_sb, sizeof(new_sb));
+	// A crash before this leaves a clean superblock without a checksum
+	if (num_block_crcs != 0) sb->checksum = sb_checksum(sb);
+}
+
+
+bool fs_ctx_init(fs_ctx *fs, void *image, size_t size, a1fs_opts *opts)
+{
+	fs->image = image;
+	fs->size = size;
+	fs->opts = opts;
+	fs->current_inode_offset = 0;
+	fs->n_inodes = 0;
+	fs->was_clean = false;
+	fs->checkpoint = false;
+
+	fs->cluster_cache_clock = 0;
+	for (int i = 0; i < A1FS_CLUSTER_CACHE_SIZE; i++) {
+		fs->cluster_cache[i].valid = false;
+		fs->cluster_cache[i].data = NULL;
+	}
+	if (!stats_init(&fs->stats)) return false;
+	fs->compress_buf = malloc(A1FS_CLUSTER_SIZE);
+	a1fs_superblock *sb = (a1fs_superblock*)image;
+	fs->cache_stale = calloc((sb->num_inodes + CHAR_BIT - 1) / CHAR_BIT, 1);
+	fs->xattr_shares_size = XATTR_SHARES_INIT_SIZE;
+	fs->xattr_shares_used = 0;
+	fs->xattr_shares = calloc(fs->xattr_shares_size, sizeof(xattr_share));
+	fs->ring = NULL;
+	fs->ring_failed = false;
+	fs->trace = NULL;
+	fs->free_inodes_next = fs->free_inodes_count = 0;
+	fs->inode_scan_pos = 0;
+	fs->free_runs_next = fs->free_runs_count = 0;
+	fs->block_scan_pos = 0;
+	memset(fs->tail_blocks, 0, sizeof(fs->tail_blocks));
+	fs->lazy_mtimes = opts->lazytime ? calloc(A1FS_LAZY_MTIME_SLOTS, sizeof(lazy_mtime))
+	                                 : NULL;
+	fs->lazy_mtimes_used = 0;
+	fs->block_crcs = NULL;
+	fs->table_verified = NULL;
+	fs->dir_crcs = NULL;
+	fs->num_dir_crcs = 0;
+	fs->dir_verified = NULL;
+	if ((fs->compress_buf == NULL) || (fs->cache_stale == NULL) ||
+	    (fs->xattr_shares == NULL) || (opts->lazytime && (fs->lazy_mtimes == NULL)))
+	{
+		fs_ctx_destroy(fs);
+		return false;
+	}
+	// The ring itself is set up on first use, after fuse_main() has forked and
+	// stderr is gone; check now that it can be, rather than quietly falling
+	// back to the mapping later
+	if (opts->io_uring) {
+		uring probe;
+		int ret = uring_init(&probe, opts->img_path);
+		if (ret != 0) {
+			fprintf(stderr, "io_uring: %s\n", strerror(-ret));
+			fs_ctx_destroy(fs);
+			return false;
+		}
+		uring_destroy(&probe);
+	}
+	if ((sb->clean != 0) && (sb->checksum != 0) && (sb_checksum(sb) != sb->checksum)) {
+		fprintf(stderr, "Superblock checksum mismatch; run fsck.a1fs\n");
+		fs_ctx_destroy(fs);
+		return false;
+	}
+	// The scan is only needed after an unclean shutdown
+	fs->was_clean = (sb->clean != 0) && checkpoint_load(fs);
+	if ((!fs->was_clean && !xattr_shares_load(fs)) ||
+	    ((fs->block_crcs != NULL) && !verify_bitmaps(fs)))
+	{
+		fs_ctx_destroy(fs);
+		return false;
+	}
+	checkpoint_release(fs);
+	fs->checkpoint = true;
+	// Metadata scans then run without page faults
+	if (opts->populate) map_populate(image, (size_t)sb->data_table * A1FS_BLOCK_SIZE);
+	// Cache buffers are allocated on first use
+	//TODO
+	return true;
+}
+
+void fs_ctx_destroy(fs_ctx *fs)
+{
+	if (fs->lazy_mtimes != NULL) fs_lazy_mtime_flush(fs);
+	if (fs->checkpoint) checkpoint_save(fs);
+	fs->checkpoint = false;
+	for (int i = 0; i < A1FS_CLUSTER_CACHE_SIZE; i++) {
+		free(fs->cluster_cache[i].data);
+		fs->cluster_cache[i].data = NULL;
+	}
+	free(fs->compress_buf);
+	fs->compress_buf = NULL;
+	free(fs->cache_stale);
+	fs->cache_stale = NULL;
+	free(fs->xattr_shares);
+	fs->xattr_shares = NULL;
+	free(fs->lazy_mtimes);
+	fs->lazy_mtimes = NULL;
+	checksums_clear(fs);
+	if (fs->ring != NULL) uring_destroy(fs->ring);
+	free(fs->ring);
+	fs->ring = NULL;
+	stats_destroy(&fs->stats);
+}
+
+int fs_ctx_grow(fs_ctx *fs, size_t size)
+{
+	a1fs_superblock *sb = (a1fs_superblock*)fs->image;
+	if ((size <= fs->size) || (size % A1FS_BLOCK_SIZE != 0)) return -EINVAL;
+	uint64_t num_blocks = size / A1FS_BLOCK_SIZE - sb->data_table;
+	if (num_blocks > sb->max_blocks) return -EFBIG;
+
+	int fd = open(fs->opts->img_path, O_RDWR);
+	if (fd < 0) return -errno;
+	int ret = (ftruncate(fd, size) < 0) ? -errno : 0;
+	close(fd);
+	if (ret != 0) return ret;
+
+	void *image = mremap(fs->image, fs->size, size, MREMAP_MAYMOVE);
+	if (image == MAP_FAILED) {
+		// The old mapping is still in place
+		ret = -errno;
+		if ((fd = open(fs->opts->img_path, O_RDWR)) >= 0) {
+			if (ftruncate(fd, fs->size) < 0) perror("ftruncate");
+			close(fd);
+		}
+		return ret;
+	}
+	fs->image = image;
+	fs->size = size;
+	sb = (a1fs_superblock*)image;
+
+	// The new blocks must start out free and unindexed. Their bits and counts
+	// are normally clear already, but a shrink leaves them as they were.
+	uint8_t *bmp = fs->image + sb->datablock_bmp * A1FS_BLOCK_SIZE;
+	uint8_t *dedup_bmp = fs->image + sb->dedup_bmp * A1FS_BLOCK_SIZE;
+	a1fs_refcount_t *refcount = fs->image + sb->refcount_table * A1FS_BLOCK_SIZE;
+	for (a1fs_blk_t blk = sb->num_blocks; blk < num_blocks; blk++) {
+		bmp[blk / 8] &= ~(1 << (blk % 8));
+		if (sb->dedup_index != 0) dedup_bmp[blk / 8] &= ~(1 << (blk % 8));
+		refcount[blk] = 0;
+	}
+
+	a1fs_superblock new_sb = *sb;
+	new_sb.size = size;
+	new_sb.num_unused_blocks += num_blocks - sb->num_blocks;
+	new_sb.num_blocks = num_blocks;
+	memcpy(sb, &new_sb, sizeof(new_sb));
+	return 0;
+}
+
+
+uring *fs_uring(fs_ctx *fs)
+{
+	if ((fs->ring != NULL) || !fs->opts->io_uring || fs->ring_failed) return fs->ring;
+
+	fs->ring = malloc(sizeof(uring));
+	int ret = (fs->ring != NULL) ? uring_init(fs->ring, fs->opts->img_path) : -ENOMEM;
+	if (ret != 0) {
+		fprintf(stderr, "io_uring: %s; using the mapping instead\n", strerror(-ret));
+		free(fs->ring);
+		fs->ring = NULL;
+		fs->ring_failed = true;
+	}
+	return fs->ring;
+}
+
+
+unsigned char *fs_cluster_cache_find(fs_ctx *fs, a1fs_ino_t ino, uint64_t index)
+{
+	for (int i = 0; i < A1FS_CLUSTER_CACHE_SIZE; i++) {
+		cluster_cache_entry *e = &fs->cluster_cache[i];
+		if (e->valid && (e->ino == ino) && (e->index == index)) {
+			e->last_use = ++fs->cluster_cache_clock;
+			return e->data;
+		}
+	}
+	return NULL;
+}
+
+unsigned char *fs_cluster_cache_add(fs_ctx *fs, a1fs_ino_t ino, uint64_t index)
+{
+	cluster_cache_entry *victim = &fs->cluster_cache[0];
+	for (int i = 0; i < A1FS_CLUSTER_CACHE_SIZE; i++) {
+		cluster_cache_entry *e = &fs->cluster_cache[i];
+		if (e->valid && (e->ino == ino) && (e->index == index)) {
+			victim = e;
+			break;
+		}
+		if (!e->valid || (victim->valid && (e->last_use < victim->last_use))) {
+			victim = e;
+		}
+	}
+
+	if (victim->data == NULL) {
+		victim->data = malloc(A1FS_CLUSTER_SIZE);
+		if (victim->data == NULL) return NULL;
+	}
+	victim->valid = true;
+	victim->ino = ino;
+	victim->index = index;
+	victim->last_use = ++fs->cluster_cache_clock;
+	return victim->data;
+}
+
+void fs_cluster_cache_drop(fs_ctx *fs, a1fs_ino_t ino, uint64_t from_index)
+{
+	for (int i = 0; i < A1FS_CLUSTER_CACHE_SIZE; i++) {
+		cluster_cache_entry *e = &fs->cluster_cache[i];
+		if (e->valid && (e->ino == ino) && (e->index >= from_index)) {
+			e->valid = false;
+		}
+	}
+}
+
+
+bool fs_xattr_share_find(fs_ctx *fs, uint64_t hash, const void *data,
+                         a1fs_blk_t *blk)
+{
+	const a1fs_superblock *sb = (const a1fs_superblock*)fs->image;
+	size_t mask = fs->xattr_shares_size - 1;
+	for (size_t i = hash & mask; fs->xattr_shares[i].hash != 0; i = (i + 1) & mask) {
+		xattr_share *e = &fs->xattr_shares[i];
+		const void *block = fs->image + (size_t)(sb->data_table + e->blk) * A1FS_BLOCK_SIZE;
+		if ((e->hash == hash) && (memcmp(block, data, A1FS_BLOCK_SIZE) == 0)) {
+			*blk = e->blk;
+			return true;
+		}
+	}
+	return false;
+}
+
+bool fs_xattr_share_add(fs_ctx *fs, uint64_t hash, a1fs_blk_t blk)
+{
+	// Keep the load factor at most 1/2 so that probe sequences stay short
+	if ((fs->xattr_shares_used + 1) * 2 > fs->xattr_shares_size) {
+		size_t size = fs->xattr_shares_size * 2;
+		xattr_share *shares = calloc(size, sizeof(xattr_share));
+		if (shares == NULL) return false;
+		for (size_t i = 0; i < fs->xattr_shares_size; i++) {
+			xattr_share *e = &fs->xattr_shares[i];
+			if (e->hash == 0) continue;
+			size_t j = e->hash & (size - 1);
+			while (shares[j].hash != 0) j = (j + 1) & (size - 1);
+			shares[j] = *e;
+		}
+		free(fs->xattr_shares);
+		fs->xattr_shares = shares;
+		fs->xattr_shares_size = size;
+	}
+
+	size_t mask = fs->xattr_shares_size - 1;
+	size_t i = hash & mask;
+	while (fs->xattr_shares[i].hash != 0) i = (i + 1) & mask;
+	fs->xattr_shares[i].hash = hash;
+	fs->xattr_shares[i].blk = blk;
+	fs->xattr_shares_used++;
+	return true;
+}
+
+void fs_xattr_share_remove(fs_ctx *fs, uint64_t hash, a1fs_blk_t blk)
+{
+	xattr_share *table = fs->xattr_shares;
+	size_t mask = fs->xattr_shares_size - 1;
+	size_t i = hash & mask;
+	while ((table[i].hash != 0) && ((table[i].hash != hash) || (table[i].blk != blk))) {
+		i = (i + 1) & mask;
+	}
+	if (table[i].hash == 0) return;
+
+	// Shift back the following entries that may move closer to their home
+	size_t j = i;
+	while (true) {
+		j = (j + 1) & mask;
+		if (table[j].hash == 0) break;
+		size_t home = table[j].hash & mask;
+		// The entry can fill the hole only if its home is not in (i, j]
+		bool stays = (i <= j) ? ((i < home) && (home <= j))
+		                      : ((i < home) || (home <= j));
+		if (!stays) {
+			table[i] = table[j];
+			i = j;
+		}
+	}
+	table[i].hash = 0;
+	fs->xattr_shares_used--;
+}
+
+
+const struct timespec *fs_lazy_mtime_find(fs_ctx *fs, a1fs_ino_t ino)
+{
+	if (fs->lazy_mtimes == NULL) return NULL;
+	size_t mask = A1FS_LAZY_MTIME_SLOTS - 1;
+	for (size_t i = ino & mask; fs->lazy_mtimes[i].used; i = (i + 1) & mask) {
+		if (fs->lazy_mtimes[i].ino == ino) return &fs->lazy_mtimes[i].mtime;
+	}
+	return NULL;
+}
+
+bool fs_lazy_mtime_set(fs_ctx *fs, a1fs_ino_t ino, const struct timespec *mtime)
+{
+	size_t mask = A1FS_LAZY_MTIME_SLOTS - 1;
+	size_t i = ino & mask;
+	while (fs->lazy_mtimes[i].used && (fs->lazy_mtimes[i].ino != ino)) i = (i + 1) & mask;
+
+	lazy_mtime *e = &fs->lazy_mtimes[i];
+	if (!e->used) {
+		// Keep the load factor at most 1/2 so that probe sequences stay short
+		if ((fs->lazy_mtimes_used + 1) * 2 > A1FS_LAZY_MTIME_SLOTS) return false;
+		if (fs->lazy_mtimes_used++ == 0) fs->lazy_mtimes_since = stats_now();
+		e->used = true;
+		e->ino = ino;
+	}
+	e->mtime = *mtime;
+	return true;
+}
+
+bool fs_lazy_mtime_take(fs_ctx *fs, a1fs_ino_t ino, struct timespec *mtime)
+{
+	if (fs->lazy_mtimes == NULL) return false;
+	lazy_mtime *table = fs->lazy_mtimes;
+	size_t mask = A1FS_LAZY_MTIME_SLOTS - 1;
+	size_t i = ino & mask;
+	while (table[i].used && (table[i].ino != ino)) i = (i + 1) & mask;
+	if (!table[i].used) return false;
+	if (mtime != NULL) *mtime = table[i].mtime;
+
+	// Shift back the following entries that may move closer to their home
+	size_t j = i;
+	while (true) {
+		j = (j + 1) & mask;
+		if (!table[j].used) break;
+		size_t home = table[j].ino & mask;
+		// The entry can fill the hole only if its home is not in (i, j]
+		bool stays = (i <= j) ? ((i < home) && (home <= j))
+		                      : ((i < home) || (home <= j));
+		if (!stays) {
+			table[i] = table[j];
+			i = j;
+		}
+	}
+	table[i].used = false;
+	fs->lazy_mtimes_used--;
+	return true;
+}
+
+void fs_lazy_mtime_flush(fs_ctx *fs)
+{
+	if (fs->lazy_mtimes_used == 0) return;
+	const a1fs_superblock *sb = (const a1fs_superblock*)fs->image;
+	a1fs_inode *table = fs->image + sb->inode_table * A1FS_BLOCK_SIZE;
+	for (size_t i = 0; i < A1FS_LAZY_MTIME_SLOTS; i++) {
+		lazy_mtime *e = &fs->lazy_mtimes[i];
+		if (!e->used) continue;
+		table[e->ino].mtime = e->mtime;
+		e->used = false;
+	}
+	stats_count(&fs->stats, A1FS_STAT_MTIME_WRITTEN, fs->lazy_mtimes_used);
+	fs->lazy_mtimes_used = 0;
+}
+
+
+void fs_verify_inode(fs_ctx *fs, a1fs_ino_t ino)
+{
+	if (fs->block_crcs == NULL) return;
+	const a1fs_superblock *sb = (const a1fs_superblock*)fs->image;
+	size_t i = (size_t)ino * sizeof(a1fs_inode) / A1FS_BLOCK_SIZE;
+	if ((fs->table_verified[i / CHAR_BIT] >> (i % CHAR_BIT)) & 1) return;
+	fs->table_verified[i / CHAR_BIT] |= 1 << (i % CHAR_BIT);
+
+	uint64_t bmp_blocks = crc_bitmap_blocks(sb);
+	uint32_t crc = crc32c(0, crc_block(fs, bmp_blocks + i), A1FS_BLOCK_SIZE);
+	if (crc != fs->block_crcs[bmp_blocks + i]) {
+		fprintf(stderr, "Checksum mismatch in inode table block %lu (inode %u); "
+		        "run fsck.a1fs\n", sb->inode_table + i, ino);
+		stats_count(&fs->stats, A1FS_STAT_CHECKSUM_ERRORS, 1);
+	}
+}
+
+void fs_verify_dir(fs_ctx *fs, a1fs_ino_t ino)
+{
+	if (fs->dir_verified == NULL) return;
+	if ((fs->dir_verified[ino / CHAR_BIT] >> (ino % CHAR_BIT)) & 1) return;
+	fs->dir_verified[ino / CHAR_BIT] |= 1 << (ino % CHAR_BIT);
+
+	size_t lo = 0, hi = fs->num_dir_crcs;
+	while (lo < hi) {
+		size_t mid = lo + (hi - lo) / 2;
+		if (fs->dir_crcs[mid].ino < ino) lo = mid + 1; else hi = mid;
+	}
+	// Directories created since mount have no checksum
+	if ((lo == fs->num_dir_crcs) || (fs->dir_crcs[lo].ino != ino)) return;
+
+	const a1fs_superblock *sb = (const a1fs_superblock*)fs->image;
+	const a1fs_inode *table = fs->image + sb->inode_table * A1FS_BLOCK_SIZE;
+	if (dir_checksum(fs, &table[ino]) != fs->dir_crcs[lo].crc) {
+		fprintf(stderr, "Checksum mismatch in directory inode %u; run fsck.a1fs\n", ino);
+		stats_count(&fs->stats, A1FS_STAT_CHECKSUM_ERRORS, 1);
+	}
+}
+
+void fs_forget_dir(fs_ctx *fs, a1fs_ino_t ino)
+{
+	if (fs->dir_verified == NULL) return;
+	fs->dir_verified[ino / CHAR_BIT] |= 1 << (ino % CHAR_BIT);
+}
@@ -1,62 +1,381 @@
-/*
- * This code is provided solely for the personal and private use of students
- * taking the CSC369H course at the University of Toronto. Copying for purposes
- * other than this use is expressly prohibited. All forms of distribution of
- * this code, including but not limited to public repositories on GitHub,
- * GitLab, Bitbucket, or any other online platform, whether as given or with
- * any changes, are expressly prohibited.
- *
- * Authors: Alexey Khrabrov, Karen Reid
- *
- * All of the files in this directory and all subdirectories are:
- * Copyright (c) 2019 Karen Reid
- */
-
-/**
- * CSC369 Assignment 1 - File system runtime context header file.
- */
-
-#pragma once
-
-#include <stddef.h>
-
-#include "options.h"
-#include "a1fs.h"
-
-
-/**
- * Mounted file system runtime state - "fs context".
- */
-typedef struct fs_ctx {
-	/** Pointer to the start of the image. */
-	void *image;
-	/** Image size in bytes. */
-	size_t size;
-	/** Command line options. */
-	a1fs_opts *opts;
-	/** Stores the current working directory */
-	int current_inode_offset;
-	/** Stores the number of inodes */
-	int n_inodes;
-
-	//TODO
-
-} fs_ctx;
-
-/**
- * Initialize file system context.
- *
- * @param fs     pointer to the context to initialize.
- * @param image  pointer to the start of the image.
- * @param size   image size in bytes.
- * @param opts   command line options.
- * @return       true on success; false on failure (e.g. invalid superblock).
- */
-bool fs_ctx_init(fs_ctx *fs, void *image, size_t size, a1fs_opts *opts);
-
-/**
- * Destroy file system context.
- *
- * Must cleanup all the resources created in fs_ctx_init().
- */
-void fs_ctx_destroy(fs_ctx *fs);
+/*
+ * This code is provided solely for the personal and private use of students
+ * taking the CSC369H course at the University of Toronto. Copying for purposes
+ * other than this use is expressly prohibited. All forms of distribution of
+ * this code, including but not limited to public repositories on GitHub,
+ * GitLab, Bitbucket, or any other online platform, whether as given or with
+ * any changes, are expressly prohibited.
+ *
+ * Authors: Alexey Khrabrov, Karen Reid
+ *
+ * All of the files in this directory and all subdirectories are:
+ * Copyright (c) 2019 Karen Reid
+ */
+
+/**
+ * CSC369 Assignment 1 - File system runtime context header file.
+ */
+
+#pragma once
+
+#include <stddef.h>
+#include <sys/types.h>
+
+#include "options.h"
+#include "a1fs.h"
+#include "stats.h"
+#include "trace.h"
+#include "uring.h"
+
+
+/** Number of decompressed clusters kept in the cluster cache. */
+#define A1FS_CLUSTER_CACHE_SIZE 8
+
+/** Cluster cache entry - decompressed contents of a compressed file cluster. */
+typedef struct cluster_cache_entry {
+	/** Whether the entry holds a cluster. */
+	bool valid;
+	/** Inode number of the file. */
+	a1fs_ino_t ino;
+	/** Cluster index within the file. */
+	uint64_t index;
+	/** Value of the cache clock at the last access, for LRU eviction. */
+	uint64_t last_use;
+	/** A1FS_CLUSTER_SIZE bytes of decompressed data. */
+	unsigned char *data;
+
+} cluster_cache_entry;
+
+/** Shared xattr block index slot. */
+typedef struct xattr_share {
+	/** Hash of the block contents; 0 for an empty slot. */
+	uint64_t hash;
+	/** Xattr block number. */
+	a1fs_blk_t blk;
+
+} xattr_share;
+
+/**
+ * Number of slots in the table of pending modification times (a power of 2).
+ * At most half of them are used.
+ */
+#define A1FS_LAZY_MTIME_SLOTS 512
+
+/** Modification time of an inode not written to the inode table yet. */
+typedef struct lazy_mtime {
+	/** Whether the slot is in use. */
+	bool used;
+	/** Inode number. */
+	a1fs_ino_t ino;
+	/** The modification time. */
+	struct timespec mtime;
+
+} lazy_mtime;
+
+/** Number of free inode numbers or free block runs gathered by a bitmap scan. */
+#define A1FS_ALLOC_BATCH 64
+
+/** Run of free data blocks found by a bitmap scan. */
+typedef struct free_run {
+	/** First block of the run. */
+	a1fs_blk_t start;
+	/** Number of blocks in the run. */
+	a1fs_blk_t count;
+
+} free_run;
+
+/** Number of tail blocks with free space that new tails are packed into. */
+#define A1FS_TAIL_OPEN_BLOCKS 8
+
+
+/**
+ * Mounted file system runtime state - "fs context".
+ */
+typedef struct fs_ctx {
+	/** Pointer to the start of the image. */
+	void *image;
+	/** Image size in bytes. */
+	size_t size;
+	/** Command line options. */
+	a1fs_opts *opts;
+	/** Stores the current working directory */
+	int current_inode_offset;
+	/** Stores the number of inodes */
+	int n_inodes;
+
+	/** Decompressed cluster cache for compressed files. */
+	cluster_cache_entry cluster_cache[A1FS_CLUSTER_CACHE_SIZE];
+	/** Cluster cache access counter. */
+	uint64_t cluster_cache_clock;
+	/** Scratch buffer for compressing a cluster. */
+	unsigned char *compress_buf;
+
+	/** Operation latency and block I/O statistics. */
+	a1fs_stats stats;
+
+	/**
+	 * Bitmap of inodes whose data was modified bypassing the kernel page
+	 * cache; their cached pages must not be kept on the next open.
+	 */
+	unsigned char *cache_stale;
+
+	/**
+	 * Index of the xattr blocks by the hash of their contents, so that inodes
+	 * with the same extended attributes share one block. Open addressing hash
+	 * table with linear probing, built when the file system is mounted.
+	 */
+	xattr_share *xattr_shares;
+	/** Number of slots in the xattr block index (a power of 2). */
+	size_t xattr_shares_size;
+	/** Number of used slots in the xattr block index. */
+	size_t xattr_shares_used;
+
+	/**
+	 * io_uring for file data I/O with --io_uring; set up on first use, in the
+	 * process that serves the requests. NULL if not set up yet.
+	 */
+	uring *ring;
+	/** Whether setting up the io_uring failed; the mapping is used instead. */
+	bool ring_failed;
+
+	/**
+	 * Whether the file system was unmounted cleanly before this mount, so the
+	 * indexes were loaded from the checkpoint and there are no orphans.
+	 */
+	bool was_clean;
+	/**
+	 * Whether fs_ctx_destroy() writes a checkpoint and marks the file system
+	 * clean. Set by fs_ctx_init(); tools that move blocks without updating the
+	 * indexes clear it, so that the indexes are rebuilt at the next mount.
+	 */
+	bool checkpoint;
+
+	/**
+	 * Modification times not written to the inode table yet with --lazytime
+	 * (see inode_touch()). Open addressing hash table keyed by inode number,
+	 * with linear probing; NULL without --lazytime.
+	 */
+	lazy_mtime *lazy_mtimes;
+	/** Number of used slots in the table of pending modification times. */
+	size_t lazy_mtimes_used;
+	/** stats_now() time when the oldest pending modification time was set. */
+	uint64_t lazy_mtimes_since;
+
+	/**
+	 * Checksums of the bitmap and inode table blocks loaded from the
+	 * checkpoint (see a1fs_checkpoint); NULL if there were none. The bitmaps
+	 * are verified at mount, and each inode table block when it is first
+	 * accessed (see fs_verify_inode()).
+	 */
+	uint32_t *block_crcs;
+	/** Bitmap of the inode table blocks already verified. */
+	unsigned char *table_verified;
+	/** Directory checksums loaded from the checkpoint, sorted by inode number. */
+	a1fs_checkpoint_dir *dir_crcs;
+	/** Number of loaded directory checksums. */
+	size_t num_dir_crcs;
+	/**
+	 * Bitmap of the inodes whose directory checksum is already verified or no
+	 * longer applies (see fs_verify_dir()).
+	 */
+	unsigned char *dir_verified;
+
+	/**
+	 * Recorder of the FUSE callbacks with --trace; NULL without it. Opened by
+	 * the FUSE front ends after a1fs_init() and closed in a1fs_destroy().
+	 */
+	a1fs_trace *trace;
+
+	/**
+	 * Credentials of the caller of the current operation, recorded by the front
+	 * end before it calls into fs_ops.c: the owner of new inodes and the
+	 * permission checks of the ioctls use the user ID, and the trace the
+	 * process ID.
+	 */
+	uid_t caller_uid;
+	pid_t caller_pid;
+
+	/**
+	 * Free inode numbers and runs of free data blocks found by the last
+	 * bitmap scans, so that inode_alloc() and block_alloc() don't scan the
+	 * bitmaps from the start every time. Each scan gathers a batch of up to
+	 * A1FS_ALLOC_BATCH entries and resumes where the previous one stopped.
+	 * The entries are only hints: nothing is marked in the bitmaps until an
+	 * entry is handed out, and each one is checked against the bitmap then.
+	 */
+	a1fs_ino_t free_inodes[A1FS_ALLOC_BATCH];
+	/** Index of the next entry to hand out in free_inodes. */
+	size_t free_inodes_next;
+	/** Number of entries in free_inodes. */
+	size_t free_inodes_count;
+	/** Inode number where the next scan of the inode bitmap starts. */
+	a1fs_ino_t inode_scan_pos;
+	/** Free block runs, like free_inodes. */
+	free_run free_runs[A1FS_ALLOC_BATCH];
+	/** Index of the next run to allocate from in free_runs. */
+	size_t free_runs_next;
+	/** Number of entries in free_runs. */
+	size_t free_runs_count;
+	/** Block number where the next scan of the data bitmap starts. */
+	a1fs_blk_t block_scan_pos;
+
+	/**
+	 * Tail blocks with free space that new tails are packed into (see
+	 * tail_alloc()); 0 for an unused slot. A block joins when it is allocated
+	 * or when a tail in it is freed, and leaves when it is freed or replaced by
+	 * a block with more free space. Not saved: tails packed before the mount
+	 * only share their blocks with new ones once some of them are freed.
+	 */
+	a1fs_blk_t tail_blocks[A1FS_TAIL_OPEN_BLOCKS];
+
+	//TODO
+
+} fs_ctx;
+
+/**
+ * Initialize file system context.
+ *
+ * The in-memory indexes are loaded from the checkpoint if the file system was
+ * unmounted cleanly, and rebuilt by scanning the image otherwise. The clean
+ * flag is then cleared and the checkpoint blocks freed until fs_ctx_destroy().
+ * If the checkpoint has checksums, the superblock and the bitmaps are
+ * verified here, and the rest of the metadata on first access.
+ *
+ * @param fs     pointer to the context to initialize.
+ * @param image  pointer to the start of the image.
+ * @param size   image size in bytes.
+ * @param opts   command line options.
+ * @return       true on success; false on failure (e.g. invalid superblock, a
+ *               checksum mismatch, or no io_uring with --io_uring).
+ */
+bool fs_ctx_init(fs_ctx *fs, void *image, size_t size, a1fs_opts *opts);
+
+/**
+ * Destroy file system context.
+ *
+ * Must cleanup all the resources created in fs_ctx_init(). Writes the pending
+ * modification times and a checkpoint of the indexes and marks the file system
+ * clean, so the image must still be mapped. If there is no room for the checkpoint, the indexes are rebuilt at
+ * the next mount instead.
+ */
+void fs_ctx_destroy(fs_ctx *fs);
+
+/**
+ * Grow the file system to a larger image size.
+ *
+ * Extends the image file, remaps it (the mapping may move, so pointers into
+ * the old one must not be used afterwards), and adds the new data blocks as
+ * free blocks. The superblock is updated in one piece once the new blocks are
+ * ready.
+ *
+ * Errors:
+ *   EFBIG   the metadata has no room for that many data blocks (see
+ *           a1fs_superblock.max_blocks).
+ *   EINVAL  the size is not larger than the current one or not a multiple of
+ *           the block size.
+ *   other   errors of open(), ftruncate() and mremap().
+ *
+ * @param fs    file system context; opts->img_path must be set.
+ * @param size  new image size in bytes.
+ * @return      0 on success; -errno on error.
+ */
+int fs_ctx_grow(fs_ctx *fs, size_t size);
+
+/**
+ * Get the io_uring for file data I/O, setting it up on first use.
+ *
+ * fs_ctx_init() fails if --io_uring is set and a ring can't be set up, so the
+ * fallback to the mapping here only covers errors after the mount (such as
+ * running out of memory).
+ *
+ * @return  the ring; NULL if --io_uring is not set or the ring can't be set up
+ *          (reported on stderr once).
+ */
+uring *fs_uring(fs_ctx *fs);
+
+/**
+ * Look up a cluster in the cluster cache.
+ *
+ * @return  pointer to the decompressed cluster data; NULL if not cached.
+ */
+unsigned char *fs_cluster_cache_find(fs_ctx *fs, a1fs_ino_t ino, uint64_t index);
+
+/**
+ * Add a cluster to the cluster cache, evicting the least recently used one.
+ *
+ * @return  pointer to the buffer that the caller must fill with the
+ *          decompressed cluster data; NULL if out of memory.
+ */
+unsigned char *fs_cluster_cache_add(fs_ctx *fs, a1fs_ino_t ino, uint64_t index);
+
+/** Drop all the cached clusters of a file starting from given index. */
+void fs_cluster_cache_drop(fs_ctx *fs, a1fs_ino_t ino, uint64_t from_index);
+
+/**
+ * Find an xattr block with given contents.
+ *
+ * @param fs    file system context.
+ * @param hash  hash of the contents (see dedup_hash()).
+ * @param data  A1FS_BLOCK_SIZE bytes of contents.
+ * @param blk   pointer to the variable that receives the block number.
+ * @return      true if found; false otherwise.
+ */
+bool fs_xattr_share_find(fs_ctx *fs, uint64_t hash, const void *data,
+                         a1fs_blk_t *blk);
+
+/**
+ * Add an xattr block to the index.
+ *
+ * @return  true on success; false if out of memory (the block is then not
+ *          shared with other inodes).
+ */
+bool fs_xattr_share_add(fs_ctx *fs, uint64_t hash, a1fs_blk_t blk);
+
+/** Remove an xattr block from the index (before it is freed). */
+void fs_xattr_share_remove(fs_ctx *fs, uint64_t hash, a1fs_blk_t blk);
+
+/**
+ * Find the pending modification time of an inode.
+ *
+ * @return  pointer to the time; NULL if there is none (or no --lazytime).
+ */
+const struct timespec *fs_lazy_mtime_find(fs_ctx *fs, a1fs_ino_t ino);
+
+/**
+ * Set the pending modification time of an inode.
+ *
+ * @return  true on success; false if the table is full (the pending times
+ *          must be written back first).
+ */
+bool fs_lazy_mtime_set(fs_ctx *fs, a1fs_ino_t ino, const struct timespec *mtime);
+
+/**
+ * Remove the pending modification time of an inode.
+ *
+ * @param fs     file system context.
+ * @param ino    inode number.
+ * @param mtime  pointer to the variable that receives the time; may be NULL.
+ * @return       true if the inode had a pending time; false otherwise.
+ */
+bool fs_lazy_mtime_take(fs_ctx *fs, a1fs_ino_t ino, struct timespec *mtime);
+
+/** Write all the pending modification times to the inode table. */
+void fs_lazy_mtime_flush(fs_ctx *fs);
+
+/**
+ * Verify the checksum of the inode table block that holds an inode, if it was
+ * loaded from the checkpoint and the block is accessed for the first time
+ * since mount. A mismatch is reported on stderr and counted in the stats.
+ */
+void fs_verify_inode(fs_ctx *fs, a1fs_ino_t ino);
+
+/**
+ * Verify the checksum of a directory, if it was loaded from the checkpoint
+ * and the directory is accessed for the first time since mount. Must be
+ * called before the directory is modified. A mismatch is reported on stderr
+ * and counted in the stats.
+ */
+void fs_verify_dir(fs_ctx *fs, a1fs_ino_t ino);
+
+/** Drop the loaded checksum of a directory (when its inode is freed). */
+void fs_forget_dir(fs_ctx *fs, a1fs_ino_t ino);
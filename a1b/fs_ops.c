@@ -0,0 +1,3137 @@
+/*
+ * This code is provided solely for the personal and private use of students
+ * taking the CSC369H course at the University of Toronto. Copying for purposes
+ * other than this use is expressly prohibited. All forms of distribution of
+ * this code, including but not limited to public repositories on GitHub,
+ * GitLab, Bitbucket, or any other online platform, whether as given or with
+ * any changes, are expressly prohibited.
+ *
+ * Authors: Alexey Khrabrov, Karen Reid
+ *
+ * All of the files in this directory and all subdirectories are:
+ * Copyright (c) 2019 Karen Reid
+ */
+
+/**
+ * CSC369 Assignment 1 - a1fs inode-based operations implementation.
+ */
+
+// For O_DIRECT
+#define _GNU_SOURCE
+
+#include <errno.h>
+#include <fcntl.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/mman.h>
+#include <sys/xattr.h>
+#include <unistd.h>
+
+#include "dedup_index.h"
+#include "fs_ops.h"
+#include "lz4.h"
+#include "map.h"
+
+
+bool a1fs_init(fs_ctx *fs, a1fs_opts *opts)
+{
+	// Nothing to initialize if only printing help or version
+	if (opts->help || opts->version) return true;
+
+#ifndef FUSE_CAP_WRITEBACK_CACHE
+	if (opts->writeback_cache) {
+		fprintf(stderr, "This FUSE library does not support the writeback cache\n");
+		return false;
+	}
+#endif
+
+	size_t size;
+	map_opts m_opts = { .hugepages = opts->hugepages,
+	                    .numa_interleave = opts->numa_interleave };
+	void *image = map_file_opts(opts->img_path, A1FS_BLOCK_SIZE, &size, &m_opts);
+	if (!image) return false;
+
+	return fs_ctx_init(fs, image, size, opts);
+}
+
+void a1fs_destroy(void *ctx)
+{
+	fs_ctx *fs = (fs_ctx*)ctx;
+	if (fs->image) {
+		// Writes the pending times and the checkpoint, so it comes before the sync
+		fs_ctx_destroy(fs);
+		if (fs->opts->sync && (msync(fs->image, fs->size, MS_SYNC) < 0)) {
+			perror("msync");
+		}
+		munmap(fs->image, fs->size);
+	}
+	if (fs->trace != NULL) {
+		trace_close(fs->trace);
+		fs->trace = NULL;
+	}
+}
+
+
+void fs_conn_init(fs_ctx *fs, struct fuse_conn_info *conn)
+{
+	// A1FS_IOC_RESIZE is called on the mount point
+	conn->want |= (FUSE_CAP_BIG_WRITES | FUSE_CAP_IOCTL_DIR) & conn->capable;
+#ifdef FUSE_CAP_WRITEBACK_CACHE
+	if (fs->opts->writeback_cache) {
+		if (conn->capable & FUSE_CAP_WRITEBACK_CACHE) {
+			conn->want |= FUSE_CAP_WRITEBACK_CACHE;
+		} else {
+			fprintf(stderr, "The kernel does not support the writeback cache\n");
+		}
+	}
+#else
+	(void)fs;// unused
+#endif
+}
+
+a1fs_superblock *get_sb(fs_ctx *fs)
+{
+	return (a1fs_superblock*)fs->image;
+}
+
+a1fs_inode *get_inode(fs_ctx *fs, a1fs_ino_t ino)
+{
+	if (fs->block_crcs != NULL) fs_verify_inode(fs, ino);
+	return (a1fs_inode*)(fs->image + get_sb(fs)->inode_table * A1FS_BLOCK_SIZE)
+	       + ino;
+}
+
+void *get_block(fs_ctx *fs, a1fs_blk_t blk)
+{
+	return fs->image + (size_t)(get_sb(fs)->data_table + blk) * A1FS_BLOCK_SIZE;
+}
+
+/** Get a pointer to the reference count of a data block. */
+static a1fs_refcount_t *get_refcount(fs_ctx *fs, a1fs_blk_t blk)
+{
+	return (a1fs_refcount_t*)(fs->image + get_sb(fs)->refcount_table * A1FS_BLOCK_SIZE)
+	       + blk;
+}
+
+void inode_stamp(fs_ctx *fs, a1fs_inode *inode)
+{
+	inode->generation = get_sb(fs)->generation;
+}
+
+/**
+ * Get the number of an inode from its pointer.
+ *
+ * @return  true on success; false if the inode is not in the inode table (but
+ *          in a snapshot).
+ */
+static bool inode_number(fs_ctx *fs, const a1fs_inode *inode, a1fs_ino_t *ino)
+{
+	const a1fs_inode *table = get_inode(fs, 0);
+	if ((inode < table) || (inode >= table + get_sb(fs)->num_inodes)) return false;
+	*ino = inode - table;
+	return true;
+}
+
+/** Write the pending modification time of an inode to the inode table. */
+static void lazytime_writeback(fs_ctx *fs, a1fs_inode *inode)
+{
+	a1fs_ino_t ino;
+	struct timespec mtime;
+	if (inode_number(fs, inode, &ino) && fs_lazy_mtime_take(fs, ino, &mtime)) {
+		inode->mtime = mtime;
+		stats_count(&fs->stats, A1FS_STAT_MTIME_WRITTEN, 1);
+	}
+}
+
+/** Get the modification time of an inode, including a pending one. */
+static struct timespec inode_mtime(fs_ctx *fs, const a1fs_inode *inode)
+{
+	a1fs_ino_t ino;
+	const struct timespec *mtime = NULL;
+	if (inode_number(fs, inode, &ino)) mtime = fs_lazy_mtime_find(fs, ino);
+	return (mtime != NULL) ? *mtime : inode->mtime;
+}
+
+void inode_touch(fs_ctx *fs, a1fs_inode *inode)
+{
+	struct timespec now;
+	clock_gettime(CLOCK_REALTIME, &now);
+	a1fs_ino_t ino;
+	if ((fs->lazy_mtimes == NULL) || !inode_number(fs, inode, &ino)) {
+		inode->mtime = now;
+		inode_stamp(fs, inode);
+		return;
+	}
+
+	if ((fs->lazy_mtimes_used != 0) &&
+	    (stats_now() - fs->lazy_mtimes_since >= fs->opts->lazytime * 1000000000ul))
+	{
+		fs_lazy_mtime_flush(fs);
+	}
+	if (!fs_lazy_mtime_set(fs, ino, &now)) {
+		fs_lazy_mtime_flush(fs);
+		fs_lazy_mtime_set(fs, ino, &now);
+	}
+	stats_count(&fs->stats, A1FS_STAT_MTIME_DEFERRED, 1);
+	// Stored only when it changes, so that the page is not dirtied
+	if (inode->generation != get_sb(fs)->generation) inode_stamp(fs, inode);
+}
+
+uint64_t size_to_blocks(uint64_t size)
+{
+	return (size + A1FS_BLOCK_SIZE - 1) / A1FS_BLOCK_SIZE;
+}
+
+
+bool bitmap_test(const uint8_t *bmp, uint32_t i)
+{
+	return (bmp[i / 8] >> (i % 8)) & 1;
+}
+
+void bitmap_set(uint8_t *bmp, uint32_t i, bool value)
+{
+	if (value) {
+		bmp[i / 8] |= 1 << (i % 8);
+	} else {
+		bmp[i / 8] &= ~(1 << (i % 8));
+	}
+}
+
+
+/** Get the quota table. Only valid if there are quotas. */
+static a1fs_quota *quota_table(fs_ctx *fs)
+{
+	return get_block(fs, get_sb(fs)->quota_table);
+}
+
+/**
+ * Get the user and the directory quota of an inode.
+ *
+ * @param fs      file system context.
+ * @param inode   the inode.
+ * @param quotas  array that receives the quotas; NULL entries for none.
+ */
+static void inode_quotas(fs_ctx *fs, const a1fs_inode *inode, a1fs_quota *quotas[2])
+{
+	quotas[0] = (inode->user_quota != 0) ? &quota_table(fs)[inode->user_quota - 1] : NULL;
+	quotas[1] = (inode->dir_quota != 0) ? &quota_table(fs)[inode->dir_quota - 1] : NULL;
+}
+
+/**
+ * Get the number of data blocks, up to count, that the quotas of an inode
+ * allow it to take.
+ */
+static uint64_t quota_room(fs_ctx *fs, const a1fs_inode *inode, uint64_t count)
+{
+	a1fs_quota *quotas[2];
+	inode_quotas(fs, inode, quotas);
+	for (int i = 0; i < 2; i++) {
+		const a1fs_quota *q = quotas[i];
+		if ((q == NULL) || (q->block_limit == 0)) continue;
+		uint64_t room = (q->blocks < q->block_limit) ? q->block_limit - q->blocks : 0;
+		if (room < count) count = room;
+	}
+	return count;
+}
+
+/**
+ * Charge data blocks and inodes to the quotas of an inode. Negative counts
+ * release them.
+ */
+static void quota_charge(fs_ctx *fs, const a1fs_inode *inode, int64_t blocks,
+                         int64_t inodes)
+{
+	a1fs_quota *quotas[2];
+	inode_quotas(fs, inode, quotas);
+	for (int i = 0; i < 2; i++) {
+		if (quotas[i] == NULL) continue;
+		quotas[i]->blocks += blocks;
+		quotas[i]->inodes += inodes;
+	}
+}
+
+
+/**
+ * Refill the cache of free inode numbers (see fs_ctx.free_inodes) with one scan
+ * of the inode bitmap, starting where the previous scan stopped. The scan stops
+ * after a batch of free inodes or a full pass over the bitmap.
+ */
+static void inode_cache_refill(fs_ctx *fs)
+{
+	a1fs_superblock *sb = get_sb(fs);
+	const uint8_t *bmp = fs->image + sb->inode_bmp * A1FS_BLOCK_SIZE;
+	a1fs_ino_t i = (fs->inode_scan_pos < sb->num_inodes) ? fs->inode_scan_pos : 0;
+	size_t n = 0;
+
+	for (a1fs_ino_t seen = 0; (seen < sb->num_inodes) && (n < A1FS_ALLOC_BATCH);) {
+		// Skip whole bytes of used inodes at once
+		if ((i % 8 == 0) && (i + 8 <= sb->num_inodes) && (bmp[i / 8] == 0xff)) {
+			i += 8;
+			seen += 8;
+		} else {
+			if (!bitmap_test(bmp, i)) fs->free_inodes[n++] = i;
+			i++;
+			seen++;
+		}
+		if (i == sb->num_inodes) i = 0;
+	}
+	fs->inode_scan_pos = i;
+	fs->free_inodes_next = 0;
+	fs->free_inodes_count = n;
+}
+
+int inode_alloc(fs_ctx *fs, a1fs_ino_t *ino)
+{
+	a1fs_superblock *sb = get_sb(fs);
+	uint8_t *bmp = fs->image + sb->inode_bmp * A1FS_BLOCK_SIZE;
+	if (sb->num_unused_inodes == 0) return -ENOSPC;
+
+	for (;;) {
+		if (fs->free_inodes_next == fs->free_inodes_count) {
+			inode_cache_refill(fs);
+			if (fs->free_inodes_count == 0) return -ENOSPC;
+		}
+		a1fs_ino_t i = fs->free_inodes[fs->free_inodes_next++];
+		// Skip numbers taken since the scan (e.g. by receive.a1fs)
+		if ((i >= sb->num_inodes) || bitmap_test(bmp, i)) continue;
+
+		bitmap_set(bmp, i, true);
+		sb->num_unused_inodes--;
+		memset(get_inode(fs, i), 0, sizeof(a1fs_inode));
+		*ino = i;
+		return 0;
+	}
+}
+
+void inode_free(fs_ctx *fs, a1fs_ino_t ino)
+{
+	a1fs_superblock *sb = get_sb(fs);
+	uint8_t *bmp = fs->image + sb->inode_bmp * A1FS_BLOCK_SIZE;
+	assert(bitmap_test(bmp, ino));
+	quota_charge(fs, get_inode(fs, ino), 0, -1);
+	fs_lazy_mtime_take(fs, ino, NULL);
+	// The number may be reused for a new directory
+	fs_forget_dir(fs, ino);
+	bitmap_set(bmp, ino, false);
+	sb->num_unused_inodes++;
+	// Hand the number out next, while its inode table block is likely cached
+	if (fs->free_inodes_next > 0) fs->free_inodes[--fs->free_inodes_next] = ino;
+}
+
+/**
+ * Refill the cache of free block runs (see fs_ctx.free_runs) with one scan of
+ * the data bitmap, starting where the previous scan stopped. The scan stops
+ * after a batch of runs or a full pass over the bitmap. Runs don't wrap around
+ * the end of the data table.
+ */
+static void block_cache_refill(fs_ctx *fs)
+{
+	a1fs_superblock *sb = get_sb(fs);
+	const uint8_t *bmp = fs->image + sb->datablock_bmp * A1FS_BLOCK_SIZE;
+	a1fs_blk_t i = (fs->block_scan_pos < sb->num_blocks) ? fs->block_scan_pos : 0;
+	size_t n = 0;
+
+	for (a1fs_blk_t seen = 0; (seen < sb->num_blocks) && (n < A1FS_ALLOC_BATCH);) {
+		if (!bitmap_test(bmp, i)) {
+			free_run *run = &fs->free_runs[n++];
+			run->start = i;
+			run->count = 0;
+			while ((i < sb->num_blocks) && (seen < sb->num_blocks) &&
+			       !bitmap_test(bmp, i))
+			{
+				// Take whole bytes of free blocks at once
+				a1fs_blk_t step = ((i % 8 == 0) && (i + 8 <= sb->num_blocks) &&
+				                   (seen + 8 <= sb->num_blocks) && (bmp[i / 8] == 0))
+				                  ? 8 : 1;
+				run->count += step;
+				i += step;
+				seen += step;
+			}
+		} else if ((i % 8 == 0) && (i + 8 <= sb->num_blocks) && (bmp[i / 8] == 0xff)) {
+			// Skip whole bytes of used blocks at once
+			i += 8;
+			seen += 8;
+		} else {
+			i++;
+			seen++;
+		}
+		if (i == sb->num_blocks) i = 0;
+	}
+	fs->block_scan_pos = i;
+	fs->free_runs_next = 0;
+	fs->free_runs_count = n;
+}
+
+/**
+ * Allocate a run of contiguous data blocks.
+ *
+ * The run starts at goal if that block is free, and at the next free run found
+ * by a scan of the data bitmap otherwise (see block_cache_refill()); it is at
+ * most count blocks long. Passing the block that follows the previous extent
+ * of a file as the goal keeps files contiguous.
+ *
+ * @param fs     file system context.
+ * @param goal   preferred first block; 0 for no preference.
+ * @param count  maximum number of blocks to allocate.
+ * @param ext    pointer to the extent that receives the allocated run.
+ * @return       0 on success; -ENOSPC if there are no free blocks.
+ */
+static int block_alloc(fs_ctx *fs, a1fs_blk_t goal, a1fs_blk_t count,
+                       a1fs_extent *ext)
+{
+	a1fs_superblock *sb = get_sb(fs);
+	uint8_t *bmp = fs->image + sb->datablock_bmp * A1FS_BLOCK_SIZE;
+	if ((sb->num_unused_blocks == 0) || (count == 0)) return -ENOSPC;
+
+	a1fs_blk_t start = goal;
+	free_run *run = NULL;
+	if ((goal == 0) || (goal >= sb->num_blocks) || bitmap_test(bmp, goal)) {
+		for (;;) {
+			if (fs->free_runs_next == fs->free_runs_count) {
+				block_cache_refill(fs);
+				if (fs->free_runs_count == 0) return -ENOSPC;
+			}
+			run = &fs->free_runs[fs->free_runs_next];
+			// Skip runs used up or taken since the scan
+			if ((run->count != 0) && (run->start < sb->num_blocks) &&
+			    !bitmap_test(bmp, run->start))
+			{
+				break;
+			}
+			fs->free_runs_next++;
+		}
+		start = run->start;
+	}
+
+	a1fs_blk_t len = 0;
+	while ((len < count) && (start + len < sb->num_blocks) &&
+	       !bitmap_test(bmp, start + len))
+	{
+		bitmap_set(bmp, start + len, true);
+		*get_refcount(fs, start + len) = 1;
+		len++;
+	}
+	if (run != NULL) {
+		// The rest of the run, if any, is checked again when it is used
+		run->start += len;
+		run->count = (len < run->count) ? run->count - len : 0;
+	}
+	sb->num_unused_blocks -= len;
+	stats_count(&fs->stats, A1FS_STAT_BLOCKS_ALLOCATED, len);
+	ext->start = start;
+	ext->count = len;
+	return 0;
+}
+
+/**
+ * Allocate exactly count contiguous data blocks.
+ *
+ * @param fs     file system context.
+ * @param goal   preferred first block.
+ * @param count  number of blocks to allocate.
+ * @param ext    pointer to the extent that receives the allocated run.
+ * @return       0 on success; -ENOSPC if there is no free run that long.
+ */
+static int block_alloc_contig(fs_ctx *fs, a1fs_blk_t goal, a1fs_blk_t count,
+                              a1fs_extent *ext)
+{
+	a1fs_superblock *sb = get_sb(fs);
+	uint8_t *bmp = fs->image + sb->datablock_bmp * A1FS_BLOCK_SIZE;
+	if ((sb->num_unused_blocks < count) || (count == 0)) return -ENOSPC;
+	if (goal >= sb->num_blocks) goal = 0;
+
+	// Search from goal to the end, then from the start up to goal
+	for (int pass = 0; pass < 2; pass++) {
+		a1fs_blk_t from = (pass == 0) ? goal : 0;
+		a1fs_blk_t to = (pass == 0) ? sb->num_blocks : goal;
+		a1fs_blk_t run = 0;
+		for (a1fs_blk_t i = from; i < to; i++) {
+			run = bitmap_test(bmp, i) ? 0 : run + 1;
+			if (run < count) continue;
+
+			ext->start = i - count + 1;
+			ext->count = count;
+			for (a1fs_blk_t b = ext->start; b <= i; b++) {
+				bitmap_set(bmp, b, true);
+				*get_refcount(fs, b) = 1;
+			}
+			sb->num_unused_blocks -= count;
+			stats_count(&fs->stats, A1FS_STAT_BLOCKS_ALLOCATED, count);
+			return 0;
+		}
+	}
+	return -ENOSPC;
+}
+
+/** Take an extra reference to a run of contiguous data blocks. */
+static void block_get(fs_ctx *fs, a1fs_blk_t start, a1fs_blk_t count)
+{
+	for (a1fs_blk_t i = start; i < start + count; i++) {
+		assert(*get_refcount(fs, i) > 0);
+		(*get_refcount(fs, i))++;
+	}
+}
+
+/**
+ * Drop a reference to a run of contiguous data blocks. Blocks that are no
+ * longer shared with any file are freed.
+ */
+static void block_put(fs_ctx *fs, a1fs_blk_t start, a1fs_blk_t count)
+{
+	a1fs_superblock *sb = get_sb(fs);
+	uint8_t *bmp = fs->image + sb->datablock_bmp * A1FS_BLOCK_SIZE;
+	for (a1fs_blk_t i = start; i < start + count; i++) {
+		assert(bitmap_test(bmp, i) && (*get_refcount(fs, i) > 0));
+		if (--(*get_refcount(fs, i)) == 0) {
+			if (dedup_index_enabled(fs)) dedup_index_forget(fs, i);
+			bitmap_set(bmp, i, false);
+			sb->num_unused_blocks++;
+			stats_count(&fs->stats, A1FS_STAT_BLOCKS_FREED, 1);
+		}
+	}
+}
+
+
+/** Number of extents in use in an inode. */
+static int extent_count(const a1fs_inode *inode)
+{
+	int n = 0;
+	while ((n < A1FS_INODE_EXTENTS) && (inode->extent_array[n].count != 0)) n++;
+	return n;
+}
+
+/** Number of data blocks mapped by the extents of an inode. */
+static uint64_t extent_blocks(const a1fs_inode *inode)
+{
+	uint64_t blocks = 0;
+	for (int i = 0; i < extent_count(inode); i++) {
+		blocks += inode->extent_array[i].count;
+	}
+	return blocks;
+}
+
+bool inode_compressed(const a1fs_inode *inode)
+{
+	return (inode->flags & A1FS_INODE_COMPRESSED) != 0;
+}
+
+bool extent_map(const a1fs_inode *inode, a1fs_blk_t lblk,
+                a1fs_blk_t *pblk, a1fs_blk_t *len)
+{
+	for (int i = 0; i < extent_count(inode); i++) {
+		const a1fs_extent *ext = &inode->extent_array[i];
+		if (lblk < ext->lblk) {
+			*len = ext->lblk - lblk;
+			return false;
+		}
+		if (lblk - ext->lblk < ext->count) {
+			*pblk = ext->start + (lblk - ext->lblk);
+			*len = ext->count - (lblk - ext->lblk);
+			return true;
+		}
+	}
+	*len = 0;
+	return false;
+}
+
+/** Remove the extent in slot i, shifting the following ones down. */
+static void extent_remove(a1fs_inode *inode, int i)
+{
+	int n = extent_count(inode);
+	memmove(&inode->extent_array[i], &inode->extent_array[i + 1],
+	        (n - i - 1) * sizeof(a1fs_extent));
+	memset(&inode->extent_array[n - 1], 0, sizeof(a1fs_extent));
+}
+
+/**
+ * Insert an extent covering a hole, merging it with its neighbours when they
+ * are contiguous both in the file and in the data table.
+ *
+ * @return  0 on success; -ENOSPC if the inode has no free extent slots.
+ */
+static int extent_insert(a1fs_inode *inode, const a1fs_extent *ext)
+{
+	int n = extent_count(inode);
+	int i = 0;
+	while ((i < n) && (inode->extent_array[i].lblk < ext->lblk)) i++;
+
+	a1fs_extent *prev = (i > 0) ? &inode->extent_array[i - 1] : NULL;
+	a1fs_extent *next = (i < n) ? &inode->extent_array[i] : NULL;
+	bool merge_prev = prev && (prev->lblk + prev->count == ext->lblk) &&
+	                  (prev->start + prev->count == ext->start);
+	bool merge_next = next && (ext->lblk + ext->count == next->lblk) &&
+	                  (ext->start + ext->count == next->start);
+
+	if (merge_prev && merge_next) {
+		prev->count += ext->count + next->count;
+		extent_remove(inode, i);
+	} else if (merge_prev) {
+		prev->count += ext->count;
+	} else if (merge_next) {
+		next->lblk = ext->lblk;
+		next->start = ext->start;
+		next->count += ext->count;
+	} else {
+		if (n == A1FS_INODE_EXTENTS) return -ENOSPC;
+		memmove(&inode->extent_array[i + 1], &inode->extent_array[i],
+		        (n - i) * sizeof(a1fs_extent));
+		inode->extent_array[i] = *ext;
+	}
+	return 0;
+}
+
+int file_punch(fs_ctx *fs, a1fs_inode *inode, uint64_t lblk,
+               uint64_t count)
+{
+	uint64_t end = lblk + count;
+	int i = 0;
+	while (i < extent_count(inode)) {
+		a1fs_extent *ext = &inode->extent_array[i];
+		uint64_t ext_end = (uint64_t)ext->lblk + ext->count;
+		if ((ext_end <= lblk) || (ext->lblk >= end)) {
+			i++;
+			continue;
+		}
+
+		if ((ext->lblk >= lblk) && (ext_end <= end)) {
+			// Whole extent is in the range
+			block_put(fs, ext->start, ext->count);
+			quota_charge(fs, inode, -(int64_t)ext->count, 0);
+			extent_remove(inode, i);
+		} else if (ext->lblk >= lblk) {
+			// Range covers the head of the extent
+			a1fs_blk_t cut = end - ext->lblk;
+			block_put(fs, ext->start, cut);
+			quota_charge(fs, inode, -(int64_t)cut, 0);
+			ext->start += cut;
+			ext->lblk += cut;
+			ext->count -= cut;
+			i++;
+		} else if (ext_end <= end) {
+			// Range covers the tail of the extent
+			a1fs_blk_t keep = lblk - ext->lblk;
+			block_put(fs, ext->start + keep, ext->count - keep);
+			quota_charge(fs, inode, -(int64_t)(ext->count - keep), 0);
+			ext->count = keep;
+			i++;
+		} else {
+			// Range is in the middle of the extent; split it
+			if (extent_count(inode) == A1FS_INODE_EXTENTS) return -ENOSPC;
+			a1fs_blk_t keep = lblk - ext->lblk;
+			a1fs_extent tail = {
+				.start = ext->start + (end - ext->lblk),
+				.count = ext_end - end,
+				.lblk  = end,
+			};
+			block_put(fs, ext->start + keep, count);
+			quota_charge(fs, inode, -(int64_t)count, 0);
+			ext->count = keep;
+			memmove(&inode->extent_array[i + 2], &inode->extent_array[i + 1],
+			        (extent_count(inode) - i - 1) * sizeof(a1fs_extent));
+			inode->extent_array[i + 1] = tail;
+			i += 2;
+		}
+	}
+	return 0;
+}
+
+/**
+ * Get the preferred data block for file block lblk: the one that continues the
+ * extent mapping the preceding file block, if any.
+ */
+static a1fs_blk_t alloc_goal(const a1fs_inode *inode, uint64_t lblk)
+{
+	a1fs_blk_t pblk, len;
+	if ((lblk > 0) && extent_map(inode, lblk - 1, &pblk, &len)) return pblk + 1;
+	return 0;
+}
+
+/** Largest file whose last partial block is packed into a tail block. */
+#define A1FS_TAIL_MAX_FILE (1024 * 1024)
+
+bool inode_has_tail(const a1fs_inode *inode)
+{
+	return (inode->flags & A1FS_INODE_TAIL) != 0;
+}
+
+/** Number of tail block units taken by a tail of len bytes. */
+static unsigned int tail_units(size_t len)
+{
+	return (len + A1FS_TAIL_UNIT - 1) / A1FS_TAIL_UNIT;
+}
+
+/** Bitmap of count tail block units starting at unit first. */
+static uint64_t tail_mask(unsigned int first, unsigned int count)
+{
+	assert((count < 64) && (first + count <= 64));
+	return (((uint64_t)1 << count) - 1) << first;
+}
+
+/** Number of free units in a tail block. */
+static int tail_free_units(fs_ctx *fs, a1fs_blk_t blk)
+{
+	const a1fs_tail_header *h = get_block(fs, blk);
+	return A1FS_TAIL_UNITS - __builtin_popcountll(h->used);
+}
+
+const char *tail_data(fs_ctx *fs, const a1fs_tail *tail)
+{
+	return (const char*)get_block(fs, tail->block) + tail->offset;
+}
+
+/**
+ * Add a tail block to the ones that new tails are packed into (see
+ * fs_ctx.tail_blocks). If all the slots are taken, it replaces the block with
+ * the least free space, unless that one has more free space than blk.
+ */
+static void tail_block_open(fs_ctx *fs, a1fs_blk_t blk)
+{
+	int slot = 0;
+	for (int i = 0; i < A1FS_TAIL_OPEN_BLOCKS; i++) {
+		a1fs_blk_t b = fs->tail_blocks[i];
+		if (b == blk) return;
+		if ((fs->tail_blocks[slot] != 0) &&
+		    ((b == 0) || (tail_free_units(fs, b) < tail_free_units(fs, fs->tail_blocks[slot]))))
+		{
+			slot = i;
+		}
+	}
+	if ((fs->tail_blocks[slot] == 0) ||
+	    (tail_free_units(fs, fs->tail_blocks[slot]) < tail_free_units(fs, blk)))
+	{
+		fs->tail_blocks[slot] = blk;
+	}
+}
+
+/**
+ * Store a tail in a tail block: in the first open tail block with a long
+ * enough run of free units, or in a newly allocated one. Tail blocks are not
+ * charged to quotas.
+ *
+ * @param fs    file system context.
+ * @param data  the tail data.
+ * @param len   tail length in bytes; must fit into a tail block.
+ * @param tail  pointer to the variable that receives the location of the tail.
+ * @return      0 on success; -ENOSPC if there are no free blocks.
+ */
+static int tail_alloc(fs_ctx *fs, const void *data, size_t len, a1fs_tail *tail)
+{
+	unsigned int count = tail_units(len);
+	a1fs_tail_header *h = NULL;
+	int unit = -1;
+	for (int i = 0; (unit < 0) && (i < A1FS_TAIL_OPEN_BLOCKS); i++) {
+		if (fs->tail_blocks[i] == 0) continue;
+		h = get_block(fs, fs->tail_blocks[i]);
+		for (unsigned int u = A1FS_TAIL_HEADER_UNITS; u + count <= A1FS_TAIL_UNITS; u++) {
+			if ((h->used & tail_mask(u, count)) == 0) {
+				tail->block = fs->tail_blocks[i];
+				unit = u;
+				break;
+			}
+		}
+	}
+
+	if (unit >= 0) {
+		block_get(fs, tail->block, 1);
+	} else {
+		// The reference count of 1 that the block starts with is the new tail's
+		a1fs_extent ext;
+		int ret = block_alloc(fs, 0, 1, &ext);
+		if (ret != 0) return ret;
+		tail->block = ext.start;
+		h = get_block(fs, tail->block);
+		memset(h, 0, sizeof(*h));
+		h->used = tail_mask(0, A1FS_TAIL_HEADER_UNITS);
+		unit = A1FS_TAIL_HEADER_UNITS;
+		tail_block_open(fs, tail->block);
+	}
+	h->used |= tail_mask(unit, count);
+	h->refs[unit] = 1;
+	tail->offset = unit * A1FS_TAIL_UNIT;
+	tail->len = len;
+	memcpy((char*)h + tail->offset, data, len);
+	memset((char*)h + tail->offset + len, 0, count * A1FS_TAIL_UNIT - len);
+	stats_count(&fs->stats, A1FS_STAT_BLOCKS_WRITTEN, 1);
+	return 0;
+}
+
+/** Take an extra reference to a tail (for a copy of its inode in a snapshot). */
+static void tail_get(fs_ctx *fs, const a1fs_tail *tail)
+{
+	a1fs_tail_header *h = get_block(fs, tail->block);
+	assert(h->refs[tail->offset / A1FS_TAIL_UNIT] > 0);
+	h->refs[tail->offset / A1FS_TAIL_UNIT]++;
+	block_get(fs, tail->block, 1);
+}
+
+/**
+ * Drop a reference to a tail. A tail that is no longer referenced is freed,
+ * and so is its block once it holds no more tails.
+ */
+static void tail_put(fs_ctx *fs, const a1fs_tail *tail)
+{
+	a1fs_tail_header *h = get_block(fs, tail->block);
+	unsigned int unit = tail->offset / A1FS_TAIL_UNIT;
+	assert(h->refs[unit] > 0);
+	if (--h->refs[unit] == 0) {
+		h->used &= ~tail_mask(unit, tail_units(tail->len));
+		if (*get_refcount(fs, tail->block) > 1) {
+			tail_block_open(fs, tail->block);
+		} else {
+			// The block is freed below
+			for (int i = 0; i < A1FS_TAIL_OPEN_BLOCKS; i++) {
+				if (fs->tail_blocks[i] == tail->block) fs->tail_blocks[i] = 0;
+			}
+		}
+	}
+	block_put(fs, tail->block, 1);
+}
+
+/** Drop the tail of a file when it is truncated to the start of the tail or less. */
+static void tail_drop(fs_ctx *fs, a1fs_inode *inode)
+{
+	tail_put(fs, &inode->tail);
+	inode->flags &= ~A1FS_INODE_TAIL;
+	memset(&inode->tail, 0, sizeof(inode->tail));
+}
+
+void tail_pack(fs_ctx *fs, a1fs_inode *inode)
+{
+	size_t len = inode->size % A1FS_BLOCK_SIZE;
+	int n = extent_count(inode);
+	if (!(get_sb(fs)->features & A1FS_FEATURE_TAILS) || !S_ISREG(inode->mode) ||
+	    inode_compressed(inode) || inode_has_tail(inode) || (len == 0) ||
+	    (inode->size > A1FS_TAIL_MAX_FILE) || (n == 0) ||
+	    (tail_units(len) > A1FS_TAIL_UNITS - A1FS_TAIL_HEADER_UNITS))
+	{
+		return;
+	}
+
+	// Unpacking must be able to map the block again, even if it doesn't
+	// merge with the last extent then
+	a1fs_blk_t lblk = inode->size / A1FS_BLOCK_SIZE;
+	const a1fs_extent *last = &inode->extent_array[n - 1];
+	a1fs_blk_t pblk = last->start + last->count - 1;
+	if ((last->lblk + last->count != lblk + 1) || (*get_refcount(fs, pblk) > 1) ||
+	    ((n == A1FS_INODE_EXTENTS) && (last->count > 1)))
+	{
+		return;
+	}
+
+	a1fs_tail tail;
+	if (tail_alloc(fs, get_block(fs, pblk), len, &tail) != 0) return;
+	stats_count(&fs->stats, A1FS_STAT_BLOCKS_READ, 1);
+	// Cutting the last block off the last extent never splits it
+	int ret = file_punch(fs, inode, lblk, 1);
+	assert(ret == 0);
+	(void)ret;
+	inode->tail = tail;
+	inode->flags |= A1FS_INODE_TAIL;
+}
+
+int tail_unpack(fs_ctx *fs, a1fs_inode *inode)
+{
+	if (!inode_has_tail(inode)) return 0;
+	if (quota_room(fs, inode, 1) == 0) return -EDQUOT;
+
+	a1fs_blk_t lblk = inode->size / A1FS_BLOCK_SIZE;
+	a1fs_extent ext;
+	int ret = block_alloc(fs, alloc_goal(inode, lblk), 1, &ext);
+	if (ret != 0) return ret;
+	ext.lblk = lblk;
+	if ((ret = extent_insert(inode, &ext)) != 0) {
+		block_put(fs, ext.start, ext.count);
+		return ret;
+	}
+	quota_charge(fs, inode, 1, 0);
+
+	char *data = get_block(fs, ext.start);
+	memcpy(data, tail_data(fs, &inode->tail), inode->tail.len);
+	memset(data + inode->tail.len, 0, A1FS_BLOCK_SIZE - inode->tail.len);
+	stats_count(&fs->stats, A1FS_STAT_BLOCKS_WRITTEN, 1);
+	tail_drop(fs, inode);
+	return 0;
+}
+
+/**
+ * Allocate data blocks for the holes in a byte range of a file.
+ *
+ * Only holes inside the range are filled; the rest of the file stays sparse.
+ * Newly allocated blocks are zeroed only where the range covers them partially,
+ * since the caller is about to overwrite the rest. On failure, all the blocks
+ * allocated by this call are freed again.
+ *
+ * @param fs      file system context.
+ * @param inode   the inode.
+ * @param offset  start of the byte range.
+ * @param size    length of the byte range; must be non-zero.
+ * @return        0 on success; -EDQUOT if a quota of the file is exceeded;
+ *                -ENOSPC if there is not enough free space or the file is too
+ *                fragmented.
+ */
+static int file_alloc_range(fs_ctx *fs, a1fs_inode *inode, uint64_t offset,
+                            uint64_t size)
+{
+	a1fs_blk_t first = offset / A1FS_BLOCK_SIZE;
+	a1fs_blk_t last = (offset + size - 1) / A1FS_BLOCK_SIZE;
+
+	// Runs allocated so far, so that they can be freed on failure
+	a1fs_extent new_runs[A1FS_INODE_EXTENTS + 1];
+	int n_new = 0;
+	int ret = 0;
+
+	uint64_t lblk = first;
+	while (lblk <= last) {
+		a1fs_blk_t pblk, len;
+		if (extent_map(inode, lblk, &pblk, &len)) {
+			lblk += len;
+			continue;
+		}
+
+		// Fill the hole up to the next extent or the end of the range
+		a1fs_blk_t want = last - lblk + 1;
+		if ((len != 0) && (len < want)) want = len;
+		if ((want = quota_room(fs, inode, want)) == 0) {
+			ret = -EDQUOT;
+			goto fail;
+		}
+
+		a1fs_extent ext;
+		ret = block_alloc(fs, alloc_goal(inode, lblk), want, &ext);
+		if (ret != 0) goto fail;
+		ext.lblk = lblk;
+		if ((ret = extent_insert(inode, &ext)) != 0) {
+			block_put(fs, ext.start, ext.count);
+			goto fail;
+		}
+		quota_charge(fs, inode, ext.count, 0);
+		assert(n_new < A1FS_INODE_EXTENTS + 1);
+		new_runs[n_new++] = ext;
+
+		// Zero the parts of the edge blocks that the range does not cover
+		if ((ext.lblk == first) && (offset % A1FS_BLOCK_SIZE != 0)) {
+			memset(get_block(fs, ext.start), 0, offset % A1FS_BLOCK_SIZE);
+		}
+		uint64_t end = offset + size;
+		if ((ext.lblk + ext.count - 1 == last) && (end % A1FS_BLOCK_SIZE != 0)) {
+			size_t tail = end % A1FS_BLOCK_SIZE;
+			memset(get_block(fs, ext.start + ext.count - 1) + tail, 0,
+			       A1FS_BLOCK_SIZE - tail);
+		}
+		lblk += ext.count;
+	}
+	return 0;
+
+fail:
+	// Turning the new runs back into holes can't split an extent that existed
+	// before this call, so it always succeeds
+	for (int i = 0; i < n_new; i++) {
+		file_punch(fs, inode, new_runs[i].lblk, new_runs[i].count);
+	}
+	return ret;
+}
+
+/**
+ * Give a file private copies of the shared data blocks in a byte range
+ * (copy-on-write), so that the range can be modified without affecting the
+ * files it was cloned to or from.
+ *
+ * Every copied block gets the old contents, even where the caller is about to
+ * overwrite it: if this or a later step of the write fails, the blocks already
+ * copied still hold the file's data.
+ *
+ * @param fs      file system context.
+ * @param inode   the inode.
+ * @param offset  start of the byte range.
+ * @param size    length of the byte range; must be non-zero.
+ * @return        0 on success; -ENOSPC if there is not enough free space or
+ *                the file is too fragmented.
+ */
+static int file_unshare_range(fs_ctx *fs, a1fs_inode *inode, uint64_t offset,
+                              uint64_t size)
+{
+	uint64_t first = offset / A1FS_BLOCK_SIZE;
+	uint64_t last = (offset + size - 1) / A1FS_BLOCK_SIZE;
+
+	uint64_t lblk = first;
+	while (lblk <= last) {
+		a1fs_blk_t pblk, len;
+		if (!extent_map(inode, lblk, &pblk, &len)) {
+			if (len == 0) break;
+			lblk += len;
+			continue;
+		}
+		if (len > last - lblk + 1) len = last - lblk + 1;
+
+		a1fs_blk_t n = 0;
+		if (*get_refcount(fs, pblk) == 1) {
+			while ((n < len) && (*get_refcount(fs, pblk + n) == 1)) n++;
+			lblk += n;
+			continue;
+		}
+		while ((n < len) && (*get_refcount(fs, pblk + n) > 1)) n++;
+
+		a1fs_extent copy;
+		int ret = block_alloc(fs, alloc_goal(inode, lblk), n, &copy);
+		if (ret != 0) return ret;
+		copy.lblk = lblk;
+
+		// The copy takes a slot of its own unless it replaces the whole
+		// extent, and one more if the extent is left with both a head and a
+		// tail. It may still merge with a neighbour, but that isn't counted on.
+		const a1fs_extent *ext = inode->extent_array;
+		while (lblk >= (uint64_t)ext->lblk + ext->count) ext++;
+		bool head = lblk > ext->lblk;
+		bool tail = lblk + copy.count < (uint64_t)ext->lblk + ext->count;
+		if (extent_count(inode) + head + tail > A1FS_INODE_EXTENTS) {
+			block_put(fs, copy.start, copy.count);
+			return -ENOSPC;
+		}
+
+		memcpy(get_block(fs, copy.start), get_block(fs, pblk),
+		       (size_t)copy.count * A1FS_BLOCK_SIZE);
+		stats_count(&fs->stats, A1FS_STAT_BLOCKS_READ, copy.count);
+		// Punching the shared blocks below releases as many as this charges
+		quota_charge(fs, inode, copy.count, 0);
+		// The old blocks stay allocated since other files still map them
+		ret = file_punch(fs, inode, lblk, copy.count);
+		assert(ret == 0);
+		ret = extent_insert(inode, &copy);
+		assert(ret == 0);
+		lblk += copy.count;
+	}
+	return 0;
+}
+
+/**
+ * Count the blocks that writing a byte range of a file takes: the holes that
+ * file_alloc_range() fills and the shared blocks that file_unshare_range()
+ * copies.
+ */
+static uint64_t file_write_blocks(fs_ctx *fs, const a1fs_inode *inode,
+                                  uint64_t offset, uint64_t size, uint64_t *holes)
+{
+	uint64_t first = offset / A1FS_BLOCK_SIZE;
+	uint64_t last = (offset + size - 1) / A1FS_BLOCK_SIZE;
+	uint64_t shared = 0;
+	*holes = 0;
+	for (uint64_t lblk = first; lblk <= last;) {
+		a1fs_blk_t pblk, len;
+		bool mapped = extent_map(inode, lblk, &pblk, &len);
+		if ((len == 0) || (len > last - lblk + 1)) len = last - lblk + 1;
+		if (!mapped) {
+			*holes += len;
+		} else {
+			for (a1fs_blk_t i = 0; i < len; i++) shared += *get_refcount(fs, pblk + i) > 1;
+		}
+		lblk += len;
+	}
+	return shared + *holes;
+}
+
+/** Largest io_uring request for file data; longer runs are split. */
+#define A1FS_URING_CHUNK (256 * 1024)
+
+/** io_uring requests for the data of one read or write of a file. */
+typedef struct io_batch {
+	/** The ring; NULL if the data is copied through the mapping instead. */
+	uring *ring;
+	/** Whether the requests are writes. */
+	bool write;
+	/** Queued requests. */
+	uring_io ios[URING_DEPTH];
+	size_t n;
+
+} io_batch;
+
+/**
+ * Start a batch for a byte range of an uncompressed file. With --io_uring, a
+ * range that is not within one extent is read or written with io_uring
+ * requests, so that the kernel works on all of its extents at once. A range
+ * within one extent is copied through the mapping, which is cheaper when its
+ * pages are cached.
+ */
+static void io_batch_init(fs_ctx *fs, io_batch *b, const a1fs_inode *inode,
+                          uint64_t offset, size_t size, bool write)
+{
+	b->ring = NULL;
+	b->write = write;
+	b->n = 0;
+	if (!fs->opts->io_uring) return;
+
+	a1fs_blk_t pblk, len;
+	bool single = extent_map(inode, offset / A1FS_BLOCK_SIZE, &pblk, &len) &&
+	              (offset % A1FS_BLOCK_SIZE + size <= (uint64_t)len * A1FS_BLOCK_SIZE);
+	if (!single) b->ring = fs_uring(fs);
+}
+
+/** Submit the queued requests of a batch and wait for them. */
+static int io_batch_flush(io_batch *b)
+{
+	int ret = uring_rw(b->ring, b->write, b->ios, b->n);
+	b->n = 0;
+	return ret;
+}
+
+/**
+ * Copy data between a buffer and a run of data blocks: through the mapping, or
+ * by queueing io_uring requests (split into A1FS_URING_CHUNK bytes so that
+ * they are served in parallel). The requests are submitted once the batch is
+ * full or flushed.
+ *
+ * @param fs       file system context.
+ * @param b        the batch.
+ * @param pblk     first data block of the run.
+ * @param blk_off  offset in the run in bytes.
+ * @param buf      data buffer.
+ * @param n        number of bytes.
+ * @return         0 on success; -errno if a submitted request failed.
+ */
+static int io_batch_add(fs_ctx *fs, io_batch *b, a1fs_blk_t pblk, size_t blk_off,
+                        char *buf, size_t n)
+{
+	if (b->ring == NULL) {
+		char *data = get_block(fs, pblk) + blk_off;
+		memcpy(b->write ? data : buf, b->write ? buf : data, n);
+		return 0;
+	}
+
+	uint64_t offset = (uint64_t)(get_sb(fs)->data_table + pblk) * A1FS_BLOCK_SIZE + blk_off;
+	while (n > 0) {
+		size_t len = (n > A1FS_URING_CHUNK) ? A1FS_URING_CHUNK : n;
+		b->ios[b->n++] = (uring_io){ .buf = buf, .len = len, .offset = offset };
+		buf += len;
+		offset += len;
+		n -= len;
+		if (b->n == URING_DEPTH) {
+			int ret = io_batch_flush(b);
+			if (ret != 0) return ret;
+		}
+	}
+	return 0;
+}
+
+/** Finish a batch: submit the remaining requests and wait for them. */
+static int io_batch_finish(io_batch *b)
+{
+	return ((b->ring != NULL) && (b->n > 0)) ? io_batch_flush(b) : 0;
+}
+
+int file_write(fs_ctx *fs, a1fs_inode *inode, const char *buf,
+               size_t size, uint64_t offset)
+{
+	// Check for the space up front, so that running out of it doesn't leave
+	// the range partly unshared and allocated
+	uint64_t holes;
+	if (file_write_blocks(fs, inode, offset, size, &holes) > get_sb(fs)->num_unused_blocks) {
+		return -ENOSPC;
+	}
+	if (quota_room(fs, inode, holes) < holes) return -EDQUOT;
+
+	// Blocks shared with clones are copied before they are modified; skipped
+	// ranges before offset stay holes
+	int ret = file_unshare_range(fs, inode, offset, size);
+	if (ret != 0) return ret;
+	if ((ret = file_alloc_range(fs, inode, offset, size)) != 0) return ret;
+
+	bool dedup = dedup_index_enabled(fs);
+	io_batch batch;
+	io_batch_init(fs, &batch, inode, offset, size, true);
+	size_t done = 0;
+	while (done < size) {
+		uint64_t pos = offset + done;
+		size_t blk_off = pos % A1FS_BLOCK_SIZE;
+		a1fs_blk_t pblk, len;
+		bool mapped = extent_map(inode, pos / A1FS_BLOCK_SIZE, &pblk, &len);
+		assert(mapped);
+		(void)mapped;
+
+		size_t n = size - done;
+		if (n > (size_t)len * A1FS_BLOCK_SIZE - blk_off) {
+			n = (size_t)len * A1FS_BLOCK_SIZE - blk_off;
+		}
+		// Indexed blocks must not change behind the index's back
+		a1fs_blk_t blocks = (blk_off + n + A1FS_BLOCK_SIZE - 1) / A1FS_BLOCK_SIZE;
+		if (dedup) {
+			for (a1fs_blk_t b = pblk; b < pblk + blocks; b++) dedup_index_forget(fs, b);
+		}
+		if ((ret = io_batch_add(fs, &batch, pblk, blk_off, (char*)buf + done, n)) != 0) {
+			return ret;
+		}
+		stats_count(&fs->stats, A1FS_STAT_BLOCKS_WRITTEN, blocks);
+		done += n;
+	}
+	return io_batch_finish(&batch);
+}
+
+/**
+ * Map a file block to an existing data block with the same contents instead of
+ * writing it. Fails if the file would need more extents than it can have, or
+ * if filling a hole would exceed a quota of the file.
+ *
+ * @param fs     file system context.
+ * @param inode  the inode.
+ * @param lblk   file block number.
+ * @param blk    data block with the contents of the file block.
+ * @return       true if the file block now maps blk; false otherwise.
+ */
+static bool file_remap_block(fs_ctx *fs, a1fs_inode *inode, a1fs_blk_t lblk,
+                             a1fs_blk_t blk)
+{
+	a1fs_blk_t pblk, len;
+	bool mapped = extent_map(inode, lblk, &pblk, &len);
+	if (mapped && (pblk == blk)) return true;
+	// Filling a hole takes a block of the quotas; leave it to the normal write
+	// to report -EDQUOT
+	if (!mapped && (quota_room(fs, inode, 1) < 1)) return false;
+
+	// Punching a block out of the middle of an extent splits it, and the new
+	// block may not merge with its neighbours. Leave room for two more extents
+	// so that the shared block can still be unshared when it is overwritten.
+	if (extent_count(inode) + 4 > A1FS_INODE_EXTENTS) return false;
+
+	// Take the new reference first so that punching can't free blk
+	block_get(fs, blk, 1);
+	quota_charge(fs, inode, 1, 0);
+	int ret = file_punch(fs, inode, lblk, 1);
+	assert(ret == 0);
+	a1fs_extent ext = { .start = blk, .count = 1, .lblk = lblk };
+	ret = extent_insert(inode, &ext);
+	assert(ret == 0);
+	(void)ret;
+	return true;
+}
+
+/**
+ * Write data to a byte range of an uncompressed file, deduplicating whole
+ * blocks against the dedup index.
+ *
+ * Each whole block of the range that matches an indexed data block is mapped
+ * to it instead of being written; the other whole blocks are written and added
+ * to the index. Partial blocks at the edges of the range are written as usual.
+ *
+ * The blocks are written one at a time, so if one fails the ones before it
+ * stay written and are counted; the caller must extend the file size to cover
+ * them.
+ *
+ * @return  number of bytes written if at least the head of the range was
+ *          written; -ENOSPC if there is not enough free space or the file is
+ *          too fragmented; -errno on other errors.
+ */
+static int file_write_dedup(fs_ctx *fs, a1fs_inode *inode, const char *buf,
+                            size_t size, uint64_t offset)
+{
+	uint64_t end = offset + size;
+	uint64_t first = (offset + A1FS_BLOCK_SIZE - 1) / A1FS_BLOCK_SIZE;
+	uint64_t last = end / A1FS_BLOCK_SIZE;// exclusive
+	int ret;
+	if (first >= last) {
+		ret = file_write(fs, inode, buf, size, offset);
+		return (ret != 0) ? ret : (int)size;
+	}
+
+	size_t head = first * A1FS_BLOCK_SIZE - offset;
+	if ((head != 0) && ((ret = file_write(fs, inode, buf, head, offset)) != 0)) {
+		return ret;
+	}
+
+	size_t done = head;
+	for (uint64_t lblk = first; lblk < last; lblk++, done += A1FS_BLOCK_SIZE) {
+		const char *data = buf + done;
+		uint64_t hash = dedup_hash(data);
+		a1fs_blk_t blk;
+		if (dedup_index_find(fs, data, hash, &blk) &&
+		    file_remap_block(fs, inode, lblk, blk))
+		{
+			continue;
+		}
+
+		ret = file_write(fs, inode, data, A1FS_BLOCK_SIZE, lblk * A1FS_BLOCK_SIZE);
+		if (ret != 0) return (done > 0) ? (int)done : ret;
+		a1fs_blk_t pblk, len;
+		bool mapped = extent_map(inode, lblk, &pblk, &len);
+		assert(mapped);
+		(void)mapped;
+		dedup_index_add(fs, pblk, hash);
+	}
+
+	size_t tail = end - last * A1FS_BLOCK_SIZE;
+	if ((tail != 0) &&
+	    ((ret = file_write(fs, inode, buf + done, tail, last * A1FS_BLOCK_SIZE)) != 0))
+	{
+		return (done > 0) ? (int)done : ret;
+	}
+	return (int)size;
+}
+
+/**
+ * Undo what a failed write left past the end of an uncompressed file: free the
+ * blocks mapped past EOF and zero the rest of the last block, so that
+ * extending the file later exposes zeros rather than the partly written data.
+ *
+ * The last block is only zeroed if the file doesn't share it. A write only
+ * modifies blocks after unsharing them, so a shared last block still has the
+ * zeros past EOF that it had before.
+ */
+static void file_write_undo(fs_ctx *fs, a1fs_inode *inode)
+{
+	// Punching from the end never splits an extent
+	uint64_t keep = size_to_blocks(inode->size);
+	int ret = file_punch(fs, inode, keep, (uint64_t)UINT32_MAX + 1 - keep);
+	assert(ret == 0);
+	(void)ret;
+
+	a1fs_blk_t pblk, len;
+	size_t tail = inode->size % A1FS_BLOCK_SIZE;
+	if ((tail != 0) && extent_map(inode, inode->size / A1FS_BLOCK_SIZE, &pblk, &len) &&
+	    (*get_refcount(fs, pblk) == 1))
+	{
+		if (dedup_index_enabled(fs)) dedup_index_forget(fs, pblk);
+		memset(get_block(fs, pblk) + tail, 0, A1FS_BLOCK_SIZE - tail);
+	}
+}
+
+/**
+ * Share a range of data blocks of one file with another file (reflink).
+ *
+ * The destination range is replaced with the source range: data blocks are
+ * shared and holes stay holes. The destination file is extended if needed.
+ * Offsets must be block-aligned; the length may be unaligned only if the range
+ * ends at the source EOF and at or after the destination EOF. Tails (see
+ * tail_pack()) are not shared: the destination gets its tail back as a block
+ * first, and a tail of the source is copied.
+ *
+ * @param fs          file system context.
+ * @param dst         destination inode.
+ * @param src         source inode; can be the same as dst.
+ * @param src_offset  offset of the range in the source file.
+ * @param length      length of the range; 0 means up to the source EOF.
+ * @param dst_offset  offset of the range in the destination file.
+ * @return            0 on success; -EINVAL if the range is invalid; -EFBIG if
+ *                    the destination would be too large; -EDQUOT if a quota
+ *                    of the destination would be exceeded; -ENOSPC if the
+ *                    destination would be too fragmented.
+ */
+static int file_clone(fs_ctx *fs, a1fs_inode *dst, const a1fs_inode *src,
+                      int64_t src_offset, int64_t length, int64_t dst_offset)
+{
+	if ((src_offset < 0) || (dst_offset < 0) || (length < 0)) return -EINVAL;
+	if ((src_offset % A1FS_BLOCK_SIZE != 0) || (dst_offset % A1FS_BLOCK_SIZE != 0)) {
+		return -EINVAL;
+	}
+	if ((uint64_t)src_offset > src->size) return -EINVAL;
+	if (length == 0) length = src->size - src_offset;
+	if ((uint64_t)(src_offset + length) > src->size) return -EINVAL;
+	if ((length % A1FS_BLOCK_SIZE != 0) &&
+	    (((uint64_t)(src_offset + length) != src->size) ||
+	     ((uint64_t)(dst_offset + length) < dst->size)))
+	{
+		return -EINVAL;
+	}
+	if ((dst == src) && (src_offset < dst_offset + length) &&
+	    (dst_offset < src_offset + length))
+	{
+		return -EINVAL;
+	}
+	if (length == 0) return 0;
+	if (size_to_blocks(dst_offset + length) > (uint64_t)UINT32_MAX + 1) return -EFBIG;
+	// This also takes the tail of the source if it is the same file
+	int ret = tail_unpack(fs, dst);
+	if (ret != 0) return ret;
+
+	uint64_t src_first = src_offset / A1FS_BLOCK_SIZE;
+	uint64_t dst_first = dst_offset / A1FS_BLOCK_SIZE;
+	uint64_t count = size_to_blocks(length);
+	uint64_t src_tail = src->size / A1FS_BLOCK_SIZE;
+	bool copy_tail = inode_has_tail(src) && (src_tail >= src_first) &&
+	                 (src_tail < src_first + count);
+
+	// Collect the source extents first since src may be the same inode as dst
+	a1fs_extent runs[A1FS_INODE_EXTENTS];
+	int n_runs = 0;
+	for (int i = 0; i < extent_count(src); i++) {
+		a1fs_extent ext = src->extent_array[i];
+		uint64_t from = (ext.lblk > src_first) ? ext.lblk : src_first;
+		uint64_t to = ext.lblk + ext.count;
+		if (to > src_first + count) to = src_first + count;
+		if (from >= to) continue;
+
+		runs[n_runs].start = ext.start + (from - ext.lblk);
+		runs[n_runs].count = to - from;
+		runs[n_runs].lblk = from - src_first + dst_first;
+		n_runs++;
+	}
+	// Punching the destination range may split an extent
+	if (extent_count(dst) + 1 + n_runs + copy_tail > A1FS_INODE_EXTENTS) return -ENOSPC;
+	if (copy_tail && (get_sb(fs)->num_unused_blocks == 0)) return -ENOSPC;
+	// Blocks punched from the destination are not counted, so that a clone
+	// never leaves it over its quota
+	uint64_t shared = copy_tail;
+	for (int i = 0; i < n_runs; i++) shared += runs[i].count;
+	if (quota_room(fs, dst, shared) < shared) return -EDQUOT;
+
+	ret = file_punch(fs, dst, dst_first, count);
+	assert(ret == 0);
+	for (int i = 0; i < n_runs; i++) {
+		block_get(fs, runs[i].start, runs[i].count);
+		quota_charge(fs, dst, runs[i].count, 0);
+		ret = extent_insert(dst, &runs[i]);
+		assert(ret == 0);
+	}
+	if (copy_tail) {
+		uint64_t lblk = src_tail - src_first + dst_first;
+		ret = file_write(fs, dst, tail_data(fs, &src->tail), src->tail.len,
+		                 lblk * A1FS_BLOCK_SIZE);
+		if (ret != 0) return ret;
+	}
+
+	if ((uint64_t)(dst_offset + length) > dst->size) dst->size = dst_offset + length;
+	inode_touch(fs, dst);
+	return 0;
+}
+
+/**
+ * Number of contiguous runs of data blocks of an inode: extents that follow
+ * each other in the file and on disk are one run.
+ */
+static uint32_t extent_runs(const a1fs_inode *inode)
+{
+	uint32_t runs = 0;
+	for (int i = 0; i < extent_count(inode); i++) {
+		const a1fs_extent *ext = &inode->extent_array[i];
+		const a1fs_extent *prev = ext - 1;
+		if ((i == 0) || (ext->start != prev->start + prev->count)) runs++;
+	}
+	return runs;
+}
+
+/**
+ * Defragment a file or directory (see A1FS_IOC_DEFRAG): copy its data blocks
+ * into one newly allocated contiguous run and switch its extents over to it.
+ * Directory entries are always kept dense (see dir_remove()), so compacting a
+ * directory only takes moving its blocks together.
+ *
+ * The extents are switched in one piece after the copy, and the old blocks
+ * are freed last, so the inode never maps a partially copied block.
+ *
+ * @param fs     file system context.
+ * @param inode  the inode.
+ * @param args   ioctl argument; receives the results.
+ * @return       0 on success (including files left as they are); -ENOSPC if
+ *               there is no free run large enough.
+ */
+static int file_defrag(fs_ctx *fs, a1fs_inode *inode, a1fs_defrag_args *args)
+{
+	args->runs_before = args->runs_after = extent_runs(inode);
+	args->blocks_moved = 0;
+	if ((args->runs_before <= 1) || inode_compressed(inode) ||
+	    (args->flags & A1FS_DEFRAG_CHECK))
+	{
+		return 0;
+	}
+	int n = extent_count(inode);
+	for (int i = 0; i < n; i++) {
+		const a1fs_extent *ext = &inode->extent_array[i];
+		for (a1fs_blk_t b = ext->start; b < ext->start + ext->count; b++) {
+			if (*get_refcount(fs, b) > 1) return 0;
+		}
+	}
+
+	a1fs_blk_t total = extent_blocks(inode);
+	a1fs_extent run;
+	int ret = block_alloc_contig(fs, inode->extent_array[0].start, total, &run);
+	if (ret != 0) return ret;
+
+	// Extents that follow each other in the file are merged into one
+	a1fs_extent old[A1FS_INODE_EXTENTS], new[A1FS_INODE_EXTENTS];
+	memcpy(old, inode->extent_array, sizeof(old));
+	memset(new, 0, sizeof(new));
+	a1fs_blk_t next = run.start;
+	int n_new = 0;
+	for (int i = 0; i < n; i++) {
+		memcpy(get_block(fs, next), get_block(fs, old[i].start),
+		       (size_t)old[i].count * A1FS_BLOCK_SIZE);
+		a1fs_extent *last = &new[n_new - 1];
+		if ((n_new > 0) && (last->lblk + last->count == old[i].lblk)) {
+			last->count += old[i].count;
+		} else {
+			new[n_new++] = (a1fs_extent){ .start = next, .count = old[i].count,
+			                              .lblk = old[i].lblk };
+		}
+		next += old[i].count;
+	}
+	memcpy(inode->extent_array, new, sizeof(new));
+	for (int i = 0; i < n; i++) block_put(fs, old[i].start, old[i].count);
+
+	stats_count(&fs->stats, A1FS_STAT_BLOCKS_READ, total);
+	stats_count(&fs->stats, A1FS_STAT_BLOCKS_WRITTEN, total);
+	args->runs_after = 1;
+	args->blocks_moved = total;
+	return 0;
+}
+
+a1fs_cluster *cluster_entry(fs_ctx *fs, const a1fs_inode *inode,
+                            uint64_t index)
+{
+	a1fs_blk_t pblk, len;
+	if (!extent_map(inode, index / A1FS_CLUSTERS_PER_BLOCK, &pblk, &len)) {
+		return NULL;
+	}
+	return (a1fs_cluster*)get_block(fs, pblk) + index % A1FS_CLUSTERS_PER_BLOCK;
+}
+
+uint64_t inode_blocks(fs_ctx *fs, const a1fs_inode *inode)
+{
+	uint64_t blocks = extent_blocks(inode);
+	if (inode->flags & A1FS_INODE_XATTR_BLOCK) blocks++;
+	if (!inode_compressed(inode)) return blocks;
+
+	for (int i = 0; i < extent_count(inode); i++) {
+		const a1fs_extent *ext = &inode->extent_array[i];
+		for (a1fs_blk_t b = 0; b < ext->count; b++) {
+			const a1fs_cluster *map = get_block(fs, ext->start + b);
+			for (size_t c = 0; c < A1FS_CLUSTERS_PER_BLOCK; c++) {
+				blocks += size_to_blocks(map[c].size);
+			}
+		}
+	}
+	return blocks;
+}
+
+
+int cluster_load(fs_ctx *fs, a1fs_ino_t ino, const a1fs_inode *inode,
+                 uint64_t index, const unsigned char **data)
+{
+	bool cached = ino != SNAPSHOT_INO;
+	const a1fs_cluster *c = cluster_entry(fs, inode, index);
+	if ((c == NULL) || (c->size == 0)) {
+		*data = NULL;
+		return 0;
+	}
+	if (c->size == A1FS_CLUSTER_SIZE) {
+		stats_count(&fs->stats, A1FS_STAT_BLOCKS_READ, A1FS_CLUSTER_SIZE / A1FS_BLOCK_SIZE);
+		*data = get_block(fs, c->start);
+		return 0;
+	}
+
+	unsigned char *buf = cached ? fs_cluster_cache_find(fs, ino, index) : NULL;
+	if (buf == NULL) {
+		// Reads never compress, so the compression buffer is free to hold a
+		// cluster that is not cached
+		buf = cached ? fs_cluster_cache_add(fs, ino, index) : fs->compress_buf;
+		if (buf == NULL) return -ENOMEM;
+		stats_count(&fs->stats, A1FS_STAT_BLOCKS_READ, size_to_blocks(c->size));
+		if (lz4_decompress(get_block(fs, c->start), c->size, buf,
+		                   A1FS_CLUSTER_SIZE) != A1FS_CLUSTER_SIZE)
+		{
+			if (cached) fs_cluster_cache_drop(fs, ino, index);
+			return -EIO;
+		}
+	}
+	*data = buf;
+	return 0;
+}
+
+/**
+ * Compress a cluster of a compressed file and store it in place of its old
+ * contents. The cluster is stored uncompressed if compressing it doesn't save
+ * at least one block. Blocks shared with snapshots are not modified.
+ *
+ * @param fs     file system context.
+ * @param inode  the inode.
+ * @param index  cluster index.
+ * @param data   A1FS_CLUSTER_SIZE bytes of new cluster data.
+ * @return       0 on success; -EDQUOT if a quota of the file is exceeded;
+ *               -ENOSPC if there is not enough free space.
+ */
+static int cluster_store(fs_ctx *fs, a1fs_inode *inode, uint64_t index,
+                         const unsigned char *data)
+{
+	a1fs_cluster *c = cluster_entry(fs, inode, index);
+	if (c == NULL) {
+		int ret = file_alloc_range(fs, inode, index * sizeof(a1fs_cluster),
+		                           sizeof(a1fs_cluster));
+		if (ret != 0) return ret;
+		c = cluster_entry(fs, inode, index);
+		c->start = 0;
+		c->size = 0;
+	} else {
+		// The cluster map block may be shared with a snapshot
+		int ret = file_unshare_range(fs, inode, index * sizeof(a1fs_cluster),
+		                             sizeof(a1fs_cluster));
+		if (ret != 0) return ret;
+		c = cluster_entry(fs, inode, index);
+	}
+
+	const void *payload = fs->compress_buf;
+	size_t size = lz4_compress(data, A1FS_CLUSTER_SIZE, fs->compress_buf,
+	                           A1FS_CLUSTER_SIZE - A1FS_BLOCK_SIZE);
+	if (size == 0) {
+		payload = data;
+		size = A1FS_CLUSTER_SIZE;
+	}
+
+	// Clusters shared with a snapshot are copied rather than overwritten
+	a1fs_blk_t count = size_to_blocks(size);
+	a1fs_blk_t old_count = size_to_blocks(c->size);
+	if ((count != old_count) ||
+	    ((old_count != 0) && (*get_refcount(fs, c->start) > 1)))
+	{
+		if ((count > old_count) &&
+		    (quota_room(fs, inode, count - old_count) < count - old_count))
+		{
+			return -EDQUOT;
+		}
+		// Allocate before freeing, so that the old data survives a failure
+		a1fs_extent ext;
+		int ret = block_alloc_contig(fs, c->start, count, &ext);
+		if (ret != 0) return ret;
+		if (old_count != 0) block_put(fs, c->start, old_count);
+		quota_charge(fs, inode, (int64_t)count - old_count, 0);
+		c->start = ext.start;
+	}
+	memcpy(get_block(fs, c->start), payload, size);
+	memset(get_block(fs, c->start) + size, 0, count * A1FS_BLOCK_SIZE - size);
+	c->size = size;
+	stats_count(&fs->stats, A1FS_STAT_BLOCKS_WRITTEN, count);
+	return 0;
+}
+
+int cluster_write(fs_ctx *fs, a1fs_ino_t ino, a1fs_inode *inode,
+                  uint64_t index, const char *buf, size_t offset,
+                  size_t size)
+{
+	const unsigned char *old;
+	int ret = cluster_load(fs, ino, inode, index, &old);
+	if (ret != 0) return ret;
+	// Zeroing a hole is a no-op
+	if ((old == NULL) && (buf == NULL)) return 0;
+
+	// The new contents are built in the cache, ready for subsequent reads
+	unsigned char *data = fs_cluster_cache_find(fs, ino, index);
+	if (data == NULL) {
+		if ((data = fs_cluster_cache_add(fs, ino, index)) == NULL) return -ENOMEM;
+		if (old != NULL) {
+			memcpy(data, old, A1FS_CLUSTER_SIZE);
+		} else {
+			memset(data, 0, A1FS_CLUSTER_SIZE);
+		}
+	}
+	if (buf != NULL) {
+		memcpy(data + offset, buf, size);
+	} else {
+		memset(data + offset, 0, size);
+	}
+
+	if ((ret = cluster_store(fs, inode, index, data)) != 0) {
+		fs_cluster_cache_drop(fs, ino, index);
+	}
+	return ret;
+}
+
+/**
+ * Read from a compressed file. The range must be within the file size.
+ *
+ * @return  0 on success; -errno on error.
+ */
+static int compressed_read(fs_ctx *fs, a1fs_ino_t ino, const a1fs_inode *inode,
+                           char *buf, size_t size, uint64_t offset)
+{
+	size_t done = 0;
+	while (done < size) {
+		uint64_t pos = offset + done;
+		size_t cluster_off = pos % A1FS_CLUSTER_SIZE;
+		size_t n = size - done;
+		if (n > A1FS_CLUSTER_SIZE - cluster_off) n = A1FS_CLUSTER_SIZE - cluster_off;
+
+		const unsigned char *data;
+		int ret = cluster_load(fs, ino, inode, pos / A1FS_CLUSTER_SIZE, &data);
+		if (ret != 0) return ret;
+		if (data != NULL) {
+			memcpy(buf + done, data + cluster_off, n);
+		} else {
+			memset(buf + done, 0, n);
+		}
+		done += n;
+	}
+	return 0;
+}
+
+/**
+ * Write to a compressed file. Doesn't update the file size.
+ *
+ * Each cluster is stored as a whole or not at all, so if storing one fails the
+ * clusters before it stay written and their part of the range is counted; the
+ * caller must extend the file size to cover it.
+ *
+ * @return  number of bytes written if at least one cluster was stored;
+ *          -errno on error.
+ */
+static int compressed_write(fs_ctx *fs, a1fs_ino_t ino, a1fs_inode *inode,
+                            const char *buf, size_t size, uint64_t offset)
+{
+	size_t done = 0;
+	while (done < size) {
+		uint64_t pos = offset + done;
+		size_t cluster_off = pos % A1FS_CLUSTER_SIZE;
+		size_t n = size - done;
+		if (n > A1FS_CLUSTER_SIZE - cluster_off) n = A1FS_CLUSTER_SIZE - cluster_off;
+
+		int ret = cluster_write(fs, ino, inode, pos / A1FS_CLUSTER_SIZE,
+		                        buf + done, cluster_off, n);
+		if (ret == 0) {
+			done += n;
+			continue;
+		}
+
+		// The failed cluster may have got a cluster map block of its own past
+		// the end of the file; only ever freed from the end, which never
+		// splits an extent
+		uint64_t eof = ((done > 0) && (pos > inode->size)) ? pos : inode->size;
+		uint64_t keep = (eof + A1FS_CLUSTER_SIZE - 1) / A1FS_CLUSTER_SIZE;
+		uint64_t map_keep = size_to_blocks(keep * sizeof(a1fs_cluster));
+		int punched = file_punch(fs, inode, map_keep, (uint64_t)UINT32_MAX + 1 - map_keep);
+		assert(punched == 0);
+		(void)punched;
+		return (done > 0) ? (int)done : ret;
+	}
+	return (int)done;
+}
+
+/**
+ * Shrink a compressed file, freeing the clusters past the new size. Doesn't
+ * update the file size.
+ *
+ * @return  0 on success; -errno on error.
+ */
+static int compressed_shrink(fs_ctx *fs, a1fs_ino_t ino, a1fs_inode *inode,
+                             uint64_t size)
+{
+	assert(size < inode->size);
+
+	// Zero the tail of the last cluster so that extending the file again
+	// exposes zeros rather than the old data
+	if (size % A1FS_CLUSTER_SIZE != 0) {
+		int ret = cluster_write(fs, ino, inode, size / A1FS_CLUSTER_SIZE, NULL,
+		                        size % A1FS_CLUSTER_SIZE,
+		                        A1FS_CLUSTER_SIZE - size % A1FS_CLUSTER_SIZE);
+		if (ret != 0) return ret;
+	}
+
+	// Entries past the new end only need clearing in the cluster map block
+	// that is kept; it may be shared with a snapshot, so it is copied first
+	uint64_t keep = (size + A1FS_CLUSTER_SIZE - 1) / A1FS_CLUSTER_SIZE;
+	uint64_t old = (inode->size + A1FS_CLUSTER_SIZE - 1) / A1FS_CLUSTER_SIZE;
+	uint64_t map_keep = size_to_blocks(keep * sizeof(a1fs_cluster));
+	if (keep % A1FS_CLUSTERS_PER_BLOCK != 0) {
+		int ret = file_unshare_range(fs, inode, keep * sizeof(a1fs_cluster),
+		                             sizeof(a1fs_cluster));
+		if (ret != 0) return ret;
+	}
+	for (uint64_t i = keep; i < old; i++) {
+		a1fs_cluster *c = cluster_entry(fs, inode, i);
+		if (c == NULL) {
+			// Skip the rest of the unallocated cluster map block
+			i += A1FS_CLUSTERS_PER_BLOCK - 1 - i % A1FS_CLUSTERS_PER_BLOCK;
+			continue;
+		}
+		if (c->size != 0) {
+			block_put(fs, c->start, size_to_blocks(c->size));
+			quota_charge(fs, inode, -(int64_t)size_to_blocks(c->size), 0);
+		}
+		if (i < map_keep * A1FS_CLUSTERS_PER_BLOCK) {
+			c->start = 0;
+			c->size = 0;
+		}
+	}
+	fs_cluster_cache_drop(fs, ino, keep);
+
+	// Cluster map blocks are only ever freed from the end, which never splits
+	// an extent
+	int ret = file_punch(fs, inode, map_keep, (uint64_t)UINT32_MAX + 1 - map_keep);
+	assert(ret == 0);
+	return ret;
+}
+
+
+/** Size of the stored entry of an extended attribute in bytes. */
+static size_t xattr_entry_size(const xattr *x)
+{
+	return sizeof(a1fs_xattr_entry) + x->name_len + x->value_len;
+}
+
+int xattr_parse(const unsigned char *area, size_t size, xattr *list, int n)
+{
+	size_t pos = 0;
+	while (pos + sizeof(a1fs_xattr_entry) <= size) {
+		a1fs_xattr_entry e;
+		memcpy(&e, area + pos, sizeof(e));
+		if (e.name_len == 0) break;
+		xattr *x = &list[n];
+		x->name = (const char*)area + pos + sizeof(e);
+		x->name_len = e.name_len;
+		x->value = x->name + e.name_len;
+		x->value_len = e.value_len;
+		if (pos + xattr_entry_size(x) > size) break;
+		pos += xattr_entry_size(x);
+		n++;
+	}
+	return n;
+}
+
+size_t inode_xattr_size(fs_ctx *fs)
+{
+	return (get_sb(fs)->features & A1FS_FEATURE_TAILS) ? A1FS_INODE_XATTR_SIZE_TAILS
+	                                                   : A1FS_INODE_XATTR_SIZE;
+}
+
+/** Get all the extended attributes of an inode; returns their number. */
+static int xattr_load(fs_ctx *fs, const a1fs_inode *inode, xattr *list)
+{
+	int n = xattr_parse(inode->xattr, inode_xattr_size(fs), list, 0);
+	if (inode->flags & A1FS_INODE_XATTR_BLOCK) {
+		n = xattr_parse(get_block(fs, inode->xattr_block), A1FS_BLOCK_SIZE, list, n);
+	}
+	return n;
+}
+
+/** Find an extended attribute by name; returns its index or -1. */
+static int xattr_find(const xattr *list, int n, const char *name)
+{
+	size_t name_len = strlen(name);
+	for (int i = 0; i < n; i++) {
+		if ((list[i].name_len == name_len) &&
+		    (memcmp(list[i].name, name, name_len) == 0))
+		{
+			return i;
+		}
+	}
+	return -1;
+}
+
+/** Compare extended attributes by name for sorting. */
+static int xattr_name_cmp(const void *a, const void *b)
+{
+	const xattr *x = (const xattr*)a;
+	const xattr *y = (const xattr*)b;
+	int cmp = memcmp(x->name, y->name, (x->name_len < y->name_len) ? x->name_len
+	                                                               : y->name_len);
+	if (cmp != 0) return cmp;
+	return (x->name_len > y->name_len) - (x->name_len < y->name_len);
+}
+
+/** Compare extended attributes by entry size, then by name, for sorting. */
+static int xattr_size_cmp(const void *a, const void *b)
+{
+	size_t x = xattr_entry_size((const xattr*)a);
+	size_t y = xattr_entry_size((const xattr*)b);
+	if (x != y) return (x > y) - (x < y);
+	return xattr_name_cmp(a, b);
+}
+
+/** Append an entry to an xattr entry list at given position; returns the end. */
+static size_t xattr_append(unsigned char *area, size_t pos, const xattr *x)
+{
+	a1fs_xattr_entry e = { .name_len = x->name_len, .value_len = x->value_len };
+	memcpy(area + pos, &e, sizeof(e));
+	memcpy(area + pos + sizeof(e), x->name, x->name_len);
+	memcpy(area + pos + sizeof(e) + x->name_len, x->value, x->value_len);
+	return pos + xattr_entry_size(x);
+}
+
+/** Drop a reference to an xattr block, freeing it if it was the last one. */
+static void xattr_block_put(fs_ctx *fs, a1fs_blk_t blk)
+{
+	if (*get_refcount(fs, blk) == 1) {
+		fs_xattr_share_remove(fs, dedup_hash(get_block(fs, blk)), blk);
+	}
+	block_put(fs, blk, 1);
+}
+
+int xattr_store(fs_ctx *fs, a1fs_inode *inode, xattr *list, int n)
+{
+	unsigned char in_inode[A1FS_INODE_XATTR_SIZE] = {0};
+	size_t in_inode_size = inode_xattr_size(fs);
+	unsigned char *block = calloc(1, A1FS_BLOCK_SIZE);
+	if (block == NULL) return -ENOMEM;
+
+	qsort(list, n, sizeof(*list), xattr_size_cmp);
+	size_t pos = 0;
+	int i = 0;
+	for (; (i < n) && (pos + xattr_entry_size(&list[i]) <= in_inode_size); i++) {
+		pos = xattr_append(in_inode, pos, &list[i]);
+	}
+	qsort(list + i, n - i, sizeof(*list), xattr_name_cmp);
+	pos = 0;
+	for (; i < n; i++) {
+		if (pos + xattr_entry_size(&list[i]) > A1FS_BLOCK_SIZE) {
+			free(block);
+			return -ENOSPC;
+		}
+		pos = xattr_append(block, pos, &list[i]);
+	}
+
+	// Take the new block before releasing the old one, which may be the same
+	a1fs_blk_t blk = 0;
+	bool had_block = (inode->flags & A1FS_INODE_XATTR_BLOCK) != 0;
+	if ((pos > 0) && !had_block && (quota_room(fs, inode, 1) == 0)) {
+		free(block);
+		return -EDQUOT;
+	}
+	if (pos > 0) {
+		uint64_t hash = dedup_hash(block);
+		if (fs_xattr_share_find(fs, hash, block, &blk)) {
+			block_get(fs, blk, 1);
+		} else {
+			// Keep the block close to the file data
+			a1fs_blk_t goal = (extent_count(inode) > 0) ? inode->extent_array[0].start : 0;
+			a1fs_extent ext;
+			int ret = block_alloc(fs, goal, 1, &ext);
+			if (ret != 0) {
+				free(block);
+				return ret;
+			}
+			blk = ext.start;
+			memcpy(get_block(fs, blk), block, A1FS_BLOCK_SIZE);
+			stats_count(&fs->stats, A1FS_STAT_BLOCKS_WRITTEN, 1);
+			// If this fails, the block is just not shared with other inodes
+			fs_xattr_share_add(fs, hash, blk);
+		}
+	}
+	free(block);
+
+	if (had_block) xattr_block_put(fs, inode->xattr_block);
+	quota_charge(fs, inode, (pos > 0) - had_block, 0);
+	memcpy(inode->xattr, in_inode, in_inode_size);
+	if (pos > 0) {
+		inode->flags |= A1FS_INODE_XATTR_BLOCK;
+		inode->xattr_block = blk;
+	} else {
+		inode->flags &= ~A1FS_INODE_XATTR_BLOCK;
+		inode->xattr_block = 0;
+	}
+	inode_stamp(fs, inode);
+	return 0;
+}
+
+void inode_free_data(fs_ctx *fs, a1fs_ino_t ino, a1fs_inode *inode)
+{
+	int ret;
+	if (inode->flags & A1FS_INODE_XATTR_BLOCK) {
+		xattr_block_put(fs, inode->xattr_block);
+		quota_charge(fs, inode, -1, 0);
+		inode->flags &= ~A1FS_INODE_XATTR_BLOCK;
+	}
+	if (inode_has_tail(inode)) tail_drop(fs, inode);
+	if (inode_compressed(inode) && (inode->size > 0)) {
+		// Shrinking to 0 doesn't write any cluster, so it can't fail
+		ret = compressed_shrink(fs, ino, inode, 0);
+		assert(ret == 0);
+	}
+	ret = file_punch(fs, inode, 0, (uint64_t)UINT32_MAX + 1);
+	assert(ret == 0);
+	(void)ret;
+	inode->size = 0;
+}
+
+int file_truncate(fs_ctx *fs, a1fs_ino_t ino, a1fs_inode *inode, off_t size)
+{
+	int ret;
+	if (size < 0) return -EINVAL;
+	if (size_to_blocks(size) > (uint64_t)UINT32_MAX + 1) return -EFBIG;
+
+	// The tail must stay at EOF. A tail that is cut off entirely is only
+	// dropped once the truncate can no longer fail.
+	bool drop_tail = false;
+	if (inode_has_tail(inode) && ((uint64_t)size != inode->size)) {
+		if ((uint64_t)size <= inode->size - inode->tail.len) {
+			drop_tail = true;
+		} else if ((ret = tail_unpack(fs, inode)) != 0) {
+			return ret;
+		}
+	}
+
+	if (inode_compressed(inode) && ((uint64_t)size < inode->size)) {
+		if ((ret = compressed_shrink(fs, ino, inode, size)) != 0) return ret;
+	} else if ((uint64_t)size < inode->size) {
+		// The tail of the last block is zeroed below; don't let that show
+		// through in files it is shared with
+		if (size % A1FS_BLOCK_SIZE != 0) {
+			ret = file_unshare_range(fs, inode, size, 1);
+			if (ret != 0) return ret;
+		}
+		if (drop_tail) tail_drop(fs, inode);
+
+		// Free whole blocks past the new end; truncating never splits extents
+		uint64_t keep = size_to_blocks(size);
+		ret = file_punch(fs, inode, keep, (uint64_t)UINT32_MAX + 1 - keep);
+		assert(ret == 0);
+
+		// Zero the tail of the last block so that extending the file again
+		// exposes zeros rather than the old data
+		a1fs_blk_t pblk, len;
+		if ((size % A1FS_BLOCK_SIZE != 0) &&
+		    extent_map(inode, size / A1FS_BLOCK_SIZE, &pblk, &len))
+		{
+			if (dedup_index_enabled(fs)) dedup_index_forget(fs, pblk);
+			memset(get_block(fs, pblk) + size % A1FS_BLOCK_SIZE, 0,
+			       A1FS_BLOCK_SIZE - size % A1FS_BLOCK_SIZE);
+		}
+	}
+	// Extending only moves EOF; the new range is a hole
+	inode->size = size;
+	inode_touch(fs, inode);
+	return 0;
+}
+
+/**
+ * Find the next data or hole offset in a file.
+ *
+ * Same semantics as lseek() with SEEK_DATA or SEEK_HOLE: there is an implicit
+ * hole at the end of the file. A tail (see tail_pack()) is data.
+ *
+ * @param inode   the inode.
+ * @param offset  offset to start searching from.
+ * @param data    true to find the next data (SEEK_DATA); false to find the
+ *                next hole (SEEK_HOLE).
+ * @return        resulting offset on success; -ENXIO if offset is beyond EOF
+ *                or (for SEEK_DATA) there is no data after offset.
+ */
+static off_t file_seek_hole_data(const a1fs_inode *inode, off_t offset,
+                                 bool data)
+{
+	if ((offset < 0) || ((uint64_t)offset >= inode->size)) return -ENXIO;
+
+	uint64_t tail = inode_has_tail(inode) ? inode->size - inode->tail.len : inode->size;
+	if ((uint64_t)offset >= tail) return data ? offset : (off_t)inode->size;
+
+	uint64_t lblk = offset / A1FS_BLOCK_SIZE;
+	a1fs_blk_t pblk, len;
+	bool mapped = extent_map(inode, lblk, &pblk, &len);
+
+	if (data) {
+		if (mapped) return offset;
+		// The tail follows the last extent
+		uint64_t next = (len == 0) ? tail : (lblk + len) * A1FS_BLOCK_SIZE;
+		if (next >= inode->size) return -ENXIO;
+		return next;
+	}
+
+	if (!mapped) return offset;
+	// Skip all the extents that are contiguous in the file
+	do {
+		lblk += len;
+	} while (extent_map(inode, lblk, &pblk, &len));
+	uint64_t hole = lblk * A1FS_BLOCK_SIZE;
+	return (hole < tail) ? hole : inode->size;
+}
+
+
+void dir_verify(fs_ctx *fs, const a1fs_inode *dir)
+{
+	a1fs_ino_t ino;
+	if ((fs->dir_verified != NULL) && inode_number(fs, dir, &ino)) fs_verify_dir(fs, ino);
+}
+
+a1fs_dentry *dir_entry(fs_ctx *fs, const a1fs_inode *dir, uint64_t i)
+{
+	const uint64_t per_block = A1FS_BLOCK_SIZE / sizeof(a1fs_dentry);
+	a1fs_blk_t pblk, len;
+	if (!extent_map(dir, i / per_block, &pblk, &len)) return NULL;
+	return (a1fs_dentry*)get_block(fs, pblk) + i % per_block;
+}
+
+/**
+ * Find the index of an entry in a directory.
+ *
+ * @return  0 on success; -ENOENT if there is no entry with given name.
+ */
+static int dir_find(fs_ctx *fs, const a1fs_inode *dir, const char *name,
+                    uint64_t *index)
+{
+	dir_verify(fs, dir);
+	uint64_t n = dir->size / sizeof(a1fs_dentry);
+	for (uint64_t i = 0; i < n; i++) {
+		if (strcmp(dir_entry(fs, dir, i)->name, name) == 0) {
+			*index = i;
+			return 0;
+		}
+	}
+	return -ENOENT;
+}
+
+int dir_lookup(fs_ctx *fs, const a1fs_inode *dir, const char *name,
+               a1fs_ino_t *ino)
+{
+	uint64_t index;
+	int ret = dir_find(fs, dir, name, &index);
+	if (ret == 0) *ino = dir_entry(fs, dir, index)->ino;
+	return ret;
+}
+
+/**
+ * Append an entry to a directory, growing it by a block if needed.
+ *
+ * @return  0 on success; -ENOSPC if there is not enough free space.
+ */
+static int dir_add(fs_ctx *fs, a1fs_inode *dir, const char *name, a1fs_ino_t ino)
+{
+	dir_verify(fs, dir);
+	// The last block may be shared with a snapshot, and is copied then
+	uint64_t n = dir->size / sizeof(a1fs_dentry);
+	int ret = (n % (A1FS_BLOCK_SIZE / sizeof(a1fs_dentry)) == 0)
+	          ? file_alloc_range(fs, dir, dir->size, A1FS_BLOCK_SIZE)
+	          : file_unshare_range(fs, dir, dir->size, sizeof(a1fs_dentry));
+	if (ret != 0) return ret;
+
+	a1fs_dentry *dentry = dir_entry(fs, dir, n);
+	dentry->ino = ino;
+	strncpy(dentry->name, name, A1FS_NAME_MAX);
+	dir->size += sizeof(a1fs_dentry);
+	inode_touch(fs, dir);
+	return 0;
+}
+
+/**
+ * Remove an entry from a directory. The last entry takes its place, and the
+ * last block is freed once it holds no entries.
+ *
+ * @return  0 on success; -ENOSPC if the block of the entry is shared with a
+ *          snapshot and there is not enough free space to copy it.
+ */
+static int dir_remove(fs_ctx *fs, a1fs_inode *dir, uint64_t index)
+{
+	const uint64_t per_block = A1FS_BLOCK_SIZE / sizeof(a1fs_dentry);
+	uint64_t last = dir->size / sizeof(a1fs_dentry) - 1;
+	int ret;
+	dir_verify(fs, dir);
+	if (index != last) {
+		ret = file_unshare_range(fs, dir, index * sizeof(a1fs_dentry),
+		                         sizeof(a1fs_dentry));
+		if (ret != 0) return ret;
+		*dir_entry(fs, dir, index) = *dir_entry(fs, dir, last);
+	}
+	dir->size -= sizeof(a1fs_dentry);
+	if (last % per_block == 0) {
+		ret = file_punch(fs, dir, last / per_block, 1);
+		assert(ret == 0);
+	}
+	inode_touch(fs, dir);
+	return 0;
+}
+
+/**
+ * Resolve a path to an inode number in given inode table: the one of the file
+ * system or a copy in a snapshot.
+ *
+ * Errors:
+ *   ENAMETOOLONG  the path or one of its components is too long.
+ *   ENOENT        a component of the path does not exist.
+ *   ENOTDIR       a component of the path prefix is not a directory.
+ *
+ * @param fs     file system context.
+ * @param table  the inode table.
+ * @param path   absolute path; an empty path refers to the root directory.
+ * @param ino    pointer to the variable that receives the inode number.
+ * @return       0 on success; -errno on error.
+ */
+static int path_walk(fs_ctx *fs, const a1fs_inode *table, const char *path,
+                     a1fs_ino_t *ino)
+{
+	if (strlen(path) >= A1FS_PATH_MAX) return -ENAMETOOLONG;
+
+	a1fs_ino_t cur = A1FS_ROOT_INO;
+	const char *p = path;
+	while (*p != '\0') {
+		while (*p == '/') p++;
+		if (*p == '\0') break;
+
+		size_t len = strcspn(p, "/");
+		if (len >= A1FS_NAME_MAX) return -ENAMETOOLONG;
+		char name[A1FS_NAME_MAX];
+		memcpy(name, p, len);
+		name[len] = '\0';
+		p += len;
+
+		const a1fs_inode *dir = &table[cur];
+		if (!S_ISDIR(dir->mode)) return -ENOTDIR;
+		int ret = dir_lookup(fs, dir, name, &cur);
+		if (ret != 0) return ret;
+	}
+	*ino = cur;
+	return 0;
+}
+
+int path_lookup(fs_ctx *fs, const char *path, a1fs_ino_t *ino)
+{
+	return path_walk(fs, get_inode(fs, 0), path, ino);
+}
+
+int path_parent(fs_ctx *fs, const char *path, a1fs_ino_t *parent,
+                char *name)
+{
+	size_t len = strlen(path);
+	if (len >= A1FS_PATH_MAX) return -ENAMETOOLONG;
+
+	const char *slash = strrchr(path, '/');
+	assert(slash != NULL);
+	if (strlen(slash + 1) >= A1FS_NAME_MAX) return -ENAMETOOLONG;
+	strcpy(name, slash + 1);
+
+	char dir_path[A1FS_PATH_MAX];
+	size_t dir_len = (slash == path) ? 1 : (size_t)(slash - path);
+	memcpy(dir_path, path, dir_len);
+	dir_path[dir_len] = '\0';
+	return path_lookup(fs, dir_path, parent);
+}
+
+
+bool is_stats_file(const char *path)
+{
+	return strcmp(path, A1FS_STATS_PATH) == 0;
+}
+
+char *fs_stats_report(fs_ctx *fs)
+{
+	char *stats = stats_report(&fs->stats);
+	if ((stats == NULL) || (get_sb(fs)->num_quotas == 0)) return stats;
+
+	char *text = NULL;
+	size_t size;
+	FILE *f = open_memstream(&text, &size);
+	if (f == NULL) {
+		free(stats);
+		return NULL;
+	}
+	fputs(stats, f);
+	free(stats);
+	fprintf(f, "\n%-12s %12s %12s %12s %12s %12s\n", "quota", "id", "blocks",
+	        "block_limit", "inodes", "inode_limit");
+	const a1fs_quota *table = quota_table(fs);
+	for (unsigned int i = 0; i < A1FS_QUOTAS_MAX; i++) {
+		const a1fs_quota *q = &table[i];
+		if (q->type == A1FS_QUOTA_NONE) continue;
+		fprintf(f, "%-12s %12u %12lu %12lu %12lu %12lu\n",
+		        (q->type == A1FS_QUOTA_USER) ? "user" : "dir", q->id, q->blocks,
+		        q->block_limit, q->inodes, q->inode_limit);
+	}
+	if (fclose(f) != 0) {
+		free(text);
+		return NULL;
+	}
+	return text;
+}
+
+int stats_file_getattr(fs_ctx *fs, struct stat *st)
+{
+	char *report = fs_stats_report(fs);
+	if (report == NULL) return -ENOMEM;
+	st->st_mode = S_IFREG | 0444;
+	st->st_nlink = 1;
+	// Reads use direct I/O, so this is only a hint for tools like ls and stat
+	st->st_size = strlen(report);
+	clock_gettime(CLOCK_REALTIME, &st->st_mtim);
+	free(report);
+	return 0;
+}
+
+int stats_file_read(fs_ctx *fs, char *buf, size_t size, off_t offset,
+                    struct fuse_file_info *fi)
+{
+	char *report = ((fi != NULL) && (fi->fh != 0)) ? (char*)(uintptr_t)fi->fh
+	                                               : fs_stats_report(fs);
+	if (report == NULL) return -ENOMEM;
+
+	size_t len = strlen(report);
+	size_t n = 0;
+	if ((uint64_t)offset < len) {
+		n = (size > len - offset) ? len - offset : size;
+		memcpy(buf, report + offset, n);
+	}
+	if ((fi == NULL) || (fi->fh == 0)) free(report);
+	return n;
+}
+
+
+
+void open_cache_policy(fs_ctx *fs, a1fs_ino_t ino,
+                       const a1fs_inode *inode, struct fuse_file_info *fi)
+{
+	const a1fs_opts *opts = fs->opts;
+	bool streaming = ((fi->flags & O_ACCMODE) == O_WRONLY) &&
+	                 (fi->flags & (O_TRUNC | O_APPEND));
+	bool direct = (fi->flags & O_DIRECT) ||
+	              ((opts->direct_io_min != 0) &&
+	               ((inode->size >= opts->direct_io_min) || streaming));
+
+	fi->fh = direct ? A1FS_FH_DIRECT_IO : 0;
+	fi->direct_io = direct;
+	fi->keep_cache = !direct && opts->keep_cache &&
+	                 !bitmap_test(fs->cache_stale, ino);
+	if (!direct) bitmap_set(fs->cache_stale, ino, false);
+}
+
+/**
+ * Record that file data was modified bypassing the kernel page cache, so that
+ * pages cached by earlier opens are dropped on the next one.
+ */
+static void cache_invalidate(fs_ctx *fs, a1fs_ino_t ino)
+{
+	bitmap_set(fs->cache_stale, ino, true);
+}
+
+
+bool is_snapshot_path(const char *path)
+{
+	size_t len = strlen(A1FS_SNAPSHOTS_PATH);
+	return (strncmp(path, A1FS_SNAPSHOTS_PATH, len) == 0) &&
+	       ((path[len] == '\0') || (path[len] == '/'));
+}
+
+bool is_snapshot_dir(const char *path)
+{
+	return strcmp(path, A1FS_SNAPSHOTS_PATH) == 0;
+}
+
+const char *snapshot_path_name(const char *path)
+{
+	const char *name = path + strlen(A1FS_SNAPSHOTS_PATH);
+	if (*name != '/') return NULL;
+	name++;
+	return (strchr(name, '/') == NULL) ? name : NULL;
+}
+
+a1fs_snapshot *snapshot_list(fs_ctx *fs)
+{
+	return get_block(fs, get_sb(fs)->snapshot_list);
+}
+
+const uint8_t *snapshot_inode_bmp(fs_ctx *fs, const a1fs_snapshot *snap)
+{
+	return get_block(fs, snap->start);
+}
+
+const a1fs_inode *snapshot_inode_table(fs_ctx *fs, const a1fs_snapshot *snap)
+{
+	const a1fs_superblock *sb = get_sb(fs);
+	return get_block(fs, snap->start + (sb->datablock_bmp - sb->inode_bmp));
+}
+
+int snapshot_find(fs_ctx *fs, const char *name)
+{
+	const a1fs_superblock *sb = get_sb(fs);
+	for (unsigned int i = 0; i < sb->num_snapshots; i++) {
+		if (strcmp(snapshot_list(fs)[i].name, name) == 0) return i;
+	}
+	return -1;
+}
+
+/**
+ * Take or drop a reference to each data block of a file: the blocks mapped by
+ * its extents, the clusters of a compressed file, the xattr block and the tail.
+ * Blocks that are no longer referenced are freed.
+ */
+static void inode_blocks_ref(fs_ctx *fs, const a1fs_inode *inode, bool get)
+{
+	if (inode_has_tail(inode)) {
+		if (get) {
+			tail_get(fs, &inode->tail);
+		} else {
+			tail_put(fs, &inode->tail);
+		}
+	}
+	if (inode->flags & A1FS_INODE_XATTR_BLOCK) {
+		if (get) {
+			block_get(fs, inode->xattr_block, 1);
+		} else {
+			xattr_block_put(fs, inode->xattr_block);
+		}
+	}
+
+	// Clusters first, since dropping the cluster map may free it
+	for (int i = 0; inode_compressed(inode) && (i < extent_count(inode)); i++) {
+		const a1fs_extent *ext = &inode->extent_array[i];
+		for (a1fs_blk_t b = 0; b < ext->count; b++) {
+			const a1fs_cluster *map = get_block(fs, ext->start + b);
+			for (size_t c = 0; c < A1FS_CLUSTERS_PER_BLOCK; c++) {
+				if (map[c].size == 0) continue;
+				if (get) {
+					block_get(fs, map[c].start, size_to_blocks(map[c].size));
+				} else {
+					block_put(fs, map[c].start, size_to_blocks(map[c].size));
+				}
+			}
+		}
+	}
+	for (int i = 0; i < extent_count(inode); i++) {
+		const a1fs_extent *ext = &inode->extent_array[i];
+		if (get) {
+			block_get(fs, ext->start, ext->count);
+		} else {
+			block_put(fs, ext->start, ext->count);
+		}
+	}
+}
+
+int snapshot_create(fs_ctx *fs, const char *name)
+{
+	a1fs_superblock *sb = get_sb(fs);
+	if (snapshot_find(fs, name) >= 0) return -EEXIST;
+	if (sb->num_snapshots == A1FS_SNAPSHOTS_MAX) return -ENOSPC;
+
+	a1fs_blk_t bmp_blocks = sb->datablock_bmp - sb->inode_bmp;
+	a1fs_blk_t table_blocks = sb->data_table - sb->inode_table;
+	a1fs_extent list = {0}, copy;
+	int ret;
+	if ((sb->num_snapshots == 0) && ((ret = block_alloc(fs, 0, 1, &list)) != 0)) {
+		return ret;
+	}
+	if ((ret = block_alloc_contig(fs, 0, bmp_blocks + table_blocks, &copy)) != 0) {
+		if (list.count != 0) block_put(fs, list.start, 1);
+		return ret;
+	}
+	// The copy of the inode table has the current modification times
+	fs_lazy_mtime_flush(fs);
+	memcpy(get_block(fs, copy.start), fs->image + (size_t)sb->inode_bmp * A1FS_BLOCK_SIZE,
+	       (size_t)bmp_blocks * A1FS_BLOCK_SIZE);
+	memcpy(get_block(fs, copy.start + bmp_blocks),
+	       fs->image + (size_t)sb->inode_table * A1FS_BLOCK_SIZE,
+	       (size_t)table_blocks * A1FS_BLOCK_SIZE);
+	stats_count(&fs->stats, A1FS_STAT_BLOCKS_WRITTEN, copy.count);
+
+	if (sb->num_snapshots == 0) sb->snapshot_list = list.start;
+	a1fs_snapshot *snap = &snapshot_list(fs)[sb->num_snapshots++];
+	memset(snap, 0, sizeof(*snap));
+	strncpy(snap->name, name, A1FS_NAME_MAX - 1);
+	snap->start = copy.start;
+	snap->count = copy.count;
+	clock_gettime(CLOCK_REALTIME, &snap->time);
+	// Changes made from now on are newer than the snapshot
+	snap->generation = sb->generation++;
+
+	const uint8_t *bmp = snapshot_inode_bmp(fs, snap);
+	const a1fs_inode *table = snapshot_inode_table(fs, snap);
+	for (a1fs_ino_t ino = 0; ino < sb->num_inodes; ino++) {
+		if (bitmap_test(bmp, ino)) inode_blocks_ref(fs, &table[ino], true);
+	}
+	return 0;
+}
+
+void snapshot_delete(fs_ctx *fs, int index)
+{
+	a1fs_superblock *sb = get_sb(fs);
+	a1fs_snapshot *list = snapshot_list(fs);
+	const uint8_t *bmp = snapshot_inode_bmp(fs, &list[index]);
+	const a1fs_inode *table = snapshot_inode_table(fs, &list[index]);
+	for (a1fs_ino_t ino = 0; ino < sb->num_inodes; ino++) {
+		if (bitmap_test(bmp, ino)) inode_blocks_ref(fs, &table[ino], false);
+	}
+	block_put(fs, list[index].start, list[index].count);
+
+	// Keep the list in creation order
+	memmove(&list[index], &list[index + 1],
+	        (sb->num_snapshots - index - 1) * sizeof(a1fs_snapshot));
+	if (--sb->num_snapshots == 0) {
+		block_put(fs, sb->snapshot_list, 1);
+		sb->snapshot_list = 0;
+	}
+}
+
+/**
+ * Resolve a path inside a snapshot: "/.snapshots/NAME/dir/file" is "/dir/file"
+ * in snapshot NAME.
+ *
+ * Errors:
+ *   ENAMETOOLONG  the path or one of its components is too long.
+ *   ENOENT        there is no such snapshot, a component of the path does not
+ *                 exist in it, or the path is the snapshot directory itself.
+ *   ENOTDIR       a component of the path prefix is not a directory.
+ *
+ * @param fs     file system context.
+ * @param path   absolute path under the snapshot directory.
+ * @param ino    pointer to the variable that receives the inode number.
+ * @param inode  pointer to the variable that receives a pointer to the inode
+ *               in the copy of the inode table.
+ * @return       0 on success; -errno on error.
+ */
+static int snapshot_lookup(fs_ctx *fs, const char *path, a1fs_ino_t *ino,
+                           const a1fs_inode **inode)
+{
+	const char *name = path + strlen(A1FS_SNAPSHOTS_PATH);
+	if (*name != '/') return -ENOENT;
+	name++;
+	size_t len = strcspn(name, "/");
+	if (len >= A1FS_NAME_MAX) return -ENAMETOOLONG;
+	char buf[A1FS_NAME_MAX];
+	memcpy(buf, name, len);
+	buf[len] = '\0';
+
+	int i = snapshot_find(fs, buf);
+	if (i < 0) return -ENOENT;
+	const a1fs_inode *table = snapshot_inode_table(fs, &snapshot_list(fs)[i]);
+	int ret = path_walk(fs, table, name + len, ino);
+	if (ret == 0) *inode = &table[*ino];
+	return ret;
+}
+
+int path_lookup_ro(fs_ctx *fs, const char *path, a1fs_ino_t *ino,
+                   const a1fs_inode **inode)
+{
+	if (is_snapshot_path(path)) return snapshot_lookup(fs, path, ino, inode);
+	int ret = path_lookup(fs, path, ino);
+	if (ret == 0) *inode = get_inode(fs, *ino);
+	return ret;
+}
+
+int snapshot_dir_getattr(fs_ctx *fs, struct stat *st)
+{
+	const a1fs_superblock *sb = get_sb(fs);
+	st->st_mode = S_IFDIR | 0555;
+	// "." and the entry in the root, and ".." of each snapshot
+	st->st_nlink = 2 + sb->num_snapshots;
+	if (sb->num_snapshots > 0) {
+		st->st_mtim = snapshot_list(fs)[sb->num_snapshots - 1].time;
+	}
+	return 0;
+}
+
+int snapshot_dir_readdir(fs_ctx *fs, void *buf, fuse_fill_dir_t filler)
+{
+	const a1fs_superblock *sb = get_sb(fs);
+	if ((filler(buf, ".", NULL, 0) != 0) || (filler(buf, "..", NULL, 0) != 0)) {
+		return -ENOMEM;
+	}
+	for (unsigned int i = 0; i < sb->num_snapshots; i++) {
+		if (filler(buf, snapshot_list(fs)[i].name, NULL, 0) != 0) return -ENOMEM;
+	}
+	return 0;
+}
+
+
+/**
+ * Find a quota.
+ *
+ * @return  quota table slot + 1 of the quota; 0 if there is none.
+ */
+static uint16_t quota_find(fs_ctx *fs, uint32_t type, uint32_t id)
+{
+	if (get_sb(fs)->num_quotas == 0) return 0;
+	const a1fs_quota *table = quota_table(fs);
+	for (unsigned int i = 0; i < A1FS_QUOTAS_MAX; i++) {
+		if ((table[i].type == type) && (table[i].id == id)) return i + 1;
+	}
+	return 0;
+}
+
+/**
+ * Set the owner of a new inode and charge it to its quotas: the user quota of
+ * the owner and the quota of the directory tree it is created in.
+ *
+ * @param fs      file system context.
+ * @param inode   the new inode.
+ * @param parent  the directory the inode is created in.
+ * @return        0 on success; -EDQUOT if a quota has no room for the inode.
+ */
+static int quota_inode_init(fs_ctx *fs, a1fs_inode *inode, const a1fs_inode *parent)
+{
+	inode->uid = fs->caller_uid;
+	// Files are usually created by the owner of the directory
+	inode->user_quota = (parent->uid == inode->uid) ? parent->user_quota
+	                    : quota_find(fs, A1FS_QUOTA_USER, inode->uid);
+	inode->dir_quota = parent->dir_quota;
+
+	a1fs_quota *quotas[2];
+	inode_quotas(fs, inode, quotas);
+	for (int i = 0; i < 2; i++) {
+		const a1fs_quota *q = quotas[i];
+		if ((q != NULL) && (q->inode_limit != 0) && (q->inodes >= q->inode_limit)) {
+			inode->user_quota = 0;
+			inode->dir_quota = 0;
+			return -EDQUOT;
+		}
+	}
+	quota_charge(fs, inode, 0, 1);
+	return 0;
+}
+
+/**
+ * Move the usage of an inode from its user or directory quota to another one.
+ *
+ * @param fs     file system context.
+ * @param inode  the inode.
+ * @param dir    true to move the directory quota; false for the user quota.
+ * @param slot   quota table slot + 1 of the new quota; 0 for none.
+ */
+static void quota_move(fs_ctx *fs, a1fs_inode *inode, bool dir, uint16_t slot)
+{
+	uint16_t *field = dir ? &inode->dir_quota : &inode->user_quota;
+	uint64_t blocks = inode_blocks(fs, inode);
+	if (*field != 0) {
+		quota_table(fs)[*field - 1].blocks -= blocks;
+		quota_table(fs)[*field - 1].inodes--;
+	}
+	if (slot != 0) {
+		quota_table(fs)[slot - 1].blocks += blocks;
+		quota_table(fs)[slot - 1].inodes++;
+	}
+	*field = slot;
+}
+
+/**
+ * Move the inodes of a directory tree from one directory quota to another.
+ * Subtrees under a different quota (their own) are left as they are.
+ */
+static void quota_move_tree(fs_ctx *fs, a1fs_ino_t ino, uint16_t from, uint16_t to)
+{
+	a1fs_inode *inode = get_inode(fs, ino);
+	if (inode->dir_quota != from) return;
+	quota_move(fs, inode, true, to);
+	if (!S_ISDIR(inode->mode)) return;
+
+	dir_verify(fs, inode);
+	for (uint64_t i = 0; i < inode->size / sizeof(a1fs_dentry); i++) {
+		const a1fs_dentry *d = dir_entry(fs, inode, i);
+		if ((strcmp(d->name, ".") != 0) && (strcmp(d->name, "..") != 0)) {
+			quota_move_tree(fs, d->ino, from, to);
+		}
+	}
+}
+
+/** Free a quota table slot; the table itself goes with the last quota. */
+static void quota_delete(fs_ctx *fs, uint16_t slot)
+{
+	a1fs_superblock *sb = get_sb(fs);
+	memset(&quota_table(fs)[slot - 1], 0, sizeof(a1fs_quota));
+	if (--sb->num_quotas == 0) {
+		block_put(fs, sb->quota_table, 1);
+		sb->quota_table = 0;
+	}
+}
+
+/**
+ * Set the limits of a quota, creating it if there is none (see
+ * A1FS_IOC_SET_QUOTA). Counting the usage of a new quota scans the files it
+ * covers: the inode table for a user quota, or the directory tree.
+ *
+ * Errors:
+ *   EINVAL  invalid quota type, or a directory quota on a file.
+ *   ENOSPC  there are A1FS_QUOTAS_MAX quotas already, or no free block for
+ *           the quota table.
+ *
+ * @param fs      file system context.
+ * @param ino     inode number of the file the ioctl was called on.
+ * @param limits  the quota and its limits.
+ * @return        0 on success; -errno on error.
+ */
+static int quota_set(fs_ctx *fs, a1fs_ino_t ino, const a1fs_quota_limits *limits)
+{
+	a1fs_superblock *sb = get_sb(fs);
+	uint32_t id = limits->id;
+	if (limits->type == A1FS_QUOTA_DIR) {
+		if (!S_ISDIR(get_inode(fs, ino)->mode)) return -EINVAL;
+		id = ino;
+	} else if (limits->type != A1FS_QUOTA_USER) {
+		return -EINVAL;
+	}
+
+	uint16_t slot = quota_find(fs, limits->type, id);
+	if (slot == 0) {
+		if (sb->num_quotas == A1FS_QUOTAS_MAX) return -ENOSPC;
+		if (sb->num_quotas == 0) {
+			a1fs_extent ext;
+			int ret = block_alloc(fs, 0, 1, &ext);
+			if (ret != 0) return ret;
+			sb->quota_table = ext.start;
+			memset(quota_table(fs), 0, A1FS_BLOCK_SIZE);
+		}
+		while (quota_table(fs)[slot].type != A1FS_QUOTA_NONE) slot++;
+		sb->num_quotas++;
+		a1fs_quota *q = &quota_table(fs)[slot++];
+		q->type = limits->type;
+		q->id = id;
+
+		if (limits->type == A1FS_QUOTA_DIR) {
+			quota_move_tree(fs, ino, get_inode(fs, ino)->dir_quota, slot);
+		} else {
+			const uint8_t *bmp = fs->image + sb->inode_bmp * A1FS_BLOCK_SIZE;
+			for (a1fs_ino_t i = 0; i < sb->num_inodes; i++) {
+				a1fs_inode *inode = get_inode(fs, i);
+				if (bitmap_test(bmp, i) && (inode->uid == id)) quota_move(fs, inode, false, slot);
+			}
+		}
+	}
+	quota_table(fs)[slot - 1].block_limit = limits->block_limit;
+	quota_table(fs)[slot - 1].inode_limit = limits->inode_limit;
+	return 0;
+}
+
+/**
+ * Remove a quota (see A1FS_IOC_REMOVE_QUOTA). The files of a directory quota
+ * fall back under the quota of the enclosing tree, if any.
+ *
+ * Errors:
+ *   EINVAL  invalid quota type.
+ *   ENOENT  there is no such quota.
+ *
+ * @param fs      file system context.
+ * @param ino     inode number of the file the ioctl was called on.
+ * @param limits  the quota; the limits are ignored.
+ * @return        0 on success; -errno on error.
+ */
+static int quota_remove(fs_ctx *fs, a1fs_ino_t ino, const a1fs_quota_limits *limits)
+{
+	a1fs_superblock *sb = get_sb(fs);
+	if ((limits->type != A1FS_QUOTA_DIR) && (limits->type != A1FS_QUOTA_USER)) return -EINVAL;
+	uint32_t id = (limits->type == A1FS_QUOTA_DIR) ? ino : limits->id;
+	uint16_t slot = quota_find(fs, limits->type, id);
+	if (slot == 0) return -ENOENT;
+
+	if (limits->type == A1FS_QUOTA_DIR) {
+		a1fs_ino_t parent;
+		int ret = dir_lookup(fs, get_inode(fs, ino), "..", &parent);
+		assert(ret == 0);
+		(void)ret;
+		uint16_t to = (parent != ino) ? get_inode(fs, parent)->dir_quota : 0;
+		quota_move_tree(fs, ino, slot, to);
+	} else {
+		const uint8_t *bmp = fs->image + sb->inode_bmp * A1FS_BLOCK_SIZE;
+		for (a1fs_ino_t i = 0; i < sb->num_inodes; i++) {
+			a1fs_inode *inode = get_inode(fs, i);
+			if (bitmap_test(bmp, i) && (inode->user_quota == slot)) {
+				quota_move(fs, inode, false, 0);
+			}
+		}
+	}
+	quota_delete(fs, slot);
+	return 0;
+}
+
+
+/*
+ * Operations on inodes. The path-based callbacks below resolve their paths and
+ * call these; the low-level API front end (a1fs_ll.c) calls them directly with
+ * the inode numbers that the kernel passes.
+ */
+
+void inode_getattr(fs_ctx *fs, const a1fs_inode *inode, struct stat *st)
+{
+	st->st_mode = inode->mode;
+	st->st_nlink = inode->links;
+	st->st_uid = inode->uid;
+	st->st_size = inode->size;
+	// Holes are not allocated, so sparse files report fewer blocks than size
+	st->st_blocks = inode_blocks(fs, inode) * (A1FS_BLOCK_SIZE / 512);
+	if (inode_has_tail(inode)) {
+		st->st_blocks += (tail_units(inode->tail.len) * A1FS_TAIL_UNIT + 511) / 512;
+	}
+	st->st_mtim = inode_mtime(fs, inode);
+}
+
+int file_pread(fs_ctx *fs, a1fs_ino_t ino, const a1fs_inode *inode,
+               char *buf, size_t size, off_t offset)
+{
+	if ((uint64_t)offset >= inode->size) return 0;
+	if (size > inode->size - offset) size = inode->size - offset;
+
+	if (inode_compressed(inode)) {
+		int ret = compressed_read(fs, ino, inode, buf, size, offset);
+		return (ret != 0) ? ret : (int)size;
+	}
+
+	io_batch batch;
+	io_batch_init(fs, &batch, inode, offset, size, false);
+	size_t done = 0;
+	while (done < size) {
+		uint64_t pos = offset + done;
+		size_t blk_off = pos % A1FS_BLOCK_SIZE;
+		size_t n = size - done;
+		a1fs_blk_t pblk, len;
+		if (extent_map(inode, pos / A1FS_BLOCK_SIZE, &pblk, &len)) {
+			if (n > (size_t)len * A1FS_BLOCK_SIZE - blk_off) {
+				n = (size_t)len * A1FS_BLOCK_SIZE - blk_off;
+			}
+			int ret = io_batch_add(fs, &batch, pblk, blk_off, buf + done, n);
+			if (ret != 0) return ret;
+			stats_count(&fs->stats, A1FS_STAT_BLOCKS_READ,
+			            (blk_off + n + A1FS_BLOCK_SIZE - 1) / A1FS_BLOCK_SIZE);
+		} else if (inode_has_tail(inode) && (pos >= inode->size - inode->tail.len)) {
+			// The tail ends at EOF, so it holds the rest of the range
+			memcpy(buf + done, tail_data(fs, &inode->tail) + blk_off, n);
+			stats_count(&fs->stats, A1FS_STAT_BLOCKS_READ, 1);
+		} else {
+			// The whole hole is zero-filled at once; len == 0 means it
+			// extends to EOF, or to the tail if there is one
+			if ((len == 0) && inode_has_tail(inode)) {
+				len = inode->size / A1FS_BLOCK_SIZE - pos / A1FS_BLOCK_SIZE;
+			}
+			if ((len != 0) && (n > (size_t)len * A1FS_BLOCK_SIZE - blk_off)) {
+				n = (size_t)len * A1FS_BLOCK_SIZE - blk_off;
+			}
+			memset(buf + done, 0, n);
+		}
+		done += n;
+	}
+	int ret = io_batch_finish(&batch);
+	return (ret != 0) ? ret : (int)size;
+}
+
+int file_pwrite(fs_ctx *fs, a1fs_ino_t ino, a1fs_inode *inode,
+                const char *buf, size_t size, off_t offset, bool direct)
+{
+	if (size == 0) return 0;
+	uint64_t end = offset + size;
+	if (size_to_blocks(end) > (uint64_t)UINT32_MAX + 1) return -EFBIG;
+	if (direct) cache_invalidate(fs, ino);
+
+	if (inode_compressed(inode)) {
+		// A short count still extends the file over the clusters it stored
+		int ret = compressed_write(fs, ino, inode, buf, size, offset);
+		if (ret < 0) return ret;
+		if (offset + (uint64_t)ret > inode->size) inode->size = offset + ret;
+		inode_touch(fs, inode);
+		return ret;
+	}
+
+	// Writing at or past the start of the tail makes it a block of the file again
+	int ret;
+	if (inode_has_tail(inode) && (end > inode->size - inode->tail.len) &&
+	    ((ret = tail_unpack(fs, inode)) != 0))
+	{
+		return ret;
+	}
+	if (dedup_index_enabled(fs)) {
+		ret = file_write_dedup(fs, inode, buf, size, offset);
+	} else if ((ret = file_write(fs, inode, buf, size, offset)) == 0) {
+		ret = size;
+	}
+	// A short count still extends the file over the part that was written;
+	// anything written past that is dropped again
+	if ((ret > 0) && (offset + (uint64_t)ret > inode->size)) {
+		inode->size = offset + ret;
+	}
+	if ((size_t)ret != size) file_write_undo(fs, inode);
+	if (ret < 0) return ret;
+
+	inode_touch(fs, inode);
+	return ret;
+}
+
+int dir_mkdir(fs_ctx *fs, a1fs_ino_t parent, const char *name, mode_t mode,
+              a1fs_ino_t *ino)
+{
+	int ret = inode_alloc(fs, ino);
+	if (ret != 0) return ret;
+	a1fs_inode *inode = get_inode(fs, *ino);
+	a1fs_inode *parent_inode = get_inode(fs, parent);
+	if ((ret = quota_inode_init(fs, inode, parent_inode)) != 0) {
+		inode_free(fs, *ino);
+		return ret;
+	}
+	inode->mode = mode | S_IFDIR;
+	// The entry in the parent and "."
+	inode->links = 2;
+	inode->size = 0;
+	inode_touch(fs, inode);
+
+	if (((ret = dir_add(fs, inode, ".", *ino)) != 0) ||
+	    ((ret = dir_add(fs, inode, "..", parent)) != 0) ||
+	    ((ret = dir_add(fs, parent_inode, name, *ino)) != 0))
+	{
+		inode_free_data(fs, *ino, inode);
+		inode_free(fs, *ino);
+		return ret;
+	}
+	// ".." of the new directory
+	parent_inode->links++;
+	return 0;
+}
+
+int dir_mkfile(fs_ctx *fs, a1fs_ino_t parent, const char *name, mode_t mode,
+               a1fs_ino_t *ino)
+{
+	int ret = inode_alloc(fs, ino);
+	if (ret != 0) return ret;
+	a1fs_inode *inode = get_inode(fs, *ino);
+	a1fs_inode *parent_inode = get_inode(fs, parent);
+	if ((ret = quota_inode_init(fs, inode, parent_inode)) != 0) {
+		inode_free(fs, *ino);
+		return ret;
+	}
+	inode->mode = mode;
+	inode->links = 1;
+	inode->size = 0;
+	if (fs->opts->compress) inode->flags |= A1FS_INODE_COMPRESSED;
+	inode_touch(fs, inode);
+
+	if ((ret = dir_add(fs, parent_inode, name, *ino)) != 0) {
+		inode_free(fs, *ino);
+		return ret;
+	}
+	return 0;
+}
+
+void inode_delete(fs_ctx *fs, a1fs_ino_t ino)
+{
+	a1fs_inode *inode = get_inode(fs, ino);
+	assert(inode->links == 0);
+	// The quota of a directory goes with it; its inode number may be reused
+	uint16_t slot = inode->dir_quota;
+	bool own_quota = S_ISDIR(inode->mode) && (slot != 0) &&
+	                 (quota_table(fs)[slot - 1].id == ino) &&
+	                 (quota_table(fs)[slot - 1].type == A1FS_QUOTA_DIR);
+	inode_free_data(fs, ino, inode);
+	inode_free(fs, ino);
+	if (own_quota) quota_delete(fs, slot);
+}
+
+int dir_unlink(fs_ctx *fs, a1fs_ino_t parent, const char *name, a1fs_ino_t *ino)
+{
+	a1fs_inode *parent_inode = get_inode(fs, parent);
+	uint64_t index;
+	int ret = dir_find(fs, parent_inode, name, &index);
+	if (ret != 0) return ret;
+	*ino = dir_entry(fs, parent_inode, index)->ino;
+	a1fs_inode *inode = get_inode(fs, *ino);
+	if (S_ISDIR(inode->mode)) return -EISDIR;
+
+	if ((ret = dir_remove(fs, parent_inode, index)) != 0) return ret;
+	inode->links--;
+	return 0;
+}
+
+int dir_rmdir(fs_ctx *fs, a1fs_ino_t parent, const char *name, a1fs_ino_t *ino)
+{
+	a1fs_inode *parent_inode = get_inode(fs, parent);
+	uint64_t index;
+	int ret = dir_find(fs, parent_inode, name, &index);
+	if (ret != 0) return ret;
+	*ino = dir_entry(fs, parent_inode, index)->ino;
+	a1fs_inode *inode = get_inode(fs, *ino);
+	if (!S_ISDIR(inode->mode)) return -ENOTDIR;
+
+	// Only "." and ".." are left in an empty directory
+	if (inode->size > 2 * sizeof(a1fs_dentry)) return -ENOTEMPTY;
+
+	if ((ret = dir_remove(fs, parent_inode, index)) != 0) return ret;
+	parent_inode->links--;
+	inode->links = 0;
+	return 0;
+}
+
+
+int file_ioctl(fs_ctx *fs, a1fs_ino_t ino, const a1fs_inode *inode,
+               bool snapshot, unsigned int cmd, void *data)
+{
+	switch (cmd) {
+		case A1FS_IOC_SEEK_DATA:
+		case A1FS_IOC_SEEK_HOLE: {
+			int64_t *offset = (int64_t*)data;
+			bool seek_data = cmd == A1FS_IOC_SEEK_DATA;
+			// Holes in compressed files are not tracked; report all data
+			if (inode_compressed(inode)) {
+				if ((*offset < 0) || ((uint64_t)*offset >= inode->size)) return -ENXIO;
+				if (!seek_data) *offset = inode->size;
+				return 0;
+			}
+			off_t pos = file_seek_hole_data(inode, *offset, seek_data);
+			if (pos < 0) return pos;
+			*offset = pos;
+			return 0;
+		}
+		case A1FS_IOC_CLONE_RANGE: {
+			a1fs_clone_range *range = (a1fs_clone_range*)data;
+			range->src_path[A1FS_PATH_MAX - 1] = '\0';
+			// Cloning from a snapshot restores a file without copying it
+			if (snapshot) return -EROFS;
+			a1fs_ino_t src_ino;
+			const a1fs_inode *src;
+			int ret = path_lookup_ro(fs, range->src_path, &src_ino, &src);
+			if (ret != 0) return ret;
+			if (!S_ISREG(src->mode) || !S_ISREG(inode->mode)) return -EINVAL;
+			if (inode_compressed(src) || inode_compressed(inode)) return -EOPNOTSUPP;
+			cache_invalidate(fs, ino);
+			return file_clone(fs, get_inode(fs, ino), src, range->src_offset,
+			                  range->src_length, range->dest_offset);
+		}
+		case A1FS_IOC_RESIZE: {
+			// Growing the image takes space on the host; only root and the user
+			// that mounted the file system can do it
+			uid_t uid = fs->caller_uid;
+			if ((uid != 0) && (uid != getuid())) return -EPERM;
+			return fs_ctx_grow(fs, *(uint64_t*)data);
+		}
+		case A1FS_IOC_DEFRAG:
+			if (snapshot) return -EROFS;
+			return file_defrag(fs, get_inode(fs, ino), (a1fs_defrag_args*)data);
+		case A1FS_IOC_SET_QUOTA:
+		case A1FS_IOC_REMOVE_QUOTA: {
+			// Only root and the user that mounted the file system manage quotas
+			uid_t uid = fs->caller_uid;
+			if ((uid != 0) && (uid != getuid())) return -EPERM;
+			if (snapshot) return -EROFS;
+			const a1fs_quota_limits *limits = (const a1fs_quota_limits*)data;
+			return (cmd == A1FS_IOC_SET_QUOTA) ? quota_set(fs, ino, limits)
+			                                                 : quota_remove(fs, ino, limits);
+		}
+		default: return -ENOTTY;
+	}
+}
+
+/** Write a range of the mapped image back to the image file. */
+static int image_sync(const void *addr, size_t len)
+{
+	// msync() needs a page-aligned start address
+	uintptr_t page = sysconf(_SC_PAGESIZE);
+	uintptr_t start = (uintptr_t)addr & ~(page - 1);
+	if (msync((void*)start, (uintptr_t)addr + len - start, MS_SYNC) < 0) return -errno;
+	return 0;
+}
+
+int file_fsync(fs_ctx *fs, a1fs_inode *inode)
+{
+	lazytime_writeback(fs, inode);
+	for (int i = 0; i < extent_count(inode); i++) {
+		const a1fs_extent *ext = &inode->extent_array[i];
+		int ret = image_sync(get_block(fs, ext->start), (size_t)ext->count * A1FS_BLOCK_SIZE);
+		if (ret != 0) return ret;
+		if (!inode_compressed(inode)) continue;
+
+		// The extents of a compressed file hold its cluster map
+		for (a1fs_blk_t b = 0; b < ext->count; b++) {
+			const a1fs_cluster *map = get_block(fs, ext->start + b);
+			for (size_t c = 0; c < A1FS_CLUSTERS_PER_BLOCK; c++) {
+				if (map[c].size == 0) continue;
+				ret = image_sync(get_block(fs, map[c].start), map[c].size);
+				if (ret != 0) return ret;
+			}
+		}
+	}
+
+	if (inode_has_tail(inode)) {
+		int ret = image_sync(get_block(fs, inode->tail.block), A1FS_BLOCK_SIZE);
+		if (ret != 0) return ret;
+	}
+
+	// The data bitmap is followed by the reference counts and the dedup index
+	a1fs_superblock *sb = get_sb(fs);
+	int ret = image_sync(fs->image + (size_t)sb->datablock_bmp * A1FS_BLOCK_SIZE,
+	                     (size_t)(sb->inode_table - sb->datablock_bmp) * A1FS_BLOCK_SIZE);
+	if (ret != 0) return ret;
+	return image_sync(inode, sizeof(*inode));
+}
+
+
+int inode_setxattr(fs_ctx *fs, a1fs_inode *inode, const char *name,
+                   const char *value, size_t size, int flags)
+{
+	size_t name_len = strlen(name);
+	if ((name_len == 0) || (name_len > A1FS_XATTR_NAME_MAX)) return -ERANGE;
+	if (size > A1FS_BLOCK_SIZE - sizeof(a1fs_xattr_entry) - name_len) return -E2BIG;
+
+	xattr list[XATTR_MAX_COUNT + 1];
+	int n = xattr_load(fs, inode, list);
+	int i = xattr_find(list, n, name);
+	if ((flags & XATTR_CREATE) && (i >= 0)) return -EEXIST;
+	if ((flags & XATTR_REPLACE) && (i < 0)) return -ENODATA;
+	if (i < 0) {
+		i = n++;
+		list[i].name = name;
+		list[i].name_len = name_len;
+	}
+	list[i].value = value;
+	list[i].value_len = size;
+	return xattr_store(fs, inode, list, n);
+}
+
+int inode_getxattr(fs_ctx *fs, const a1fs_inode *inode, const char *name,
+                   char *value, size_t size)
+{
+	xattr list[XATTR_MAX_COUNT];
+	int n = xattr_parse(inode->xattr, inode_xattr_size(fs), list, 0);
+	int i = xattr_find(list, n, name);
+	if ((i < 0) && (inode->flags & A1FS_INODE_XATTR_BLOCK)) {
+		n = xattr_parse(get_block(fs, inode->xattr_block), A1FS_BLOCK_SIZE, list, 0);
+		i = xattr_find(list, n, name);
+	}
+	if (i < 0) return -ENODATA;
+
+	if (size == 0) return list[i].value_len;
+	if (size < list[i].value_len) return -ERANGE;
+	memcpy(value, list[i].value, list[i].value_len);
+	return list[i].value_len;
+}
+
+int inode_listxattr(fs_ctx *fs, const a1fs_inode *inode, char *buf,
+                    size_t size)
+{
+	xattr list[XATTR_MAX_COUNT];
+	int n = xattr_load(fs, inode, list);
+	size_t total = 0;
+	for (int i = 0; i < n; i++) total += list[i].name_len + 1;
+	if (size == 0) return total;
+	if (size < total) return -ERANGE;
+
+	for (int i = 0; i < n; i++) {
+		memcpy(buf, list[i].name, list[i].name_len);
+		buf[list[i].name_len] = '\0';
+		buf += list[i].name_len + 1;
+	}
+	return total;
+}
+
+int inode_removexattr(fs_ctx *fs, a1fs_inode *inode, const char *name)
+{
+	xattr list[XATTR_MAX_COUNT];
+	int n = xattr_load(fs, inode, list);
+	int i = xattr_find(list, n, name);
+	if (i < 0) return -ENODATA;
+	list[i] = list[--n];
+	return xattr_store(fs, inode, list, n);
+}
+
+
+/**
+ * Get file system statistics.
+ *
+ * Implements the statvfs() system call. See "man 2 statvfs" for details.
+ * The f_bfree and f_bavail fields should be set to the same value.
+ * The f_ffree and f_favail fields should be set to the same value.
+ * The f_fsid and f_flag fields are ignored.
+ *
+ * @param path  path to any file in the file system. Can be ignored.
+ * @param st    pointer to the struct statvfs that receives the result.
+ * @return      0 on success; -errno on error.
+ */
+void fs_statfs(fs_ctx *fs, struct statvfs *st)
+{
+	a1fs_superblock* superblock = (a1fs_superblock *)fs->image;
+
+	memset(st, 0, sizeof(*st));
+	st->f_bsize   = A1FS_BLOCK_SIZE;
+	st->f_frsize  = A1FS_BLOCK_SIZE;
+	//TODO
+	st->f_bsize = A1FS_BLOCK_SIZE;
+	st->f_files = superblock->num_inodes;
+	st->f_bfree = superblock->num_unused_blocks;
+	st->f_ffree = superblock->num_unused_inodes;
+	st->f_bavail = superblock->num_unused_blocks;
+	st->f_favail = superblock->num_unused_inodes;
+	st->f_namemax = A1FS_NAME_MAX;
+}
+
+
+void trace_op(fs_ctx *fs, a1fs_stats_op op, uint64_t start, int ret,
+              a1fs_ino_t ino, const char *path, const char *name,
+              uint64_t offset, uint64_t size)
+{
+	a1fs_trace_record rec = {
+		.offset = offset,
+		.size = size,
+		.result = ret,
+		.ino = ino,
+		.pid = fs->caller_pid,
+		.op = op,
+	};
+	trace_record(fs->trace, &rec, start, path, name);
+}
@@ -0,0 +1,622 @@
+/*
+ * This code is provided solely for the personal and private use of students
+ * taking the CSC369H course at the University of Toronto. Copying for purposes
+ * other than this use is expressly prohibited. All forms of distribution of
+ * this code, including but not limited to public repositories on GitHub,
+ * GitLab, Bitbucket, or any other online platform, whether as given or with
+ * any changes, are expressly prohibited.
+ *
+ * Authors: Alexey Khrabrov, Karen Reid
+ *
+ * All of the files in this directory and all subdirectories are:
+ * Copyright (c) 2019 Karen Reid
+ */
+
+/**
+ * CSC369 Assignment 1 - a1fs inode-based operations header file.
+ *
+ * The file system logic shared by all the front ends: the path-based FUSE
+ * callbacks (fuse_ops.c), the low-level FUSE API (a1fs_ll.c), liba1fs, and the
+ * send and receive tools. The operations work on inode numbers and inodes; the
+ * front ends resolve paths or node IDs and record the caller's credentials in
+ * fs->caller_uid and fs->caller_pid before calling them.
+ */
+
+#pragma once
+
+#include <stdbool.h>
+#include <sys/stat.h>
+#include <sys/statvfs.h>
+#include <sys/types.h>
+// Using 2.9.x FUSE API
+#define FUSE_USE_VERSION 29
+#include <fuse.h>
+
+#include "a1fs.h"
+#include "fs_ctx.h"
+#include "options.h"
+#include "stats.h"
+
+
+/**
+ * Initialize the file system.
+ *
+ * Called when the file system is mounted. NOTE: we are not using the FUSE
+ * init() callback since it doesn't support returning errors. This function must
+ * be called explicitly before fuse_main().
+ *
+ * @param fs    file system context to initialize.
+ * @param opts  command line options.
+ * @return      true on success; false on failure.
+ */
+bool a1fs_init(fs_ctx *fs, a1fs_opts *opts);
+
+/**
+ * Cleanup the file system.
+ *
+ * Called when the file system is unmounted. Must cleanup all the resources
+ * created in a1fs_init(), and closes the trace if the front end opened one.
+ */
+void a1fs_destroy(void *ctx);
+
+/**
+ * Negotiate the connection capabilities with the kernel (the init() callback
+ * of both FUSE front ends).
+ *
+ * With --writeback_cache, the kernel caches writes and sends them in large
+ * batches; it then keeps the file sizes and modification times itself and
+ * tells a1fs about them through write(), truncate() and utimens().
+ *
+ * @param fs    file system context.
+ * @param conn  connection info; receives the wanted capabilities.
+ */
+void fs_conn_init(fs_ctx *fs, struct fuse_conn_info *conn);
+
+/** Get a pointer to the superblock. */
+a1fs_superblock *get_sb(fs_ctx *fs);
+
+/**
+ * Get a pointer to an inode in the inode table. Its block is verified against
+ * the checksum loaded at mount on first access.
+ */
+a1fs_inode *get_inode(fs_ctx *fs, a1fs_ino_t ino);
+
+/** Get a pointer to a block in the data table. */
+void *get_block(fs_ctx *fs, a1fs_blk_t blk);
+
+/** Record that an inode was modified in the current generation. */
+void inode_stamp(fs_ctx *fs, a1fs_inode *inode);
+
+/**
+ * Update the modification time of an inode to the current time.
+ *
+ * With --lazytime, the time is kept in memory instead (see inode_mtime()), so
+ * that a file modified over and over doesn't dirty its inode table page each
+ * time. The pending times are written back all together once the oldest one
+ * is opts->lazytime seconds old or the table fills up, on snapshots and on
+ * unmount; fsync() writes back the time of the file. A crash loses them.
+ */
+void inode_touch(fs_ctx *fs, a1fs_inode *inode);
+
+/** Number of blocks needed to store size bytes. */
+uint64_t size_to_blocks(uint64_t size);
+
+/** Get a bit of a bitmap. */
+bool bitmap_test(const uint8_t *bmp, uint32_t i);
+
+/** Set or clear a bit of a bitmap. */
+void bitmap_set(uint8_t *bmp, uint32_t i, bool value);
+
+/**
+ * Allocate an inode and reset it to an empty state.
+ *
+ * @param fs   file system context.
+ * @param ino  pointer to the variable that receives the inode number.
+ * @return     0 on success; -ENOSPC if there are no free inodes.
+ */
+int inode_alloc(fs_ctx *fs, a1fs_ino_t *ino);
+
+/** Free an inode. Its data blocks must have been freed already. */
+void inode_free(fs_ctx *fs, a1fs_ino_t ino);
+
+/** Whether file data of an inode is stored in compressed clusters. */
+bool inode_compressed(const a1fs_inode *inode);
+
+/**
+ * Map a file block to a data block.
+ *
+ * @param inode  the inode.
+ * @param lblk   file block number.
+ * @param pblk   pointer to the variable that receives the data block number.
+ * @param len    pointer to the variable that receives the length of the run:
+ *               the number of mapped blocks starting at lblk if it is mapped;
+ *               otherwise the number of hole blocks before the next extent,
+ *               or 0 if there are no extents after lblk.
+ * @return       true if lblk is mapped; false if it is in a hole.
+ */
+bool extent_map(const a1fs_inode *inode, a1fs_blk_t lblk,
+                a1fs_blk_t *pblk, a1fs_blk_t *len);
+
+/**
+ * Drop the data blocks of a range of file blocks, turning it into a hole.
+ *
+ * @param fs     file system context.
+ * @param inode  the inode.
+ * @param lblk   first file block of the range.
+ * @param count  number of file blocks in the range.
+ * @return       0 on success; -ENOSPC if an extent has to be split and the
+ *               inode has no free extent slots.
+ */
+int file_punch(fs_ctx *fs, a1fs_inode *inode, uint64_t lblk,
+               uint64_t count);
+
+/** Whether the last partial block of a file is stored in a tail block. */
+bool inode_has_tail(const a1fs_inode *inode);
+
+/** Get a pointer to the data of a tail. */
+const char *tail_data(fs_ctx *fs, const a1fs_tail *tail);
+
+/**
+ * Pack the last partial block of a file into a tail block, freeing the data
+ * block it took. Only done with A1FS_FEATURE_TAILS, for regular uncompressed
+ * files of up to A1FS_TAIL_MAX_FILE bytes whose last block is mapped by the
+ * last extent and not shared with other files. Called when a file is closed;
+ * the file is left as it is if the tail can't be packed.
+ */
+void tail_pack(fs_ctx *fs, a1fs_inode *inode);
+
+/**
+ * Move the tail of a file back into a data block mapped by its extents, before
+ * the file is modified at or past the start of the tail.
+ *
+ * @return  0 on success; -EDQUOT if a quota of the file is exceeded; -ENOSPC
+ *          if there are no free blocks or the file is too fragmented.
+ */
+int tail_unpack(fs_ctx *fs, a1fs_inode *inode);
+
+/**
+ * Write data to a byte range of an uncompressed file, allocating and unsharing
+ * data blocks as needed. Does not update the file size.
+ *
+ * @return  0 on success; -EDQUOT if a quota of the file is exceeded; -ENOSPC
+ *          if there is not enough free space or the file is too fragmented;
+ *          -errno if an io_uring write failed.
+ */
+int file_write(fs_ctx *fs, a1fs_inode *inode, const char *buf,
+               size_t size, uint64_t offset);
+
+/**
+ * Get the cluster map entry of a compressed file.
+ *
+ * @return  pointer to the entry; NULL if the cluster map block that would hold
+ *          it is not allocated (the cluster is a hole).
+ */
+a1fs_cluster *cluster_entry(fs_ctx *fs, const a1fs_inode *inode,
+                            uint64_t index);
+
+/**
+ * Number of data blocks allocated to an inode, including the clusters of a
+ * compressed file and the xattr block.
+ */
+uint64_t inode_blocks(fs_ctx *fs, const a1fs_inode *inode);
+
+// Inode number passed to cluster_load() for files in snapshots. The cluster
+// cache is keyed by the inode numbers of the file system, so clusters of
+// snapshot files are decompressed without caching them.
+#define SNAPSHOT_INO ((a1fs_ino_t)-1)
+
+/**
+ * Get the decompressed contents of a cluster of a compressed file.
+ *
+ * Clusters stored uncompressed are returned in place; the others are
+ * decompressed into the cluster cache unless they are already cached.
+ *
+ * @param fs     file system context.
+ * @param ino    inode number of the file; SNAPSHOT_INO for a file in a
+ *               snapshot, whose clusters are not cached.
+ * @param inode  the inode.
+ * @param index  cluster index.
+ * @param data   pointer to the variable that receives a pointer to
+ *               A1FS_CLUSTER_SIZE bytes of data, or NULL if the cluster is
+ *               a hole.
+ * @return       0 on success; -ENOMEM if out of memory; -EIO if the stored
+ *               cluster is corrupted.
+ */
+int cluster_load(fs_ctx *fs, a1fs_ino_t ino, const a1fs_inode *inode,
+                 uint64_t index, const unsigned char **data);
+
+/**
+ * Write to a range of a cluster of a compressed file.
+ *
+ * @param fs      file system context.
+ * @param ino     inode number of the file.
+ * @param inode   the inode.
+ * @param index   cluster index.
+ * @param buf     data to write; NULL to write zeros.
+ * @param offset  offset of the range within the cluster.
+ * @param size    size of the range.
+ * @return        0 on success; -errno on error.
+ */
+int cluster_write(fs_ctx *fs, a1fs_ino_t ino, a1fs_inode *inode,
+                  uint64_t index, const char *buf, size_t offset,
+                  size_t size);
+
+/** Extended attribute of an inode. */
+typedef struct xattr {
+	/** Name; not null-terminated. */
+	const char *name;
+	size_t name_len;
+	const void *value;
+	size_t value_len;
+
+} xattr;
+
+// Every entry takes at least one byte of name in addition to the header
+#define XATTR_MAX_COUNT \
+	((A1FS_INODE_XATTR_SIZE + A1FS_BLOCK_SIZE) / (sizeof(a1fs_xattr_entry) + 1))
+
+/**
+ * Parse an xattr entry list (see a1fs_xattr_entry).
+ *
+ * @param area  the entry list.
+ * @param size  size of the area that holds the list in bytes.
+ * @param list  array that receives the extended attributes.
+ * @param n     number of entries in the array so far.
+ * @return      number of entries in the array after parsing.
+ */
+int xattr_parse(const unsigned char *area, size_t size, xattr *list, int n);
+
+/**
+ * Size of the extended attribute area of the inodes in bytes: shorter with
+ * A1FS_FEATURE_TAILS, where the tail follows it.
+ */
+size_t inode_xattr_size(fs_ctx *fs);
+
+/**
+ * Replace the extended attributes of an inode.
+ *
+ * The attributes are placed the same way for any inode with the same set, so
+ * that equal sets can share an xattr block: the smallest ones go into the
+ * inode while they fit, and the rest into the block, sorted by name. Blocks
+ * are never modified once written; a changed set gets a new (or another
+ * existing) block.
+ *
+ * Errors:
+ *   ENOMEM  not enough memory.
+ *   EDQUOT  a quota of the inode doesn't allow it to take an xattr block.
+ *   ENOSPC  the attributes don't fit into the inode and an xattr block, or
+ *           there are no free blocks.
+ *
+ * @param fs     file system context.
+ * @param inode  the inode.
+ * @param list   the new extended attributes; may point into the inode and its
+ *               current xattr block. Reordered by this call.
+ * @param n      number of extended attributes.
+ * @return       0 on success; -errno on error.
+ */
+int xattr_store(fs_ctx *fs, a1fs_inode *inode, xattr *list, int n);
+
+/**
+ * Free all the data blocks of an inode (before the inode itself is freed).
+ */
+void inode_free_data(fs_ctx *fs, a1fs_ino_t ino, a1fs_inode *inode);
+
+/**
+ * Change the size of a file (see a1fs_truncate()).
+ *
+ * Errors:
+ *   EFBIG   the new size is too large.
+ *   EINVAL  the new size is negative.
+ *   ENOMEM  not enough memory.
+ *   ENOSPC  not enough free space to copy a shared block.
+ *
+ * @param fs     file system context.
+ * @param ino    inode number of the file.
+ * @param inode  the inode.
+ * @param size   new file size in bytes.
+ * @return       0 on success; -errno on error.
+ */
+int file_truncate(fs_ctx *fs, a1fs_ino_t ino, a1fs_inode *inode, off_t size);
+
+/**
+ * Verify a directory against the checksum loaded at mount if this is its first
+ * access (see fs_verify_dir()). Called once per operation that walks or
+ * modifies the entries, rather than for each entry.
+ */
+void dir_verify(fs_ctx *fs, const a1fs_inode *dir);
+
+/** Get a pointer to the i-th entry of a directory. */
+a1fs_dentry *dir_entry(fs_ctx *fs, const a1fs_inode *dir, uint64_t i);
+
+/**
+ * Find an entry in a directory.
+ *
+ * @return  0 on success; -ENOENT if there is no entry with given name.
+ */
+int dir_lookup(fs_ctx *fs, const a1fs_inode *dir, const char *name,
+               a1fs_ino_t *ino);
+
+/**
+ * Resolve a path to an inode number.
+ *
+ * @param fs    file system context.
+ * @param path  absolute path.
+ * @param ino   pointer to the variable that receives the inode number.
+ * @return      0 on success; -errno on error (same as path_walk()).
+ */
+int path_lookup(fs_ctx *fs, const char *path, a1fs_ino_t *ino);
+
+/**
+ * Resolve the parent directory of a path and extract the last path component.
+ *
+ * @param fs      file system context.
+ * @param path    absolute path; must not be "/".
+ * @param parent  pointer to the variable that receives the parent inode number.
+ * @param name    buffer of A1FS_NAME_MAX bytes that receives the last component.
+ * @return        0 on success; -errno on error (same as path_lookup()).
+ */
+int path_parent(fs_ctx *fs, const char *path, a1fs_ino_t *parent,
+                char *name);
+
+/**
+ * Whether a path refers to the statistics file. The file is virtual: it is not
+ * stored in the image and is not listed by readdir(), but can be opened and
+ * read to get a report of the operation latencies and block I/O counters.
+ */
+bool is_stats_file(const char *path);
+
+/**
+ * Format a report of the statistics, followed by the usage and the limits of
+ * the quotas.
+ *
+ * @return  the report that the caller must free(); NULL if out of memory.
+ */
+char *fs_stats_report(fs_ctx *fs);
+
+/** Get the attributes of the statistics file. */
+int stats_file_getattr(fs_ctx *fs, struct stat *st);
+
+/**
+ * Read from the statistics file: from the snapshot taken by open(), or from
+ * a new one if the file was not opened through FUSE.
+ */
+int stats_file_read(fs_ctx *fs, char *buf, size_t size, off_t offset,
+                    struct fuse_file_info *fi);
+
+// File handle of regular files opened with direct I/O. FUSE does not pass the
+// direct_io flag to read() and write(), so it is remembered here.
+#define A1FS_FH_DIRECT_IO 1
+
+/**
+ * Choose how the kernel page cache is used for a newly opened file.
+ *
+ * The data of every file already lives in the mapped image, so caching it in
+ * the kernel as well doubles its memory footprint. Files opened with O_DIRECT
+ * bypass the page cache. With --direct_io_min, so do files of at least that
+ * size and write-only opens that truncate or append (streaming writers such
+ * as cp or loggers), whose data is unlikely to be read back soon. Other files
+ * go through the page cache; with --keep_cache, their cached pages are kept
+ * across opens unless the data was modified bypassing the cache since then.
+ *
+ * @param fs     file system context.
+ * @param ino    inode number of the file.
+ * @param inode  pointer to the inode.
+ * @param fi     file info; receives the direct_io and keep_cache flags.
+ */
+void open_cache_policy(fs_ctx *fs, a1fs_ino_t ino,
+                       const a1fs_inode *inode, struct fuse_file_info *fi);
+
+/** Whether a path is the snapshot directory or is inside it. */
+bool is_snapshot_path(const char *path);
+
+/** Whether a path is the snapshot directory itself. */
+bool is_snapshot_dir(const char *path);
+
+/**
+ * Get the name of the snapshot that a path under the snapshot directory
+ * refers to, if the path is "/.snapshots/NAME" exactly.
+ *
+ * @return  pointer to the name within path; NULL if path is the snapshot
+ *          directory or is inside a snapshot.
+ */
+const char *snapshot_path_name(const char *path);
+
+/** Get the snapshot list. Only valid if there are snapshots. */
+a1fs_snapshot *snapshot_list(fs_ctx *fs);
+
+/** Get the copy of the inode bitmap in a snapshot. */
+const uint8_t *snapshot_inode_bmp(fs_ctx *fs, const a1fs_snapshot *snap);
+
+/** Get the copy of the inode table in a snapshot. */
+const a1fs_inode *snapshot_inode_table(fs_ctx *fs, const a1fs_snapshot *snap);
+
+/**
+ * Find a snapshot by name.
+ *
+ * @return  index of the snapshot in the list; -1 if there is none.
+ */
+int snapshot_find(fs_ctx *fs, const char *name);
+
+/**
+ * Take a snapshot of the file system.
+ *
+ * The inode bitmap and the inode table are copied as they are; the snapshot
+ * then holds a reference to every data block of every file. Only the data is
+ * shared copy-on-write, so the time and space this takes grow with the size of
+ * the image (the inode table and the blocks in use), not with what changes
+ * after it.
+ *
+ * Errors:
+ *   EEXIST  a snapshot with that name exists.
+ *   ENOSPC  there are A1FS_SNAPSHOTS_MAX snapshots already, or there is not
+ *           enough contiguous free space for the copy of the inode table.
+ *
+ * @param fs    file system context.
+ * @param name  snapshot name; shorter than A1FS_NAME_MAX.
+ * @return      0 on success; -errno on error.
+ */
+int snapshot_create(fs_ctx *fs, const char *name);
+
+/**
+ * Delete a snapshot, dropping its references to the data blocks. Blocks that
+ * only the snapshot still used are freed.
+ */
+void snapshot_delete(fs_ctx *fs, int index);
+
+/**
+ * Resolve a path for an operation that doesn't modify the file: paths inside
+ * snapshots are resolved as well.
+ *
+ * @return  0 on success; -errno on error (see path_walk()).
+ */
+int path_lookup_ro(fs_ctx *fs, const char *path, a1fs_ino_t *ino,
+                   const a1fs_inode **inode);
+
+/** Get the attributes of the snapshot directory. */
+int snapshot_dir_getattr(fs_ctx *fs, struct stat *st);
+
+/** List the snapshots in the snapshot directory. */
+int snapshot_dir_readdir(fs_ctx *fs, void *buf, fuse_fill_dir_t filler);
+
+/** Fill in the attributes of an inode (see a1fs_getattr()). */
+void inode_getattr(fs_ctx *fs, const a1fs_inode *inode, struct stat *st);
+
+/**
+ * Read data from a file (see a1fs_read()).
+ *
+ * @param fs      file system context.
+ * @param ino     inode number of the file; SNAPSHOT_INO for a file in a
+ *                snapshot.
+ * @param inode   pointer to the inode.
+ * @param buf     pointer to the buffer that receives the data.
+ * @param size    buffer size - number of bytes requested.
+ * @param offset  offset from the beginning of the file to read from.
+ * @return        number of bytes read on success; 0 if offset is beyond EOF;
+ *                -errno on error.
+ */
+int file_pread(fs_ctx *fs, a1fs_ino_t ino, const a1fs_inode *inode,
+               char *buf, size_t size, off_t offset);
+
+/**
+ * Write data to a file (see a1fs_write()).
+ *
+ * @param fs      file system context.
+ * @param ino     inode number of the file.
+ * @param inode   pointer to the inode.
+ * @param buf     pointer to the buffer containing the data.
+ * @param size    buffer size - number of bytes requested.
+ * @param offset  offset from the beginning of the file to write to.
+ * @param direct  whether the file was opened with direct I/O.
+ * @return        number of bytes written on success; -errno on error.
+ */
+int file_pwrite(fs_ctx *fs, a1fs_ino_t ino, a1fs_inode *inode,
+                const char *buf, size_t size, off_t offset, bool direct);
+
+/**
+ * Create a directory (see a1fs_mkdir()).
+ *
+ * @param fs      file system context.
+ * @param parent  inode number of the parent directory.
+ * @param name    name of the new directory.
+ * @param mode    file mode bits.
+ * @param ino     pointer to the variable that receives the inode number.
+ * @return        0 on success; -errno on error.
+ */
+int dir_mkdir(fs_ctx *fs, a1fs_ino_t parent, const char *name, mode_t mode,
+              a1fs_ino_t *ino);
+
+/**
+ * Create a file (see a1fs_create()). Same parameters as dir_mkdir().
+ */
+int dir_mkfile(fs_ctx *fs, a1fs_ino_t parent, const char *name, mode_t mode,
+               a1fs_ino_t *ino);
+
+/**
+ * Free an inode that has no links left, along with its data and the quota of
+ * the directory if it has one of its own.
+ */
+void inode_delete(fs_ctx *fs, a1fs_ino_t ino);
+
+/**
+ * Remove the entry of a file from a directory (see a1fs_unlink()). The inode
+ * is not freed: the caller deletes it with inode_delete() once it has no
+ * links and nothing else refers to it.
+ *
+ * Errors:
+ *   EISDIR  the entry is a directory.
+ *   ENOENT  there is no entry with that name.
+ *   ENOSPC  a directory block shared with a snapshot can't be copied.
+ *
+ * @param fs      file system context.
+ * @param parent  inode number of the directory.
+ * @param name    name of the entry.
+ * @param ino     pointer to the variable that receives the inode number.
+ * @return        0 on success; -errno on error.
+ */
+int dir_unlink(fs_ctx *fs, a1fs_ino_t parent, const char *name, a1fs_ino_t *ino);
+
+/**
+ * Remove an empty directory from its parent (see a1fs_rmdir()). Its links drop
+ * to 0; the caller deletes the inode as with dir_unlink().
+ *
+ * Errors:
+ *   ENOENT     there is no entry with that name.
+ *   ENOSPC     a directory block shared with a snapshot can't be copied.
+ *   ENOTDIR    the entry is not a directory.
+ *   ENOTEMPTY  the directory is not empty.
+ */
+int dir_rmdir(fs_ctx *fs, a1fs_ino_t parent, const char *name, a1fs_ino_t *ino);
+
+/**
+ * Perform a file-specific control operation (see a1fs_ioctl()).
+ *
+ * @param fs        file system context.
+ * @param ino       inode number of the file.
+ * @param inode     pointer to the inode.
+ * @param snapshot  whether the file is inside a snapshot.
+ * @param cmd       ioctl command.
+ * @param data      command argument; both input and output.
+ * @return          0 on success; -errno on error.
+ */
+int file_ioctl(fs_ctx *fs, a1fs_ino_t ino, const a1fs_inode *inode,
+               bool snapshot, unsigned int cmd, void *data);
+
+/**
+ * Synchronize file contents (see a1fs_fsync()).
+ *
+ * @param fs     file system context.
+ * @param inode  pointer to the inode of the file.
+ * @return       0 on success; -errno on error.
+ */
+int file_fsync(fs_ctx *fs, a1fs_inode *inode);
+
+/** Set an extended attribute of an inode (see a1fs_setxattr()). */
+int inode_setxattr(fs_ctx *fs, a1fs_inode *inode, const char *name,
+                   const char *value, size_t size, int flags);
+
+/** Get an extended attribute of an inode (see a1fs_getxattr()). */
+int inode_getxattr(fs_ctx *fs, const a1fs_inode *inode, const char *name,
+                   char *value, size_t size);
+
+/** List the extended attributes of an inode (see a1fs_listxattr()). */
+int inode_listxattr(fs_ctx *fs, const a1fs_inode *inode, char *buf,
+                    size_t size);
+
+/** Remove an extended attribute of an inode (see a1fs_removexattr()). */
+int inode_removexattr(fs_ctx *fs, a1fs_inode *inode, const char *name);
+
+/**
+ * Get file system statistics (see a1fs_statfs()).
+ *
+ * @param fs  file system context.
+ * @param st  pointer to the struct statvfs that receives the result.
+ */
+void fs_statfs(fs_ctx *fs, struct statvfs *st);
+
+/**
+ * Record an operation of a FUSE front end into the trace, on behalf of
+ * fs->caller_pid (see a1fs_trace_record for the meaning of offset and size).
+ */
+void trace_op(fs_ctx *fs, a1fs_stats_op op, uint64_t start, int ret,
+              a1fs_ino_t ino, const char *path, const char *name,
+              uint64_t offset, uint64_t size);
@@ -0,0 +1,1288 @@
+/*
+ * This code is provided solely for the personal and private use of students
+ * taking the CSC369H course at the University of Toronto. Copying for purposes
+ * other than this use is expressly prohibited. All forms of distribution of
+ * this code, including but not limited to public repositories on GitHub,
+ * GitLab, Bitbucket, or any other online platform, whether as given or with
+ * any changes, are expressly prohibited.
+ *
+ * Authors: Alexey Khrabrov, Karen Reid
+ *
+ * All of the files in this directory and all subdirectories are:
+ * Copyright (c) 2019 Karen Reid
+ */
+
+/**
+ * CSC369 Assignment 1 - a1fs offline file system checker.
+ *
+ * Verifies the consistency of an unmounted image without modifying it. After
+ * the superblock is validated, the inode table, the data block metadata and
+ * the directory tree are checked in parallel passes over the memory-mapped
+ * image:
+ *
+ *   1. Inodes: extents, compressed cluster maps and directory entries. Every
+ *      reference to a data block or an inode is counted.
+ *   2. Data blocks: the data bitmap, the refcount table and the dedup index
+ *      are compared with the counted references, which also catches extents
+ *      that overlap within or across files.
+ *   3. Inodes again: the inode bitmap, link counts and reachability of every
+ *      inode from the root directory.
+ *
+ * Each pass splits its range into chunks that worker threads take in turn.
+ */
+
+#include <pthread.h>
+#include <stdarg.h>
+#include <stdbool.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <time.h>
+#include <unistd.h>
+
+#include "a1fs.h"
+#include "crc32c.h"
+#include "dedup_index.h"
+#include "lz4.h"
+#include "map.h"
+
+
+/** Command line options. */
+typedef struct fsck_opts {
+	/** File system image file path. */
+	const char *img_path;
+	/** Number of worker threads; 0 means one per online CPU. */
+	unsigned int n_threads;
+
+	/** Print help and exit. */
+	bool help;
+	/** Verbose output: report all errors and print statistics. */
+	bool verbose;
+
+} fsck_opts;
+
+static const char *help_str = "\
+Usage: %s options image\n\
+\n\
+Check the consistency of an unmounted a1fs image. The image is not modified.\n\
+Exits with 0 if the image is consistent, 1 if errors were found and 2 if the\n\
+image could not be checked.\n\
+\n\
+Options:\n\
+    -j num  number of worker threads (default: number of CPUs)\n\
+    -h      print help and exit\n\
+    -v      verbose output - report all errors and print statistics\n\
+";
+
+static void print_help(FILE *f, const char *progname)
+{
+	fprintf(f, help_str, progname);
+}
+
+static bool parse_args(int argc, char *argv[], fsck_opts *opts)
+{
+	int o;
+	while ((o = getopt(argc, argv, "j:hv")) != -1) {
+		switch (o) {
+			case 'j': opts->n_threads = strtoul(optarg, NULL, 10); break;
+
+			case 'h': opts->help    = true; return true;// skip other arguments
+			case 'v': opts->verbose = true; break;
+
+			case '?': return false;
+			default : assert(false);
+		}
+	}
+
+	if (optind >= argc) {
+		fprintf(stderr, "Missing image path\n");
+		return false;
+	}
+	opts->img_path = argv[optind];
+	return true;
+}
+
+
+/** Number of errors reported in full unless -v is given. */
+#define MAX_REPORTED_ERRORS 100
+
+/** Marks a missing parent in fsck_ctx.parent. */
+#define NO_INO UINT32_MAX
+
+/** Reachability states in fsck_ctx.reachable. */
+enum { REACH_UNKNOWN = 0, REACH_YES, REACH_NO };
+
+/** Checker state shared by all worker threads. */
+typedef struct fsck_ctx {
+	const fsck_opts *opts;
+	/** Pointer to the start of the image. */
+	void *image;
+	/** Image size in bytes. */
+	size_t size;
+	const a1fs_superblock *sb;
+
+	/** Number of references to each data block found in inodes. */
+	uint32_t *block_refs;
+	/** Number of those references that are tails (see a1fs_tail). */
+	uint32_t *tail_refs;
+	/** Number of directory entries that refer to each inode. */
+	uint32_t *inode_refs;
+	/**
+	 * Directory that contains an entry for each inode (any one of them for
+	 * files with several links), or NO_INO.
+	 */
+	a1fs_ino_t *parent;
+	/** Whether each inode is reachable from the root (REACH_*). */
+	uint8_t *reachable;
+
+	/** Number of errors found so far. */
+	unsigned long errors;
+	/** Number of free inodes and data blocks according to the bitmaps. */
+	unsigned long free_inodes;
+	unsigned long free_blocks;
+	/** Number of entries in the dedup index. */
+	unsigned long dedup_entries;
+
+	pthread_mutex_t print_lock;
+
+} fsck_ctx;
+
+/** Report an inconsistency. Safe to call from any thread. */
+__attribute__((format(printf, 2, 3)))
+static void fsck_error(fsck_ctx *ctx, const char *fmt, ...)
+{
+	unsigned long n = __atomic_add_fetch(&ctx->errors, 1, __ATOMIC_RELAXED);
+	if (!ctx->opts->verbose && (n > MAX_REPORTED_ERRORS)) return;
+
+	va_list args;
+	va_start(args, fmt);
+	pthread_mutex_lock(&ctx->print_lock);
+	vfprintf(stdout, fmt, args);
+	fputc('\n', stdout);
+	if (!ctx->opts->verbose && (n == MAX_REPORTED_ERRORS)) {
+		printf("Too many errors; use -v to report all of them\n");
+	}
+	pthread_mutex_unlock(&ctx->print_lock);
+	va_end(args);
+}
+
+
+static const a1fs_inode *get_inode(const fsck_ctx *ctx, a1fs_ino_t ino)
+{
+	return (const a1fs_inode*)(ctx->image + ctx->sb->inode_table * A1FS_BLOCK_SIZE)
+	       + ino;
+}
+
+static const void *get_block(const fsck_ctx *ctx, a1fs_blk_t blk)
+{
+	return ctx->image + (size_t)(ctx->sb->data_table + blk) * A1FS_BLOCK_SIZE;
+}
+
+static const uint8_t *get_region(const fsck_ctx *ctx, int first_block)
+{
+	return ctx->image + (size_t)first_block * A1FS_BLOCK_SIZE;
+}
+
+static bool bitmap_test(const uint8_t *bmp, uint32_t i)
+{
+	return (bmp[i / 8] >> (i % 8)) & 1;
+}
+
+static uint64_t size_to_blocks(uint64_t size)
+{
+	return (size + A1FS_BLOCK_SIZE - 1) / A1FS_BLOCK_SIZE;
+}
+
+static bool is_inode_used(const fsck_ctx *ctx, a1fs_ino_t ino)
+{
+	return bitmap_test(get_region(ctx, ctx->sb->inode_bmp), ino);
+}
+
+
+/**
+ * Check that the superblock describes a layout that fits into the image. The
+ * other checks rely on it, so checking stops if it doesn't.
+ */
+static bool check_superblock(fsck_ctx *ctx)
+{
+	const a1fs_superblock *sb = ctx->sb;
+	unsigned long errors = ctx->errors;
+	uint64_t image_blocks = ctx->size / A1FS_BLOCK_SIZE;
+
+	if (sb->magic != A1FS_MAGIC) {
+		fsck_error(ctx, "superblock: bad magic value 0x%lx", sb->magic);
+		return false;
+	}
+	if (sb->size != ctx->size) {
+		fsck_error(ctx, "superblock: file system size %lu doesn't match image size %zu",
+		           sb->size, ctx->size);
+	}
+	if ((sb->num_inodes < 2) || (sb->num_blocks < 2)) {
+		fsck_error(ctx, "superblock: too few inodes (%u) or data blocks (%u)",
+		           sb->num_inodes, sb->num_blocks);
+	}
+
+	// Metadata regions must follow each other in this order
+	bool dedup = sb->dedup_index != 0;
+	int refcount_end = dedup ? sb->dedup_bmp : sb->inode_table;
+	if ((sb->inode_bmp != 1) || (sb->datablock_bmp <= sb->inode_bmp) ||
+	    (sb->refcount_table <= sb->datablock_bmp) || (refcount_end <= sb->refcount_table) ||
+	    (dedup && ((sb->dedup_index <= sb->dedup_bmp) || (sb->inode_table <= sb->dedup_index))) ||
+	    (sb->data_table <= sb->inode_table) ||
+	    ((uint64_t)sb->data_table + sb->num_blocks > image_blocks))
+	{
+		fsck_error(ctx, "superblock: invalid layout (inode bitmap %d, data bitmap %d, "
+		           "refcount table %d, dedup bitmap %d, dedup index %d, inode table %d, "
+		           "data table %d, %u data blocks, %lu image blocks)",
+		           sb->inode_bmp, sb->datablock_bmp, sb->refcount_table, sb->dedup_bmp,
+		           sb->dedup_index, sb->inode_table, sb->data_table, sb->num_blocks,
+		           image_blocks);
+		return false;
+	}
+
+	// Each region must be large enough for the number of inodes or for the
+	// number of blocks that the file system can grow to
+	const uint64_t bits = A1FS_BLOCK_SIZE * 8;
+	if (sb->max_blocks < sb->num_blocks) {
+		fsck_error(ctx, "superblock: %u data blocks exceed the maximum of %u",
+		           sb->num_blocks, sb->max_blocks);
+	}
+	if ((uint64_t)(sb->datablock_bmp - sb->inode_bmp) * bits < sb->num_inodes) {
+		fsck_error(ctx, "superblock: inode bitmap is too small");
+	}
+	if ((uint64_t)(sb->refcount_table - sb->datablock_bmp) * bits < sb->max_blocks) {
+		fsck_error(ctx, "superblock: data bitmap is too small");
+	}
+	if ((uint64_t)(refcount_end - sb->refcount_table) * A1FS_REFCOUNTS_PER_BLOCK < sb->max_blocks) {
+		fsck_error(ctx, "superblock: refcount table is too small");
+	}
+	if (dedup) {
+		if ((uint64_t)(sb->dedup_index - sb->dedup_bmp) * bits < sb->max_blocks) {
+			fsck_error(ctx, "superblock: dedup bitmap is too small");
+		}
+		if ((sb->dedup_slots == 0) || ((sb->dedup_slots & (sb->dedup_slots - 1)) != 0) ||
+		    ((uint64_t)(sb->inode_table - sb->dedup_index) * A1FS_DEDUP_ENTRIES_PER_BLOCK
+		     < sb->dedup_slots))
+		{
+			fsck_error(ctx, "superblock: invalid number of dedup index slots %u",
+			           sb->dedup_slots);
+		}
+	}
+	if ((uint64_t)(sb->data_table - sb->inode_table) * A1FS_BLOCK_SIZE
+	    < (uint64_t)sb->num_inodes * sizeof(a1fs_inode))
+	{
+		fsck_error(ctx, "superblock: inode table is too small for %u inodes",
+		           sb->num_inodes);
+	}
+	if ((sb->num_unused_inodes > sb->num_inodes) || (sb->num_unused_blocks > sb->num_blocks)) {
+		fsck_error(ctx, "superblock: free inode or block count is out of range");
+	}
+	return ctx->errors == errors;
+}
+
+
+/** Per-thread state of a parallel pass. */
+typedef struct fsck_worker fsck_worker;
+
+/** Check items [begin, end) of a pass. */
+typedef void (*fsck_work_fn)(fsck_worker *w, uint64_t begin, uint64_t end);
+
+struct fsck_worker {
+	fsck_ctx *ctx;
+	fsck_work_fn fn;
+	/** Next chunk to take, shared by all the workers of a pass. */
+	uint64_t *next;
+	uint64_t total;
+	uint64_t chunk;
+	/** Scratch buffer for decompressing a cluster. */
+	unsigned char *cluster_buf;
+};
+
+static void *worker_main(void *arg)
+{
+	fsck_worker *w = (fsck_worker*)arg;
+	while (true) {
+		uint64_t begin = __atomic_fetch_add(w->next, w->chunk, __ATOMIC_RELAXED);
+		if (begin >= w->total) break;
+		uint64_t end = (begin + w->chunk < w->total) ? begin + w->chunk : w->total;
+		w->fn(w, begin, end);
+	}
+	return NULL;
+}
+
+/**
+ * Run a pass over items [0, total) in chunks of given size on all threads.
+ *
+ * @return  true on success; false if the worker threads can't be created.
+ */
+static bool run_parallel(fsck_ctx *ctx, fsck_work_fn fn, uint64_t total,
+                         uint64_t chunk)
+{
+	unsigned int n = ctx->opts->n_threads;
+	fsck_worker workers[n];
+	pthread_t threads[n];
+	uint64_t next = 0;
+	bool ok = true;
+
+	unsigned int started = 0;
+	for (; started < n; started++) {
+		workers[started] = (fsck_worker){ .ctx = ctx, .fn = fn, .next = &next,
+		                                  .total = total, .chunk = chunk };
+		workers[started].cluster_buf = malloc(A1FS_CLUSTER_SIZE);
+		if (workers[started].cluster_buf == NULL) {
+			perror("malloc");
+			ok = false;
+			break;
+		}
+		// The calling thread is the first worker
+		if (started == 0) continue;
+		int ret = pthread_create(&threads[started], NULL, worker_main, &workers[started]);
+		if (ret != 0) {
+			fprintf(stderr, "pthread_create: %s\n", strerror(ret));
+			free(workers[started].cluster_buf);
+			ok = false;
+			break;
+		}
+	}
+	// Finish the pass even on failure, so that no worker outlives it
+	if (started > 0) worker_main(&workers[0]);
+	for (unsigned int i = 0; i < started; i++) {
+		if (i > 0) pthread_join(threads[i], NULL);
+		free(workers[i].cluster_buf);
+	}
+	return ok;
+}
+
+
+/**
+ * Check the extents of an inode and count the references to the blocks they
+ * map.
+ *
+ * @return  true if the extents are valid and can be followed.
+ */
+static bool check_extents(fsck_ctx *ctx, a1fs_ino_t ino, const a1fs_inode *inode,
+                          uint64_t max_blocks)
+{
+	const a1fs_superblock *sb = ctx->sb;
+	bool ok = true;
+	int n = 0;
+	while ((n < A1FS_INODE_EXTENTS) && (inode->extent_array[n].count != 0)) n++;
+	for (int i = n; i < A1FS_INODE_EXTENTS; i++) {
+		if (inode->extent_array[i].count != 0) {
+			fsck_error(ctx, "inode %u: extent %d follows an unused extent slot", ino, i);
+			ok = false;
+		}
+	}
+
+	uint64_t prev_end = 0;
+	for (int i = 0; i < n; i++) {
+		const a1fs_extent *ext = &inode->extent_array[i];
+		uint64_t end = (uint64_t)ext->lblk + ext->count;
+		if ((uint64_t)ext->start + ext->count > sb->num_blocks) {
+			fsck_error(ctx, "inode %u: extent %d (blocks %u-%lu) is outside of the data table",
+			           ino, i, ext->start, (uint64_t)ext->start + ext->count - 1);
+			ok = false;
+			continue;
+		}
+		if ((i > 0) && (ext->lblk < prev_end)) {
+			fsck_error(ctx, "inode %u: extent %d (file blocks %u-%lu) overlaps or is out of order",
+			           ino, i, ext->lblk, end - 1);
+			ok = false;
+		}
+		if (end > max_blocks) {
+			fsck_error(ctx, "inode %u: extent %d maps file blocks past EOF (%lu > %lu)",
+			           ino, i, end, max_blocks);
+		}
+		prev_end = end;
+
+		for (a1fs_blk_t b = ext->start; b < ext->start + ext->count; b++) {
+			__atomic_fetch_add(&ctx->block_refs[b], 1, __ATOMIC_RELAXED);
+		}
+	}
+	return ok;
+}
+
+/** Find the data block that maps a file block. */
+static bool extent_map(const a1fs_inode *inode, uint64_t lblk, a1fs_blk_t *pblk)
+{
+	for (int i = 0; (i < A1FS_INODE_EXTENTS) && (inode->extent_array[i].count != 0); i++) {
+		const a1fs_extent *ext = &inode->extent_array[i];
+		if ((lblk >= ext->lblk) && (lblk < (uint64_t)ext->lblk + ext->count)) {
+			*pblk = ext->start + (lblk - ext->lblk);
+			return true;
+		}
+	}
+	return false;
+}
+
+/** Check the part of the last block of a regular file past EOF is zero. */
+static void check_file_tail(fsck_ctx *ctx, a1fs_ino_t ino, const a1fs_inode *inode)
+{
+	size_t tail = inode->size % A1FS_BLOCK_SIZE;
+	a1fs_blk_t pblk;
+	if ((tail == 0) || !extent_map(inode, inode->size / A1FS_BLOCK_SIZE, &pblk)) return;
+
+	const uint8_t *data = get_block(ctx, pblk);
+	for (size_t i = tail; i < A1FS_BLOCK_SIZE; i++) {
+		if (data[i] != 0) {
+			fsck_error(ctx, "inode %u: data past EOF in the last block is not zero", ino);
+			return;
+		}
+	}
+}
+
+/**
+ * Check the cluster map of a compressed file and count the references to the
+ * blocks of its clusters. Compressed clusters must decompress cleanly.
+ */
+static void check_clusters(fsck_worker *w, a1fs_ino_t ino, const a1fs_inode *inode)
+{
+	fsck_ctx *ctx = w->ctx;
+	uint64_t n_clusters = (inode->size + A1FS_CLUSTER_SIZE - 1) / A1FS_CLUSTER_SIZE;
+
+	for (int i = 0; (i < A1FS_INODE_EXTENTS) && (inode->extent_array[i].count != 0); i++) {
+		const a1fs_extent *ext = &inode->extent_array[i];
+		for (a1fs_blk_t b = 0; b < ext->count; b++) {
+			const a1fs_cluster *map = get_block(ctx, ext->start + b);
+			uint64_t first = (uint64_t)(ext->lblk + b) * A1FS_CLUSTERS_PER_BLOCK;
+			for (size_t c = 0; c < A1FS_CLUSTERS_PER_BLOCK; c++) {
+				uint64_t index = first + c;
+				if (map[c].size == 0) continue;
+				if (index >= n_clusters) {
+					fsck_error(ctx, "inode %u: cluster %lu is past EOF", ino, index);
+				}
+				uint64_t count = size_to_blocks(map[c].size);
+				if ((map[c].size > A1FS_CLUSTER_SIZE) ||
+				    ((uint64_t)map[c].start + count > ctx->sb->num_blocks))
+				{
+					fsck_error(ctx, "inode %u: cluster %lu has invalid location %u or size %u",
+					           ino, index, map[c].start, map[c].size);
+					continue;
+				}
+				for (a1fs_blk_t blk = map[c].start; blk < map[c].start + count; blk++) {
+					__atomic_fetch_add(&ctx->block_refs[blk], 1, __ATOMIC_RELAXED);
+				}
+				if ((map[c].size < A1FS_CLUSTER_SIZE) &&
+				    (lz4_decompress(get_block(ctx, map[c].start), map[c].size,
+				                    w->cluster_buf, A1FS_CLUSTER_SIZE) != A1FS_CLUSTER_SIZE))
+				{
+					fsck_error(ctx, "inode %u: cluster %lu is corrupted", ino, index);
+				}
+			}
+		}
+	}
+}
+
+/**
+ * Check the location of the tail of a file (see a1fs_tail) and that the tail
+ * block header has its units allocated.
+ *
+ * @return  true if the tail is valid and its block can be counted.
+ */
+static bool check_tail(fsck_ctx *ctx, a1fs_ino_t ino, const a1fs_inode *inode)
+{
+	const a1fs_tail *tail = &inode->tail;
+	if (!(ctx->sb->features & A1FS_FEATURE_TAILS) || !S_ISREG(inode->mode) ||
+	    (inode->flags & A1FS_INODE_COMPRESSED))
+	{
+		fsck_error(ctx, "inode %u: has a tail, but it can't have one", ino);
+		return false;
+	}
+	unsigned int unit = tail->offset / A1FS_TAIL_UNIT;
+	unsigned int count = (tail->len + A1FS_TAIL_UNIT - 1) / A1FS_TAIL_UNIT;
+	if ((tail->block >= ctx->sb->num_blocks) || (tail->offset % A1FS_TAIL_UNIT != 0) ||
+	    (unit < A1FS_TAIL_HEADER_UNITS) || (tail->len == 0) ||
+	    (tail->len != inode->size % A1FS_BLOCK_SIZE) || (unit + count > A1FS_TAIL_UNITS))
+	{
+		fsck_error(ctx, "inode %u: invalid tail (%u bytes at %u in block %u)", ino,
+		           tail->len, tail->offset, tail->block);
+		return false;
+	}
+	const a1fs_tail_header *h = get_block(ctx, tail->block);
+	uint64_t mask = (((uint64_t)1 << count) - 1) << unit;
+	if (((h->used & mask) != mask) || (h->refs[unit] == 0)) {
+		fsck_error(ctx, "inode %u: tail at %u in block %u is not allocated", ino,
+		           tail->offset, tail->block);
+	}
+	return true;
+}
+
+/** Count a reference to a tail block. Safe to call from any thread. */
+static void count_tail(fsck_ctx *ctx, a1fs_blk_t blk)
+{
+	__atomic_fetch_add(&ctx->block_refs[blk], 1, __ATOMIC_RELAXED);
+	__atomic_fetch_add(&ctx->tail_refs[blk], 1, __ATOMIC_RELAXED);
+}
+
+/** Check an xattr entry list (see a1fs_xattr_entry). */
+static void check_xattr_list(fsck_ctx *ctx, a1fs_ino_t ino, const uint8_t *area,
+                             size_t size, const char *where)
+{
+	size_t pos = 0;
+	while (pos + sizeof(a1fs_xattr_entry) <= size) {
+		a1fs_xattr_entry e;
+		memcpy(&e, area + pos, sizeof(e));
+		if (e.name_len == 0) return;
+		pos += sizeof(e) + e.name_len + e.value_len;
+		if (pos > size) {
+			fsck_error(ctx, "inode %u: extended attribute in the %s overruns it", ino, where);
+			return;
+		}
+	}
+}
+
+/**
+ * Check the extended attributes of an inode and count the reference to its
+ * xattr block.
+ */
+static void check_xattrs(fsck_ctx *ctx, a1fs_ino_t ino, const a1fs_inode *inode)
+{
+	// With tails, the tail of the file follows the area
+	size_t size = (ctx->sb->features & A1FS_FEATURE_TAILS) ? A1FS_INODE_XATTR_SIZE_TAILS
+	                                                       : A1FS_INODE_XATTR_SIZE;
+	check_xattr_list(ctx, ino, inode->xattr, size, "inode");
+	if (!(inode->flags & A1FS_INODE_XATTR_BLOCK)) return;
+
+	a1fs_blk_t blk = inode->xattr_block;
+	if (blk >= ctx->sb->num_blocks) {
+		fsck_error(ctx, "inode %u: xattr block %u is outside of the data table", ino, blk);
+		return;
+	}
+	__atomic_fetch_add(&ctx->block_refs[blk], 1, __ATOMIC_RELAXED);
+	check_xattr_list(ctx, ino, get_block(ctx, blk), A1FS_BLOCK_SIZE, "xattr block");
+}
+
+/** Compare directory entry names for sorting. */
+static int dentry_name_cmp(const void *a, const void *b)
+{
+	return strcmp((*(const a1fs_dentry**)a)->name, (*(const a1fs_dentry**)b)->name);
+}
+
+/**
+ * Check the entries of a directory and count the references to the inodes
+ * they point to.
+ */
+static void check_dir(fsck_ctx *ctx, a1fs_ino_t ino, const a1fs_inode *inode)
+{
+	const a1fs_superblock *sb = ctx->sb;
+	const uint64_t per_block = A1FS_BLOCK_SIZE / sizeof(a1fs_dentry);
+	if (inode->size % sizeof(a1fs_dentry) != 0) {
+		fsck_error(ctx, "inode %u: directory size %lu is not a multiple of the entry size",
+		           ino, inode->size);
+	}
+	uint64_t n = inode->size / sizeof(a1fs_dentry);
+	const a1fs_dentry **entries = malloc(n * sizeof(*entries));
+	if ((n != 0) && (entries == NULL)) {
+		fsck_error(ctx, "inode %u: out of memory checking %lu directory entries", ino, n);
+		return;
+	}
+
+	uint64_t n_valid = 0;
+	bool has_dot = false, has_dotdot = false;
+	for (uint64_t i = 0; i < n; i++) {
+		a1fs_blk_t pblk;
+		if (!extent_map(inode, i / per_block, &pblk)) {
+			fsck_error(ctx, "inode %u: directory block %lu is a hole", ino, i / per_block);
+			i += per_block - 1 - i % per_block;
+			continue;
+		}
+		const a1fs_dentry *d = (const a1fs_dentry*)get_block(ctx, pblk) + i % per_block;
+		size_t len = strnlen(d->name, A1FS_NAME_MAX);
+		if ((len == 0) || (len == A1FS_NAME_MAX) ||
+		    ((ino != 0) && (memchr(d->name, '/', len) != NULL)))
+		{
+			fsck_error(ctx, "inode %u: entry %lu has an invalid name", ino, i);
+			continue;
+		}
+		if ((d->ino >= sb->num_inodes) || !is_inode_used(ctx, d->ino)) {
+			fsck_error(ctx, "inode %u: entry \"%s\" points to %s inode %u", ino, d->name,
+			           (d->ino >= sb->num_inodes) ? "invalid" : "free", d->ino);
+			continue;
+		}
+		entries[n_valid++] = d;
+		// The holder of "/" doesn't add to the link count of the root
+		if (ino != 0) __atomic_fetch_add(&ctx->inode_refs[d->ino], 1, __ATOMIC_RELAXED);
+
+		const a1fs_inode *child = get_inode(ctx, d->ino);
+		if (strcmp(d->name, ".") == 0) {
+			has_dot = true;
+			if (d->ino != ino) fsck_error(ctx, "inode %u: \".\" points to inode %u", ino, d->ino);
+		} else if (strcmp(d->name, "..") == 0) {
+			// Checked in the reachability pass once all parents are known
+			has_dotdot = true;
+		} else if (S_ISDIR(child->mode)) {
+			a1fs_ino_t expected = NO_INO;
+			if (!__atomic_compare_exchange_n(&ctx->parent[d->ino], &expected, ino, false,
+			                                 __ATOMIC_RELAXED, __ATOMIC_RELAXED))
+			{
+				fsck_error(ctx, "inode %u: directory has entries in directories %u and %u",
+				           d->ino, expected, ino);
+			}
+		} else {
+			__atomic_store_n(&ctx->parent[d->ino], ino, __ATOMIC_RELAXED);
+		}
+	}
+	if ((ino != 0) && (!has_dot || !has_dotdot)) {
+		fsck_error(ctx, "inode %u: directory has no \".\" or \"..\" entry", ino);
+	}
+
+	qsort(entries, n_valid, sizeof(*entries), dentry_name_cmp);
+	for (uint64_t i = 1; i < n_valid; i++) {
+		if (strcmp(entries[i - 1]->name, entries[i]->name) == 0) {
+			fsck_error(ctx, "inode %u: duplicate entry \"%s\"", ino, entries[i]->name);
+		}
+	}
+	free(entries);
+}
+
+/** Pass 1: check inodes. */
+static void check_inodes(fsck_worker *w, uint64_t begin, uint64_t end)
+{
+	fsck_ctx *ctx = w->ctx;
+	for (a1fs_ino_t ino = begin; ino < end; ino++) {
+		if (!is_inode_used(ctx, ino)) continue;
+		const a1fs_inode *inode = get_inode(ctx, ino);
+
+		bool compressed = (inode->flags & A1FS_INODE_COMPRESSED) != 0;
+		if (!S_ISREG(inode->mode) && !S_ISDIR(inode->mode)) {
+			fsck_error(ctx, "inode %u: unsupported file type (mode 0%o)", ino, inode->mode);
+			continue;
+		}
+		if (compressed && !S_ISREG(inode->mode)) {
+			fsck_error(ctx, "inode %u: directory is marked compressed", ino);
+			continue;
+		}
+		if ((ino <= A1FS_ROOT_INO) && !S_ISDIR(inode->mode)) {
+			fsck_error(ctx, "inode %u: root inode is not a directory", ino);
+			continue;
+		}
+		if (inode->generation > ctx->sb->generation) {
+			fsck_error(ctx, "inode %u: generation %lu is newer than the file system (%lu)",
+			           ino, inode->generation, ctx->sb->generation);
+		}
+		check_xattrs(ctx, ino, inode);
+		bool has_tail = (inode->flags & A1FS_INODE_TAIL) != 0;
+		if (has_tail && check_tail(ctx, ino, inode)) count_tail(ctx, inode->tail.block);
+
+		// Extents of a compressed file map its cluster map; the last block of
+		// a file with a tail is in the tail
+		uint64_t max_blocks = size_to_blocks(inode->size);
+		if (has_tail) {
+			max_blocks = inode->size / A1FS_BLOCK_SIZE;
+		} else if (compressed) {
+			uint64_t n_clusters = (inode->size + A1FS_CLUSTER_SIZE - 1) / A1FS_CLUSTER_SIZE;
+			max_blocks = (n_clusters + A1FS_CLUSTERS_PER_BLOCK - 1) / A1FS_CLUSTERS_PER_BLOCK;
+		}
+		if (!check_extents(ctx, ino, inode, max_blocks)) continue;
+
+		if (compressed) {
+			check_clusters(w, ino, inode);
+		} else if (S_ISDIR(inode->mode)) {
+			check_dir(ctx, ino, inode);
+		} else {
+			check_file_tail(ctx, ino, inode);
+		}
+	}
+}
+
+/** Count a reference to each block of a run, if it is inside the data table. */
+static bool count_run(fsck_ctx *ctx, a1fs_blk_t start, uint64_t count)
+{
+	if ((uint64_t)start + count > ctx->sb->num_blocks) return false;
+	for (a1fs_blk_t blk = start; blk < start + count; blk++) ctx->block_refs[blk]++;
+	return true;
+}
+
+/** Count the references to the data blocks of a file in a snapshot. */
+static void count_snapshot_inode(fsck_ctx *ctx, const a1fs_snapshot *snap,
+                                 a1fs_ino_t ino, const a1fs_inode *inode)
+{
+	bool ok = true;
+	if (inode->flags & A1FS_INODE_XATTR_BLOCK) ok &= count_run(ctx, inode->xattr_block, 1);
+	if (inode->flags & A1FS_INODE_TAIL) {
+		if (inode->tail.block < ctx->sb->num_blocks) {
+			count_tail(ctx, inode->tail.block);
+		} else {
+			ok = false;
+		}
+	}
+	for (int i = 0; (i < A1FS_INODE_EXTENTS) && (inode->extent_array[i].count != 0); i++) {
+		const a1fs_extent *ext = &inode->extent_array[i];
+		if (!count_run(ctx, ext->start, ext->count)) {
+			ok = false;
+			continue;
+		}
+		if (!(inode->flags & A1FS_INODE_COMPRESSED)) continue;
+		for (a1fs_blk_t b = 0; b < ext->count; b++) {
+			const a1fs_cluster *map = get_block(ctx, ext->start + b);
+			for (size_t c = 0; c < A1FS_CLUSTERS_PER_BLOCK; c++) {
+				if (map[c].size == 0) continue;
+				ok &= (map[c].size <= A1FS_CLUSTER_SIZE) &&
+				      count_run(ctx, map[c].start, size_to_blocks(map[c].size));
+			}
+		}
+	}
+	if (!ok) {
+		fsck_error(ctx, "snapshot \"%s\": inode %u maps blocks outside of the data table",
+		           snap->name, ino);
+	}
+}
+
+/**
+ * Check the snapshot list and count the references to the blocks that the
+ * snapshots use: the list itself, the copies of the inode bitmap and table,
+ * and the data blocks of the files. The files in snapshots are not checked
+ * any further, since they were checked with the file system before.
+ */
+static void check_snapshots(fsck_ctx *ctx)
+{
+	const a1fs_superblock *sb = ctx->sb;
+	if (sb->num_snapshots == 0) return;
+	if ((sb->num_snapshots > A1FS_SNAPSHOTS_MAX) || !count_run(ctx, sb->snapshot_list, 1)) {
+		fsck_error(ctx, "superblock: invalid snapshot list (%u snapshots in block %u)",
+		           sb->num_snapshots, sb->snapshot_list);
+		return;
+	}
+
+	const a1fs_snapshot *list = get_block(ctx, sb->snapshot_list);
+	a1fs_blk_t bmp_blocks = sb->datablock_bmp - sb->inode_bmp;
+	a1fs_blk_t count = bmp_blocks + (sb->data_table - sb->inode_table);
+	for (unsigned int i = 0; i < sb->num_snapshots; i++) {
+		const a1fs_snapshot *snap = &list[i];
+		size_t len = strnlen(snap->name, A1FS_NAME_MAX);
+		if ((len == 0) || (len == A1FS_NAME_MAX) || (memchr(snap->name, '/', len) != NULL)) {
+			fsck_error(ctx, "snapshot %u: invalid name", i);
+			continue;
+		}
+		if ((snap->count != count) || !count_run(ctx, snap->start, count)) {
+			fsck_error(ctx, "snapshot \"%s\": invalid inode table copy (%u blocks at %u)",
+			           snap->name, snap->count, snap->start);
+			continue;
+		}
+		for (unsigned int j = 0; j < i; j++) {
+			if (strcmp(list[j].name, snap->name) == 0) {
+				fsck_error(ctx, "snapshot \"%s\": duplicate name", snap->name);
+			}
+		}
+		if ((snap->generation >= sb->generation) ||
+		    ((i > 0) && (snap->generation <= list[i - 1].generation)))
+		{
+			fsck_error(ctx, "snapshot \"%s\": generation %lu is out of order",
+			           snap->name, snap->generation);
+		}
+
+		const uint8_t *bmp = get_block(ctx, snap->start);
+		const a1fs_inode *table = get_block(ctx, snap->start + bmp_blocks);
+		for (a1fs_ino_t ino = 0; ino < sb->num_inodes; ino++) {
+			if (bitmap_test(bmp, ino)) count_snapshot_inode(ctx, snap, ino, &table[ino]);
+		}
+	}
+}
+
+/** Get the number of data blocks charged to the quotas of an inode. */
+static uint64_t inode_quota_blocks(const fsck_ctx *ctx, const a1fs_inode *inode)
+{
+	uint64_t blocks = (inode->flags & A1FS_INODE_XATTR_BLOCK) ? 1 : 0;
+	for (int i = 0; (i < A1FS_INODE_EXTENTS) && (inode->extent_array[i].count != 0); i++) {
+		const a1fs_extent *ext = &inode->extent_array[i];
+		blocks += ext->count;
+		if (!(inode->flags & A1FS_INODE_COMPRESSED) ||
+		    ((uint64_t)ext->start + ext->count > ctx->sb->num_blocks))
+		{
+			continue;
+		}
+		for (a1fs_blk_t b = 0; b < ext->count; b++) {
+			const a1fs_cluster *map = get_block(ctx, ext->start + b);
+			for (size_t c = 0; c < A1FS_CLUSTERS_PER_BLOCK; c++) {
+				blocks += size_to_blocks(map[c].size);
+			}
+		}
+	}
+	return blocks;
+}
+
+/**
+ * Check the quota table and count the reference to its block. The usage of
+ * each quota must match the files charged to it. Runs after the inodes have
+ * been checked, so their block maps can be trusted.
+ */
+static void check_quotas(fsck_ctx *ctx)
+{
+	const a1fs_superblock *sb = ctx->sb;
+	if (sb->num_quotas == 0) return;
+	if ((sb->num_quotas > A1FS_QUOTAS_MAX) || !count_run(ctx, sb->quota_table, 1)) {
+		fsck_error(ctx, "superblock: invalid quota table (%u quotas in block %u)",
+		           sb->num_quotas, sb->quota_table);
+		return;
+	}
+
+	const a1fs_quota *table = get_block(ctx, sb->quota_table);
+	uint64_t blocks[A1FS_QUOTAS_MAX] = {0};
+	uint64_t inodes[A1FS_QUOTAS_MAX] = {0};
+	for (a1fs_ino_t ino = 0; ino < sb->num_inodes; ino++) {
+		if (!is_inode_used(ctx, ino)) continue;
+		const a1fs_inode *inode = get_inode(ctx, ino);
+		uint16_t slots[2] = { inode->user_quota, inode->dir_quota };
+		uint32_t types[2] = { A1FS_QUOTA_USER, A1FS_QUOTA_DIR };
+		for (int i = 0; i < 2; i++) {
+			if (slots[i] == 0) continue;
+			if ((slots[i] > A1FS_QUOTAS_MAX) || (table[slots[i] - 1].type != types[i])) {
+				fsck_error(ctx, "inode %u: invalid %s quota slot %u", ino,
+				           (i == 0) ? "user" : "directory", slots[i]);
+				continue;
+			}
+			if ((i == 0) && (table[slots[i] - 1].id != inode->uid)) {
+				fsck_error(ctx, "inode %u: charged to the user quota of %u, but owned by %u",
+				           ino, table[slots[i] - 1].id, inode->uid);
+			}
+			blocks[slots[i] - 1] += inode_quota_blocks(ctx, inode);
+			inodes[slots[i] - 1]++;
+		}
+	}
+
+	unsigned int used = 0;
+	for (unsigned int i = 0; i < A1FS_QUOTAS_MAX; i++) {
+		const a1fs_quota *q = &table[i];
+		if (q->type == A1FS_QUOTA_NONE) continue;
+		used++;
+		if ((q->type != A1FS_QUOTA_USER) && (q->type != A1FS_QUOTA_DIR)) {
+			fsck_error(ctx, "quota %u: invalid type %u", i, q->type);
+			continue;
+		}
+		if ((q->type == A1FS_QUOTA_DIR) &&
+		    ((q->id >= sb->num_inodes) || !is_inode_used(ctx, q->id) ||
+		     (get_inode(ctx, q->id)->dir_quota != i + 1)))
+		{
+			fsck_error(ctx, "quota %u: invalid directory %u", i, q->id);
+		}
+		if ((q->blocks != blocks[i]) || (q->inodes != inodes[i])) {
+			fsck_error(ctx, "quota %u: usage is %lu blocks and %lu inodes, but the files "
+			           "have %lu and %lu", i, q->blocks, q->inodes, blocks[i], inodes[i]);
+		}
+	}
+	if (used != sb->num_quotas) {
+		fsck_error(ctx, "superblock: %u quotas, but the quota table has %u",
+		           sb->num_quotas, used);
+	}
+}
+
+/** Checksum of the entries of a directory (see a1fs_checkpoint_dir). */
+static uint32_t dir_checksum(const fsck_ctx *ctx, const a1fs_inode *dir)
+{
+	uint32_t crc = 0;
+	for (int i = 0; (i < A1FS_INODE_EXTENTS) && (dir->extent_array[i].count != 0); i++) {
+		const a1fs_extent *ext = &dir->extent_array[i];
+		uint64_t offset = (uint64_t)ext->lblk * A1FS_BLOCK_SIZE;
+		// Invalid extents are reported by check_inodes()
+		if ((offset >= dir->size) ||
+		    ((uint64_t)ext->start + ext->count > ctx->sb->num_blocks))
+		{
+			break;
+		}
+		uint64_t len = (uint64_t)ext->count * A1FS_BLOCK_SIZE;
+		if (len > dir->size - offset) len = dir->size - offset;
+		crc = crc32c(crc, get_block(ctx, ext->start), len);
+	}
+	return crc;
+}
+
+/**
+ * Check the metadata checksums in a checkpoint: the bitmap and inode table
+ * blocks and the directories must not have changed since it was written.
+ */
+static void check_checksums(fsck_ctx *ctx, const a1fs_checkpoint *cp)
+{
+	const a1fs_superblock *sb = ctx->sb;
+	const uint32_t *crcs = (const uint32_t*)((const a1fs_checkpoint_xattr*)(cp + 1)
+	                                         + cp->num_xattr_shares);
+	const a1fs_checkpoint_dir *dirs = (const a1fs_checkpoint_dir*)(crcs + cp->num_block_crcs);
+	uint64_t bmp_blocks = sb->refcount_table - sb->inode_bmp;
+
+	for (uint64_t i = 0; i < cp->num_block_crcs; i++) {
+		bool bmp = i < bmp_blocks;
+		int blk = bmp ? sb->inode_bmp + i : sb->inode_table + (i - bmp_blocks);
+		if (crc32c(0, get_region(ctx, blk), A1FS_BLOCK_SIZE) != crcs[i]) {
+			fsck_error(ctx, "checkpoint: checksum mismatch in %s block %d",
+			           bmp ? "bitmap" : "inode table", blk);
+		}
+	}
+	for (uint64_t i = 0; i < cp->num_dir_crcs; i++) {
+		a1fs_ino_t ino = dirs[i].ino;
+		if ((ino >= sb->num_inodes) || ((i > 0) && (ino <= dirs[i - 1].ino)) ||
+		    !is_inode_used(ctx, ino) || !S_ISDIR(get_inode(ctx, ino)->mode))
+		{
+			fsck_error(ctx, "checkpoint: invalid directory checksum for inode %u", ino);
+		} else if (dir_checksum(ctx, get_inode(ctx, ino)) != dirs[i].crc) {
+			fsck_error(ctx, "checkpoint: checksum mismatch in directory inode %u", ino);
+		}
+	}
+}
+
+/**
+ * Check the checkpoint of a cleanly unmounted file system and count the
+ * references to its blocks. Each saved xattr block index entry must refer to a
+ * block in use with the same contents, and the superblock and the metadata
+ * must match their checksums, if any. Runs after the inodes have been
+ * checked, so the references to their xattr blocks have been counted.
+ */
+static void check_checkpoint(fsck_ctx *ctx)
+{
+	const a1fs_superblock *sb = ctx->sb;
+	if (!sb->clean) return;
+	if (sb->checksum != 0) {
+		a1fs_superblock copy;
+		memcpy(&copy, sb, sizeof(copy));
+		copy.checksum = 0;
+		if (crc32c(0, &copy, sizeof(copy)) != sb->checksum) {
+			fsck_error(ctx, "superblock: checksum mismatch");
+		}
+	}
+	if (sb->checkpoint_blocks == 0) return;
+	if ((uint64_t)sb->checkpoint + sb->checkpoint_blocks > sb->num_blocks) {
+		fsck_error(ctx, "superblock: invalid checkpoint (%u blocks at %u)",
+		           sb->checkpoint_blocks, sb->checkpoint);
+		return;
+	}
+
+	const a1fs_checkpoint *cp = get_block(ctx, sb->checkpoint);
+	const a1fs_checkpoint_xattr *xattrs = (const a1fs_checkpoint_xattr*)(cp + 1);
+	uint64_t capacity = (uint64_t)sb->checkpoint_blocks * A1FS_BLOCK_SIZE - sizeof(*cp);
+	uint64_t crc_blocks = (uint64_t)(sb->refcount_table - sb->inode_bmp)
+	                    + (sb->data_table - sb->inode_table);
+	if ((cp->magic != A1FS_CHECKPOINT_MAGIC) || (cp->generation != sb->generation) ||
+	    (cp->num_xattr_shares > capacity) || (cp->num_dir_crcs > capacity) ||
+	    ((cp->num_block_crcs != 0) && (cp->num_block_crcs != crc_blocks)) ||
+	    (cp->num_xattr_shares * sizeof(*xattrs) + cp->num_block_crcs * sizeof(uint32_t)
+	     + cp->num_dir_crcs * sizeof(a1fs_checkpoint_dir) > capacity))
+	{
+		fsck_error(ctx, "checkpoint: invalid header");
+	} else {
+		check_checksums(ctx, cp);
+		for (uint64_t i = 0; i < cp->num_xattr_shares; i++) {
+			const a1fs_checkpoint_xattr *e = &xattrs[i];
+			if ((e->blk >= sb->num_blocks) || (ctx->block_refs[e->blk] == 0)) {
+				fsck_error(ctx, "checkpoint: xattr block %u is not in use", e->blk);
+			} else if (dedup_hash(get_block(ctx, e->blk)) != e->hash) {
+				fsck_error(ctx, "checkpoint: xattr block %u was modified after the "
+				           "checkpoint", e->blk);
+			}
+		}
+	}
+	count_run(ctx, sb->checkpoint, sb->checkpoint_blocks);
+}
+
+/**
+ * Check a tail block: it must only be used by tails, and the reference counts
+ * in its header must add up to their number.
+ */
+static void check_tail_block(fsck_ctx *ctx, a1fs_blk_t blk)
+{
+	uint32_t tails = ctx->tail_refs[blk];
+	if (ctx->block_refs[blk] != tails) {
+		fsck_error(ctx, "block %u: holds %u tails but is also used as a file block", blk, tails);
+		return;
+	}
+	const a1fs_tail_header *h = get_block(ctx, blk);
+	uint32_t refs = 0;
+	for (unsigned int i = 0; i < A1FS_TAIL_UNITS; i++) refs += h->refs[i];
+	if (refs != tails) {
+		fsck_error(ctx, "block %u: tail reference counts add up to %u, but %u tails use it",
+		           blk, refs, tails);
+	}
+}
+
+/** Pass 2: check the data bitmap, the refcount table and the dedup bitmap. */
+static void check_blocks(fsck_worker *w, uint64_t begin, uint64_t end)
+{
+	fsck_ctx *ctx = w->ctx;
+	const a1fs_superblock *sb = ctx->sb;
+	const uint8_t *bmp = get_region(ctx, sb->datablock_bmp);
+	const uint8_t *dedup_bmp = (sb->dedup_index != 0) ? get_region(ctx, sb->dedup_bmp) : NULL;
+	const a1fs_refcount_t *refcount = (const a1fs_refcount_t*)get_region(ctx, sb->refcount_table);
+
+	unsigned long free_blocks = 0;
+	for (a1fs_blk_t blk = begin; blk < end; blk++) {
+		bool used = bitmap_test(bmp, blk);
+		uint32_t refs = ctx->block_refs[blk];
+		if (!used) free_blocks++;
+
+		if (used && (refs == 0)) {
+			fsck_error(ctx, "block %u: allocated but not used by any file", blk);
+		} else if (!used && (refs != 0)) {
+			fsck_error(ctx, "block %u: used by %u file blocks but marked free", blk, refs);
+		}
+		if (refcount[blk] != refs) {
+			fsck_error(ctx, "block %u: refcount is %u but %u file blocks map it%s", blk,
+			           refcount[blk], refs,
+			           (refs > refcount[blk]) ? " (overlapping extents)" : "");
+		}
+		if (dedup_bmp && bitmap_test(dedup_bmp, blk) && !used) {
+			fsck_error(ctx, "block %u: free block is marked as indexed", blk);
+		}
+		if (ctx->tail_refs[blk] != 0) check_tail_block(ctx, blk);
+	}
+	__atomic_fetch_add(&ctx->free_blocks, free_blocks, __ATOMIC_RELAXED);
+}
+
+/** Pass 2: check the entries of the dedup index. */
+static void check_dedup_index(fsck_worker *w, uint64_t begin, uint64_t end)
+{
+	fsck_ctx *ctx = w->ctx;
+	const a1fs_superblock *sb = ctx->sb;
+	const a1fs_dedup_entry *table = (const a1fs_dedup_entry*)get_region(ctx, sb->dedup_index);
+	const uint8_t *dedup_bmp = get_region(ctx, sb->dedup_bmp);
+
+	unsigned long entries = 0;
+	for (uint64_t i = begin; i < end; i++) {
+		const a1fs_dedup_entry *e = &table[i];
+		if (e->hash == 0) continue;
+		entries++;
+		if ((e->blk >= sb->num_blocks) || !bitmap_test(dedup_bmp, e->blk)) {
+			fsck_error(ctx, "dedup index slot %lu: block %u is not marked as indexed", i, e->blk);
+		} else if (dedup_hash(get_block(ctx, e->blk)) != e->hash) {
+			fsck_error(ctx, "dedup index slot %lu: block %u was modified after indexing",
+			           i, e->blk);
+		}
+	}
+	__atomic_fetch_add(&ctx->dedup_entries, entries, __ATOMIC_RELAXED);
+}
+
+/**
+ * Determine whether a directory is reachable from the root by following the
+ * parent links. Directories on a cycle or cut off from the root are not.
+ */
+static bool dir_reachable(fsck_ctx *ctx, a1fs_ino_t ino)
+{
+	a1fs_ino_t cur = ino;
+	uint32_t steps = 0;
+	uint8_t result = REACH_NO;
+	while (true) {
+		uint8_t state = __atomic_load_n(&ctx->reachable[cur], __ATOMIC_RELAXED);
+		if (state != REACH_UNKNOWN) {
+			result = state;
+			break;
+		}
+		if (cur == 0) {
+			result = REACH_YES;
+			break;
+		}
+		cur = ctx->parent[cur];
+		if ((cur == NO_INO) || (++steps > ctx->sb->num_inodes)) break;
+	}
+	// Memoize the result for the whole chain
+	for (cur = ino; steps-- > 0 && (cur != NO_INO); cur = ctx->parent[cur]) {
+		__atomic_store_n(&ctx->reachable[cur], result, __ATOMIC_RELAXED);
+	}
+	return result == REACH_YES;
+}
+
+/**
+ * Pass 3: check the inode bitmap counts, the link counts, the ".." entries and
+ * that all inodes are reachable.
+ */
+static void check_links(fsck_worker *w, uint64_t begin, uint64_t end)
+{
+	fsck_ctx *ctx = w->ctx;
+	unsigned long free_inodes = 0;
+	for (a1fs_ino_t ino = begin; ino < end; ino++) {
+		if (!is_inode_used(ctx, ino)) {
+			free_inodes++;
+			continue;
+		}
+		const a1fs_inode *inode = get_inode(ctx, ino);
+		uint32_t refs = (ino == 0) ? 1 : ctx->inode_refs[ino];
+		if (inode->links != refs) {
+			fsck_error(ctx, "inode %u: link count is %u but %u entries refer to it",
+			           ino, inode->links, refs);
+		}
+
+		a1fs_ino_t parent = ctx->parent[ino];
+		bool reachable;
+		if (ino == 0) {
+			reachable = true;
+		} else if (S_ISDIR(inode->mode)) {
+			reachable = dir_reachable(ctx, ino);
+		} else {
+			reachable = (parent != NO_INO) && dir_reachable(ctx, parent);
+		}
+		if (!reachable) {
+			fsck_error(ctx, "inode %u: not reachable from the root directory", ino);
+		}
+	}
+	__atomic_fetch_add(&ctx->free_inodes, free_inodes, __ATOMIC_RELAXED);
+}
+
+/** Check that ".." of each directory points to the directory containing it. */
+static void check_dotdot(fsck_worker *w, uint64_t begin, uint64_t end)
+{
+	fsck_ctx *ctx = w->ctx;
+	const uint64_t per_block = A1FS_BLOCK_SIZE / sizeof(a1fs_dentry);
+	for (a1fs_ino_t ino = begin; ino < end; ino++) {
+		const a1fs_inode *inode = get_inode(ctx, ino);
+		if ((ino == 0) || !is_inode_used(ctx, ino) || !S_ISDIR(inode->mode)) continue;
+
+		// The root is its own parent
+		a1fs_ino_t expected = (ino == A1FS_ROOT_INO) ? ino : ctx->parent[ino];
+		uint64_t n = inode->size / sizeof(a1fs_dentry);
+		for (uint64_t i = 0; i < n; i++) {
+			a1fs_blk_t pblk;
+			if (!extent_map(inode, i / per_block, &pblk)) continue;
+			const a1fs_dentry *d = (const a1fs_dentry*)get_block(ctx, pblk) + i % per_block;
+			if ((strcmp(d->name, "..") == 0) && (d->ino != expected) && (expected != NO_INO)) {
+				fsck_error(ctx, "inode %u: \"..\" points to inode %u instead of %u",
+				           ino, d->ino, expected);
+			}
+		}
+	}
+}
+
+/** Check the root directory holder: inode 0 with a single "/" entry. */
+static void check_root(fsck_ctx *ctx)
+{
+	if (!is_inode_used(ctx, 0) || !is_inode_used(ctx, A1FS_ROOT_INO)) {
+		fsck_error(ctx, "root: inode 0 or %d is not in use", A1FS_ROOT_INO);
+		return;
+	}
+	const a1fs_inode *holder = get_inode(ctx, 0);
+	a1fs_blk_t pblk;
+	if ((holder->size != sizeof(a1fs_dentry)) || !extent_map(holder, 0, &pblk) ||
+	    (pblk >= ctx->sb->num_blocks))
+	{
+		fsck_error(ctx, "root: inode 0 must hold exactly one entry");
+		return;
+	}
+	const a1fs_dentry *d = get_block(ctx, pblk);
+	if ((d->ino != A1FS_ROOT_INO) || (strcmp(d->name, "/") != 0)) {
+		fsck_error(ctx, "root: the entry in inode 0 must be \"/\" pointing to inode %d",
+		           A1FS_ROOT_INO);
+	}
+}
+
+static double elapsed(const struct timespec *start)
+{
+	struct timespec now;
+	clock_gettime(CLOCK_MONOTONIC, &now);
+	return (now.tv_sec - start->tv_sec) + (now.tv_nsec - start->tv_nsec) / 1e9;
+}
+
+/**
+ * Check the file system.
+ *
+ * @return  true if the checks ran (whether or not errors were found);
+ *          false on failure to run them.
+ */
+static bool fsck(fsck_ctx *ctx)
+{
+	struct timespec start;
+	clock_gettime(CLOCK_MONOTONIC, &start);
+	if (!check_superblock(ctx)) return true;
+
+	const a1fs_superblock *sb = ctx->sb;
+	ctx->block_refs = calloc(sb->num_blocks, sizeof(uint32_t));
+	ctx->tail_refs = calloc(sb->num_blocks, sizeof(uint32_t));
+	ctx->inode_refs = calloc(sb->num_inodes, sizeof(uint32_t));
+	ctx->parent = malloc(sb->num_inodes * sizeof(a1fs_ino_t));
+	ctx->reachable = calloc(sb->num_inodes, sizeof(uint8_t));
+	bool ok = false;
+	if (!ctx->block_refs || !ctx->tail_refs || !ctx->inode_refs || !ctx->parent || !ctx->reachable) {
+		perror("malloc");
+		goto end;
+	}
+	memset(ctx->parent, 0xFF, sb->num_inodes * sizeof(a1fs_ino_t));
+	// Start reading the metadata in; the data table is only partly read
+	madvise(ctx->image, (size_t)sb->data_table * A1FS_BLOCK_SIZE, MADV_WILLNEED);
+
+	check_root(ctx);
+	if (!run_parallel(ctx, check_inodes, sb->num_inodes, 1024)) goto end;
+	check_snapshots(ctx);
+	check_quotas(ctx);
+	check_checkpoint(ctx);
+	if (!run_parallel(ctx, check_blocks, sb->num_blocks, 64 * 1024)) goto end;
+	if ((sb->dedup_index != 0) &&
+	    !run_parallel(ctx, check_dedup_index, sb->dedup_slots, 64 * 1024))
+	{
+		goto end;
+	}
+	if (!run_parallel(ctx, check_links, sb->num_inodes, 1024)) goto end;
+	if (!run_parallel(ctx, check_dotdot, sb->num_inodes, 1024)) goto end;
+
+	if (ctx->free_inodes != sb->num_unused_inodes) {
+		fsck_error(ctx, "superblock: %u free inodes, but the inode bitmap has %lu",
+		           sb->num_unused_inodes, ctx->free_inodes);
+	}
+	if (ctx->free_blocks != sb->num_unused_blocks) {
+		fsck_error(ctx, "superblock: %u free blocks, but the data bitmap has %lu",
+		           sb->num_unused_blocks, ctx->free_blocks);
+	}
+	if (sb->dedup_index != 0) {
+		unsigned long indexed = 0;
+		const uint8_t *dedup_bmp = get_region(ctx, sb->dedup_bmp);
+		for (a1fs_blk_t blk = 0; blk < sb->num_blocks; blk++) {
+			indexed += bitmap_test(dedup_bmp, blk);
+		}
+		if (indexed != ctx->dedup_entries) {
+			fsck_error(ctx, "dedup index: %lu blocks marked as indexed, but %lu entries",
+			           indexed, ctx->dedup_entries);
+		}
+	}
+
+	if (ctx->opts->verbose) {
+		double t = elapsed(&start);
+		printf("%u/%u inodes, %u/%u blocks used; checked in %.3f s (%.2f GB/s) "
+		       "with %u threads\n",
+		       sb->num_inodes - sb->num_unused_inodes, sb->num_inodes,
+		       sb->num_blocks - sb->num_unused_blocks, sb->num_blocks, t,
+		       ctx->size / t / 1e9, ctx->opts->n_threads);
+	}
+	ok = true;
+
+end:
+	free(ctx->block_refs);
+	free(ctx->tail_refs);
+	free(ctx->inode_refs);
+	free(ctx->parent);
+	free(ctx->reachable);
+	return ok;
+}
+
+
+int main(int argc, char *argv[])
+{
+	fsck_opts opts = {0};// defaults are all 0
+	if (!parse_args(argc, argv, &opts)) {
+		// Invalid arguments, print help to stderr
+		print_help(stderr, argv[0]);
+		return 2;
+	}
+	if (opts.help) {
+		// Help requested, print it to stdout
+		print_help(stdout, argv[0]);
+		return 0;
+	}
+	if (opts.n_threads == 0) {
+		long n = sysconf(_SC_NPROCESSORS_ONLN);
+		opts.n_threads = (n > 0) ? n : 1;
+	}
+
+	// Map image file into memory
+	size_t size;
+	void *image = map_file(opts.img_path, A1FS_BLOCK_SIZE, &size);
+	if (image == NULL) return 2;
+
+	fsck_ctx ctx = {
+		.opts = &opts,
+		.image = image,
+		.size = size,
+		.sb = (const a1fs_superblock*)image,
+		.print_lock = PTHREAD_MUTEX_INITIALIZER,
+	};
+	int ret = 2;
+	if (fsck(&ctx)) {
+		if (ctx.errors != 0) printf("%lu errors found\n", ctx.errors);
+		ret = (ctx.errors != 0) ? 1 : 0;
+	}
+	munmap(image, size);
+	return ret;
+}
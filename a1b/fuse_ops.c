@@ -0,0 +1,921 @@
+/*
+ * This code is provided solely for the personal and private use of students
+ * taking the CSC369H course at the University of Toronto. Copying for purposes
+ * other than this use is expressly prohibited. All forms of distribution of
+ * this code, including but not limited to public repositories on GitHub,
+ * GitLab, Bitbucket, or any other online platform, whether as given or with
+ * any changes, are expressly prohibited.
+ *
+ * Authors: Alexey Khrabrov, Karen Reid
+ *
+ * All of the files in this directory and all subdirectories are:
+ * Copyright (c) 2019 Karen Reid
+ */
+
+/**
+ * CSC369 Assignment 1 - a1fs FUSE callbacks.
+ *
+ * The path-based callbacks of the high-level FUSE API. Each one resolves its
+ * path and calls the inode-based operations in fs_ops.c.
+ */
+
+#include <errno.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include "fuse_ops.h"
+
+//NOTE: All path arguments are absolute paths within the a1fs file system and
+// start with a '/' that corresponds to the a1fs root directory.
+//
+// For example, if a1fs is mounted at "~/my_csc369_repo/a1b/mnt/", the path to a
+// file at "~/my_csc369_repo/a1b/mnt/dir/file" (as seen by the OS) will be
+// passed to FUSE callbacks as "/dir/file".
+//
+// Paths to directories (except for the root directory - "/") do not end in a
+// trailing '/'. For example, "~/my_csc369_repo/a1b/mnt/dir/" will be passed to
+// FUSE callbacks as "/dir".
+
+
+// TODO: sultan included this, see if this works
+
+
+
+/** Get file system context, and record the caller of the current callback. */
+static fs_ctx *get_fs(void)
+{
+	struct fuse_context *ctx = fuse_get_context();
+	fs_ctx *fs = (fs_ctx*)ctx->private_data;
+	fs->caller_uid = ctx->uid;
+	fs->caller_pid = ctx->pid;
+	return fs;
+}
+
+/**
+ * Negotiate the connection capabilities with the kernel (see fs_conn_init()).
+ *
+ * Called by FUSE once the connection is set up, after a1fs_init().
+ *
+ * @param conn  connection info; receives the wanted capabilities.
+ * @return      file system context that FUSE passes to the other callbacks.
+ */
+static void *a1fs_conn_init(struct fuse_conn_info *conn)
+{
+	fs_ctx *fs = get_fs();
+	fs_conn_init(fs, conn);
+	return fs;
+}
+
+
+
+/**
+ * Get file system statistics.
+ *
+ * Implements the statvfs() system call. See "man 2 statvfs" for details.
+ * The f_bfree and f_bavail fields should be set to the same value.
+ * The f_ffree and f_favail fields should be set to the same value.
+ * The f_fsid and f_flag fields are ignored.
+ *
+ * @param path  path to any file in the file system. Can be ignored.
+ * @param st    pointer to the struct statvfs that receives the result.
+ * @return      0 on success; -errno on error.
+ */
+static int a1fs_statfs(const char *path, struct statvfs *st)
+{
+	(void)path;// unused
+	fs_statfs(get_fs(), st);
+	return 0;
+}
+
+
+/**
+ * Get file or directory attributes.
+ *
+ * Implements the stat() system call. See "man 2 stat" for details.
+ * The st_dev, st_blksize, and st_ino fields are ignored.
+ *
+ * NOTE: the st_blocks field is measured in 512-byte units (disk sectors).
+ *
+ * Errors:
+ *   ENAMETOOLONG  the path or one of its components is too long.
+ *   ENOENT        a component of the path does not exist.
+ *   ENOTDIR       a component of the path prefix is not a directory.
+ *
+ * @param path  path to a file or directory.
+ * @param st    pointer to the struct stat that receives the result.
+ * @return      0 on success; -errno on error;
+ */
+static int a1fs_getattr(const char *path, struct stat *st)
+{
+	if (strlen(path) >= A1FS_PATH_MAX) return -ENAMETOOLONG;
+	fs_ctx *fs = get_fs();
+	memset(st, 0, sizeof(*st));
+
+	if (is_stats_file(path)) return stats_file_getattr(fs, st);
+	if (is_snapshot_dir(path)) return snapshot_dir_getattr(fs, st);
+
+	a1fs_ino_t ino;
+	const a1fs_inode *inode;
+	int ret = path_lookup_ro(fs, path, &ino, &inode);
+	if (ret != 0) return ret;
+
+	inode_getattr(fs, inode, st);
+	if (is_snapshot_path(path)) st->st_mode &= ~(S_IWUSR | S_IWGRP | S_IWOTH);
+	return 0;
+}
+
+/**
+ * Read a directory.
+ *
+ * Implements the readdir() system call. Should call filler() for each directory
+ * entry. See fuse.h in libfuse source code for details.
+ *
+ * Assumptions (already verified by FUSE using getattr() calls):
+ *   "path" exists and is a directory.
+ *
+ * Errors:
+ *   ENOMEM  not enough memory (e.g. a filler() call failed).
+ *
+ * @param path    path to the directory.
+ * @param buf     buffer that receives the result.
+ * @param filler  function that needs to be called for each directory entry.
+ *                Pass 0 as offset (4th argument). 3rd argument can be NULL.
+ * @param offset  unused.
+ * @param fi      unused.
+ * @return        0 on success; -errno on error.
+ */
+static int a1fs_readdir(const char *path, void *buf, fuse_fill_dir_t filler,
+                        off_t offset, struct fuse_file_info *fi)
+{
+	(void)offset;// unused
+	(void)fi;// unused
+	fs_ctx *fs = get_fs();
+	if (is_snapshot_dir(path)) return snapshot_dir_readdir(fs, buf, filler);
+
+	a1fs_ino_t ino;
+	const a1fs_inode *dir;
+	int ret = path_lookup_ro(fs, path, &ino, &dir);
+	if (ret != 0) return ret;
+
+	dir_verify(fs, dir);
+	uint64_t n = dir->size / sizeof(a1fs_dentry);
+	for (uint64_t i = 0; i < n; i++) {
+		if (filler(buf, dir_entry(fs, dir, i)->name, NULL, 0) != 0) return -ENOMEM;
+	}
+	return 0;
+}
+
+
+/**
+ * Create a directory.
+ *
+ * Implements the mkdir() system call. A directory created in the snapshot
+ * directory takes a snapshot of the file system (see snapshot_create()).
+ *
+ * NOTE: the mode argument may not have the type specification bits set, i.e.
+ * S_ISDIR(mode) can be false. To obtain the correct directory type bits use
+ * "mode | S_IFDIR".
+ *
+ * Assumptions (already verified by FUSE using getattr() calls):
+ *   "path" doesn't exist.
+ *   The parent directory of "path" exists and is a directory.
+ *   "path" and its components are not too long.
+ *
+ * Errors:
+ *   EDQUOT  a block or inode quota of the directory would be exceeded.
+ *   EEXIST  a snapshot with that name exists.
+ *   ENOMEM  not enough memory (e.g. a malloc() call failed).
+ *   ENOSPC  not enough free space in the file system.
+ *   EROFS   the path is inside a snapshot.
+ *
+ * @param path  path to the directory to create.
+ * @param mode  file mode bits.
+ * @return      0 on success; -errno on error.
+ */
+static int a1fs_mkdir(const char *path, mode_t mode)
+{
+	fs_ctx *fs = get_fs();
+	if (is_snapshot_path(path)) {
+		const char *name = snapshot_path_name(path);
+		if (name == NULL) return is_snapshot_dir(path) ? -EEXIST : -EROFS;
+		if (strlen(name) >= A1FS_NAME_MAX) return -ENAMETOOLONG;
+		return snapshot_create(fs, name);
+	}
+
+	a1fs_ino_t parent;
+	char name[A1FS_NAME_MAX];
+	int ret = path_parent(fs, path, &parent, name);
+	if (ret != 0) return ret;
+	a1fs_ino_t ino;
+	return dir_mkdir(fs, parent, name, mode, &ino);
+}
+
+/**
+ * Remove a directory.
+ *
+ * Implements the rmdir() system call. Removing a directory from the snapshot
+ * directory deletes that snapshot.
+ *
+ * Assumptions (already verified by FUSE using getattr() calls):
+ *   "path" exists and is a directory.
+ *
+ * Errors:
+ *   ENOSPC     a directory block shared with a snapshot can't be copied.
+ *   ENOTEMPTY  the directory is not empty.
+ *   EPERM      the path is the snapshot directory.
+ *   EROFS      the path is inside a snapshot.
+ *
+ * @param path  path to the directory to remove.
+ * @return      0 on success; -errno on error.
+ */
+static int a1fs_rmdir(const char *path)
+{
+	fs_ctx *fs = get_fs();
+	if (is_snapshot_path(path)) {
+		const char *name = snapshot_path_name(path);
+		if (name == NULL) return is_snapshot_dir(path) ? -EPERM : -EROFS;
+		int i = snapshot_find(fs, name);
+		if (i < 0) return -ENOENT;
+		snapshot_delete(fs, i);
+		return 0;
+	}
+
+	a1fs_ino_t parent;
+	char name[A1FS_NAME_MAX];
+	int ret = path_parent(fs, path, &parent, name);
+	if (ret != 0) return ret;
+	a1fs_ino_t ino;
+	if ((ret = dir_rmdir(fs, parent, name, &ino)) != 0) return ret;
+	inode_delete(fs, ino);
+	return 0;
+}
+
+/**
+ * Create a file.
+ *
+ * Implements the open()/creat() system call.
+ *
+ * Assumptions (already verified by FUSE using getattr() calls):
+ *   "path" doesn't exist.
+ *   The parent directory of "path" exists and is a directory.
+ *   "path" and its components are not too long.
+ *
+ * Errors:
+ *   EDQUOT  a block or inode quota of the file would be exceeded.
+ *   ENOMEM  not enough memory (e.g. a malloc() call failed).
+ *   ENOSPC  not enough free space in the file system.
+ *
+ * @param path  path to the file to create.
+ * @param mode  file mode bits.
+ * @param fi    file info; receives the page cache policy for the new file.
+ * @return      0 on success; -errno on error.
+ */
+static int a1fs_create(const char *path, mode_t mode, struct fuse_file_info *fi)
+{
+	assert(S_ISREG(mode));
+	fs_ctx *fs = get_fs();
+	if (is_snapshot_path(path)) return -EROFS;
+
+	a1fs_ino_t parent;
+	char name[A1FS_NAME_MAX];
+	int ret = path_parent(fs, path, &parent, name);
+	if (ret != 0) return ret;
+	a1fs_ino_t ino;
+	if ((ret = dir_mkfile(fs, parent, name, mode, &ino)) != 0) return ret;
+	if (fi != NULL) open_cache_policy(fs, ino, get_inode(fs, ino), fi);
+	return 0;
+}
+
+/**
+ * Remove a file.
+ *
+ * Implements the unlink() system call.
+ *
+ * Assumptions (already verified by FUSE using getattr() calls):
+ *   "path" exists and is a file.
+ *
+ * @param path  path to the file to remove.
+ * @return      0 on success; -errno on error.
+ */
+static int a1fs_unlink(const char *path)
+{
+	fs_ctx *fs = get_fs();
+	if (is_stats_file(path)) return -EPERM;
+	if (is_snapshot_path(path)) return -EROFS;
+
+	a1fs_ino_t parent;
+	char name[A1FS_NAME_MAX];
+	int ret = path_parent(fs, path, &parent, name);
+	if (ret != 0) return ret;
+	a1fs_ino_t ino;
+	if ((ret = dir_unlink(fs, parent, name, &ino)) != 0) return ret;
+	if (get_inode(fs, ino)->links == 0) inode_delete(fs, ino);
+	return 0;
+}
+
+/**
+ * Rename a file or directory.
+ *
+ * Implements the rename() system call.
+ *
+ * Assumptions (already verified by FUSE using getattr() calls):
+ *   "from" exists.
+ *   The parent directory of "to" exists and is a directory.
+ *
+ * Errors:
+ *   ENOMEM  not enough memory (e.g. a malloc() call failed).
+ *   ENOSPC  not enough free space in the file system.
+ *
+ * @param from  original file path.
+ * @param to    new file path.
+ * @return      0 on success; -errno on error.
+ */
+static int a1fs_rename(const char *from, const char *to)
+{
+	fs_ctx *fs = get_fs();
+	//I think we should use search, find inode referred to by path, and then change the name in the dentry? to the **to path.
+	//TODO
+	(void)from;
+	(void)to;
+	(void)fs;
+	return -ENOSYS;
+}
+
+
+/**
+ * Change the access and modification times of a file or directory.
+ *
+ * Implements the utimensat() system call. See "man 2 utimensat" for details.
+ *
+ * NOTE: You only have to implement the setting of modification time (mtime).
+ *
+ * Assumptions (already verified by FUSE using getattr() calls):
+ *   "path" exists.
+ *
+ * @param path  path to the file or directory.
+ * @param tv    timestamps array. See "man 2 utimensat" for details.
+ * @return      0 on success; -errno on failure.
+ */
+static int a1fs_utimens(const char *path, const struct timespec tv[2])
+{
+	fs_ctx *fs = get_fs();
+	//I think that we should use the search function to find the inode, and then update the 
+	//TODO
+	(void)path;
+	(void)tv;
+	(void)fs;
+	return -ENOSYS;
+}
+
+/**
+ * Change the size of a file.
+ *
+ * Implements the truncate() system call. Supports both extending and shrinking.
+ * If the file is extended, future reads from the new uninitialized range must
+ * return zero data.
+ *
+ * Assumptions (already verified by FUSE using getattr() calls):
+ *   "path" exists and is a file.
+ *
+ * Errors:
+ *   ENOMEM  not enough memory (e.g. a malloc() call failed).
+ *   ENOSPC  not enough free space in the file system.
+ *
+ * @param path  path to the file to set the size.
+ * @param size  new file size in bytes.
+ * @return      0 on success; -errno on error.
+ */
+static int a1fs_truncate(const char *path, off_t size)
+{
+	fs_ctx *fs = get_fs();
+	if (is_stats_file(path)) return -EACCES;
+	if (is_snapshot_path(path)) return -EROFS;
+
+	a1fs_ino_t ino;
+	int ret = path_lookup(fs, path, &ino);
+	if (ret != 0) return ret;
+	return file_truncate(fs, ino, get_inode(fs, ino), size);
+}
+
+
+/**
+ * Read data from a file.
+ *
+ * Implements the pread() system call. Should return exactly the number of bytes
+ * requested except on EOF (end of file) or error, otherwise the rest of the
+ * data will be substituted with zeros. Reads from file ranges that have not
+ * been written to must return zero data.image
+ *
+ * Assumptions (already verified by FUSE using getattr() calls):
+ *   "path" exists and is a file.
+ *
+ * @param path    path to the file to read from.
+ * @param buf     pointer to the buffer that receives the data.
+ * @param size    buffer size - number of bytes requested.
+ * @param offset  offset from the beginning of the file to read from.
+ * @param fi      file info; holds the statistics snapshot for the statistics
+ *                file, unused otherwise.
+ * @return        number of bytes read on success; 0 if offset is beyond EOF;
+ *                -errno on error.
+ */
+static int a1fs_read(const char *path, char *buf, size_t size, off_t offset,
+                     struct fuse_file_info *fi)
+{
+	fs_ctx *fs = get_fs();
+	if (is_stats_file(path)) return stats_file_read(fs, buf, size, offset, fi);
+
+	a1fs_ino_t ino;
+	const a1fs_inode *inode;
+	int ret = path_lookup_ro(fs, path, &ino, &inode);
+	if (ret != 0) return ret;
+	if (is_snapshot_path(path)) ino = SNAPSHOT_INO;
+
+	return file_pread(fs, ino, inode, buf, size, offset);
+}
+
+/**
+ * Write data to a file.
+ *
+ * Implements the pwrite() system call. Should return exactly the number of
+ * bytes requested except on error. If the offset is beyond EOF (end of file),
+ * the file must be extended. If the write creates a "hole" of uninitialized
+ * data, future reads from the "hole" must return zero data.
+ *
+ * Assumptions (already verified by FUSE using getattr() calls):
+ *   "path" exists and is a file.
+ *
+ * @param path    path to the file to write to.
+ * @param buf     pointer to the buffer containing the data.
+ * @param size    buffer size - number of bytes requested.
+ * @param offset  offset from the beginning of the file to write to.
+ * @param fi      file info; tells whether the file was opened with direct I/O.
+ * @return        number of bytes written on success; -errno on error.
+ */
+static int a1fs_write(const char *path, const char *buf, size_t size,
+                      off_t offset, struct fuse_file_info *fi)
+{
+	fs_ctx *fs = get_fs();
+	if (is_stats_file(path)) return -EACCES;
+	if (is_snapshot_path(path)) return -EROFS;
+
+	a1fs_ino_t ino;
+	int ret = path_lookup(fs, path, &ino);
+	if (ret != 0) return ret;
+	return file_pwrite(fs, ino, get_inode(fs, ino), buf, size, offset,
+	                   (fi != NULL) && (fi->fh == A1FS_FH_DIRECT_IO));
+}
+
+
+/**
+ * Perform a file-specific control operation.
+ *
+ * Implements the ioctl() system call for the A1FS_IOC_* commands defined in
+ * a1fs.h. The FUSE 2.9 API has no lseek() callback, so SEEK_DATA and SEEK_HOLE
+ * queries are only available through the private A1FS_IOC_SEEK_* ioctls; the
+ * kernel answers lseek() without asking the file system. FICLONE and FICLONERANGE are handled by the
+ * kernel and never reach FUSE, so reflink clones use A1FS_IOC_CLONE_RANGE.
+ * A1FS_IOC_RESIZE grows the file system (see fs_ctx_grow()).
+ * A1FS_IOC_SET_QUOTA and A1FS_IOC_REMOVE_QUOTA manage quotas (see quota_set()
+ * and quota_remove()).
+ * A1FS_IOC_DEFRAG moves the data blocks of a file or directory into one
+ * contiguous run (see file_defrag()).
+ *
+ * Errors:
+ *   EDQUOT      the clone destination would exceed its quota.
+ *   EFBIG       the metadata has no room for the new size.
+ *   EINVAL      invalid clone range, new size or quota, or the clone source is
+ *               not a regular file.
+ *   ENOENT      the clone source or the quota to remove does not exist.
+ *   ENOSPC      the clone destination would be too fragmented, there is no
+ *               room for another quota, or no free run to defragment into.
+ *   ENOTTY      unknown command.
+ *   ENXIO       no data or hole after the given offset (see "man 2 lseek").
+ *   EOPNOTSUPP  cloning to or from a compressed file.
+ *   EPERM       the caller may not manage quotas or resize the file system.
+ *   EROFS       the file is inside a snapshot.
+ *
+ * @param path   path to the file.
+ * @param cmd    ioctl command.
+ * @param arg    unused.
+ * @param fi     unused.
+ * @param flags  FUSE_IOCTL_* flags.
+ * @param data   command argument; both input and output.
+ * @return       0 on success; -errno on error.
+ */
+static int a1fs_ioctl(const char *path, int cmd, void *arg,
+                      struct fuse_file_info *fi, unsigned int flags, void *data)
+{
+	(void)arg;// unused
+	(void)fi;// unused
+	fs_ctx *fs = get_fs();
+	if (flags & FUSE_IOCTL_COMPAT) return -ENOSYS;
+
+	a1fs_ino_t ino;
+	const a1fs_inode *inode;
+	int ret = path_lookup_ro(fs, path, &ino, &inode);
+	if (ret != 0) return ret;
+
+	return file_ioctl(fs, ino, inode, is_snapshot_path(path), cmd, data);
+}
+
+
+/**
+ * Open a file.
+ *
+ * Implements the open() system call. Regular files get their page cache policy
+ * (see open_cache_policy()). For the statistics file, a snapshot of the
+ * statistics is taken so that all reads through the file descriptor see the
+ * same report, and direct I/O makes the kernel fetch it from here rather than
+ * from the page cache. Files in snapshots can only be opened for reading.
+ *
+ * Errors:
+ *   EACCES  the statistics file is opened for writing.
+ *   EROFS   a file in a snapshot is opened for writing.
+ *   ENOMEM  not enough memory for the statistics snapshot.
+ *
+ * @param path  path to the file.
+ * @param fi    file info; receives the page cache policy or the statistics
+ *              snapshot.
+ * @return      0 on success; -errno on error.
+ */
+static int a1fs_open(const char *path, struct fuse_file_info *fi)
+{
+	fs_ctx *fs = get_fs();
+	if (is_snapshot_path(path)) {
+		if ((fi->flags & O_ACCMODE) != O_RDONLY) return -EROFS;
+		a1fs_ino_t ino;
+		const a1fs_inode *inode;
+		int ret = path_lookup_ro(fs, path, &ino, &inode);
+		if (ret != 0) return ret;
+		// Files in snapshots never change
+		fi->keep_cache = 1;
+		return 0;
+	}
+	if (!is_stats_file(path)) {
+		a1fs_ino_t ino;
+		int ret = path_lookup(fs, path, &ino);
+		if (ret != 0) return ret;
+		open_cache_policy(fs, ino, get_inode(fs, ino), fi);
+		return 0;
+	}
+	if ((fi->flags & O_ACCMODE) != O_RDONLY) return -EACCES;
+
+	char *report = fs_stats_report(fs);
+	if (report == NULL) return -ENOMEM;
+	fi->fh = (uintptr_t)report;
+	fi->direct_io = 1;
+	return 0;
+}
+
+/**
+ * Release an open file.
+ *
+ * Called when the last file descriptor of an open file is closed. The tail of
+ * the file is packed then (see tail_pack()).
+ *
+ * @param path  path to the file.
+ * @param fi    file info.
+ * @return      0 (the return value is ignored).
+ */
+static int a1fs_release(const char *path, struct fuse_file_info *fi)
+{
+	if (is_stats_file(path)) {
+		free((char*)(uintptr_t)fi->fh);
+		return 0;
+	}
+	fs_ctx *fs = get_fs();
+	a1fs_ino_t ino;
+	if (!is_snapshot_path(path) && (path_lookup(fs, path, &ino) == 0)) {
+		tail_pack(fs, get_inode(fs, ino));
+	}
+	return 0;
+}
+
+/**
+ * Flush an open file.
+ *
+ * Called on each close() of a file descriptor. With the writeback cache, the
+ * kernel writes the dirty pages back before calling this. a1fs keeps no file
+ * data outside of the mapped image, so there is nothing left to flush.
+ *
+ * @param path  path to the file.
+ * @param fi    file info.
+ * @return      0.
+ */
+static int a1fs_flush(const char *path, struct fuse_file_info *fi)
+{
+	(void)path;// unused
+	(void)fi;// unused
+	return 0;
+}
+
+/**
+ * Synchronize file contents.
+ *
+ * Implements the fsync() and fdatasync() system calls. The writes are ordered
+ * so that a crash never leaves the file pointing at blocks that are not on
+ * disk yet: the file data first, then the block bitmap and reference counts
+ * that make its blocks allocated, and finally the inode with the extents and
+ * the size. fdatasync() does the same, since the data can't be read back
+ * without the extents and the size. With --lazytime, the pending modification
+ * time of the file is written to the inode first.
+ *
+ * Errors:
+ *   EIO  writing back the image failed (see "man 2 msync").
+ *
+ * @param path      path to the file.
+ * @param datasync  whether only the data needs to be synchronized; unused.
+ * @param fi        unused.
+ * @return          0 on success; -errno on error.
+ */
+static int a1fs_fsync(const char *path, int datasync, struct fuse_file_info *fi)
+{
+	(void)datasync;// unused
+	(void)fi;// unused
+	fs_ctx *fs = get_fs();
+	// Snapshots are synced along with the files they were taken of
+	if (is_stats_file(path) || is_snapshot_path(path)) return 0;
+
+	a1fs_ino_t ino;
+	int ret = path_lookup(fs, path, &ino);
+	if (ret != 0) return ret;
+	return file_fsync(fs, get_inode(fs, ino));
+}
+
+
+/**
+ * Set an extended attribute.
+ *
+ * Implements the setxattr() system call. See "man 2 setxattr" for details.
+ *
+ * Errors:
+ *   E2BIG   the value is too large to fit into an xattr block.
+ *   EEXIST  XATTR_CREATE was given and the attribute exists.
+ *   ENODATA XATTR_REPLACE was given and the attribute doesn't exist.
+ *   ENOMEM  not enough memory.
+ *   ENOSPC  not enough space for the attributes of the file.
+ *   EPERM   the file is the statistics file.
+ *   ERANGE  the name is empty or too long.
+ *
+ * @param path   path to the file or directory.
+ * @param name   attribute name, including the namespace prefix.
+ * @param value  attribute value.
+ * @param size   size of the value in bytes.
+ * @param flags  0, XATTR_CREATE or XATTR_REPLACE.
+ * @return       0 on success; -errno on error.
+ */
+static int a1fs_setxattr(const char *path, const char *name, const char *value,
+                         size_t size, int flags)
+{
+	fs_ctx *fs = get_fs();
+	if (is_stats_file(path)) return -EPERM;
+	if (is_snapshot_path(path)) return -EROFS;
+
+	a1fs_ino_t ino;
+	int ret = path_lookup(fs, path, &ino);
+	if (ret != 0) return ret;
+	return inode_setxattr(fs, get_inode(fs, ino), name, value, size, flags);
+}
+
+/**
+ * Get an extended attribute.
+ *
+ * Implements the getxattr() system call. Attributes stored in the inode are
+ * found without reading the xattr block.
+ *
+ * Errors:
+ *   ENODATA  the attribute doesn't exist.
+ *   ERANGE   the buffer is too small for the value.
+ *
+ * @param path   path to the file or directory.
+ * @param name   attribute name.
+ * @param value  buffer that receives the value.
+ * @param size   buffer size in bytes; 0 to only get the size of the value.
+ * @return       size of the value on success; -errno on error.
+ */
+static int a1fs_getxattr(const char *path, const char *name, char *value,
+                         size_t size)
+{
+	fs_ctx *fs = get_fs();
+	if (is_stats_file(path) || is_snapshot_dir(path)) return -ENODATA;
+
+	a1fs_ino_t ino;
+	const a1fs_inode *inode;
+	int ret = path_lookup_ro(fs, path, &ino, &inode);
+	if (ret != 0) return ret;
+	return inode_getxattr(fs, inode, name, value, size);
+}
+
+/**
+ * List extended attributes.
+ *
+ * Implements the listxattr() system call: the names are stored one after
+ * another, each followed by a null character.
+ *
+ * Errors:
+ *   ERANGE  the buffer is too small for the list.
+ *
+ * @param path  path to the file or directory.
+ * @param buf   buffer that receives the list.
+ * @param size  buffer size in bytes; 0 to only get the size of the list.
+ * @return      size of the list on success; -errno on error.
+ */
+static int a1fs_listxattr(const char *path, char *buf, size_t size)
+{
+	fs_ctx *fs = get_fs();
+	if (is_stats_file(path) || is_snapshot_dir(path)) return 0;
+
+	a1fs_ino_t ino;
+	const a1fs_inode *inode;
+	int ret = path_lookup_ro(fs, path, &ino, &inode);
+	if (ret != 0) return ret;
+	return inode_listxattr(fs, inode, buf, size);
+}
+
+/**
+ * Remove an extended attribute.
+ *
+ * Implements the removexattr() system call.
+ *
+ * Errors:
+ *   ENODATA  the attribute doesn't exist.
+ *   ENOMEM   not enough memory.
+ *   EPERM    the file is the statistics file.
+ *
+ * @param path  path to the file or directory.
+ * @param name  attribute name.
+ * @return      0 on success; -errno on error.
+ */
+static int a1fs_removexattr(const char *path, const char *name)
+{
+	fs_ctx *fs = get_fs();
+	if (is_stats_file(path)) return -EPERM;
+	if (is_snapshot_path(path)) return -EROFS;
+
+	a1fs_ino_t ino;
+	int ret = path_lookup(fs, path, &ino);
+	if (ret != 0) return ret;
+	return inode_removexattr(fs, get_inode(fs, ino), name);
+}
+
+
+// Each callback is called through a wrapper that records its latency in the
+// calling thread's histograms, whichever way the callback returns, and the
+// call itself into the trace with --trace.
+#define TIMED_OP(op, path, name, offset, size, call)                       \
+	do {                                                               \
+		fs_ctx *fs = get_fs();                                     \
+		uint64_t start = stats_now();                              \
+		int ret = (call);                                          \
+		stats_record_op(&fs->stats, (op), start);                  \
+		if (fs->trace != NULL) {                                   \
+			trace_op(fs, (op), start, ret, 0, (path), (name),  \
+			         (offset), (size));                        \
+		}                                                          \
+		return ret;                                                \
+	} while (0)
+
+static int timed_statfs(const char *path, struct statvfs *st)
+{
+	TIMED_OP(A1FS_OP_STATFS, path, NULL, 0, 0, a1fs_statfs(path, st));
+}
+
+static int timed_getattr(const char *path, struct stat *st)
+{
+	TIMED_OP(A1FS_OP_GETATTR, path, NULL, 0, 0, a1fs_getattr(path, st));
+}
+
+static int timed_readdir(const char *path, void *buf, fuse_fill_dir_t filler,
+                         off_t offset, struct fuse_file_info *fi)
+{
+	TIMED_OP(A1FS_OP_READDIR, path, NULL, offset, 0,
+	         a1fs_readdir(path, buf, filler, offset, fi));
+}
+
+static int timed_mkdir(const char *path, mode_t mode)
+{
+	TIMED_OP(A1FS_OP_MKDIR, path, NULL, mode, 0, a1fs_mkdir(path, mode));
+}
+
+static int timed_rmdir(const char *path)
+{
+	TIMED_OP(A1FS_OP_RMDIR, path, NULL, 0, 0, a1fs_rmdir(path));
+}
+
+static int timed_create(const char *path, mode_t mode, struct fuse_file_info *fi)
+{
+	TIMED_OP(A1FS_OP_CREATE, path, NULL, mode, 0, a1fs_create(path, mode, fi));
+}
+
+static int timed_unlink(const char *path)
+{
+	TIMED_OP(A1FS_OP_UNLINK, path, NULL, 0, 0, a1fs_unlink(path));
+}
+
+static int timed_rename(const char *from, const char *to)
+{
+	TIMED_OP(A1FS_OP_RENAME, from, to, 0, 0, a1fs_rename(from, to));
+}
+
+static int timed_utimens(const char *path, const struct timespec tv[2])
+{
+	TIMED_OP(A1FS_OP_UTIMENS, path, NULL, 0, 0, a1fs_utimens(path, tv));
+}
+
+static int timed_truncate(const char *path, off_t size)
+{
+	TIMED_OP(A1FS_OP_TRUNCATE, path, NULL, size, 0, a1fs_truncate(path, size));
+}
+
+static int timed_open(const char *path, struct fuse_file_info *fi)
+{
+	TIMED_OP(A1FS_OP_OPEN, path, NULL, fi->flags, 0, a1fs_open(path, fi));
+}
+
+static int timed_read(const char *path, char *buf, size_t size, off_t offset,
+                      struct fuse_file_info *fi)
+{
+	TIMED_OP(A1FS_OP_READ, path, NULL, offset, size,
+	         a1fs_read(path, buf, size, offset, fi));
+}
+
+static int timed_write(const char *path, const char *buf, size_t size,
+                       off_t offset, struct fuse_file_info *fi)
+{
+	TIMED_OP(A1FS_OP_WRITE, path, NULL, offset, size,
+	         a1fs_write(path, buf, size, offset, fi));
+}
+
+static int timed_release(const char *path, struct fuse_file_info *fi)
+{
+	TIMED_OP(A1FS_OP_RELEASE, path, NULL, 0, 0, a1fs_release(path, fi));
+}
+
+static int timed_flush(const char *path, struct fuse_file_info *fi)
+{
+	TIMED_OP(A1FS_OP_FLUSH, path, NULL, 0, 0, a1fs_flush(path, fi));
+}
+
+static int timed_fsync(const char *path, int datasync, struct fuse_file_info *fi)
+{
+	TIMED_OP(A1FS_OP_FSYNC, path, NULL, 0, 0, a1fs_fsync(path, datasync, fi));
+}
+
+static int timed_setxattr(const char *path, const char *name, const char *value,
+                          size_t size, int flags)
+{
+	TIMED_OP(A1FS_OP_SETXATTR, path, name, flags, size,
+	         a1fs_setxattr(path, name, value, size, flags));
+}
+
+static int timed_getxattr(const char *path, const char *name, char *value,
+                          size_t size)
+{
+	TIMED_OP(A1FS_OP_GETXATTR, path, name, 0, size,
+	         a1fs_getxattr(path, name, value, size));
+}
+
+static int timed_listxattr(const char *path, char *buf, size_t size)
+{
+	TIMED_OP(A1FS_OP_LISTXATTR, path, NULL, 0, size, a1fs_listxattr(path, buf, size));
+}
+
+static int timed_removexattr(const char *path, const char *name)
+{
+	TIMED_OP(A1FS_OP_REMOVEXATTR, path, name, 0, 0, a1fs_removexattr(path, name));
+}
+
+static int timed_ioctl(const char *path, int cmd, void *arg,
+                       struct fuse_file_info *fi, unsigned int flags, void *data)
+{
+	TIMED_OP(A1FS_OP_IOCTL, path, NULL, (unsigned int)cmd, 0,
+	         a1fs_ioctl(path, cmd, arg, fi, flags, data));
+}
+
+
+struct fuse_operations a1fs_ops = {
+	.init        = a1fs_conn_init,
+	.destroy     = a1fs_destroy,
+	.statfs      = timed_statfs,
+	.getattr     = timed_getattr,
+	.readdir     = timed_readdir,
+	.mkdir       = timed_mkdir,
+	.rmdir       = timed_rmdir,
+	.create      = timed_create,
+	.unlink      = timed_unlink,
+	.rename      = timed_rename,
+	.utimens     = timed_utimens,
+	.truncate    = timed_truncate,
+	.open        = timed_open,
+	.read        = timed_read,
+	.write       = timed_write,
+	.release     = timed_release,
+	.flush       = timed_flush,
+	.fsync       = timed_fsync,
+	.setxattr    = timed_setxattr,
+	.getxattr    = timed_getxattr,
+	.listxattr   = timed_listxattr,
+	.removexattr = timed_removexattr,
+	.ioctl       = timed_ioctl,
+};
+
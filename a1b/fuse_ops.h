@@ -0,0 +1,29 @@
+/*
+ * This code is provided solely for the personal and private use of students
+ * taking the CSC369H course at the University of Toronto. Copying for purposes
+ * other than this use is expressly prohibited. All forms of distribution of
+ * this code, including but not limited to public repositories on GitHub,
+ * GitLab, Bitbucket, or any other online platform, whether as given or with
+ * any changes, are expressly prohibited.
+ *
+ * Authors: Alexey Khrabrov, Karen Reid
+ *
+ * All of the files in this directory and all subdirectories are:
+ * Copyright (c) 2019 Karen Reid
+ */
+
+/**
+ * CSC369 Assignment 1 - a1fs FUSE callbacks header file.
+ */
+
+#pragma once
+
+#include "fs_ops.h"
+
+
+/**
+ * The path-based FUSE callbacks of a1fs. They get the file system context and
+ * the caller's credentials from fuse_get_context(), whose private_data must
+ * point to a context set up with a1fs_init().
+ */
+extern struct fuse_operations a1fs_ops;
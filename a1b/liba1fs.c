@@ -0,0 +1,264 @@
+/*
+ * This code is provided solely for the personal and private use of students
+ * taking the CSC369H course at the University of Toronto. Copying for purposes
+ * other than this use is expressly prohibited. All forms of distribution of
+ * this code, including but not limited to public repositories on GitHub,
+ * GitLab, Bitbucket, or any other online platform, whether as given or with
+ * any changes, are expressly prohibited.
+ *
+ * Authors: Alexey Khrabrov, Karen Reid
+ *
+ * All of the files in this directory and all subdirectories are:
+ * Copyright (c) 2019 Karen Reid
+ */
+
+
+/**
+ * CSC369 Assignment 1 - In-process a1fs library implementation.
+ *
+ * Calls the inode-based operations in fs_ops.c (file_pread(), dir_mkfile()
+ * etc.) directly, without FUSE. The calls are not recorded with --trace.
+ */
+
+#include <errno.h>
+#include <fcntl.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+
+#include "fs_ops.h"
+#include "liba1fs.h"
+
+
+/** Largest read or write passed to file_pread() and file_pwrite() at once. */
+#define LIB_IO_MAX (1u << 30)
+
+/**
+ * Start an operation on a file system from the calling thread: the caller's
+ * credentials are those of the process.
+ *
+ * @return  start time for stats_record_op().
+ */
+static uint64_t lib_enter(fs_ctx *fs)
+{
+	fs->caller_uid = geteuid();
+	fs->caller_pid = getpid();
+	return stats_now();
+}
+
+
+bool a1fs_mount(fs_ctx *fs, a1fs_opts *opts)
+{
+	return a1fs_init(fs, opts);
+}
+
+void a1fs_unmount(fs_ctx *fs)
+{
+	a1fs_destroy(fs);
+}
+
+static int lib_open(fs_ctx *fs, const char *path, int flags, mode_t mode,
+                    a1fs_ino_t *ino)
+{
+	if (path[0] != '/') return -EINVAL;
+	if (is_snapshot_path(path) || is_stats_file(path)) return -ENOTSUP;
+
+	int ret = path_lookup(fs, path, ino);
+	if ((ret == -ENOENT) && (flags & O_CREAT)) {
+		// The lookup only fails on the last component if its parent exists
+		a1fs_ino_t parent;
+		char name[A1FS_NAME_MAX];
+		if ((ret = path_parent(fs, path, &parent, name)) != 0) return ret;
+		return dir_mkfile(fs, parent, name, S_IFREG | (mode & ~S_IFMT), ino);
+	}
+	if (ret != 0) return ret;
+	if ((flags & O_CREAT) && (flags & O_EXCL)) return -EEXIST;
+
+	a1fs_inode *inode = get_inode(fs, *ino);
+	bool writable = (flags & O_ACCMODE) != O_RDONLY;
+	if (S_ISDIR(inode->mode)) return writable ? -EISDIR : 0;
+	if (writable && (flags & O_TRUNC)) return file_truncate(fs, *ino, inode, 0);
+	return 0;
+}
+
+int a1fs_open(fs_ctx *fs, const char *path, int flags, mode_t mode,
+              a1fs_ino_t *ino)
+{
+	uint64_t start = lib_enter(fs);
+	int ret = lib_open(fs, path, flags, mode, ino);
+	stats_record_op(&fs->stats, A1FS_OP_OPEN, start);
+	return ret;
+}
+
+void a1fs_close(fs_ctx *fs, a1fs_ino_t ino)
+{
+	uint64_t start = lib_enter(fs);
+	a1fs_inode *inode = get_inode(fs, ino);
+	if (inode->links != 0) tail_pack(fs, inode);
+	stats_record_op(&fs->stats, A1FS_OP_RELEASE, start);
+}
+
+void a1fs_fstat(fs_ctx *fs, a1fs_ino_t ino, struct stat *st)
+{
+	uint64_t start = lib_enter(fs);
+	memset(st, 0, sizeof(*st));
+	inode_getattr(fs, get_inode(fs, ino), st);
+	st->st_ino = ino;
+	stats_record_op(&fs->stats, A1FS_OP_GETATTR, start);
+}
+
+ssize_t a1fs_pread(fs_ctx *fs, a1fs_ino_t ino, void *buf, size_t size,
+                   off_t offset)
+{
+	uint64_t start = lib_enter(fs);
+	const a1fs_inode *inode = get_inode(fs, ino);
+	ssize_t ret = S_ISDIR(inode->mode) ? -EISDIR : 0;
+
+	size_t done = 0;
+	while ((ret == 0) && (done < size)) {
+		size_t n = (size - done > LIB_IO_MAX) ? LIB_IO_MAX : size - done;
+		int count = file_pread(fs, ino, inode, (char*)buf + done, n, offset + done);
+		if (count < 0) {
+			ret = count;
+		} else {
+			done += count;
+			// Reached EOF
+			if ((size_t)count < n) break;
+		}
+	}
+
+	stats_record_op(&fs->stats, A1FS_OP_READ, start);
+	return (ret == 0) ? (ssize_t)done : ret;
+}
+
+ssize_t a1fs_pwrite(fs_ctx *fs, a1fs_ino_t ino, const void *buf, size_t size,
+                    off_t offset)
+{
+	uint64_t start = lib_enter(fs);
+	ssize_t ret = S_ISDIR(get_inode(fs, ino)->mode) ? -EISDIR : 0;
+
+	size_t done = 0;
+	while ((ret == 0) && (done < size)) {
+		size_t n = (size - done > LIB_IO_MAX) ? LIB_IO_MAX : size - done;
+		// No kernel page cache holds the file's pages
+		int count = file_pwrite(fs, ino, get_inode(fs, ino), (const char*)buf + done,
+		                        n, offset + done, false);
+		if (count < 0) {
+			ret = count;
+		} else {
+			done += count;
+		}
+	}
+
+	stats_record_op(&fs->stats, A1FS_OP_WRITE, start);
+	// Like pwrite(), report what was written before an error such as ENOSPC
+	return ((ret == 0) || (done > 0)) ? (ssize_t)done : ret;
+}
+
+/**
+ * Resolve the parent directory of a path for creating or removing its entry.
+ *
+ * @return  0 on success; -errno on error (see a1fs_mkdir() and a1fs_unlink()).
+ */
+static int lib_parent(fs_ctx *fs, const char *path, a1fs_ino_t *parent, char *name)
+{
+	if (path[0] != '/') return -EINVAL;
+	if (is_snapshot_path(path) || is_stats_file(path)) return -ENOTSUP;
+	if (strcmp(path, "/") == 0) return -EBUSY;
+
+	int ret = path_parent(fs, path, parent, name);
+	if (ret != 0) return ret;
+	return S_ISDIR(get_inode(fs, *parent)->mode) ? 0 : -ENOTDIR;
+}
+
+static int lib_mkdir(fs_ctx *fs, const char *path, mode_t mode)
+{
+	a1fs_ino_t parent, ino;
+	char name[A1FS_NAME_MAX];
+	int ret = lib_parent(fs, path, &parent, name);
+	if (ret != 0) return (ret == -EBUSY) ? -EEXIST : ret;
+	if (dir_lookup(fs, get_inode(fs, parent), name, &ino) == 0) return -EEXIST;
+	return dir_mkdir(fs, parent, name, mode & ~S_IFMT, &ino);
+}
+
+int a1fs_mkdir(fs_ctx *fs, const char *path, mode_t mode)
+{
+	uint64_t start = lib_enter(fs);
+	int ret = lib_mkdir(fs, path, mode);
+	stats_record_op(&fs->stats, A1FS_OP_MKDIR, start);
+	return ret;
+}
+
+static int lib_rmdir(fs_ctx *fs, const char *path)
+{
+	a1fs_ino_t parent, ino;
+	char name[A1FS_NAME_MAX];
+	int ret = lib_parent(fs, path, &parent, name);
+	if (ret != 0) return ret;
+	if ((ret = dir_rmdir(fs, parent, name, &ino)) != 0) return ret;
+	inode_delete(fs, ino);
+	return 0;
+}
+
+int a1fs_rmdir(fs_ctx *fs, const char *path)
+{
+	uint64_t start = lib_enter(fs);
+	int ret = lib_rmdir(fs, path);
+	stats_record_op(&fs->stats, A1FS_OP_RMDIR, start);
+	return ret;
+}
+
+static int lib_unlink(fs_ctx *fs, const char *path)
+{
+	a1fs_ino_t parent, ino;
+	char name[A1FS_NAME_MAX];
+	int ret = lib_parent(fs, path, &parent, name);
+	if (ret != 0) return (ret == -EBUSY) ? -EISDIR : ret;
+	if ((ret = dir_unlink(fs, parent, name, &ino)) != 0) return ret;
+	if (get_inode(fs, ino)->links == 0) inode_delete(fs, ino);
+	return 0;
+}
+
+int a1fs_unlink(fs_ctx *fs, const char *path)
+{
+	uint64_t start = lib_enter(fs);
+	int ret = lib_unlink(fs, path);
+	stats_record_op(&fs->stats, A1FS_OP_UNLINK, start);
+	return ret;
+}
+
+int a1fs_ftruncate(fs_ctx *fs, a1fs_ino_t ino, off_t size)
+{
+	uint64_t start = lib_enter(fs);
+	a1fs_inode *inode = get_inode(fs, ino);
+	int ret = S_ISDIR(inode->mode) ? -EISDIR : (size < 0) ? -EINVAL
+	          : file_truncate(fs, ino, inode, size);
+	stats_record_op(&fs->stats, A1FS_OP_TRUNCATE, start);
+	return ret;
+}
+
+int a1fs_fsync(fs_ctx *fs, a1fs_ino_t ino)
+{
+	uint64_t start = lib_enter(fs);
+	int ret = file_fsync(fs, get_inode(fs, ino));
+	stats_record_op(&fs->stats, A1FS_OP_FSYNC, start);
+	return ret;
+}
+
+int a1fs_readdir(fs_ctx *fs, a1fs_ino_t ino, a1fs_readdir_fn fn, void *arg)
+{
+	uint64_t start = lib_enter(fs);
+	const a1fs_inode *dir = get_inode(fs, ino);
+	int ret = S_ISDIR(dir->mode) ? 0 : -ENOTDIR;
+	if (ret == 0) {
+		dir_verify(fs, dir);
+		uint64_t n = dir->size / sizeof(a1fs_dentry);
+		for (uint64_t i = 0; (i < n) && (ret == 0); i++) {
+			const a1fs_dentry *d = dir_entry(fs, dir, i);
+			ret = fn(arg, d->name, d->ino);
+		}
+	}
+	stats_record_op(&fs->stats, A1FS_OP_READDIR, start);
+	return ret;
+}
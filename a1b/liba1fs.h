@@ -0,0 +1,237 @@
+/*
+ * This code is provided solely for the personal and private use of students
+ * taking the CSC369H course at the University of Toronto. Copying for purposes
+ * other than this use is expressly prohibited. All forms of distribution of
+ * this code, including but not limited to public repositories on GitHub,
+ * GitLab, Bitbucket, or any other online platform, whether as given or with
+ * any changes, are expressly prohibited.
+ *
+ * Authors: Alexey Khrabrov, Karen Reid
+ *
+ * All of the files in this directory and all subdirectories are:
+ * Copyright (c) 2019 Karen Reid
+ */
+
+
+/**
+ * CSC369 Assignment 1 - In-process a1fs library header file.
+ *
+ * liba1fs reads and writes a1fs images from within the calling process, without
+ * FUSE: an operation is a function call on the mapped image instead of a round
+ * trip through the kernel and the a1fs process. It is meant for batch jobs that
+ * process images directly.
+ *
+ * Files are referred to by their inode numbers, as returned by a1fs_open();
+ * there is nothing to close. An image must not be mounted with a1fs while a
+ * process has it open with liba1fs, and the operations on one fs_ctx must not
+ * run concurrently (different contexts can be used from different threads).
+ */
+
+#pragma once
+
+#include <stdbool.h>
+#include <sys/stat.h>
+#include <sys/types.h>
+
+#include "fs_ctx.h"
+
+
+/**
+ * Mount an image in-process.
+ *
+ * @param fs    file system context to initialize.
+ * @param opts  options (img_path must be set); must stay valid until the file
+ *              system is unmounted.
+ * @return      true on success; false on failure.
+ */
+bool a1fs_mount(fs_ctx *fs, a1fs_opts *opts);
+
+/**
+ * Unmount an image mounted with a1fs_mount(). With opts->sync, its contents
+ * are synced to disk first.
+ */
+void a1fs_unmount(fs_ctx *fs);
+
+/**
+ * Open a file by its path.
+ *
+ * Supports O_CREAT, O_EXCL and O_TRUNC like open(). Files in snapshots and the
+ * statistics file are only served by the FUSE front ends.
+ *
+ * Errors:
+ *   EDQUOT        creating the file would exceed a quota.
+ *   EEXIST        O_CREAT and O_EXCL were given and the file exists.
+ *   EINVAL        the path is not absolute.
+ *   EISDIR        a directory is opened for writing.
+ *   ENAMETOOLONG  the path or one of its components is too long.
+ *   ENOENT        the file does not exist and O_CREAT was not given, or a
+ *                 component of the path prefix does not exist.
+ *   ENOSPC        not enough free inodes or blocks to create the file.
+ *   ENOTDIR       a component of the path prefix is not a directory.
+ *   ENOTSUP       the path is in a snapshot or is the statistics file.
+ *
+ * @param fs     file system context.
+ * @param path   absolute path to the file.
+ * @param flags  open() flags.
+ * @param mode   permission bits of a created file.
+ * @param ino    pointer to the variable that receives the inode number.
+ * @return       0 on success; -errno on error.
+ */
+int a1fs_open(fs_ctx *fs, const char *path, int flags, mode_t mode,
+              a1fs_ino_t *ino);
+
+/**
+ * Close a file opened with a1fs_open(). Packs the tail of the file with
+ * A1FS_FEATURE_TAILS; the inode number stays valid while the file is linked.
+ *
+ * @param fs   file system context.
+ * @param ino  inode number of the file.
+ */
+void a1fs_close(fs_ctx *fs, a1fs_ino_t ino);
+
+/**
+ * Get the attributes of an open file.
+ *
+ * @param fs   file system context.
+ * @param ino  inode number of the file.
+ * @param st   pointer to the struct that receives the attributes.
+ */
+void a1fs_fstat(fs_ctx *fs, a1fs_ino_t ino, struct stat *st);
+
+/**
+ * Read data from a file, like pread().
+ *
+ * Errors:
+ *   EISDIR  the file is a directory.
+ *   ENOMEM  not enough memory to decompress a cluster of a compressed file.
+ *
+ * @param fs      file system context.
+ * @param ino     inode number of the file.
+ * @param buf     pointer to the buffer that receives the data.
+ * @param size    number of bytes requested.
+ * @param offset  offset from the beginning of the file to read from.
+ * @return        number of bytes read on success (less than size only at
+ *                EOF); -errno on error.
+ */
+ssize_t a1fs_pread(fs_ctx *fs, a1fs_ino_t ino, void *buf, size_t size,
+                   off_t offset);
+
+/**
+ * Write data to a file, like pwrite(). The file is extended if the write ends
+ * beyond EOF; a hole left before the offset reads as zeros. If the file system
+ * runs out of space partway, the part already written is kept and its size is
+ * returned.
+ *
+ * Errors:
+ *   EDQUOT  a block quota of the file would be exceeded.
+ *   EFBIG   the write would exceed the maximum file size.
+ *   EISDIR  the file is a directory.
+ *   ENOMEM  not enough memory.
+ *   ENOSPC  not enough free space in the file system.
+ *
+ * @param fs      file system context.
+ * @param ino     inode number of the file.
+ * @param buf     pointer to the buffer containing the data.
+ * @param size    number of bytes to write.
+ * @param offset  offset from the beginning of the file to write to.
+ * @return        number of bytes written on success; -errno on error.
+ */
+ssize_t a1fs_pwrite(fs_ctx *fs, a1fs_ino_t ino, const void *buf, size_t size,
+                    off_t offset);
+
+/**
+ * Create a directory, like mkdir().
+ *
+ * Errors:
+ *   EDQUOT        a block or inode quota of the parent would be exceeded.
+ *   EEXIST        the path exists.
+ *   EINVAL        the path is not absolute.
+ *   ENAMETOOLONG  the path or one of its components is too long.
+ *   ENOENT        a component of the path prefix does not exist.
+ *   ENOMEM        not enough memory.
+ *   ENOSPC        not enough free inodes or blocks.
+ *   ENOTDIR       a component of the path prefix is not a directory.
+ *   ENOTSUP       the path is in a snapshot or is the statistics file.
+ *
+ * @param fs    file system context.
+ * @param path  absolute path to the directory.
+ * @param mode  permission bits.
+ * @return      0 on success; -errno on error.
+ */
+int a1fs_mkdir(fs_ctx *fs, const char *path, mode_t mode);
+
+/**
+ * Remove an empty directory, like rmdir().
+ *
+ * Errors:
+ *   EBUSY      the path is the root directory.
+ *   ENOTDIR    the path is not a directory.
+ *   ENOTEMPTY  the directory is not empty.
+ *   other      same as a1fs_mkdir() for resolving the path.
+ *
+ * @param fs    file system context.
+ * @param path  absolute path to the directory.
+ * @return      0 on success; -errno on error.
+ */
+int a1fs_rmdir(fs_ctx *fs, const char *path);
+
+/**
+ * Remove a file, like unlink(). Its inode number must not be used afterwards.
+ *
+ * Errors:
+ *   EISDIR  the path is a directory.
+ *   other   same as a1fs_mkdir() for resolving the path.
+ *
+ * @param fs    file system context.
+ * @param path  absolute path to the file.
+ * @return      0 on success; -errno on error.
+ */
+int a1fs_unlink(fs_ctx *fs, const char *path);
+
+/**
+ * Change the size of a file, like ftruncate().
+ *
+ * Errors:
+ *   EDQUOT  a block quota of the file would be exceeded.
+ *   EINVAL  the size is negative.
+ *   EISDIR  the file is a directory.
+ *   ENOSPC  not enough free space in the file system.
+ *
+ * @param fs    file system context.
+ * @param ino   inode number of the file.
+ * @param size  new size in bytes.
+ * @return      0 on success; -errno on error.
+ */
+int a1fs_ftruncate(fs_ctx *fs, a1fs_ino_t ino, off_t size);
+
+/**
+ * Write the data of a file to disk, along with its pending modification time
+ * with --lazytime, like fsync().
+ *
+ * @param fs   file system context.
+ * @param ino  inode number of the file.
+ * @return     0 on success; -errno on error.
+ */
+int a1fs_fsync(fs_ctx *fs, a1fs_ino_t ino);
+
+/**
+ * Callback of a1fs_readdir(), called for each entry.
+ *
+ * @return  0 to continue; any other value stops the listing and is returned.
+ */
+typedef int (*a1fs_readdir_fn)(void *arg, const char *name, a1fs_ino_t ino);
+
+/**
+ * List the entries of a directory, including "." and "..".
+ *
+ * Errors:
+ *   ENOTDIR  the file is not a directory.
+ *
+ * @param fs   file system context.
+ * @param ino  inode number of the directory, as returned by a1fs_open().
+ * @param fn   function called for each entry.
+ * @param arg  passed to fn.
+ * @return     0 on success; the value returned by fn if it stopped the
+ *             listing; -errno on error.
+ */
+int a1fs_readdir(fs_ctx *fs, a1fs_ino_t ino, a1fs_readdir_fn fn, void *arg);
@@ -0,0 +1,320 @@
+/*
+ * This code is provided solely for the personal and private use of students
+ * taking the CSC369H course at the University of Toronto. Copying for purposes
+ * other than this use is expressly prohibited. All forms of distribution of
+ * this code, including but not limited to public repositories on GitHub,
+ * GitLab, Bitbucket, or any other online platform, whether as given or with
+ * any changes, are expressly prohibited.
+ *
+ * Authors: Alexey Khrabrov, Karen Reid
+ *
+ * All of the files in this directory and all subdirectories are:
+ * Copyright (c) 2019 Karen Reid
+ */
+
+
+/**
+ * CSC369 Assignment 1 - liba1fs benchmark.
+ *
+ * Runs the same file I/O workload through liba1fs on an image, and through the
+ * file system calls on a mounted a1fs, and reports the throughput and p50/p99
+ * latency of each operation for both. The difference is the cost of going
+ * through the kernel and the a1fs process on every call.
+ *
+ * The image given for liba1fs must not be mounted while the benchmark runs;
+ * mount a separate image of the same size and options to compare with.
+ */
+
+#include <assert.h>
+#include <errno.h>
+#include <fcntl.h>
+#include <limits.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+#include <unistd.h>
+
+#include "liba1fs.h"
+
+
+/** Name of the data file in the root directory. */
+#define DATA_FILE "libbench.dat"
+
+/** Command line options. */
+typedef struct libbench_opts {
+	/** Data file size in bytes. */
+	size_t size;
+	/** Size of a single read or write in bytes. */
+	size_t io_size;
+	/** Number of operations for the random I/O benchmarks. */
+	unsigned int n_ops;
+	/** Image to run the workload on with liba1fs. */
+	const char *img_path;
+	/** Mount point of a1fs to run the workload on; NULL to skip. */
+	const char *mountpoint;
+
+	/** Print help and exit. */
+	bool help;
+
+} libbench_opts;
+
+static const char *libbench_help_str = "\
+Usage: %s [options] image\n\
+\n\
+Run a file I/O workload on an a1fs image in-process with liba1fs and, with -m,\n\
+on a mounted a1fs through the kernel. The image must not be mounted; mount a\n\
+separate one of the same size to compare with.\n\
+\n\
+Options:\n\
+    -s MiB  data file size (default: 64)\n\
+    -b KiB  size of a single read or write (default: 4)\n\
+    -n num  operations per random I/O benchmark (default: 10000)\n\
+    -m dir  mount point of a1fs to compare with\n\
+    -h      print help and exit\n\
+";
+
+static bool libbench_parse_args(int argc, char *argv[], libbench_opts *opts)
+{
+	int o;
+	while ((o = getopt(argc, argv, "s:b:n:m:h")) != -1) {
+		switch (o) {
+			case 's': opts->size = strtoul(optarg, NULL, 10) << 20; break;
+			case 'b': opts->io_size = strtoul(optarg, NULL, 10) << 10; break;
+			case 'n': opts->n_ops = strtoul(optarg, NULL, 10); break;
+			case 'm': opts->mountpoint = optarg; break;
+
+			case 'h': opts->help = true; return true;// skip other arguments
+
+			case '?': return false;
+			default : assert(false);
+		}
+	}
+
+	if (optind != argc - 1) {
+		fprintf(stderr, "Missing image path\n");
+		return false;
+	}
+	opts->img_path = argv[optind];
+
+	if (opts->size == 0) opts->size = 64ul << 20;
+	if (opts->io_size == 0) opts->io_size = 4ul << 10;
+	if (opts->n_ops == 0) opts->n_ops = 10000;
+	if (opts->size < opts->io_size) {
+		fprintf(stderr, "The data file is smaller than a single I/O\n");
+		return false;
+	}
+	return true;
+}
+
+
+/** A way to read and write the data file. */
+typedef struct backend {
+	/** Name printed in the results. */
+	const char *name;
+	/** pread() and pwrite() of the backend; return -errno on error. */
+	ssize_t (*pread)(struct backend *b, void *buf, size_t size, off_t offset);
+	ssize_t (*pwrite)(struct backend *b, const void *buf, size_t size, off_t offset);
+
+	/** liba1fs: the mounted image and the data file inode. */
+	fs_ctx fs;
+	a1fs_ino_t ino;
+	/** Mounted a1fs: the open data file. */
+	int fd;
+
+} backend;
+
+static ssize_t lib_pread(backend *b, void *buf, size_t size, off_t offset)
+{
+	return a1fs_pread(&b->fs, b->ino, buf, size, offset);
+}
+
+static ssize_t lib_pwrite(backend *b, const void *buf, size_t size, off_t offset)
+{
+	return a1fs_pwrite(&b->fs, b->ino, buf, size, offset);
+}
+
+static ssize_t mnt_pread(backend *b, void *buf, size_t size, off_t offset)
+{
+	ssize_t ret = pread(b->fd, buf, size, offset);
+	return (ret < 0) ? -errno : ret;
+}
+
+static ssize_t mnt_pwrite(backend *b, const void *buf, size_t size, off_t offset)
+{
+	ssize_t ret = pwrite(b->fd, buf, size, offset);
+	return (ret < 0) ? -errno : ret;
+}
+
+
+/** State of a benchmark run. */
+typedef struct libbench_run {
+	const libbench_opts *opts;
+	/** Latency of each operation of the current benchmark in nanoseconds. */
+	uint64_t *samples;
+	size_t n_samples;
+	/** I/O buffer of io_size bytes. */
+	char *buf;
+
+} libbench_run;
+
+static uint64_t now_ns(void)
+{
+	struct timespec ts;
+	clock_gettime(CLOCK_MONOTONIC, &ts);
+	return ts.tv_sec * 1000000000ul + ts.tv_nsec;
+}
+
+static int cmp_u64(const void *a, const void *b)
+{
+	uint64_t x = *(const uint64_t*)a, y = *(const uint64_t*)b;
+	return (x > y) - (x < y);
+}
+
+/** Print the results of a benchmark and reset the samples. */
+static void report(libbench_run *run, const backend *b, const char *op)
+{
+	size_t n = run->n_samples;
+	if (n == 0) return;
+	uint64_t total = 0;
+	for (size_t i = 0; i < n; i++) total += run->samples[i];
+	qsort(run->samples, n, sizeof(uint64_t), cmp_u64);
+
+	double secs = total / 1e9;
+	printf("%-8s %-12s %12.0f %10.1f %10.2f %10.2f\n", b->name, op, n / secs,
+	       n * run->opts->io_size / secs / (1 << 20), run->samples[n / 2] / 1e3,
+	       run->samples[n * 99 / 100] / 1e3);
+	run->n_samples = 0;
+}
+
+/** Time a single call; evaluates to the call's return value. */
+#define TIMED(run, call) ({                                     \
+	uint64_t start_ = now_ns();                             \
+	ssize_t ret_ = (call);                                  \
+	(run)->samples[(run)->n_samples++] = now_ns() - start_; \
+	ret_;                                                   \
+})
+
+/** Report a failed read or write; evaluates to false. */
+static bool io_failed(const backend *b, const char *op, ssize_t ret)
+{
+	fprintf(stderr, "%s: %s failed: %s\n", b->name, op,
+	        (ret < 0) ? strerror(-ret) : "short read or write");
+	return false;
+}
+
+/**
+ * Run the workload on the data file of a backend: sequential writes and reads
+ * of the whole file, then random writes and reads.
+ *
+ * @return  true on success; false if an operation failed.
+ */
+static bool run_workload(libbench_run *run, backend *b)
+{
+	const libbench_opts *opts = run->opts;
+	size_t io = opts->io_size;
+	size_t n_ios = opts->size / io;
+	memset(run->buf, 'a', io);
+
+	for (size_t i = 0; i < n_ios; i++) {
+		ssize_t ret = TIMED(run, b->pwrite(b, run->buf, io, i * io));
+		if (ret != (ssize_t)io) return io_failed(b, "seq write", ret);
+	}
+	report(run, b, "seq write");
+
+	for (size_t i = 0; i < n_ios; i++) {
+		ssize_t ret = TIMED(run, b->pread(b, run->buf, io, i * io));
+		if (ret != (ssize_t)io) return io_failed(b, "seq read", ret);
+	}
+	report(run, b, "seq read");
+
+	for (unsigned int i = 0; i < opts->n_ops; i++) {
+		off_t offset = (off_t)(rand() % n_ios) * io;
+		ssize_t ret = TIMED(run, b->pwrite(b, run->buf, io, offset));
+		if (ret != (ssize_t)io) return io_failed(b, "rand write", ret);
+	}
+	report(run, b, "rand write");
+
+	for (unsigned int i = 0; i < opts->n_ops; i++) {
+		off_t offset = (off_t)(rand() % n_ios) * io;
+		ssize_t ret = TIMED(run, b->pread(b, run->buf, io, offset));
+		if (ret != (ssize_t)io) return io_failed(b, "rand read", ret);
+	}
+	report(run, b, "rand read");
+	return true;
+}
+
+/** Run the workload in-process with liba1fs. */
+static bool bench_lib(libbench_run *run)
+{
+	a1fs_opts fs_opts = { .img_path = run->opts->img_path };
+	backend b = { .name = "liba1fs", .pread = lib_pread, .pwrite = lib_pwrite };
+	if (!a1fs_mount(&b.fs, &fs_opts)) {
+		fprintf(stderr, "Failed to mount %s\n", fs_opts.img_path);
+		return false;
+	}
+
+	int ret = a1fs_open(&b.fs, "/" DATA_FILE, O_RDWR | O_CREAT | O_TRUNC, 0644, &b.ino);
+	bool ok = (ret == 0) && run_workload(run, &b);
+	if (ret != 0) fprintf(stderr, "/%s: %s\n", DATA_FILE, strerror(-ret));
+	if (ret == 0) a1fs_unlink(&b.fs, "/" DATA_FILE);
+	a1fs_unmount(&b.fs);
+	return ok;
+}
+
+/** Run the workload through the kernel on the mounted a1fs. */
+static bool bench_mount(libbench_run *run)
+{
+	char path[PATH_MAX];
+	snprintf(path, sizeof(path), "%s/%s", run->opts->mountpoint, DATA_FILE);
+	backend b = { .name = "fuse", .pread = mnt_pread, .pwrite = mnt_pwrite };
+	b.fd = open(path, O_RDWR | O_CREAT | O_TRUNC, 0644);
+	if (b.fd < 0) {
+		perror(path);
+		return false;
+	}
+
+	bool ok = run_workload(run, &b);
+	close(b.fd);
+	unlink(path);
+	return ok;
+}
+
+
+int main(int argc, char *argv[])
+{
+	libbench_opts opts = {0};// defaults are all 0
+	if (!libbench_parse_args(argc, argv, &opts)) {
+		// Invalid arguments, print help to stderr
+		fprintf(stderr, libbench_help_str, argv[0]);
+		return 1;
+	}
+	if (opts.help) {
+		// Help requested, print it to stdout
+		printf(libbench_help_str, argv[0]);
+		return 0;
+	}
+
+	size_t n_ios = opts.size / opts.io_size;
+	libbench_run run = { .opts = &opts };
+	run.samples = malloc(((n_ios > opts.n_ops) ? n_ios : opts.n_ops) * sizeof(uint64_t));
+	run.buf = malloc(opts.io_size);
+	if ((run.samples == NULL) || (run.buf == NULL)) {
+		perror("malloc");
+		return 1;
+	}
+
+	printf("%-8s %-12s %12s %10s %10s %10s\n", "backend", "operation", "ops/s",
+	       "MiB/s", "p50 (us)", "p99 (us)");
+	// Same sequence of random offsets for both backends
+	srand(1);
+	bool ok = bench_lib(&run);
+	if (ok && (opts.mountpoint != NULL)) {
+		srand(1);
+		ok = bench_mount(&run);
+	}
+
+	free(run.samples);
+	free(run.buf);
+	return ok ? 0 : 1;
+}
@@ -0,0 +1,192 @@
+/*
+ * This code is provided solely for the personal and private use of students
+ * taking the CSC369H course at the University of Toronto. Copying for purposes
+ * other than this use is expressly prohibited. All forms of distribution of
+ * this code, including but not limited to public repositories on GitHub,
+ * GitLab, Bitbucket, or any other online platform, whether as given or with
+ * any changes, are expressly prohibited.
+ *
+ * Authors: Alexey Khrabrov, Karen Reid
+ *
+ * All of the files in this directory and all subdirectories are:
+ * Copyright (c) 2019 Karen Reid
+ */
+
+/**
+ * CSC369 Assignment 1 - LZ4 block format compression implementation.
+ */
+
+#include <stdbool.h>
+#include <stdint.h>
+#include <string.h>
+
+#include "lz4.h"
+
+
+// A block is a sequence of (literals, match) pairs. Each sequence starts with a
+// token: the high nibble is the literal count, the low nibble is the match
+// length minus MINMATCH; 15 means that more length bytes follow. The literals
+// are followed by a 2-byte little-endian match offset. The last sequence only
+// has literals.
+
+#define MINMATCH 4
+// The last LASTLITERALS bytes are always literals
+#define LASTLITERALS 5
+// A match can't start within the last MFLIMIT bytes
+#define MFLIMIT 12
+#define MAX_OFFSET 65535
+
+#define HASH_LOG 12
+
+
+static uint32_t read32(const uint8_t *p)
+{
+	uint32_t v;
+	memcpy(&v, p, sizeof(v));
+	return v;
+}
+
+static uint32_t hash32(uint32_t v)
+{
+	return (v * 2654435761u) >> (32 - HASH_LOG);
+}
+
+// Write a length that didn't fit into a token nibble
+static uint8_t *write_length(uint8_t *op, size_t len)
+{
+	for (; len >= 255; len -= 255) *op++ = 255;
+	*op++ = (uint8_t)len;
+	return op;
+}
+
+// Emit a sequence; match_len is 0 for the last (literals only) sequence
+static uint8_t *write_sequence(uint8_t *op, const uint8_t *oend,
+                               const uint8_t *literals, size_t lit_len,
+                               size_t offset, size_t match_len)
+{
+	// Worst case size: token, literal length, literals, offset, match length
+	size_t max_size = 1 + lit_len / 255 + 1 + lit_len + 2 + match_len / 255 + 1;
+	if (max_size > (size_t)(oend - op)) return NULL;
+
+	uint8_t *token = op++;
+	*token = (lit_len >= 15 ? 15 : lit_len) << 4;
+	if (lit_len >= 15) op = write_length(op, lit_len - 15);
+	memcpy(op, literals, lit_len);
+	op += lit_len;
+
+	if (match_len != 0) {
+		*op++ = offset & 0xFF;
+		*op++ = offset >> 8;
+		size_t len = match_len - MINMATCH;
+		*token |= (len >= 15) ? 15 : len;
+		if (len >= 15) op = write_length(op, len - 15);
+	}
+	return op;
+}
+
+size_t lz4_compress(const void *src, size_t src_size, void *dst,
+                    size_t dst_capacity)
+{
+	const uint8_t *base = (const uint8_t*)src;
+	const uint8_t *ip = base;
+	const uint8_t *anchor = base;
+	const uint8_t *iend = base + src_size;
+	uint8_t *op = (uint8_t*)dst;
+	const uint8_t *oend = op + dst_capacity;
+
+	// Too short inputs are stored as literals
+	if (src_size > MFLIMIT) {
+		const uint8_t *mflimit = iend - MFLIMIT;
+		const uint8_t *matchlimit = iend - LASTLITERALS;
+		uint32_t table[1 << HASH_LOG] = {0};
+
+		ip++;
+		while (ip < mflimit) {
+			uint32_t h = hash32(read32(ip));
+			const uint8_t *ref = base + table[h];
+			table[h] = ip - base;
+			if ((ref >= ip) || (ip - ref > MAX_OFFSET) || (read32(ref) != read32(ip))) {
+				ip++;
+				continue;
+			}
+
+			// Extend the match forwards and backwards
+			const uint8_t *end = ip + MINMATCH;
+			const uint8_t *ref_end = ref + MINMATCH;
+			while ((end < matchlimit) && (*end == *ref_end)) {
+				end++;
+				ref_end++;
+			}
+			while ((ip > anchor) && (ref > base) && (ip[-1] == ref[-1])) {
+				ip--;
+				ref--;
+			}
+
+			op = write_sequence(op, oend, anchor, ip - anchor, ip - ref, end - ip);
+			if (op == NULL) return 0;
+			ip = anchor = end;
+		}
+	}
+
+	op = write_sequence(op, oend, anchor, iend - anchor, 0, 0);
+	if (op == NULL) return 0;
+	return op - (uint8_t*)dst;
+}
+
+// Read a length that didn't fit into a token nibble; returns false on overrun
+static bool read_length(const uint8_t **ip, const uint8_t *iend, size_t *len)
+{
+	uint8_t b;
+	do {
+		if (*ip >= iend) return false;
+		b = *(*ip)++;
+		*len += b;
+	} while (b == 255);
+	return true;
+}
+
+long lz4_decompress(const void *src, size_t src_size, void *dst,
+                    size_t dst_capacity)
+{
+	const uint8_t *ip = (const uint8_t*)src;
+	const uint8_t *iend = ip + src_size;
+	uint8_t *start = (uint8_t*)dst;
+	uint8_t *op = start;
+	uint8_t *oend = start + dst_capacity;
+
+	while (ip < iend) {
+		uint8_t token = *ip++;
+
+		size_t lit_len = token >> 4;
+		if ((lit_len == 15) && !read_length(&ip, iend, &lit_len)) return -1;
+		if ((lit_len > (size_t)(iend - ip)) || (lit_len > (size_t)(oend - op))) {
+			return -1;
+		}
+		memcpy(op, ip, lit_len);
+		op += lit_len;
+		ip += lit_len;
+
+		// The last sequence has no match
+		if (ip == iend) break;
+
+		if (iend - ip < 2) return -1;
+		size_t offset = ip[0] | (ip[1] << 8);
+		ip += 2;
+		if ((offset == 0) || (offset > (size_t)(op - start))) return -1;
+
+		size_t match_len = token & 15;
+		if ((match_len == 15) && !read_length(&ip, iend, &match_len)) return -1;
+		match_len += MINMATCH;
+		if (match_len > (size_t)(oend - op)) return -1;
+
+		const uint8_t *match = op - offset;
+		if (offset >= match_len) {
+			memcpy(op, match, match_len);
+			op += match_len;
+		} else {
+			// Overlapping copy repeats the last offset bytes
+			while (match_len--) *op++ = *match++;
+		}
+	}
+	return op - start;
+}
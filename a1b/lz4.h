@@ -0,0 +1,54 @@
+/*
+ * This code is provided solely for the personal and private use of students
+ * taking the CSC369H course at the University of Toronto. Copying for purposes
+ * other than this use is expressly prohibited. All forms of distribution of
+ * this code, including but not limited to public repositories on GitHub,
+ * GitLab, Bitbucket, or any other online platform, whether as given or with
+ * any changes, are expressly prohibited.
+ *
+ * Authors: Alexey Khrabrov, Karen Reid
+ *
+ * All of the files in this directory and all subdirectories are:
+ * Copyright (c) 2019 Karen Reid
+ */
+
+/**
+ * CSC369 Assignment 1 - LZ4 block format compression header file.
+ *
+ * A small, self-contained implementation of the LZ4 block format (no frame
+ * format). Its output can be decoded by the reference LZ4 implementation and
+ * vice versa.
+ */
+
+#pragma once
+
+#include <stddef.h>
+
+
+/**
+ * Compress a buffer into an LZ4 block.
+ *
+ * @param src           input data.
+ * @param src_size      input size in bytes.
+ * @param dst           output buffer.
+ * @param dst_capacity  output buffer size in bytes.
+ * @return              compressed size in bytes on success; 0 if the result
+ *                      doesn't fit into dst_capacity bytes.
+ */
+size_t lz4_compress(const void *src, size_t src_size, void *dst,
+                    size_t dst_capacity);
+
+/**
+ * Decompress an LZ4 block.
+ *
+ * Safe against malformed input: never reads or writes outside of the buffers.
+ *
+ * @param src           compressed data.
+ * @param src_size      compressed size in bytes.
+ * @param dst           output buffer.
+ * @param dst_capacity  output buffer size in bytes.
+ * @return              decompressed size in bytes on success; -1 if the input
+ *                      is malformed or doesn't fit into dst_capacity bytes.
+ */
+long lz4_decompress(const void *src, size_t src_size, void *dst,
+                    size_t dst_capacity);
@@ -1,71 +1,156 @@
-/*
- * This code is provided solely for the personal and private use of students
- * taking the CSC369H course at the University of Toronto. Copying for purposes
- * other than this use is expressly prohibited. All forms of distribution of
- * this code, including but not limited to public repositories on GitHub,
- * GitLab, Bitbucket, or any other online platform, whether as given or with
- * any changes, are expressly prohibited.
- *
- * Authors: Alexey Khrabrov, Karen Reid
- *
- * All of the files in this directory and all subdirectories are:
- * Copyright (c) 2019 Karen Reid
- */
-
-/**
- * CSC369 Assignment 1 - File mapping helper implementation.
- */
-
-#include <fcntl.h>
-#include <stdio.h>
-#include <sys/mman.h>
-#include <sys/stat.h>
-#include <unistd.h>
-
-#include "map.h"
-#include "util.h"
-
-
-void *map_file(const char *path, size_t block_size, size_t *size)
-{
-	// Open the file for reading and writing
-	int fd = open(path, O_RDWR);
-	if (fd < 0) {
-		perror(path);
-		return NULL;
-	}
-
-	void *addr = NULL;
-	// Get file size
-	struct stat s;
-	if (fstat(fd, &s) < 0) {
-		perror("fstat");
-		goto end;
-	}
-
-	// Check that the file size is valid
-	if (s.st_size == 0) {
-		fprintf(stderr, "Image file is empty\n");
-		goto end;
-	}
-	if (s.st_size % block_size != 0) {
-		fprintf(stderr, "Image file size is not a multiple of block size\n");
-		goto end;
-	}
-
-	// Map file contents into memory
-	addr = mmap(NULL, s.st_size, PROT_READ | PROT_WRITE, MAP_SHARED, fd, 0);
-	if (addr == MAP_FAILED) {
-		perror("mmap");
-		addr = NULL;
-		goto end;
-	}
-	assert(is_aligned((size_t)addr, block_size));
-	*size = s.st_size;
-
-end:
-	//NOTE: memory mapping keeps a reference to the open file; can safely close
-	// the file descriptor now; a future munmap() will close the file
-	close(fd);
-	return addr;
-}
+/*
+ * This code is provided solely for the personal and private use of students
+ * taking the CSC369H course at the University of Toronto. Copying for purposes
+ * other than this use is expressly prohibited. All forms of distribution of
+ * this code, including but not limited to public repositories on GitHub,
+ * GitLab, Bitbucket, or any other online platform, whether as given or with
+ * any changes, are expressly prohibited.
+ *
+ * Authors: Alexey Khrabrov, Karen Reid
+ *
+ * All of the files in this directory and all subdirectories are:
+ * Copyright (c) 2019 Karen Reid
+ */
+
+/**
+ * CSC369 Assignment 1 - File mapping helper implementation.
+ */
+
+#include <fcntl.h>
+#include <linux/magic.h>
+#include <linux/mempolicy.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <sys/syscall.h>
+#include <sys/vfs.h>
+#include <unistd.h>
+
+#include "map.h"
+#include "util.h"
+
+
+/** Transparent huge page size (with 4 KiB base pages). */
+#define HUGE_PAGE_SIZE (2ul << 20)
+
+/** Maximum number of NUMA nodes in the interleave node mask. */
+#define MAX_NUMA_NODES 1024
+
+/**
+ * Map a file at an address aligned to the huge page size, so that the kernel
+ * can back it with huge pages from the start.
+ *
+ * @return  pointer to the mapping on success; MAP_FAILED on failure.
+ */
+static void *mmap_aligned(int fd, size_t size)
+{
+	// Reserve enough address space for an aligned mapping of that size
+	size_t len = size + HUGE_PAGE_SIZE;
+	void *area = mmap(NULL, len, PROT_NONE, MAP_PRIVATE | MAP_ANONYMOUS | MAP_NORESERVE,
+	                  -1, 0);
+	if (area == MAP_FAILED) return MAP_FAILED;
+
+	uintptr_t start = align_up((uintptr_t)area, HUGE_PAGE_SIZE);
+	void *addr = mmap((void*)start, size, PROT_READ | PROT_WRITE, MAP_SHARED | MAP_FIXED,
+	                  fd, 0);
+	if (addr == MAP_FAILED) {
+		munmap(area, len);
+		return MAP_FAILED;
+	}
+	// Give back the rest of the reservation
+	if (start > (uintptr_t)area) munmap(area, start - (uintptr_t)area);
+	size_t tail = (uintptr_t)area + len - (start + size);
+	if (tail > 0) munmap((void*)(start + size), tail);
+	return addr;
+}
+
+/** Interleave the pages of a mapping across the allowed NUMA nodes. */
+static void numa_interleave(void *addr, size_t size)
+{
+	unsigned long nodes[MAX_NUMA_NODES / (8 * sizeof(unsigned long))] = {0};
+	// No libnuma dependency: the system calls are simple enough
+	if ((syscall(SYS_get_mempolicy, NULL, nodes, MAX_NUMA_NODES, NULL,
+	             MPOL_F_MEMS_ALLOWED) < 0) ||
+	    (syscall(SYS_mbind, addr, size, MPOL_INTERLEAVE, nodes, MAX_NUMA_NODES, 0) < 0))
+	{
+		perror("mbind");
+	}
+}
+
+
+void *map_file(const char *path, size_t block_size, size_t *size)
+{
+	return map_file_opts(path, block_size, size, NULL);
+}
+
+void *map_file_opts(const char *path, size_t block_size, size_t *size,
+                    const map_opts *opts)
+{
+	// Open the file for reading and writing
+	int fd = open(path, O_RDWR);
+	if (fd < 0) {
+		perror(path);
+		return NULL;
+	}
+
+	void *addr = NULL;
+	// Get file size
+	struct stat s;
+	if (fstat(fd, &s) < 0) {
+		perror("fstat");
+		goto end;
+	}
+
+	// Check that the file size is valid
+	if (s.st_size == 0) {
+		fprintf(stderr, "Image file is empty\n");
+		goto end;
+	}
+	if (s.st_size % block_size != 0) {
+		fprintf(stderr, "Image file size is not a multiple of block size\n");
+		goto end;
+	}
+
+	// Map file contents into memory. Files on hugetlbfs are always mapped with
+	// huge pages (MAP_HUGETLB is only for anonymous mappings).
+	struct statfs fs;
+	bool huge = (opts != NULL) && opts->hugepages &&
+	            ((fstatfs(fd, &fs) < 0) || (fs.f_type != HUGETLBFS_MAGIC));
+	if (huge) {
+		addr = mmap_aligned(fd, s.st_size);
+	} else {
+		addr = mmap(NULL, s.st_size, PROT_READ | PROT_WRITE, MAP_SHARED, fd, 0);
+	}
+	if (addr == MAP_FAILED) {
+		perror("mmap");
+		addr = NULL;
+		goto end;
+	}
+	assert(is_aligned((size_t)addr, block_size));
+	*size = s.st_size;
+
+	// Placement must be set before the pages are faulted in
+	if (huge && (madvise(addr, s.st_size, MADV_HUGEPAGE) < 0)) {
+		perror("madvise(MADV_HUGEPAGE)");
+	}
+	if ((opts != NULL) && opts->numa_interleave) numa_interleave(addr, s.st_size);
+
+end:
+	//NOTE: memory mapping keeps a reference to the open file; can safely close
+	// the file descriptor now; a future munmap() will close the file
+	close(fd);
+	return addr;
+}
+
+void map_populate(void *addr, size_t len)
+{
+	if (madvise(addr, len, MADV_POPULATE_WRITE) == 0) return;
+
+	// Kernels before 5.14 don't have MADV_POPULATE_WRITE; read-faulting the
+	// pages still saves the major faults
+	long page_size = sysconf(_SC_PAGESIZE);
+	for (size_t off = 0; off < len; off += page_size) {
+		(void)*(volatile char*)(addr + off);
+	}
+}
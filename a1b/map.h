@@ -1,35 +1,80 @@
-/*
- * This code is provided solely for the personal and private use of students
- * taking the CSC369H course at the University of Toronto. Copying for purposes
- * other than this use is expressly prohibited. All forms of distribution of
- * this code, including but not limited to public repositories on GitHub,
- * GitLab, Bitbucket, or any other online platform, whether as given or with
- * any changes, are expressly prohibited.
- *
- * Authors: Alexey Khrabrov, Karen Reid
- *
- * All of the files in this directory and all subdirectories are:
- * Copyright (c) 2019 Karen Reid
- */
-
-/**
- * CSC369 Assignment 1 - File mapping helper header file.
- */
-
-#pragma once
-
-#include <stddef.h>
-
-
-/**
- * Map the whole file into memory for reading and writing.
- *
- * File size must be a non-zero multiple of the block_size.
- *
- * @param path        image file path.
- * @param block_size  file system block size.
- * @param size        pointer to the variable that will be set to file size.
- * @return            pointer to the file mapping in memory on success;
- *                    NULL on failure.
- */
-void *map_file(const char *path, size_t block_size, size_t *size);
+/*
+ * This code is provided solely for the personal and private use of students
+ * taking the CSC369H course at the University of Toronto. Copying for purposes
+ * other than this use is expressly prohibited. All forms of distribution of
+ * this code, including but not limited to public repositories on GitHub,
+ * GitLab, Bitbucket, or any other online platform, whether as given or with
+ * any changes, are expressly prohibited.
+ *
+ * Authors: Alexey Khrabrov, Karen Reid
+ *
+ * All of the files in this directory and all subdirectories are:
+ * Copyright (c) 2019 Karen Reid
+ */
+
+/**
+ * CSC369 Assignment 1 - File mapping helper header file.
+ */
+
+#pragma once
+
+#include <stdbool.h>
+#include <stddef.h>
+
+
+/** Placement options of a file mapping (see map_file_opts()). */
+typedef struct map_opts {
+	/**
+	 * Back the mapping with huge pages to cut TLB misses on large images.
+	 * Images on hugetlbfs always are; otherwise the mapping is aligned to the
+	 * huge page size and transparent huge pages are requested for it, which
+	 * the kernel honors for tmpfs and, with CONFIG_READ_ONLY_THP_FOR_FS, for
+	 * other file systems.
+	 */
+	bool hugepages;
+	/**
+	 * Interleave the pages of the mapping across the NUMA nodes the process
+	 * may use, so that scans draw on the memory bandwidth of all of them.
+	 * The kernel applies the policy to shared memory (tmpfs) images.
+	 */
+	bool numa_interleave;
+
+} map_opts;
+
+/**
+ * Map the whole file into memory for reading and writing.
+ *
+ * File size must be a non-zero multiple of the block_size.
+ *
+ * @param path        image file path.
+ * @param block_size  file system block size.
+ * @param size        pointer to the variable that will be set to file size.
+ * @return            pointer to the file mapping in memory on success;
+ *                    NULL on failure.
+ */
+void *map_file(const char *path, size_t block_size, size_t *size);
+
+/**
+ * Map the whole file into memory with the given placement options.
+ *
+ * Same as map_file(), except that the options that the kernel doesn't support
+ * are reported on stderr and otherwise ignored.
+ *
+ * @param path        image file path.
+ * @param block_size  file system block size.
+ * @param size        pointer to the variable that will be set to file size.
+ * @param opts        placement options; NULL for the defaults.
+ * @return            pointer to the file mapping in memory on success;
+ *                    NULL on failure.
+ */
+void *map_file_opts(const char *path, size_t block_size, size_t *size,
+                    const map_opts *opts);
+
+/**
+ * Prefault a range of a file mapping, so that later accesses to it don't take
+ * page faults. Used for the metadata regions when mounting.
+ *
+ * @param addr  start of the range; must be page-aligned.
+ * @param len   range size in bytes.
+ */
+void map_populate(void *addr, size_t len);
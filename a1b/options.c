@@ -1,97 +1,137 @@
-/*
- * This code is provided solely for the personal and private use of students
- * taking the CSC369H course at the University of Toronto. Copying for purposes
- * other than this use is expressly prohibited. All forms of distribution of
- * this code, including but not limited to public repositories on GitHub,
- * GitLab, Bitbucket, or any other online platform, whether as given or with
- * any changes, are expressly prohibited.
- *
- * Authors: Alexey Khrabrov, Karen Reid
- *
- * All of the files in this directory and all subdirectories are:
- * Copyright (c) 2019 Karen Reid
- */
-
-/**
- * CSC369 Assignment 1 - a1fs command line options parser implementation.
- */
-
-#include <stddef.h>
-#include <stdio.h>
-#include <string.h>
-
-#include "options.h"
-
-
-// We are using the existing option parsing infrastructure in FUSE.
-// See fuse_opt.h in libfuse source code for details.
-
-#define A1FS_OPT(t, p) { t, offsetof(a1fs_opts, p), 1 }
-
-static const struct fuse_opt opt_spec[] = {
-	A1FS_OPT("-h"    , help),
-	A1FS_OPT("--help", help),
-
-	A1FS_OPT("-V"       , version),
-	A1FS_OPT("--version", version),
-
-	A1FS_OPT("--sync"   , sync   ),
-	A1FS_OPT("--verbose", verbose),
-
-	FUSE_OPT_END
-};
-
-static const char *help_str = "\
-Usage: %s image dir [options]\n\
-\n\
-Mount a1fs image file at given mount point. Use fusermount(1) to unmount.\n\
-Only single-threaded mount is supported; -s FUSE option is implied.\n\
-\n\
-general options:\n\
-    -o opt,[opt...]        mount options\n\
-    -h   --help            print help\n\
-    -V   --version         print version\n\
-\n\
-a1fs options:\n\
-    --sync                 sync image file contents to disk on unmount\n\
-    --verbose              verbose output; only useful in foreground mode (-f)\n\
-\n\
-";
-
-// Callback for fuse_opt_parse()
-static int opt_proc(void *data, const char *arg, int key, struct fuse_args *out)
-{
-	a1fs_opts *opts = (a1fs_opts*)data;
-	(void)out;// unused
-
-	if ((key == FUSE_OPT_KEY_NONOPT) && (opts->img_path == NULL)) {
-		opts->img_path = strdup(arg);
-		return 0;
-	}
-	return 1;
-}
-
-
-bool a1fs_opt_parse(struct fuse_args *args, a1fs_opts *opts)
-{
-	if (fuse_opt_parse(args, opts, opt_spec, opt_proc) != 0) return false;
-
-	//NOTE: printing to stderr to keep it consistent with FUSE
-	if (opts->help) {
-		fprintf(stderr, help_str, args->argv[0]);
-		fuse_opt_add_arg(args, "-ho");
-	}
-	if (opts->version) {
-		fprintf(stderr, "a1fs 0.0\n");
-		fuse_opt_add_arg(args, "-V");
-	}
-
-	if (!opts->help && !opts->version && !opts->img_path) {
-		fprintf(stderr, "Missing image path\n");
-		return false;
-	}
-
-	// Only single-threaded mount is supported
-	fuse_opt_add_arg(args, "-s");
-	return true;
-}
+/*
+ * This code is provided solely for the personal and private use of students
+ * taking the CSC369H course at the University of Toronto. Copying for purposes
+ * other than this use is expressly prohibited. All forms of distribution of
+ * this code, including but not limited to public repositories on GitHub,
+ * GitLab, Bitbucket, or any other online platform, whether as given or with
+ * any changes, are expressly prohibited.
+ *
+ * Authors: Alexey Khrabrov, Karen Reid
+ *
+ * All of the files in this directory and all subdirectories are:
+ * Copyright (c) 2019 Karen Reid
+ */
+
+/**
+ * CSC369 Assignment 1 - a1fs command line options parser implementation.
+ */
+
+#include <stddef.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include "options.h"
+
+
+// We are using the existing option parsing infrastructure in FUSE.
+// See fuse_opt.h in libfuse source code for details.
+
+#define A1FS_OPT(t, p) { t, offsetof(a1fs_opts, p), 1 }
+
+static const struct fuse_opt opt_spec[] = {
+	A1FS_OPT("-h"    , help),
+	A1FS_OPT("--help", help),
+
+	A1FS_OPT("-V"       , version),
+	A1FS_OPT("--version", version),
+
+	A1FS_OPT("--sync"    , sync    ),
+	A1FS_OPT("--verbose" , verbose ),
+	A1FS_OPT("--compress", compress),
+	A1FS_OPT("--keep_cache", keep_cache),
+	A1FS_OPT("--writeback_cache", writeback_cache),
+	A1FS_OPT("--hugepages", hugepages),
+	A1FS_OPT("--populate", populate),
+	A1FS_OPT("--numa_interleave", numa_interleave),
+	A1FS_OPT("--io_uring", io_uring),
+	A1FS_OPT("--checksums", checksums),
+	{ "--direct_io_min=%lu", offsetof(a1fs_opts, direct_io_min), 0 },
+	{ "--lazytime=%lu", offsetof(a1fs_opts, lazytime), 0 },
+	{ "--trace=%s", offsetof(a1fs_opts, trace), 0 },
+
+	FUSE_OPT_END
+};
+
+static const char *help_str = "\
+Usage: %s image dir [options]\n\
+\n\
+Mount a1fs image file at given mount point. Use fusermount(1) to unmount.\n\
+Only single-threaded mount is supported; -s FUSE option is implied.\n\
+\n\
+general options:\n\
+    -o opt,[opt...]        mount options\n\
+    -h   --help            print help\n\
+    -V   --version         print version\n\
+\n\
+a1fs options:\n\
+    --sync                 sync image file contents to disk on unmount\n\
+    --verbose              verbose output; only useful in foreground mode (-f)\n\
+    --compress             compress data of new files in 64 KiB LZ4 clusters\n\
+    --direct_io_min=BYTES  bypass the kernel page cache for files of at least\n\
+                           BYTES bytes and for streaming writers\n\
+    --keep_cache           keep cached data of other files across opens\n\
+    --writeback_cache      cache writes in the kernel and write them back in\n\
+                           large batches\n\
+    --hugepages            map the image with huge pages\n\
+    --populate             prefault the metadata of the image when mounting\n\
+    --numa_interleave      interleave the image memory across NUMA nodes\n\
+    --io_uring             read and write data spanning several extents with\n\
+                           batched io_uring requests instead of the mapping;\n\
+                           mounting fails if io_uring can't be set up\n\
+    --lazytime=SECONDS     keep file modification times in memory and write\n\
+                           them back within SECONDS, on fsync and on unmount\n\
+    --checksums            save checksums of the superblock, bitmaps, inode\n\
+                           table and directories on unmount and verify them\n\
+                           after the next mount\n\
+    --trace=FILE           record every operation into FILE for replay.a1fs\n\
+\n\
+";
+
+// Callback for fuse_opt_parse()
+static int opt_proc(void *data, const char *arg, int key, struct fuse_args *out)
+{
+	a1fs_opts *opts = (a1fs_opts*)data;
+	(void)out;// unused
+
+	if ((key == FUSE_OPT_KEY_NONOPT) && (opts->img_path == NULL)) {
+		// The image is opened again after fuse_main() has changed the working
+		// directory to "/" (to resize it or for io_uring), so keep it absolute.
+		// A path that doesn't resolve is kept as is; mounting then reports it.
+		if ((opts->img_path = realpath(arg, NULL)) == NULL) {
+			opts->img_path = strdup(arg);
+		}
+		return 0;
+	}
+	return 1;
+}
+
+
+bool a1fs_opt_parse(struct fuse_args *args, a1fs_opts *opts)
+{
+	if (fuse_opt_parse(args, opts, opt_spec, opt_proc) != 0) return false;
+
+	//NOTE: printing to stderr to keep it consistent with FUSE
+	if (opts->help) {
+		fprintf(stderr, help_str, args->argv[0]);
+		fuse_opt_add_arg(args, "-ho");
+	}
+	if (opts->version) {
+		fprintf(stderr, "a1fs 0.0\n");
+		fuse_opt_add_arg(args, "-V");
+	}
+
+	if (!opts->help && !opts->version && !opts->img_path) {
+		fprintf(stderr, "Missing image path\n");
+		return false;
+	}
+
+	// Direct I/O and writeback requests are not split into page-sized writes
+	if ((opts->direct_io_min != 0) || opts->writeback_cache) {
+		fuse_opt_add_arg(args, "-obig_writes");
+	}
+
+	// Only single-threaded mount is supported
+	fuse_opt_add_arg(args, "-s");
+	return true;
+}
@@ -1,50 +1,81 @@
-/*
- * This code is provided solely for the personal and private use of students
- * taking the CSC369H course at the University of Toronto. Copying for purposes
- * other than this use is expressly prohibited. All forms of distribution of
- * this code, including but not limited to public repositories on GitHub,
- * GitLab, Bitbucket, or any other online platform, whether as given or with
- * any changes, are expressly prohibited.
- *
- * Authors: Alexey Khrabrov, Karen Reid
- *
- * All of the files in this directory and all subdirectories are:
- * Copyright (c) 2019 Karen Reid
- */
-
-/**
- * CSC369 Assignment 1 - a1fs command line options parser header file.
- */
-
-#pragma once
-
-#include <stdbool.h>
-
-#include <fuse_opt.h>
-
-
-/** a1fs command line options. */
-typedef struct a1fs_opts {
-	/** a1fs image file path. */
-	const char *img_path;
-
-	/** Print help and exit. FUSE option. */
-	int help;
-	/** Print version and exit. FUSE option. */
-	int version;
-
-	/** Sync memory-mapped image file contents to disk on unmount. */
-	int sync;
-	/** Verbose output. Only print logging/debug info if this flag is set. */
-	int verbose;
-
-} a1fs_opts;
-
-/**
- * Parse a1fs command line options.
- *
- * @param args  pointer to 'struct fuse_args' with the program arguments.
- * @param args  pointer to the options struct that receives the result.
- * @return      true on success; false on failure.
- */
-bool a1fs_opt_parse(struct fuse_args *args, a1fs_opts *opts);
+/*
+ * This code is provided solely for the personal and private use of students
+ * taking the CSC369H course at the University of Toronto. Copying for purposes
+ * other than this use is expressly prohibited. All forms of distribution of
+ * this code, including but not limited to public repositories on GitHub,
+ * GitLab, Bitbucket, or any other online platform, whether as given or with
+ * any changes, are expressly prohibited.
+ *
+ * Authors: Alexey Khrabrov, Karen Reid
+ *
+ * All of the files in this directory and all subdirectories are:
+ * Copyright (c) 2019 Karen Reid
+ */
+
+/**
+ * CSC369 Assignment 1 - a1fs command line options parser header file.
+ */
+
+#pragma once
+
+#include <stdbool.h>
+
+#include <fuse_opt.h>
+
+
+/** a1fs command line options. */
+typedef struct a1fs_opts {
+	/** a1fs image file path; absolute if set by a1fs_opt_parse(). */
+	const char *img_path;
+
+	/** Print help and exit. FUSE option. */
+	int help;
+	/** Print version and exit. FUSE option. */
+	int version;
+
+	/** Sync memory-mapped image file contents to disk on unmount. */
+	int sync;
+	/** Verbose output. Only print logging/debug info if this flag is set. */
+	int verbose;
+	/** Store data of newly created files in LZ4-compressed clusters. */
+	int compress;
+	/**
+	 * Open files of at least this size in bytes with direct I/O, bypassing the
+	 * kernel page cache. 0 disables the policy.
+	 */
+	unsigned long direct_io_min;
+	/** Keep the kernel page cache of files opened through the page cache. */
+	int keep_cache;
+	/** Let the kernel cache writes and send them to a1fs in large batches. */
+	int writeback_cache;
+	/** Back the image mapping with huge pages (see map_opts). */
+	int hugepages;
+	/** Prefault the metadata regions of the image when mounting. */
+	int populate;
+	/** Interleave the image mapping across the NUMA nodes (see map_opts). */
+	int numa_interleave;
+	/** Read and write data spanning several extents through io_uring. */
+	int io_uring;
+	/**
+	 * Keep modification times in memory and write them to the inode table
+	 * at most this many seconds later (see inode_touch()). 0 disables it.
+	 */
+	unsigned long lazytime;
+	/**
+	 * Write checksums of the metadata into the checkpoint on unmount, to be
+	 * verified after the next mount (see a1fs_checkpoint).
+	 */
+	int checksums;
+	/** Record every callback into this trace file (see trace.h); NULL if not set. */
+	char *trace;
+
+} a1fs_opts;
+
+/**
+ * Parse a1fs command line options.
+ *
+ * @param args  pointer to 'struct fuse_args' with the program arguments.
+ * @param args  pointer to the options struct that receives the result.
+ * @return      true on success; false on failure.
+ */
+bool a1fs_opt_parse(struct fuse_args *args, a1fs_opts *opts);
@@ -0,0 +1,147 @@
+/*
+ * This code is provided solely for the personal and private use of students
+ * taking the CSC369H course at the University of Toronto. Copying for purposes
+ * other than this use is expressly prohibited. All forms of distribution of
+ * this code, including but not limited to public repositories on GitHub,
+ * GitLab, Bitbucket, or any other online platform, whether as given or with
+ * any changes, are expressly prohibited.
+ *
+ * Authors: Alexey Khrabrov, Karen Reid
+ *
+ * All of the files in this directory and all subdirectories are:
+ * Copyright (c) 2019 Karen Reid
+ */
+
+
+/**
+ * CSC369 Assignment 1 - a1fs quota tool.
+ *
+ * Sets or removes a user or directory quota of a mounted a1fs through the
+ * A1FS_IOC_SET_QUOTA and A1FS_IOC_REMOVE_QUOTA ioctls. The current usage of
+ * the quotas is reported in the statistics file.
+ */
+
+#include <fcntl.h>
+#include <stdbool.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/ioctl.h>
+#include <unistd.h>
+
+#include "a1fs.h"
+#include "util.h"
+
+
+/** Command line options. */
+typedef struct quota_opts {
+	/** File or directory of a mounted file system. */
+	const char *path;
+	/** The quota and its limits. */
+	a1fs_quota_limits limits;
+
+	/** Print help and exit. */
+	bool help;
+	/** Remove the quota instead of setting it. */
+	bool remove;
+
+} quota_opts;
+
+static const char *help_str = "\
+Usage: %s options path\n\
+\n\
+Set the limits of a quota of a mounted a1fs, creating it if there is none.\n\
+A directory quota covers the directory tree at path; a user quota covers the\n\
+files of the user anywhere in the file system that path is on.\n\
+\n\
+Options:\n\
+    -b SIZE  block limit in bytes (K, M, G and T suffixes are accepted);\n\
+             0 (default) for no limit\n\
+    -d       directory quota (default)\n\
+    -h       print help and exit\n\
+    -i NUM   inode limit; 0 (default) for no limit\n\
+    -r       remove the quota\n\
+    -u UID   user quota of the given user\n\
+";
+
+static void print_help(FILE *f, const char *progname)
+{
+	fprintf(f, help_str, progname);
+}
+
+static bool parse_args(int argc, char *argv[], quota_opts *opts)
+{
+	opts->limits.type = A1FS_QUOTA_DIR;
+	char *end;
+	int o;
+	while ((o = getopt(argc, argv, "b:dhi:ru:")) != -1) {
+		switch (o) {
+			case 'b':
+				// parse_size() treats 0 as an error
+				if (strcmp(optarg, "0") == 0) break;
+				opts->limits.block_limit = parse_size(optarg);
+				if (opts->limits.block_limit == 0) {
+					fprintf(stderr, "Invalid block limit: %s\n", optarg);
+					return false;
+				}
+				opts->limits.block_limit = (opts->limits.block_limit + A1FS_BLOCK_SIZE - 1)
+				                           / A1FS_BLOCK_SIZE;
+				break;
+			case 'd': opts->limits.type = A1FS_QUOTA_DIR; break;
+			case 'h': opts->help = true; return true;// skip other arguments
+			case 'i':
+				opts->limits.inode_limit = strtoull(optarg, &end, 10);
+				if ((*optarg == '\0') || (*end != '\0')) {
+					fprintf(stderr, "Invalid inode limit: %s\n", optarg);
+					return false;
+				}
+				break;
+			case 'r': opts->remove = true; break;
+			case 'u':
+				opts->limits.type = A1FS_QUOTA_USER;
+				opts->limits.id = strtoul(optarg, &end, 10);
+				if ((*optarg == '\0') || (*end != '\0')) {
+					fprintf(stderr, "Invalid user ID: %s\n", optarg);
+					return false;
+				}
+				break;
+
+			case '?': return false;
+			default : assert(false);
+		}
+	}
+
+	if (optind + 1 != argc) {
+		fprintf(stderr, "Missing path\n");
+		return false;
+	}
+	opts->path = argv[optind];
+	return true;
+}
+
+
+int main(int argc, char *argv[])
+{
+	quota_opts opts = {0};// defaults are all 0
+	if (!parse_args(argc, argv, &opts)) {
+		// Invalid arguments, print help to stderr
+		print_help(stderr, argv[0]);
+		return 1;
+	}
+	if (opts.help) {
+		// Help requested, print it to stdout
+		print_help(stdout, argv[0]);
+		return 0;
+	}
+
+	int fd = open(opts.path, O_RDONLY);
+	if (fd < 0) {
+		perror(opts.path);
+		return 1;
+	}
+	unsigned long cmd = opts.remove ? A1FS_IOC_REMOVE_QUOTA : A1FS_IOC_SET_QUOTA;
+	int ret = ioctl(fd, cmd, &opts.limits);
+	if (ret < 0) perror(opts.remove ? "A1FS_IOC_REMOVE_QUOTA" : "A1FS_IOC_SET_QUOTA");
+	close(fd);
+	return (ret < 0) ? 1 : 0;
+}
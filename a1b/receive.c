@@ -0,0 +1,392 @@
+/*
+ * This code is provided solely for the personal and private use of students
+ * taking the CSC369H course at the University of Toronto. Copying for purposes
+ * other than this use is expressly prohibited. All forms of distribution of
+ * this code, including but not limited to public repositories on GitHub,
+ * GitLab, Bitbucket, or any other online platform, whether as given or with
+ * any changes, are expressly prohibited.
+ *
+ * Authors: Alexey Khrabrov, Karen Reid
+ *
+ * All of the files in this directory and all subdirectories are:
+ * Copyright (c) 2019 Karen Reid
+ */
+
+
+/**
+ * CSC369 Assignment 1 - a1fs receive tool.
+ *
+ * Applies a send stream (see stream.h and send.c) from the standard input to
+ * an unmounted a1fs image, then takes a snapshot named as the target of the
+ * stream, so that the next incremental stream can be applied on top of it.
+ *
+ * An incremental stream needs a snapshot named as its base, and the file
+ * system must not have been modified since that snapshot was taken; the
+ * inode generations tell whether it was. A full stream needs an empty file
+ * system. Inodes keep the numbers they have in the source file system.
+ *
+ * The stream is applied with the same code in fs_ops.c that the file system
+ * uses for writes, truncation and extended attributes.
+ */
+
+#include <errno.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/mman.h>
+#include <unistd.h>
+
+#include "fs_ops.h"
+#include "map.h"
+#include "stream.h"
+
+
+/** Command line options. */
+typedef struct receive_opts {
+	/** File system image file path. */
+	const char *img_path;
+
+	/** Print help and exit. */
+	bool help;
+	/** Sync memory-mapped image file contents to disk. */
+	bool sync;
+	/** Verbose output. If false, the program must only print errors. */
+	bool verbose;
+
+} receive_opts;
+
+static const char *help_str = "\
+Usage: %s options image\n\
+\n\
+Apply a send stream from the standard input to an unmounted a1fs image and\n\
+take a snapshot named as the target of the stream. An incremental stream\n\
+needs a snapshot named as its base, with no changes since; a full stream\n\
+needs an empty file system.\n\
+\n\
+Options:\n\
+    -h      print help and exit\n\
+    -s      sync image file contents to disk\n\
+    -v      verbose output\n\
+";
+
+static void print_help(FILE *f, const char *progname)
+{
+	fprintf(f, help_str, progname);
+}
+
+static bool parse_args(int argc, char *argv[], receive_opts *opts)
+{
+	int o;
+	while ((o = getopt(argc, argv, "hsv")) != -1) {
+		switch (o) {
+			case 'h': opts->help    = true; return true;// skip other arguments
+			case 's': opts->sync    = true; break;
+			case 'v': opts->verbose = true; break;
+
+			case '?': return false;
+			default : assert(false);
+		}
+	}
+
+	if (optind + 1 != argc) {
+		fprintf(stderr, "Missing image path\n");
+		return false;
+	}
+	opts->img_path = argv[optind];
+	return true;
+}
+
+
+/**
+ * Check that the file system is in the state the stream expects: a copy of
+ * the base snapshot, or empty for a full stream.
+ */
+static bool check_base(fs_ctx *fs, const a1fs_stream_header *header)
+{
+	const a1fs_superblock *sb = get_sb(fs);
+	const uint8_t *bmp = fs->image + sb->inode_bmp * A1FS_BLOCK_SIZE;
+	if (header->num_inodes > sb->num_inodes) {
+		fprintf(stderr, "The file system has fewer inodes (%u) than the source (%u)\n",
+		        sb->num_inodes, header->num_inodes);
+		return false;
+	}
+	if (snapshot_find(fs, header->target) >= 0) {
+		fprintf(stderr, "Snapshot %s exists already\n", header->target);
+		return false;
+	}
+	if (sb->num_snapshots == A1FS_SNAPSHOTS_MAX) {
+		fprintf(stderr, "No room for snapshot %s\n", header->target);
+		return false;
+	}
+
+	if (header->base[0] == '\0') {
+		const a1fs_inode *root = get_inode(fs, A1FS_ROOT_INO);
+		for (a1fs_ino_t ino = A1FS_ROOT_INO + 1; ino < sb->num_inodes; ino++) {
+			if (bitmap_test(bmp, ino)) {
+				fprintf(stderr, "A full stream needs an empty file system\n");
+				return false;
+			}
+		}
+		// Only "." and ".."
+		if (root->size > 2 * sizeof(a1fs_dentry)) {
+			fprintf(stderr, "A full stream needs an empty file system\n");
+			return false;
+		}
+		return true;
+	}
+
+	int i = snapshot_find(fs, header->base);
+	if (i < 0) {
+		fprintf(stderr, "No snapshot named %s\n", header->base);
+		return false;
+	}
+	const a1fs_snapshot *snap = &snapshot_list(fs)[i];
+	const uint8_t *snap_bmp = snapshot_inode_bmp(fs, snap);
+	for (a1fs_ino_t ino = 0; ino < sb->num_inodes; ino++) {
+		bool used = bitmap_test(bmp, ino);
+		if ((used != bitmap_test(snap_bmp, ino)) ||
+		    (used && (get_inode(fs, ino)->generation > snap->generation)))
+		{
+			fprintf(stderr, "The file system was modified since snapshot %s\n", snap->name);
+			return false;
+		}
+	}
+	return true;
+}
+
+/**
+ * Create or update an inode (A1FS_STREAM_INODE record).
+ *
+ * @return  0 on success; -errno on error.
+ */
+static int receive_inode(fs_ctx *fs, a1fs_ino_t ino, const a1fs_stream_inode *si)
+{
+	a1fs_superblock *sb = get_sb(fs);
+	uint8_t *bmp = fs->image + sb->inode_bmp * A1FS_BLOCK_SIZE;
+	a1fs_inode *inode = get_inode(fs, ino);
+
+	if (!bitmap_test(bmp, ino)) {
+		// The inode number is given, so inode_alloc() can't be used
+		if (!si->reset) return -EINVAL;
+		bitmap_set(bmp, ino, true);
+		sb->num_unused_inodes--;
+		memset(inode, 0, sizeof(*inode));
+	} else if (si->reset) {
+		inode_free_data(fs, ino, inode);
+	}
+	if (si->reset) {
+		inode->flags = (inode->flags & ~A1FS_INODE_COMPRESSED) | si->flags;
+	} else if ((inode->flags & A1FS_INODE_COMPRESSED) != si->flags) {
+		return -EINVAL;
+	}
+	// The file size is set before its data is received: writes don't change it
+	int ret = file_truncate(fs, ino, inode, si->size);
+	if (ret != 0) return ret;
+	inode->mode = si->mode;
+	inode->links = si->links;
+	inode->mtime = si->mtime;
+	return 0;
+}
+
+/**
+ * Write file data (A1FS_STREAM_DATA record) or make it a hole
+ * (A1FS_STREAM_HOLE record, with data == NULL).
+ *
+ * @return  0 on success; -errno on error.
+ */
+static int receive_data(fs_ctx *fs, const a1fs_stream_record *rec, const void *data)
+{
+	a1fs_inode *inode = get_inode(fs, rec->ino);
+	if (inode_compressed(inode)) {
+		if ((rec->count != 1) || ((data != NULL) && (rec->size != A1FS_CLUSTER_SIZE))) {
+			return -EINVAL;
+		}
+		return cluster_write(fs, rec->ino, inode, rec->index, data, 0, A1FS_CLUSTER_SIZE);
+	}
+
+	if (rec->index + rec->count > (uint64_t)UINT32_MAX + 1) return -EINVAL;
+	// The tail is packed again once all the records of the inode are applied
+	if (inode_has_tail(inode) && (rec->index + rec->count > inode->size / A1FS_BLOCK_SIZE)) {
+		int ret = tail_unpack(fs, inode);
+		if (ret != 0) return ret;
+	}
+	if (data == NULL) return file_punch(fs, inode, rec->index, rec->count);
+	if (rec->size != (uint64_t)rec->count * A1FS_BLOCK_SIZE) return -EINVAL;
+	// Runs are written as they are, keeping the file contiguous rather than
+	// deduplicating it block by block; dedup.a1fs can do that afterwards
+	return file_write(fs, inode, data, rec->size, rec->index * A1FS_BLOCK_SIZE);
+}
+
+/**
+ * Replace the extended attributes of an inode (A1FS_STREAM_XATTR record).
+ *
+ * @return  0 on success; -errno on error.
+ */
+static int receive_xattrs(fs_ctx *fs, a1fs_ino_t ino, const unsigned char *data,
+                          uint32_t size)
+{
+	if ((size < A1FS_INODE_XATTR_SIZE) || (size > A1FS_INODE_XATTR_SIZE + A1FS_BLOCK_SIZE)) {
+		return -EINVAL;
+	}
+	xattr *list = malloc(XATTR_MAX_COUNT * sizeof(xattr));
+	if (list == NULL) return -ENOMEM;
+	int n = xattr_parse(data, A1FS_INODE_XATTR_SIZE, list, 0);
+	n = xattr_parse(data + A1FS_INODE_XATTR_SIZE, size - A1FS_INODE_XATTR_SIZE, list, n);
+	int ret = xattr_store(fs, get_inode(fs, ino), list, n);
+	free(list);
+	return ret;
+}
+
+/** Pack the tail of a received inode after its last record (see tail_pack()). */
+static void receive_done(fs_ctx *fs, a1fs_ino_t ino)
+{
+	const a1fs_superblock *sb = get_sb(fs);
+	const uint8_t *bmp = fs->image + sb->inode_bmp * A1FS_BLOCK_SIZE;
+	if ((ino < sb->num_inodes) && bitmap_test(bmp, ino)) tail_pack(fs, get_inode(fs, ino));
+}
+
+/**
+ * Apply the records of the stream up to the end record. The records of an
+ * inode are contiguous in the stream.
+ *
+ * @return  true on success; false on error.
+ */
+static bool receive_records(fs_ctx *fs, receive_opts *opts)
+{
+	const a1fs_superblock *sb = get_sb(fs);
+	const uint8_t *bmp = fs->image + sb->inode_bmp * A1FS_BLOCK_SIZE;
+	unsigned char *payload = malloc(A1FS_STREAM_PAYLOAD_MAX);
+	if (payload == NULL) {
+		fprintf(stderr, "Out of memory\n");
+		return false;
+	}
+
+	uint64_t records = 0, bytes = 0;
+	a1fs_ino_t prev = UINT32_MAX;
+	bool ok = false;
+	while (true) {
+		a1fs_stream_record rec;
+		if ((fread(&rec, sizeof(rec), 1, stdin) != 1) ||
+		    (rec.size > A1FS_STREAM_PAYLOAD_MAX) ||
+		    ((rec.size > 0) && (fread(payload, rec.size, 1, stdin) != 1)))
+		{
+			fprintf(stderr, "Truncated or corrupted stream\n");
+			break;
+		}
+		if (rec.ino != prev) receive_done(fs, prev);
+		prev = rec.ino;
+		if (rec.type == A1FS_STREAM_END) {
+			ok = true;
+			break;
+		}
+
+		int ret = -EINVAL;
+		bool used = (rec.ino < sb->num_inodes) && bitmap_test(bmp, rec.ino);
+		switch (rec.type) {
+			case A1FS_STREAM_DELETE:
+				if (!used) break;
+				inode_free_data(fs, rec.ino, get_inode(fs, rec.ino));
+				inode_free(fs, rec.ino);
+				ret = 0;
+				break;
+			case A1FS_STREAM_INODE:
+				if ((rec.ino >= sb->num_inodes) || (rec.size != sizeof(a1fs_stream_inode))) break;
+				ret = receive_inode(fs, rec.ino, (const a1fs_stream_inode*)payload);
+				break;
+			case A1FS_STREAM_DATA:
+				if (!used) break;
+				ret = receive_data(fs, &rec, payload);
+				bytes += rec.size;
+				break;
+			case A1FS_STREAM_HOLE:
+				if (!used) break;
+				ret = receive_data(fs, &rec, NULL);
+				break;
+			case A1FS_STREAM_XATTR:
+				if (!used) break;
+				ret = receive_xattrs(fs, rec.ino, payload, rec.size);
+				break;
+		}
+		if (ret != 0) {
+			fprintf(stderr, "Failed to apply record %lu (inode %u): %s\n", records, rec.ino,
+			        strerror(-ret));
+			break;
+		}
+		// Received changes belong to the generation that the snapshot ends
+		if (rec.type != A1FS_STREAM_DELETE) inode_stamp(fs, get_inode(fs, rec.ino));
+		records++;
+	}
+	free(payload);
+
+	if (!ok) {
+		fprintf(stderr, "The file system is left partially updated\n");
+	} else if (opts->verbose) {
+		printf("Applied %lu records with %lu bytes of data\n", records, bytes);
+	}
+	return ok;
+}
+
+
+int main(int argc, char *argv[])
+{
+	receive_opts opts = {0};// defaults are all 0
+	if (!parse_args(argc, argv, &opts)) {
+		// Invalid arguments, print help to stderr
+		print_help(stderr, argv[0]);
+		return 1;
+	}
+	if (opts.help) {
+		// Help requested, print it to stdout
+		print_help(stdout, argv[0]);
+		return 0;
+	}
+
+	a1fs_stream_header header;
+	if ((fread(&header, sizeof(header), 1, stdin) != 1) ||
+	    (header.magic != A1FS_STREAM_MAGIC) ||
+	    (strnlen(header.base, A1FS_NAME_MAX) == A1FS_NAME_MAX) ||
+	    (strnlen(header.target, A1FS_NAME_MAX) == A1FS_NAME_MAX) ||
+	    (header.target[0] == '\0'))
+	{
+		fprintf(stderr, "Input is not an a1fs send stream\n");
+		return 1;
+	}
+
+	// Map image file into memory
+	size_t size;
+	void *image = map_file(opts.img_path, A1FS_BLOCK_SIZE, &size);
+	if (image == NULL) return 1;
+
+	int ret = 1;
+	a1fs_opts fs_opts = { .img_path = opts.img_path };
+	fs_ctx fs = { .image = image, .size = size };
+	if (((a1fs_superblock*)image)->magic != A1FS_MAGIC) {
+		fprintf(stderr, "Image does not contain a1fs\n");
+		goto end;
+	}
+	if (!fs_ctx_init(&fs, image, size, &fs_opts)) {
+		fprintf(stderr, "Failed to initialize file system context\n");
+		goto end;
+	}
+
+	if (check_base(&fs, &header) && receive_records(&fs, &opts)) {
+		int err = snapshot_create(&fs, header.target);
+		if (err == 0) {
+			ret = 0;
+			if (opts.verbose) printf("Received snapshot %s\n", header.target);
+		} else {
+			fprintf(stderr, "Failed to take snapshot %s: %s\n", header.target,
+			        strerror(-err));
+		}
+	}
+	fs_ctx_destroy(&fs);
+
+	// Sync to disk if requested
+	if ((ret == 0) && opts.sync && (msync(image, size, MS_SYNC) < 0)) {
+		perror("msync");
+		ret = 1;
+	}
+end:
+	munmap(image, size);
+	return ret;
+}
@@ -0,0 +1,887 @@
+/*
+ * This code is provided solely for the personal and private use of students
+ * taking the CSC369H course at the University of Toronto. Copying for purposes
+ * other than this use is expressly prohibited. All forms of distribution of
+ * this code, including but not limited to public repositories on GitHub,
+ * GitLab, Bitbucket, or any other online platform, whether as given or with
+ * any changes, are expressly prohibited.
+ *
+ * Authors: Alexey Khrabrov, Karen Reid
+ *
+ * All of the files in this directory and all subdirectories are:
+ * Copyright (c) 2019 Karen Reid
+ */
+
+/**
+ * CSC369 Assignment 1 - Trace replay tool.
+ *
+ * Replays a trace recorded by a1fs or a1fs_ll with --trace (see trace.h)
+ * against an image in-process with liba1fs, or against a mounted file system
+ * through the file system calls, and reports how the latencies and the results
+ * compare with the recorded ones.
+ *
+ * The operations of each recorded process are replayed in order by one worker
+ * thread; processes are spread over the workers in the order in which they
+ * first appear in the trace. Each operation waits for its recorded start time,
+ * scaled by the speed factor, unless the speed factor is 0. The operations of
+ * the a1fs_ll front end refer to inodes, which are mapped to paths through the
+ * recorded results of lookup(), mkdir() and create().
+ *
+ * File data and attribute values are not recorded: writes and setxattr() use
+ * a fixed pattern. Operations that the backend can't replay, and operations on
+ * files whose paths are not known, are skipped.
+ *
+ * liba1fs operations on one image must not run concurrently, so with liba1fs
+ * the workers only overlap in waiting for the start times.
+ */
+
+#include <assert.h>
+#include <dirent.h>
+#include <errno.h>
+#include <fcntl.h>
+#include <limits.h>
+#include <pthread.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/stat.h>
+#include <sys/statvfs.h>
+#include <sys/xattr.h>
+#include <time.h>
+#include <unistd.h>
+
+#include "liba1fs.h"
+#include "trace.h"
+
+
+/** Command line options. */
+typedef struct replay_opts {
+	/** Trace to replay. */
+	const char *trace_path;
+	/** Image to replay the trace on with liba1fs. */
+	const char *img_path;
+	/** Mount point of a1fs to replay the trace on instead; NULL for liba1fs. */
+	const char *mountpoint;
+	/** Number of worker threads. */
+	unsigned int n_threads;
+	/** Speed factor of the timing: 1 replays in real time; 0 without waits. */
+	double speed;
+	/** Print each operation whose result differs from the recorded one. */
+	bool verbose;
+
+	/** Print help and exit. */
+	bool help;
+
+} replay_opts;
+
+static const char *replay_help_str = "\
+Usage: %s [options] trace [image]\n\
+\n\
+Replay a trace recorded with the --trace option of a1fs or a1fs_ll on an a1fs\n\
+image in-process with liba1fs, or with -m, on a mounted a1fs through the\n\
+kernel. The image must not be mounted.\n\
+\n\
+Options:\n\
+    -m dir    mount point of a1fs to replay the trace on\n\
+    -j num    number of worker threads (default: 1)\n\
+    -s speed  speed factor of the recorded timing; 0 replays as fast as\n\
+              possible (default: 1)\n\
+    -v        print the operations whose results differ from the trace\n\
+    -h        print help and exit\n\
+";
+
+static bool replay_parse_args(int argc, char *argv[], replay_opts *opts)
+{
+	opts->speed = 1;
+	int o;
+	while ((o = getopt(argc, argv, "m:j:s:vh")) != -1) {
+		switch (o) {
+			case 'm': opts->mountpoint = optarg; break;
+			case 'j': opts->n_threads = strtoul(optarg, NULL, 10); break;
+			case 's': opts->speed = strtod(optarg, NULL); break;
+			case 'v': opts->verbose = true; break;
+
+			case 'h': opts->help = true; return true;// skip other arguments
+
+			case '?': return false;
+			default : assert(false);
+		}
+	}
+
+	int n_args = (opts->mountpoint != NULL) ? 1 : 2;
+	if (optind != argc - n_args) {
+		fprintf(stderr, (opts->mountpoint != NULL) ? "Missing trace path\n"
+		                                           : "Missing trace or image path\n");
+		return false;
+	}
+	opts->trace_path = argv[optind];
+	if (opts->mountpoint == NULL) opts->img_path = argv[optind + 1];
+
+	if (opts->n_threads == 0) opts->n_threads = 1;
+	if (opts->speed < 0) {
+		fprintf(stderr, "Invalid speed factor\n");
+		return false;
+	}
+	return true;
+}
+
+
+/** Result of an operation that was not replayed. */
+#define REPLAY_SKIPPED INT_MIN
+
+/** A recorded operation to replay. */
+typedef struct replay_op {
+	/** The record. */
+	a1fs_trace_record rec;
+	/** Path of the file (within the mount point with -m); NULL if not known. */
+	char *path;
+	/** New path for rename() (like path), or attribute name; NULL if none. */
+	char *name;
+	/** Worker thread that replays the operation. */
+	unsigned int worker;
+
+	/** Result of the replay: >= 0 on success; -errno or REPLAY_SKIPPED. */
+	int result;
+	/** Latency of the replay in ns. */
+	uint64_t latency;
+
+} replay_op;
+
+/** A file opened by a replayed open() or create() and not released yet. */
+typedef struct replay_handle {
+	/** Path of the file (owned by the replay_op that opened it). */
+	const char *path;
+	/** O_RDONLY, O_WRONLY or O_RDWR. */
+	int accmode;
+	/** liba1fs: inode number of the file. */
+	a1fs_ino_t ino;
+	/** Mounted a1fs: the file descriptor. */
+	int fd;
+
+} replay_handle;
+
+/** Replay state shared by the worker threads. */
+typedef struct replay_ctx {
+	const replay_opts *opts;
+	/** The operations, in trace order. */
+	replay_op *ops;
+	size_t n_ops;
+	/** Largest read, write or xattr size in the trace. */
+	size_t max_size;
+	/** Data written by writes and setxattr(); max_size bytes. */
+	char *pattern;
+	/** stats_now() time when the replay started. */
+	uint64_t start_ns;
+
+	/** liba1fs: the image; operations on it are serialized with fs_lock. */
+	fs_ctx fs;
+	pthread_mutex_t fs_lock;
+
+	/** Open files, in the order in which they were opened. */
+	replay_handle *handles;
+	size_t n_handles;
+	size_t handles_size;
+	pthread_mutex_t handles_lock;
+
+} replay_ctx;
+
+/** Worker thread state. */
+typedef struct replay_worker {
+	replay_ctx *ctx;
+	/** Index of the worker. */
+	unsigned int index;
+	/** Buffer of max_size bytes for reads. */
+	char *buf;
+
+} replay_worker;
+
+
+/** Join a directory path and an entry name; the result is allocated with malloc(). */
+static char *path_join(const char *dir, const char *name)
+{
+	size_t dir_len = strlen(dir);
+	size_t len = dir_len + 1 + strlen(name);
+	char *path = malloc(len + 1);
+	if (path == NULL) return NULL;
+	// The root directory is the only one whose path ends in a '/'
+	if ((dir_len > 0) && (dir[dir_len - 1] == '/')) dir_len--;
+	sprintf(path, "%.*s/%s", (int)dir_len, dir, name);
+	return path;
+}
+
+/** Paths of the inodes seen in an a1fs_ll trace, indexed by inode number. */
+typedef struct ino_paths {
+	char **paths;
+	size_t size;
+
+} ino_paths;
+
+static const char *ino_path_get(const ino_paths *m, a1fs_ino_t ino)
+{
+	return (ino < m->size) ? m->paths[ino] : NULL;
+}
+
+static bool ino_path_set(ino_paths *m, a1fs_ino_t ino, const char *path)
+{
+	if (ino >= m->size) {
+		size_t size = (m->size == 0) ? 1024 : m->size;
+		while (size <= ino) size *= 2;
+		char **paths = realloc(m->paths, size * sizeof(char*));
+		if (paths == NULL) return false;
+		memset(paths + m->size, 0, (size - m->size) * sizeof(char*));
+		m->paths = paths;
+		m->size = size;
+	}
+	char *copy = strdup(path);
+	if (copy == NULL) return false;
+	free(m->paths[ino]);
+	m->paths[ino] = copy;
+	return true;
+}
+
+/** Whether an a1fs_ll operation refers to a directory entry by parent and name. */
+static bool is_entry_op(a1fs_stats_op op)
+{
+	return (op == A1FS_OP_LOOKUP) || (op == A1FS_OP_MKDIR) || (op == A1FS_OP_CREATE) ||
+	       (op == A1FS_OP_UNLINK) || (op == A1FS_OP_RMDIR);
+}
+
+/**
+ * Resolve the paths of an operation. a1fs records paths; a1fs_ll records the
+ * inode number of the file, or of the parent and the entry name.
+ *
+ * @return  true on success; false if out of memory.
+ */
+static bool resolve_paths(replay_ctx *ctx, replay_op *op, ino_paths *m,
+                          const char *path, const char *name)
+{
+	const a1fs_trace_record *rec = &op->rec;
+	if ((rec->path_len > 0) || (rec->ino == 0)) {
+		op->path = (rec->path_len > 0) ? strdup(path) : NULL;
+		op->name = (rec->name_len > 0) ? strdup(name) : NULL;
+		if (((rec->path_len > 0) && (op->path == NULL)) ||
+		    ((rec->name_len > 0) && (op->name == NULL)))
+		{
+			return false;
+		}
+	} else if (is_entry_op(rec->op)) {
+		const char *dir = ino_path_get(m, rec->ino);
+		if (dir == NULL) return true;
+		if ((op->path = path_join(dir, name)) == NULL) return false;
+		// The recorded inode number of the entry
+		bool has_entry = (rec->op == A1FS_OP_LOOKUP) || (rec->op == A1FS_OP_MKDIR) ||
+		                 (rec->op == A1FS_OP_CREATE);
+		// The statistics file has a node ID past the inode numbers
+		if (has_entry && (rec->result == 0) && (rec->size != 0) &&
+		    (rec->size <= UINT32_MAX) && !ino_path_set(m, rec->size, op->path))
+		{
+			return false;
+		}
+	} else {
+		const char *file = ino_path_get(m, rec->ino);
+		op->path = (file != NULL) ? strdup(file) : NULL;
+		op->name = (rec->name_len > 0) ? strdup(name) : NULL;
+		if (((file != NULL) && (op->path == NULL)) ||
+		    ((rec->name_len > 0) && (op->name == NULL)))
+		{
+			return false;
+		}
+	}
+
+	// Paths within the mount point
+	const char *mnt = ctx->opts->mountpoint;
+	if ((mnt != NULL) && (op->path != NULL)) {
+		char *full = path_join(mnt, op->path + 1);
+		free(op->path);
+		if ((op->path = full) == NULL) return false;
+	}
+	if ((mnt != NULL) && (rec->op == A1FS_OP_RENAME) && (op->name != NULL)) {
+		char *full = path_join(mnt, op->name + 1);
+		free(op->name);
+		if ((op->name = full) == NULL) return false;
+	}
+	return true;
+}
+
+/**
+ * Load the operations of the trace and assign them to the workers.
+ *
+ * @return  true on success; false on failure (reported on stderr).
+ */
+static bool load_trace(replay_ctx *ctx)
+{
+	const char *trace_path = ctx->opts->trace_path;
+	FILE *f = fopen(trace_path, "r");
+	if (f == NULL) {
+		perror(trace_path);
+		return false;
+	}
+	a1fs_trace_header header;
+	if ((fread(&header, sizeof(header), 1, f) != 1) ||
+	    (header.magic != A1FS_TRACE_MAGIC))
+	{
+		fprintf(stderr, "%s: not an a1fs trace\n", trace_path);
+		fclose(f);
+		return false;
+	}
+
+	char *path = malloc(UINT16_MAX + 1);
+	char *name = malloc(UINT16_MAX + 1);
+	ino_paths m = {0};
+	// Processes in the order in which they first appear
+	uint32_t *pids = NULL;
+	size_t n_pids = 0;
+	size_t size = 0;
+	bool ok = (path != NULL) && (name != NULL) && ino_path_set(&m, A1FS_ROOT_INO, "/");
+	if (!ok) perror("malloc");
+
+	int ret = 0;
+	while (ok) {
+		if (ctx->n_ops == size) {
+			size = (size == 0) ? 1024 : size * 2;
+			replay_op *ops = realloc(ctx->ops, size * sizeof(replay_op));
+			if (ops == NULL) {
+				perror("realloc");
+				ok = false;
+				break;
+			}
+			ctx->ops = ops;
+		}
+		replay_op *op = &ctx->ops[ctx->n_ops];
+		memset(op, 0, sizeof(*op));
+		if ((ret = trace_read(f, &op->rec, path, name)) <= 0) break;
+		ctx->n_ops++;
+
+		if (!resolve_paths(ctx, op, &m, path, name)) {
+			perror("malloc");
+			ok = false;
+			break;
+		}
+
+		size_t i = 0;
+		while ((i < n_pids) && (pids[i] != op->rec.pid)) i++;
+		if (i == n_pids) {
+			uint32_t *p = realloc(pids, (n_pids + 1) * sizeof(uint32_t));
+			if (p == NULL) {
+				perror("realloc");
+				ok = false;
+				break;
+			}
+			pids = p;
+			pids[n_pids++] = op->rec.pid;
+		}
+		op->worker = i % ctx->opts->n_threads;
+
+		a1fs_stats_op o = op->rec.op;
+		if (((o == A1FS_OP_READ) || (o == A1FS_OP_WRITE) || (o == A1FS_OP_SETXATTR) ||
+		     (o == A1FS_OP_GETXATTR) || (o == A1FS_OP_LISTXATTR)) &&
+		    (op->rec.size > ctx->max_size))
+		{
+			ctx->max_size = op->rec.size;
+		}
+	}
+	if (ok && (ret < 0)) {
+		fprintf(stderr, "%s: truncated or malformed trace\n", trace_path);
+		ok = false;
+	}
+
+	for (size_t i = 0; i < m.size; i++) free(m.paths[i]);
+	free(m.paths);
+	free(pids);
+	free(path);
+	free(name);
+	fclose(f);
+	return ok;
+}
+
+
+/**
+ * Remember a file opened by a replayed operation.
+ *
+ * @return  true on success; false if out of memory.
+ */
+static bool handle_add(replay_ctx *ctx, const char *path, int accmode,
+                       a1fs_ino_t ino, int fd)
+{
+	bool ok = true;
+	pthread_mutex_lock(&ctx->handles_lock);
+	if (ctx->n_handles == ctx->handles_size) {
+		size_t size = (ctx->handles_size == 0) ? 64 : ctx->handles_size * 2;
+		replay_handle *handles = realloc(ctx->handles, size * sizeof(replay_handle));
+		if (handles != NULL) {
+			ctx->handles = handles;
+			ctx->handles_size = size;
+		} else {
+			ok = false;
+		}
+	}
+	if (ok) {
+		ctx->handles[ctx->n_handles++] = (replay_handle){
+			.path = path, .accmode = accmode, .ino = ino, .fd = fd,
+		};
+	}
+	pthread_mutex_unlock(&ctx->handles_lock);
+	return ok;
+}
+
+/**
+ * Find the most recently opened handle of a file that allows reading (for
+ * O_RDONLY) or writing (for O_WRONLY).
+ *
+ * @return  true if found; false otherwise.
+ */
+static bool handle_find(replay_ctx *ctx, const char *path, int access,
+                        replay_handle *h)
+{
+	int bad = (access == O_RDONLY) ? O_WRONLY : O_RDONLY;
+	bool found = false;
+	pthread_mutex_lock(&ctx->handles_lock);
+	for (size_t i = ctx->n_handles; i > 0; i--) {
+		const replay_handle *cur = &ctx->handles[i - 1];
+		if ((cur->accmode != bad) && (strcmp(cur->path, path) == 0)) {
+			*h = *cur;
+			found = true;
+			break;
+		}
+	}
+	pthread_mutex_unlock(&ctx->handles_lock);
+	return found;
+}
+
+/**
+ * Forget the most recently opened handle of a file. The recorded release()
+ * doesn't tell which one was released.
+ *
+ * @return  true if found; false otherwise.
+ */
+static bool handle_remove(replay_ctx *ctx, const char *path, replay_handle *h)
+{
+	bool found = false;
+	pthread_mutex_lock(&ctx->handles_lock);
+	for (size_t i = ctx->n_handles; i > 0; i--) {
+		if (strcmp(ctx->handles[i - 1].path, path) == 0) {
+			*h = ctx->handles[i - 1];
+			memmove(&ctx->handles[i - 1], &ctx->handles[i],
+			        (ctx->n_handles - i) * sizeof(replay_handle));
+			ctx->n_handles--;
+			found = true;
+			break;
+		}
+	}
+	pthread_mutex_unlock(&ctx->handles_lock);
+	return found;
+}
+
+
+/** Result of a system call: its return value on success; -errno on failure. */
+static int sys_result(long ret)
+{
+	return (ret < 0) ? -errno : (int)ret;
+}
+
+/**
+ * Get a file descriptor for reading (O_RDONLY) or writing (O_WRONLY) a file:
+ * its open handle, or a new descriptor that the caller closes.
+ *
+ * @return  the file descriptor on success; -errno on error.
+ */
+static int mnt_fd(replay_ctx *ctx, const char *path, int access, bool *temp)
+{
+	replay_handle h;
+	*temp = !handle_find(ctx, path, access, &h);
+	return *temp ? sys_result(open(path, access)) : h.fd;
+}
+
+/** Read or write a file through a descriptor from mnt_fd(). */
+static int mnt_io(replay_worker *w, const replay_op *op)
+{
+	const a1fs_trace_record *rec = &op->rec;
+	bool write = rec->op == A1FS_OP_WRITE;
+	bool temp;
+	int fd = mnt_fd(w->ctx, op->path, write ? O_WRONLY : O_RDONLY, &temp);
+	if (fd < 0) return fd;
+	int ret = write ? sys_result(pwrite(fd, w->ctx->pattern, rec->size, rec->offset))
+	                : sys_result(pread(fd, w->buf, rec->size, rec->offset));
+	if (temp) close(fd);
+	return ret;
+}
+
+/** Open a file like a recorded open() or create(), and keep it open until release(). */
+static int mnt_open(replay_ctx *ctx, const char *path, int flags, mode_t mode)
+{
+	int fd = open(path, flags, mode);
+	if (fd < 0) return -errno;
+	if (!handle_add(ctx, path, flags & O_ACCMODE, 0, fd)) {
+		close(fd);
+		return -ENOMEM;
+	}
+	return 0;
+}
+
+/** List a directory through the kernel. */
+static int mnt_readdir(const char *path)
+{
+	DIR *dir = opendir(path);
+	if (dir == NULL) return -errno;
+	errno = 0;
+	while (readdir(dir) != NULL);
+	int ret = -errno;
+	closedir(dir);
+	return ret;
+}
+
+/** Replay an operation on the mounted a1fs. */
+static int mnt_replay(replay_worker *w, const replay_op *op)
+{
+	replay_ctx *ctx = w->ctx;
+	const a1fs_trace_record *rec = &op->rec;
+	const char *path = op->path;
+	if (path == NULL) return REPLAY_SKIPPED;
+
+	struct stat st;
+	struct statvfs stv;
+	replay_handle h;
+	bool temp;
+	int fd, ret;
+	switch (rec->op) {
+		case A1FS_OP_STATFS:
+			return sys_result(statvfs(path, &stv));
+		case A1FS_OP_GETATTR:
+		case A1FS_OP_LOOKUP:
+			return sys_result(lstat(path, &st));
+		case A1FS_OP_READDIR:
+			return mnt_readdir(path);
+		case A1FS_OP_MKDIR:
+			return sys_result(mkdir(path, rec->offset & 07777));
+		case A1FS_OP_RMDIR:
+			return sys_result(rmdir(path));
+		case A1FS_OP_UNLINK:
+			return sys_result(unlink(path));
+		case A1FS_OP_RENAME:
+			return (op->name != NULL) ? sys_result(rename(path, op->name)) : REPLAY_SKIPPED;
+		case A1FS_OP_CREATE:
+			return mnt_open(ctx, path, O_RDWR | O_CREAT | O_EXCL, rec->offset & 07777);
+		case A1FS_OP_OPEN:
+			return mnt_open(ctx, path, rec->offset & (O_ACCMODE | O_TRUNC), 0);
+		case A1FS_OP_RELEASE:
+			if (handle_remove(ctx, path, &h)) close(h.fd);
+			return 0;
+		case A1FS_OP_READ:
+		case A1FS_OP_WRITE:
+			return mnt_io(w, op);
+		case A1FS_OP_FSYNC:
+			if ((fd = mnt_fd(ctx, path, O_RDONLY, &temp)) < 0) return fd;
+			ret = sys_result(fsync(fd));
+			if (temp) close(fd);
+			return ret;
+		case A1FS_OP_TRUNCATE:
+			return sys_result(truncate(path, rec->offset));
+		case A1FS_OP_SETATTR:
+			if (rec->size & A1FS_TRACE_SET_SIZE) return sys_result(truncate(path, rec->offset));
+			if (rec->size & A1FS_TRACE_SET_MTIME) {
+				return sys_result(utimensat(AT_FDCWD, path, NULL, AT_SYMLINK_NOFOLLOW));
+			}
+			return REPLAY_SKIPPED;
+		case A1FS_OP_UTIMENS:
+			return sys_result(utimensat(AT_FDCWD, path, NULL, AT_SYMLINK_NOFOLLOW));
+		case A1FS_OP_SETXATTR:
+			if (op->name == NULL) return REPLAY_SKIPPED;
+			return sys_result(lsetxattr(path, op->name, ctx->pattern, rec->size, rec->offset));
+		case A1FS_OP_GETXATTR:
+			if (op->name == NULL) return REPLAY_SKIPPED;
+			return sys_result(lgetxattr(path, op->name, w->buf, rec->size));
+		case A1FS_OP_LISTXATTR:
+			return sys_result(llistxattr(path, w->buf, rec->size));
+		case A1FS_OP_REMOVEXATTR:
+			if (op->name == NULL) return REPLAY_SKIPPED;
+			return sys_result(lremovexattr(path, op->name));
+		default:
+			// flush() is sent by close() in release(); forget() and ioctl()
+			// have no equivalent here
+			return REPLAY_SKIPPED;
+	}
+}
+
+
+/**
+ * Get the inode number of a file for reading (O_RDONLY) or writing (O_WRONLY):
+ * from its open handle, or by its path.
+ */
+static int lib_file(replay_ctx *ctx, const char *path, int access, a1fs_ino_t *ino)
+{
+	replay_handle h;
+	if (!handle_find(ctx, path, access, &h)) return a1fs_open(&ctx->fs, path, access, 0, ino);
+	*ino = h.ino;
+	return 0;
+}
+
+/** Open a file like a recorded open() or create(), and keep it open until release(). */
+static int lib_open(replay_ctx *ctx, const char *path, int flags, mode_t mode)
+{
+	a1fs_ino_t ino;
+	int ret = a1fs_open(&ctx->fs, path, flags, mode, &ino);
+	if (ret != 0) return ret;
+	return handle_add(ctx, path, flags & O_ACCMODE, ino, -1) ? 0 : -ENOMEM;
+}
+
+/** a1fs_readdir() callback that counts the entries. */
+static int count_entry(void *arg, const char *name, a1fs_ino_t ino)
+{
+	(void)name;// unused
+	(void)ino;// unused
+	(*(size_t*)arg)++;
+	return 0;
+}
+
+/** Replay an operation in-process with liba1fs. */
+static int lib_replay(replay_worker *w, const replay_op *op)
+{
+	replay_ctx *ctx = w->ctx;
+	fs_ctx *fs = &ctx->fs;
+	const a1fs_trace_record *rec = &op->rec;
+	const char *path = op->path;
+	if (path == NULL) return REPLAY_SKIPPED;
+
+	struct stat st;
+	replay_handle h;
+	a1fs_ino_t ino;
+	size_t n = 0;
+	int ret;
+	switch (rec->op) {
+		case A1FS_OP_GETATTR:
+		case A1FS_OP_LOOKUP:
+			if ((ret = a1fs_open(fs, path, O_RDONLY, 0, &ino)) != 0) return ret;
+			a1fs_fstat(fs, ino, &st);
+			return 0;
+		case A1FS_OP_READDIR:
+			if ((ret = a1fs_open(fs, path, O_RDONLY, 0, &ino)) != 0) return ret;
+			return a1fs_readdir(fs, ino, count_entry, &n);
+		case A1FS_OP_MKDIR:
+			return a1fs_mkdir(fs, path, rec->offset);
+		case A1FS_OP_RMDIR:
+			return a1fs_rmdir(fs, path);
+		case A1FS_OP_UNLINK:
+			return a1fs_unlink(fs, path);
+		case A1FS_OP_CREATE:
+			return lib_open(ctx, path, O_RDWR | O_CREAT | O_EXCL, rec->offset);
+		case A1FS_OP_OPEN:
+			return lib_open(ctx, path, rec->offset & (O_ACCMODE | O_TRUNC), 0);
+		case A1FS_OP_RELEASE:
+			if (handle_remove(ctx, path, &h)) a1fs_close(fs, h.ino);
+			return 0;
+		case A1FS_OP_READ:
+			if ((ret = lib_file(ctx, path, O_RDONLY, &ino)) != 0) return ret;
+			return a1fs_pread(fs, ino, w->buf, rec->size, rec->offset);
+		case A1FS_OP_WRITE:
+			if ((ret = lib_file(ctx, path, O_WRONLY, &ino)) != 0) return ret;
+			return a1fs_pwrite(fs, ino, ctx->pattern, rec->size, rec->offset);
+		case A1FS_OP_FSYNC:
+			if ((ret = lib_file(ctx, path, O_RDONLY, &ino)) != 0) return ret;
+			return a1fs_fsync(fs, ino);
+		case A1FS_OP_TRUNCATE:
+		case A1FS_OP_SETATTR:
+			if ((rec->op == A1FS_OP_SETATTR) && !(rec->size & A1FS_TRACE_SET_SIZE)) {
+				return REPLAY_SKIPPED;
+			}
+			if ((ret = a1fs_open(fs, path, O_WRONLY, 0, &ino)) != 0) return ret;
+			return a1fs_ftruncate(fs, ino, rec->offset);
+		default:
+			// liba1fs has no statfs(), rename(), utimens() or xattr calls
+			return REPLAY_SKIPPED;
+	}
+}
+
+
+/** Sleep until a stats_now() time. */
+static void wait_until(uint64_t ns)
+{
+	struct timespec ts = { .tv_sec = ns / 1000000000, .tv_nsec = ns % 1000000000 };
+	while (clock_nanosleep(CLOCK_MONOTONIC, TIMER_ABSTIME, &ts, NULL) == EINTR);
+}
+
+static void *worker_run(void *arg)
+{
+	replay_worker *w = (replay_worker*)arg;
+	replay_ctx *ctx = w->ctx;
+	double speed = ctx->opts->speed;
+	bool lib = ctx->opts->mountpoint == NULL;
+
+	for (size_t i = 0; i < ctx->n_ops; i++) {
+		replay_op *op = &ctx->ops[i];
+		if (op->worker != w->index) continue;
+		if (speed > 0) wait_until(ctx->start_ns + (uint64_t)(op->rec.time / speed));
+
+		if (lib) pthread_mutex_lock(&ctx->fs_lock);
+		uint64_t start = stats_now();
+		op->result = lib ? lib_replay(w, op) : mnt_replay(w, op);
+		op->latency = stats_now() - start;
+		if (lib) pthread_mutex_unlock(&ctx->fs_lock);
+	}
+	return NULL;
+}
+
+
+/** Whether the result of a replayed operation differs from the recorded one. */
+static bool result_differs(const replay_op *op)
+{
+	// Successful results (e.g. the number of bytes read) may legitimately differ
+	return (op->result != REPLAY_SKIPPED) && ((op->result < 0) || (op->rec.result < 0)) &&
+	       (op->result != op->rec.result);
+}
+
+static const char *result_str(int result)
+{
+	return (result >= 0) ? "success" : strerror(-result);
+}
+
+static int cmp_u64(const void *a, const void *b)
+{
+	uint64_t x = *(const uint64_t*)a, y = *(const uint64_t*)b;
+	return (x > y) - (x < y);
+}
+
+/**
+ * Print the per-operation results: counts, and the p50/p99 latencies recorded
+ * in the trace and measured by the replay.
+ *
+ * @return  true on success; false if out of memory.
+ */
+static bool report(const replay_ctx *ctx, uint64_t elapsed_ns)
+{
+	uint64_t *traced = malloc((ctx->n_ops + 1) * sizeof(uint64_t));
+	uint64_t *replayed = malloc((ctx->n_ops + 1) * sizeof(uint64_t));
+	if ((traced == NULL) || (replayed == NULL)) {
+		perror("malloc");
+		free(traced);
+		free(replayed);
+		return false;
+	}
+
+	if (ctx->opts->verbose) {
+		for (size_t i = 0; i < ctx->n_ops; i++) {
+			const replay_op *op = &ctx->ops[i];
+			if (!result_differs(op)) continue;
+			printf("%12.6f %-11s %s: %s in the trace, ", op->rec.time / 1e9,
+			       stats_op_name(op->rec.op), op->path, result_str(op->rec.result));
+			printf("%s in the replay\n", result_str(op->result));
+		}
+	}
+
+	printf("%-12s %8s %8s %8s %12s %12s %10s %10s\n", "operation", "count", "skipped",
+	       "differ", "trace p50", "trace p99", "p50 (us)", "p99 (us)");
+	size_t total_skipped = 0, total_differ = 0;
+	for (int o = 0; o < A1FS_OP_COUNT; o++) {
+		size_t count = 0, n = 0, differ = 0;
+		for (size_t i = 0; i < ctx->n_ops; i++) {
+			const replay_op *op = &ctx->ops[i];
+			if (op->rec.op != o) continue;
+			traced[count++] = op->rec.latency;
+			if (op->result != REPLAY_SKIPPED) replayed[n++] = op->latency;
+			if (result_differs(op)) differ++;
+		}
+		if (count == 0) continue;
+		total_skipped += count - n;
+		total_differ += differ;
+
+		qsort(traced, count, sizeof(uint64_t), cmp_u64);
+		qsort(replayed, n, sizeof(uint64_t), cmp_u64);
+		printf("%-12s %8zu %8zu %8zu %12.2f %12.2f", stats_op_name(o), count, count - n,
+		       differ, traced[count / 2] / 1e3, traced[count * 99 / 100] / 1e3);
+		if (n > 0) {
+			printf(" %10.2f %10.2f\n", replayed[n / 2] / 1e3, replayed[n * 99 / 100] / 1e3);
+		} else {
+			printf(" %10s %10s\n", "-", "-");
+		}
+	}
+
+	double secs = elapsed_ns / 1e9;
+	size_t done = ctx->n_ops - total_skipped;
+	printf("\nReplayed %zu of %zu operations in %.3f s (%.0f ops/s); "
+	       "%zu results differ from the trace\n", done, ctx->n_ops, secs,
+	       (secs > 0) ? done / secs : 0.0, total_differ);
+	free(traced);
+	free(replayed);
+	return true;
+}
+
+
+int main(int argc, char *argv[])
+{
+	replay_opts opts = {0};
+	if (!replay_parse_args(argc, argv, &opts)) {
+		// Invalid arguments, print help to stderr
+		fprintf(stderr, replay_help_str, argv[0]);
+		return 1;
+	}
+	if (opts.help) {
+		// Help requested, print it to stdout
+		printf(replay_help_str, argv[0]);
+		return 0;
+	}
+
+	replay_ctx ctx = { .opts = &opts };
+	pthread_mutex_init(&ctx.fs_lock, NULL);
+	pthread_mutex_init(&ctx.handles_lock, NULL);
+	bool ok = load_trace(&ctx);
+	replay_worker *workers = NULL;
+	pthread_t *threads = NULL;
+	if (ok) {
+		ctx.pattern = malloc(ctx.max_size + 1);
+		workers = calloc(opts.n_threads, sizeof(replay_worker));
+		threads = calloc(opts.n_threads, sizeof(pthread_t));
+		ok = (ctx.pattern != NULL) && (workers != NULL) && (threads != NULL);
+		for (unsigned int i = 0; ok && (i < opts.n_threads); i++) {
+			workers[i] = (replay_worker){ .ctx = &ctx, .index = i,
+			                              .buf = malloc(ctx.max_size + 1) };
+			ok = workers[i].buf != NULL;
+		}
+		if (!ok) perror("malloc");
+		if (ok) memset(ctx.pattern, 'a', ctx.max_size);
+	}
+
+	a1fs_opts fs_opts = { .img_path = opts.img_path };
+	bool mounted = false;
+	if (ok && (opts.mountpoint == NULL)) {
+		if (!(mounted = a1fs_mount(&ctx.fs, &fs_opts))) {
+			fprintf(stderr, "Failed to mount %s\n", opts.img_path);
+			ok = false;
+		}
+	}
+
+	if (ok) {
+		ctx.start_ns = stats_now();
+		unsigned int n_started = 0;
+		for (; n_started < opts.n_threads; n_started++) {
+			int ret = pthread_create(&threads[n_started], NULL, worker_run,
+			                         &workers[n_started]);
+			if (ret != 0) {
+				fprintf(stderr, "pthread_create: %s\n", strerror(ret));
+				ok = false;
+				break;
+			}
+		}
+		for (unsigned int i = 0; i < n_started; i++) pthread_join(threads[i], NULL);
+		uint64_t elapsed = stats_now() - ctx.start_ns;
+
+		// Files the trace left open
+		for (size_t i = 0; i < ctx.n_handles; i++) {
+			if (ctx.handles[i].fd >= 0) close(ctx.handles[i].fd);
+		}
+		if (ok) ok = report(&ctx, elapsed);
+	}
+	if (mounted) a1fs_unmount(&ctx.fs);
+
+	for (unsigned int i = 0; (workers != NULL) && (i < opts.n_threads); i++) {
+		free(workers[i].buf);
+	}
+	for (size_t i = 0; i < ctx.n_ops; i++) {
+		free(ctx.ops[i].path);
+		free(ctx.ops[i].name);
+	}
+	free(workers);
+	free(threads);
+	free(ctx.ops);
+	free(ctx.pattern);
+	free(ctx.handles);
+	return ok ? 0 : 1;
+}
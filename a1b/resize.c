@@ -0,0 +1,586 @@
+/*
+ * This code is provided solely for the personal and private use of students
+ * taking the CSC369H course at the University of Toronto. Copying for purposes
+ * other than this use is expressly prohibited. All forms of distribution of
+ * this code, including but not limited to public repositories on GitHub,
+ * GitLab, Bitbucket, or any other online platform, whether as given or with
+ * any changes, are expressly prohibited.
+ *
+ * Authors: Alexey Khrabrov, Karen Reid
+ *
+ * All of the files in this directory and all subdirectories are:
+ * Copyright (c) 2019 Karen Reid
+ */
+
+
+/**
+ * CSC369 Assignment 1 - a1fs resize tool.
+ *
+ * Changes the size of an a1fs image in place. Shrinking is done offline: the
+ * data blocks past the new end are moved to free space below it, the file
+ * system references to them are updated, and the image file is truncated.
+ * Growing extends the image and adds the new space as free data blocks, up to
+ * the limit that mkfs reserved the metadata for (mkfs -g). A mounted file
+ * system can only grow; it is grown through the A1FS_IOC_RESIZE ioctl when a
+ * directory of it is given instead of the image.
+ *
+ * The metadata regions keep their size on shrinking, so a shrunk file system
+ * can grow back to where it was.
+ */
+
+#include <errno.h>
+#include <fcntl.h>
+#include <stdbool.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/ioctl.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
+
+#include "a1fs.h"
+#include "dedup_index.h"
+#include "fs_ctx.h"
+#include "map.h"
+#include "util.h"
+
+
+/** Command line options. */
+typedef struct resize_opts {
+	/** File system image file path, or a directory of a mounted file system. */
+	const char *img_path;
+	/** New image size in bytes. */
+	uint64_t size;
+
+	/** Print help and exit. */
+	bool help;
+	/** Only report what would be moved; don't modify the image. */
+	bool dry_run;
+	/** Sync memory-mapped image file contents to disk. */
+	bool sync;
+	/** Verbose output. If false, the program must only print errors. */
+	bool verbose;
+
+} resize_opts;
+
+static const char *help_str = "\
+Usage: %s options image size\n\
+\n\
+Resize an a1fs image to size bytes (K, M, G and T suffixes are accepted).\n\
+An unmounted image can be shrunk or grown. If image is a directory of a\n\
+mounted a1fs, the file system is grown online.\n\
+\n\
+Options:\n\
+    -h      print help and exit\n\
+    -n      dry run - report what would be moved but don't modify the image\n\
+    -s      sync image file contents to disk\n\
+    -v      verbose output\n\
+";
+
+static void print_help(FILE *f, const char *progname)
+{
+	fprintf(f, help_str, progname);
+}
+
+static bool parse_args(int argc, char *argv[], resize_opts *opts)
+{
+	int o;
+	while ((o = getopt(argc, argv, "hnsv")) != -1) {
+		switch (o) {
+			case 'h': opts->help    = true; return true;// skip other arguments
+			case 'n': opts->dry_run = true; break;
+			case 's': opts->sync    = true; break;
+			case 'v': opts->verbose = true; break;
+
+			case '?': return false;
+			default : assert(false);
+		}
+	}
+
+	if (optind + 2 != argc) {
+		fprintf(stderr, "Missing image path or size\n");
+		return false;
+	}
+	opts->img_path = argv[optind];
+	opts->size = parse_size(argv[optind + 1]);
+	if ((opts->size == 0) || (opts->size % A1FS_BLOCK_SIZE != 0)) {
+		fprintf(stderr, "Size must be a non-zero multiple of %d bytes\n", A1FS_BLOCK_SIZE);
+		return false;
+	}
+	return true;
+}
+
+
+static a1fs_superblock *get_sb(fs_ctx *fs)
+{
+	return (a1fs_superblock*)fs->image;
+}
+
+static a1fs_inode *get_inode(fs_ctx *fs, a1fs_ino_t ino)
+{
+	return (a1fs_inode*)(fs->image + get_sb(fs)->inode_table * A1FS_BLOCK_SIZE)
+	       + ino;
+}
+
+static void *get_block(fs_ctx *fs, a1fs_blk_t blk)
+{
+	return fs->image + (size_t)(get_sb(fs)->data_table + blk) * A1FS_BLOCK_SIZE;
+}
+
+static a1fs_refcount_t *get_refcount(fs_ctx *fs, a1fs_blk_t blk)
+{
+	return (a1fs_refcount_t*)(fs->image + get_sb(fs)->refcount_table * A1FS_BLOCK_SIZE)
+	       + blk;
+}
+
+static bool bitmap_test(const uint8_t *bmp, uint32_t i)
+{
+	return (bmp[i / 8] >> (i % 8)) & 1;
+}
+
+static void bitmap_set(uint8_t *bmp, uint32_t i, bool value)
+{
+	if (value) {
+		bmp[i / 8] |= 1 << (i % 8);
+	} else {
+		bmp[i / 8] &= ~(1 << (i % 8));
+	}
+}
+
+
+/**
+ * Run of data blocks. References to the file system's blocks (extents,
+ * compressed clusters and xattr blocks) are collected as runs and merged into
+ * groups of overlapping runs; a group is moved as a whole, so that every run
+ * in it stays contiguous.
+ */
+typedef struct block_run {
+	a1fs_blk_t start;
+	a1fs_blk_t count;
+	/** Where the group starts after the move. */
+	a1fs_blk_t dest;
+
+} block_run;
+
+/** Growable array of block runs. */
+typedef struct run_list {
+	block_run *runs;
+	size_t n;
+	size_t capacity;
+
+} run_list;
+
+static bool run_list_add(run_list *l, a1fs_blk_t start, a1fs_blk_t count)
+{
+	if (l->n == l->capacity) {
+		size_t capacity = (l->capacity == 0) ? 64 : l->capacity * 2;
+		block_run *runs = realloc(l->runs, capacity * sizeof(block_run));
+		if (runs == NULL) return false;
+		l->runs = runs;
+		l->capacity = capacity;
+	}
+	l->runs[l->n++] = (block_run){ .start = start, .count = count };
+	return true;
+}
+
+static int run_cmp(const void *a, const void *b)
+{
+	a1fs_blk_t x = ((const block_run*)a)->start;
+	a1fs_blk_t y = ((const block_run*)b)->start;
+	return (x > y) - (x < y);
+}
+
+/** Collect the runs of blocks referenced by the used inodes of an inode table. */
+static bool collect_table_runs(fs_ctx *fs, const uint8_t *inode_bmp,
+                               const a1fs_inode *table, run_list *l)
+{
+	a1fs_superblock *sb = get_sb(fs);
+	for (a1fs_ino_t ino = 0; ino < sb->num_inodes; ino++) {
+		if (!bitmap_test(inode_bmp, ino)) continue;
+		const a1fs_inode *inode = &table[ino];
+
+		for (int i = 0; (i < A1FS_INODE_EXTENTS) && (inode->extent_array[i].count != 0); i++) {
+			const a1fs_extent *ext = &inode->extent_array[i];
+			if (!run_list_add(l, ext->start, ext->count)) return false;
+			if (!(inode->flags & A1FS_INODE_COMPRESSED)) continue;
+
+			// The extents of a compressed file map its cluster map
+			for (a1fs_blk_t b = 0; b < ext->count; b++) {
+				const a1fs_cluster *map = get_block(fs, ext->start + b);
+				for (size_t c = 0; c < A1FS_CLUSTERS_PER_BLOCK; c++) {
+					if (map[c].size == 0) continue;
+					a1fs_blk_t count = (map[c].size + A1FS_BLOCK_SIZE - 1) / A1FS_BLOCK_SIZE;
+					if (!run_list_add(l, map[c].start, count)) return false;
+				}
+			}
+		}
+		if ((inode->flags & A1FS_INODE_XATTR_BLOCK) &&
+		    !run_list_add(l, inode->xattr_block, 1))
+		{
+			return false;
+		}
+		if ((inode->flags & A1FS_INODE_TAIL) && !run_list_add(l, inode->tail.block, 1)) {
+			return false;
+		}
+	}
+	return true;
+}
+
+/** Get the copies of the inode bitmap and table in a snapshot. */
+static void get_snapshot_tables(fs_ctx *fs, const a1fs_snapshot *snap,
+                                const uint8_t **inode_bmp, a1fs_inode **table)
+{
+	a1fs_superblock *sb = get_sb(fs);
+	*inode_bmp = get_block(fs, snap->start);
+	*table = get_block(fs, snap->start + (sb->datablock_bmp - sb->inode_bmp));
+}
+
+/**
+ * Collect the runs of blocks referenced by the file system and its snapshots,
+ * including the blocks that hold the quota table and the snapshots.
+ */
+static bool collect_runs(fs_ctx *fs, run_list *l)
+{
+	a1fs_superblock *sb = get_sb(fs);
+	const uint8_t *inode_bmp = fs->image + sb->inode_bmp * A1FS_BLOCK_SIZE;
+	if (!collect_table_runs(fs, inode_bmp, get_inode(fs, 0), l)) return false;
+	if ((sb->num_quotas != 0) && !run_list_add(l, sb->quota_table, 1)) return false;
+	if (sb->num_snapshots == 0) return true;
+
+	if (!run_list_add(l, sb->snapshot_list, 1)) return false;
+	const a1fs_snapshot *list = get_block(fs, sb->snapshot_list);
+	for (unsigned int i = 0; i < sb->num_snapshots; i++) {
+		a1fs_inode *table;
+		get_snapshot_tables(fs, &list[i], &inode_bmp, &table);
+		if (!run_list_add(l, list[i].start, list[i].count) ||
+		    !collect_table_runs(fs, inode_bmp, table, l))
+		{
+			return false;
+		}
+	}
+	return true;
+}
+
+/**
+ * Merge sorted runs into groups of overlapping runs, keeping only the groups
+ * that reach past limit. Returns the number of such groups.
+ */
+static size_t merge_runs(run_list *l, a1fs_blk_t limit)
+{
+	qsort(l->runs, l->n, sizeof(block_run), run_cmp);
+	size_t n = 0;
+	for (size_t i = 0; i < l->n; ) {
+		uint64_t start = l->runs[i].start;
+		uint64_t end = start + l->runs[i].count;
+		for (i++; (i < l->n) && (l->runs[i].start < end); i++) {
+			uint64_t run_end = (uint64_t)l->runs[i].start + l->runs[i].count;
+			if (run_end > end) end = run_end;
+		}
+		if (end > limit) {
+			l->runs[n++] = (block_run){ .start = start, .count = end - start };
+		}
+	}
+	l->n = n;
+	return n;
+}
+
+/**
+ * Find a run of count free blocks below limit, starting the search at *cursor
+ * and wrapping around once. Marks the run used in bmp.
+ *
+ * @return  true if found; false otherwise.
+ */
+static bool find_free_run(uint8_t *bmp, a1fs_blk_t limit, a1fs_blk_t count,
+                          a1fs_blk_t *cursor, a1fs_blk_t *start)
+{
+	a1fs_blk_t run = 0;
+	for (uint64_t i = 0; i < (uint64_t)limit + count; i++) {
+		a1fs_blk_t blk = (*cursor + i) % limit;
+		// Runs can't wrap around the end
+		if (blk == 0) run = 0;
+		if (bitmap_test(bmp, blk)) {
+			run = 0;
+			continue;
+		}
+		if (++run == count) {
+			*start = blk - count + 1;
+			for (a1fs_blk_t b = *start; b <= blk; b++) bitmap_set(bmp, b, true);
+			*cursor = (blk + 1) % limit;
+			return true;
+		}
+	}
+	return false;
+}
+
+/** Translate a block number through the moved groups. */
+static a1fs_blk_t remap(const run_list *groups, a1fs_blk_t blk)
+{
+	size_t lo = 0, hi = groups->n;
+	while (lo < hi) {
+		size_t mid = (lo + hi) / 2;
+		const block_run *g = &groups->runs[mid];
+		if (blk < g->start) {
+			hi = mid;
+		} else if (blk >= g->start + g->count) {
+			lo = mid + 1;
+		} else {
+			return g->dest + (blk - g->start);
+		}
+	}
+	return blk;
+}
+
+/** Move a data block that is not referenced by anything but the groups. */
+static void move_block(fs_ctx *fs, a1fs_blk_t src, a1fs_blk_t dst)
+{
+	a1fs_superblock *sb = get_sb(fs);
+	uint8_t *bmp = fs->image + sb->datablock_bmp * A1FS_BLOCK_SIZE;
+	if (!bitmap_test(bmp, src)) return;
+
+	// The index must not point at the old location
+	bool indexed = dedup_index_enabled(fs) &&
+	               bitmap_test(fs->image + sb->dedup_bmp * A1FS_BLOCK_SIZE, src);
+	uint64_t hash = indexed ? dedup_hash(get_block(fs, src)) : 0;
+	if (indexed) dedup_index_forget(fs, src);
+
+	memcpy(get_block(fs, dst), get_block(fs, src), A1FS_BLOCK_SIZE);
+	*get_refcount(fs, dst) = *get_refcount(fs, src);
+	*get_refcount(fs, src) = 0;
+	bitmap_set(bmp, dst, true);
+	bitmap_set(bmp, src, false);
+	if (indexed) dedup_index_add(fs, dst, hash);
+}
+
+/** Update the block references of the used inodes of an inode table. */
+static void remap_table(fs_ctx *fs, const run_list *groups,
+                        const uint8_t *inode_bmp, a1fs_inode *table)
+{
+	a1fs_superblock *sb = get_sb(fs);
+	for (a1fs_ino_t ino = 0; ino < sb->num_inodes; ino++) {
+		if (!bitmap_test(inode_bmp, ino)) continue;
+		a1fs_inode *inode = &table[ino];
+
+		for (int i = 0; (i < A1FS_INODE_EXTENTS) && (inode->extent_array[i].count != 0); i++) {
+			a1fs_extent *ext = &inode->extent_array[i];
+			ext->start = remap(groups, ext->start);
+			if (!(inode->flags & A1FS_INODE_COMPRESSED)) continue;
+
+			// The cluster map itself has moved already
+			for (a1fs_blk_t b = 0; b < ext->count; b++) {
+				a1fs_cluster *map = get_block(fs, ext->start + b);
+				for (size_t c = 0; c < A1FS_CLUSTERS_PER_BLOCK; c++) {
+					if (map[c].size != 0) map[c].start = remap(groups, map[c].start);
+				}
+			}
+		}
+		if (inode->flags & A1FS_INODE_XATTR_BLOCK) {
+			inode->xattr_block = remap(groups, inode->xattr_block);
+		}
+		if (inode->flags & A1FS_INODE_TAIL) inode->tail.block = remap(groups, inode->tail.block);
+	}
+}
+
+/**
+ * Update the block references of the file system and its snapshots after the
+ * groups moved.
+ */
+static void remap_inodes(fs_ctx *fs, const run_list *groups)
+{
+	a1fs_superblock *sb = get_sb(fs);
+	const uint8_t *inode_bmp = fs->image + sb->inode_bmp * A1FS_BLOCK_SIZE;
+	remap_table(fs, groups, inode_bmp, get_inode(fs, 0));
+	if (sb->num_quotas != 0) sb->quota_table = remap(groups, sb->quota_table);
+	if (sb->num_snapshots == 0) return;
+
+	// The snapshots themselves have moved already
+	sb->snapshot_list = remap(groups, sb->snapshot_list);
+	a1fs_snapshot *list = get_block(fs, sb->snapshot_list);
+	for (unsigned int i = 0; i < sb->num_snapshots; i++) {
+		list[i].start = remap(groups, list[i].start);
+		a1fs_inode *table;
+		get_snapshot_tables(fs, &list[i], &inode_bmp, &table);
+		remap_table(fs, groups, inode_bmp, table);
+	}
+}
+
+/**
+ * Shrink the file system so that it fits into an image of given size.
+ *
+ * @return  true on success; false on failure (the image is not modified).
+ */
+static bool shrink(fs_ctx *fs, const resize_opts *opts)
+{
+	a1fs_superblock *sb = get_sb(fs);
+	uint64_t image_blocks = opts->size / A1FS_BLOCK_SIZE;
+	if (image_blocks < (uint64_t)sb->data_table + 2) {
+		fprintf(stderr, "Size is too small for the file system metadata\n");
+		return false;
+	}
+	a1fs_blk_t limit = image_blocks - sb->data_table;
+	if (sb->num_blocks - sb->num_unused_blocks > limit) {
+		fprintf(stderr, "Not enough free space to shrink to %lu bytes\n", opts->size);
+		return false;
+	}
+
+	run_list groups = {0};
+	size_t bmp_size = (sb->num_blocks + 7) / 8;
+	uint8_t *plan = malloc(bmp_size);
+	if ((plan == NULL) || !collect_runs(fs, &groups)) {
+		perror("malloc");
+		free(plan);
+		free(groups.runs);
+		return false;
+	}
+	merge_runs(&groups, limit);
+
+	// Plan the moves on a copy of the bitmap, so that nothing changes unless
+	// all the groups fit. The blocks being moved stay used in the plan, so
+	// destinations never overlap sources.
+	bool ok = true;
+	uint64_t moved = 0;
+	memcpy(plan, fs->image + sb->datablock_bmp * A1FS_BLOCK_SIZE, bmp_size);
+	a1fs_blk_t cursor = 0;
+	for (size_t i = 0; i < groups.n; i++) {
+		block_run *g = &groups.runs[i];
+		if (!find_free_run(plan, limit, g->count, &cursor, &g->dest)) {
+			fprintf(stderr, "Free space below %lu bytes is too fragmented to move "
+			        "%u contiguous blocks\n", opts->size, g->count);
+			ok = false;
+			break;
+		}
+		moved += g->count;
+	}
+
+	// Anything still in use past the limit is not referenced by any inode
+	uint8_t *bmp = fs->image + sb->datablock_bmp * A1FS_BLOCK_SIZE;
+	size_t next = 0;
+	for (a1fs_blk_t blk = limit; ok && (blk < sb->num_blocks); blk++) {
+		while ((next < groups.n) && (groups.runs[next].start + groups.runs[next].count <= blk)) {
+			next++;
+		}
+		bool in_group = (next < groups.n) && (groups.runs[next].start <= blk);
+		if (bitmap_test(bmp, blk) && !in_group) {
+			fprintf(stderr, "Block %u is allocated but not used by any file; "
+			        "run fsck.a1fs\n", blk);
+			ok = false;
+		}
+	}
+
+	if (ok && (opts->verbose || opts->dry_run)) {
+		printf("%lu blocks in %zu groups %s\n", moved, groups.n,
+		       opts->dry_run ? "would be moved" : "moved");
+	}
+	if (ok && !opts->dry_run) {
+		for (size_t i = 0; i < groups.n; i++) {
+			const block_run *g = &groups.runs[i];
+			for (a1fs_blk_t b = 0; b < g->count; b++) {
+				move_block(fs, g->start + b, g->dest + b);
+			}
+		}
+		remap_inodes(fs, &groups);
+		// The xattr block index still has the old block numbers
+		fs->checkpoint = false;
+
+		// The blocks past the limit are all free now
+		a1fs_superblock new_sb = *sb;
+		new_sb.size = opts->size;
+		new_sb.num_unused_blocks -= sb->num_blocks - limit;
+		new_sb.num_blocks = limit;
+		memcpy(sb, &new_sb, sizeof(new_sb));
+	}
+
+	free(plan);
+	free(groups.runs);
+	return ok;
+}
+
+
+/** Grow a mounted file system through a directory of it. */
+static bool grow_online(const resize_opts *opts)
+{
+	int fd = open(opts->img_path, O_RDONLY | O_DIRECTORY);
+	if (fd < 0) {
+		perror(opts->img_path);
+		return false;
+	}
+	uint64_t size = opts->size;
+	bool ok = ioctl(fd, A1FS_IOC_RESIZE, &size) == 0;
+	if (!ok) perror("A1FS_IOC_RESIZE");
+	close(fd);
+	return ok;
+}
+
+
+int main(int argc, char *argv[])
+{
+	resize_opts opts = {0};// defaults are all 0
+	if (!parse_args(argc, argv, &opts)) {
+		// Invalid arguments, print help to stderr
+		print_help(stderr, argv[0]);
+		return 1;
+	}
+	if (opts.help) {
+		// Help requested, print it to stdout
+		print_help(stdout, argv[0]);
+		return 0;
+	}
+
+	struct stat st;
+	if (stat(opts.img_path, &st) < 0) {
+		perror(opts.img_path);
+		return 1;
+	}
+	if (S_ISDIR(st.st_mode)) {
+		if (opts.dry_run) return 0;
+		return grow_online(&opts) ? 0 : 1;
+	}
+
+	// Map image file into memory
+	size_t size;
+	void *image = map_file(opts.img_path, A1FS_BLOCK_SIZE, &size);
+	if (image == NULL) return 1;
+
+	int ret = 1;
+	a1fs_opts fs_opts = { .img_path = opts.img_path };
+	fs_ctx fs = { .image = image, .size = size };
+	if (((a1fs_superblock*)image)->magic != A1FS_MAGIC) {
+		fprintf(stderr, "Image does not contain a1fs\n");
+		goto end;
+	}
+	if (!fs_ctx_init(&fs, image, size, &fs_opts)) {
+		fprintf(stderr, "Failed to initialize file system context\n");
+		goto end;
+	}
+
+	bool ok = true;
+	if (opts.size < size) {
+		ok = shrink(&fs, &opts);
+	} else if ((opts.size > size) && !opts.dry_run) {
+		int err = fs_ctx_grow(&fs, opts.size);
+		if (err != 0) {
+			fprintf(stderr, "Failed to grow the image: %s\n", strerror(-err));
+			ok = false;
+		}
+	}
+	fs_ctx_destroy(&fs);
+	if (!ok) goto end;
+
+	// Sync to disk if requested
+	if (opts.sync && (msync(fs.image, fs.size, MS_SYNC) < 0)) {
+		perror("msync");
+		goto end;
+	}
+
+	ret = 0;
+end:
+	munmap(fs.image, fs.size);
+	// The blocks past the new end are free, so the file can be cut off
+	if ((ret == 0) && (opts.size < size) && !opts.dry_run &&
+	    (truncate(opts.img_path, opts.size) < 0))
+	{
+		perror("truncate");
+		ret = 1;
+	}
+	return ret;
+}
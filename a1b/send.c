@@ -0,0 +1,432 @@
+/*
+ * This code is provided solely for the personal and private use of students
+ * taking the CSC369H course at the University of Toronto. Copying for purposes
+ * other than this use is expressly prohibited. All forms of distribution of
+ * this code, including but not limited to public repositories on GitHub,
+ * GitLab, Bitbucket, or any other online platform, whether as given or with
+ * any changes, are expressly prohibited.
+ *
+ * Authors: Alexey Khrabrov, Karen Reid
+ *
+ * All of the files in this directory and all subdirectories are:
+ * Copyright (c) 2019 Karen Reid
+ */
+
+
+/**
+ * CSC369 Assignment 1 - a1fs send tool.
+ *
+ * Writes a send stream (see stream.h) with the changes between two snapshots
+ * of an a1fs image to the standard output; receive.a1fs applies it to another
+ * image. Without a base snapshot, the whole target snapshot is sent.
+ *
+ * Finding the changes doesn't require reading unchanged data. The inodes
+ * modified after the base snapshot was taken have a later generation than the
+ * snapshot. Within a modified file, a block (or a cluster of a compressed
+ * file) has changed if and only if it maps to a different data block than in
+ * the base: blocks shared with a snapshot are copied before they are modified,
+ * and are not freed while the snapshot holds them.
+ *
+ * Snapshots never change, so the file system may stay mounted while sending,
+ * as long as the two snapshots are not deleted.
+ *
+ * The extent and cluster map code of fs_ops.c is used to read the snapshots.
+ */
+
+#include <errno.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/mman.h>
+#include <unistd.h>
+
+#include "fs_ops.h"
+#include "map.h"
+#include "stream.h"
+
+
+/** Command line options. */
+typedef struct send_opts {
+	/** File system image file path. */
+	const char *img_path;
+	/** Name of the base snapshot; NULL to send the whole target. */
+	const char *base;
+	/** Name of the target snapshot. */
+	const char *target;
+
+	/** Print help and exit. */
+	bool help;
+	/** Print a summary to stderr. */
+	bool verbose;
+
+} send_opts;
+
+static const char *help_str = "\
+Usage: %s options image target\n\
+\n\
+Write the changes from snapshot base to snapshot target of an a1fs image to\n\
+the standard output, to be applied to another image with receive.a1fs.\n\
+Without a base, the whole target snapshot is sent.\n\
+\n\
+Options:\n\
+    -h       print help and exit\n\
+    -p base  send the changes since snapshot base\n\
+    -v       verbose output (to stderr)\n\
+";
+
+static void print_help(FILE *f, const char *progname)
+{
+	fprintf(f, help_str, progname);
+}
+
+static bool parse_args(int argc, char *argv[], send_opts *opts)
+{
+	int o;
+	while ((o = getopt(argc, argv, "hp:v")) != -1) {
+		switch (o) {
+			case 'h': opts->help    = true; return true;// skip other arguments
+			case 'p': opts->base    = optarg; break;
+			case 'v': opts->verbose = true; break;
+
+			case '?': return false;
+			default : assert(false);
+		}
+	}
+
+	if (optind + 2 != argc) {
+		fprintf(stderr, "Missing image path or target snapshot\n");
+		return false;
+	}
+	opts->img_path = argv[optind];
+	opts->target = argv[optind + 1];
+	return true;
+}
+
+
+/** Send stream writer state. */
+typedef struct send_ctx {
+	fs_ctx *fs;
+	/** Number of inodes sent. */
+	uint64_t inodes;
+	/** Number of inodes deleted. */
+	uint64_t deleted;
+	/** Number of bytes of file data sent. */
+	uint64_t bytes;
+
+} send_ctx;
+
+/** Write a record to the stream. */
+static bool emit(uint32_t type, a1fs_ino_t ino, uint64_t index, uint32_t count,
+                 const void *payload, uint32_t size)
+{
+	a1fs_stream_record rec = {
+		.type = type, .ino = ino, .index = index, .count = count, .size = size
+	};
+	if ((fwrite(&rec, sizeof(rec), 1, stdout) != 1) ||
+	    ((size > 0) && (fwrite(payload, size, 1, stdout) != 1)))
+	{
+		perror("write");
+		return false;
+	}
+	return true;
+}
+
+/** Logical block of the tail of a file (see tail_pack()); UINT64_MAX if none. */
+static uint64_t tail_lblk(const a1fs_inode *inode)
+{
+	return inode_has_tail(inode) ? inode->size / A1FS_BLOCK_SIZE : UINT64_MAX;
+}
+
+/**
+ * Send the blocks of a file that differ from its base version.
+ *
+ * @param ctx   send context.
+ * @param ino   inode number.
+ * @param file  the inode in the target snapshot.
+ * @param base  the inode in the base snapshot; NULL if there is none.
+ * @return      true on success; false on error.
+ */
+static bool send_blocks(send_ctx *ctx, a1fs_ino_t ino, const a1fs_inode *file,
+                        const a1fs_inode *base)
+{
+	uint64_t end = size_to_blocks(file->size);
+	uint64_t file_tail = tail_lblk(file);
+	uint64_t base_tail = (base != NULL) ? tail_lblk(base) : UINT64_MAX;
+	uint64_t lblk = 0;
+	while (lblk < end) {
+		if (lblk == file_tail) {
+			// Tails are never modified in place, so the same tail has the same data
+			if ((base_tail != lblk) ||
+			    (memcmp(&file->tail, &base->tail, sizeof(file->tail)) != 0))
+			{
+				static unsigned char block[A1FS_BLOCK_SIZE];
+				memcpy(block, tail_data(ctx->fs, &file->tail), file->tail.len);
+				memset(block + file->tail.len, 0, A1FS_BLOCK_SIZE - file->tail.len);
+				if (!emit(A1FS_STREAM_DATA, ino, lblk, 1, block, A1FS_BLOCK_SIZE)) return false;
+				ctx->bytes += A1FS_BLOCK_SIZE;
+			}
+			lblk++;
+			continue;
+		}
+
+		// Both versions are the same over the shorter of the two runs; a run
+		// of length 0 is the hole past the last extent. The tail of the base
+		// version is a run of its own.
+		a1fs_blk_t pblk, len, base_pblk = 0, base_len = 0;
+		bool mapped = extent_map(file, lblk, &pblk, &len);
+		bool base_mapped = (base != NULL) &&
+		                   (extent_map(base, lblk, &base_pblk, &base_len) || (lblk == base_tail));
+		uint64_t n = end - lblk;
+		if ((len != 0) && (len < n)) n = len;
+		if ((base_len != 0) && (base_len < n)) n = base_len;
+		if ((file_tail > lblk) && (file_tail - lblk < n)) n = file_tail - lblk;
+		if (base_tail == lblk) {
+			n = 1;
+		} else if ((base_tail > lblk) && (base_tail - lblk < n)) {
+			n = base_tail - lblk;
+		}
+
+		if (mapped && (!base_mapped || (pblk != base_pblk))) {
+			for (uint64_t i = 0; i < n; i += A1FS_STREAM_DATA_BLOCKS) {
+				uint32_t count = (n - i < A1FS_STREAM_DATA_BLOCKS) ? n - i
+				                                                   : A1FS_STREAM_DATA_BLOCKS;
+				if (!emit(A1FS_STREAM_DATA, ino, lblk + i, count, get_block(ctx->fs, pblk + i),
+				          count * A1FS_BLOCK_SIZE))
+				{
+					return false;
+				}
+			}
+			ctx->bytes += n * A1FS_BLOCK_SIZE;
+		} else if (!mapped && base_mapped) {
+			if (!emit(A1FS_STREAM_HOLE, ino, lblk, n, NULL, 0)) return false;
+		}
+		lblk += n;
+	}
+	return true;
+}
+
+/**
+ * Send the clusters of a compressed file that differ from its base version.
+ * Clusters are sent decompressed.
+ *
+ * @param ctx   send context.
+ * @param ino   inode number.
+ * @param file  the inode in the target snapshot.
+ * @param base  the inode in the base snapshot; NULL if there is none.
+ * @return      true on success; false on error.
+ */
+static bool send_clusters(send_ctx *ctx, a1fs_ino_t ino, const a1fs_inode *file,
+                          const a1fs_inode *base)
+{
+	fs_ctx *fs = ctx->fs;
+	uint64_t n = (file->size + A1FS_CLUSTER_SIZE - 1) / A1FS_CLUSTER_SIZE;
+	for (uint64_t index = 0; index < n; index++) {
+		// A cluster map block shared by both versions has no changed entries
+		a1fs_blk_t pblk, base_pblk, len;
+		if ((base != NULL) && (index % A1FS_CLUSTERS_PER_BLOCK == 0) &&
+		    extent_map(file, index / A1FS_CLUSTERS_PER_BLOCK, &pblk, &len) &&
+		    extent_map(base, index / A1FS_CLUSTERS_PER_BLOCK, &base_pblk, &len) &&
+		    (pblk == base_pblk))
+		{
+			index += A1FS_CLUSTERS_PER_BLOCK - 1;
+			continue;
+		}
+
+		const a1fs_cluster *c = cluster_entry(fs, file, index);
+		const a1fs_cluster *base_c = (base != NULL) ? cluster_entry(fs, base, index) : NULL;
+		bool data = (c != NULL) && (c->size != 0);
+		bool base_data = (base_c != NULL) && (base_c->size != 0);
+		if (data && (!base_data || (c->start != base_c->start) || (c->size != base_c->size))) {
+			const unsigned char *buf;
+			int ret = cluster_load(fs, SNAPSHOT_INO, file, index, &buf);
+			if (ret != 0) {
+				fprintf(stderr, "inode %u: failed to read cluster %lu: %s\n", ino, index,
+				        strerror(-ret));
+				return false;
+			}
+			if (!emit(A1FS_STREAM_DATA, ino, index, 1, buf, A1FS_CLUSTER_SIZE)) return false;
+			ctx->bytes += A1FS_CLUSTER_SIZE;
+		} else if (!data && base_data) {
+			if (!emit(A1FS_STREAM_HOLE, ino, index, 1, NULL, 0)) return false;
+		}
+	}
+	return true;
+}
+
+/**
+ * Send an inode that was created or modified since the base snapshot.
+ *
+ * @param ctx   send context.
+ * @param ino   inode number.
+ * @param file  the inode in the target snapshot.
+ * @param base  the inode in the base snapshot; NULL if there is none.
+ * @return      true on success; false on error.
+ */
+static bool send_inode(send_ctx *ctx, a1fs_ino_t ino, const a1fs_inode *file,
+                       const a1fs_inode *base)
+{
+	// The data of a different kind of file can't be compared with
+	bool reset = (base == NULL) || (((file->mode ^ base->mode) & S_IFMT) != 0) ||
+	             (((file->flags ^ base->flags) & A1FS_INODE_COMPRESSED) != 0);
+	if (reset) base = NULL;
+
+	a1fs_stream_inode si;
+	memset(&si, 0, sizeof(si));
+	si.mode = file->mode;
+	si.links = file->links;
+	si.size = file->size;
+	si.mtime = file->mtime;
+	si.flags = file->flags & A1FS_INODE_COMPRESSED;
+	si.reset = reset;
+	if (!emit(A1FS_STREAM_INODE, ino, 0, 0, &si, sizeof(si))) return false;
+
+	bool ok = inode_compressed(file) ? send_clusters(ctx, ino, file, base)
+	                                 : send_blocks(ctx, ino, file, base);
+	if (!ok) return false;
+
+	// The stream always has the full size of the area, for any receiver
+	size_t area = inode_xattr_size(ctx->fs);
+	bool has_block = (file->flags & A1FS_INODE_XATTR_BLOCK) != 0;
+	if ((base != NULL) && (memcmp(file->xattr, base->xattr, area) == 0) &&
+	    (has_block == ((base->flags & A1FS_INODE_XATTR_BLOCK) != 0)) &&
+	    (!has_block || (file->xattr_block == base->xattr_block)))
+	{
+		ctx->inodes++;
+		return true;
+	}
+	static unsigned char xattrs[A1FS_INODE_XATTR_SIZE + A1FS_BLOCK_SIZE];
+	memcpy(xattrs, file->xattr, area);
+	memset(xattrs + area, 0, A1FS_INODE_XATTR_SIZE - area);
+	uint32_t size = A1FS_INODE_XATTR_SIZE;
+	if (has_block) {
+		memcpy(xattrs + size, get_block(ctx->fs, file->xattr_block), A1FS_BLOCK_SIZE);
+		size += A1FS_BLOCK_SIZE;
+	}
+	ctx->inodes++;
+	return emit(A1FS_STREAM_XATTR, ino, 0, 0, xattrs, size);
+}
+
+/**
+ * Write the send stream.
+ *
+ * @param fs      file system context.
+ * @param opts    command line options.
+ * @param base    the base snapshot; NULL to send the whole target.
+ * @param target  the target snapshot.
+ * @return        true on success; false on error.
+ */
+static bool send_stream(fs_ctx *fs, send_opts *opts, const a1fs_snapshot *base,
+                 const a1fs_snapshot *target)
+{
+	const a1fs_superblock *sb = get_sb(fs);
+	a1fs_stream_header header;
+	memset(&header, 0, sizeof(header));
+	header.magic = A1FS_STREAM_MAGIC;
+	header.num_inodes = sb->num_inodes;
+	if (base != NULL) strncpy(header.base, base->name, A1FS_NAME_MAX - 1);
+	strncpy(header.target, target->name, A1FS_NAME_MAX - 1);
+	if (fwrite(&header, sizeof(header), 1, stdout) != 1) {
+		perror("write");
+		return false;
+	}
+
+	send_ctx ctx = { .fs = fs };
+	const uint8_t *bmp = snapshot_inode_bmp(fs, target);
+	const a1fs_inode *table = snapshot_inode_table(fs, target);
+	const uint8_t *base_bmp = (base != NULL) ? snapshot_inode_bmp(fs, base) : NULL;
+	const a1fs_inode *base_table = (base != NULL) ? snapshot_inode_table(fs, base) : NULL;
+
+	// Deleted inodes first, so that the receiver has their space for the rest
+	for (a1fs_ino_t ino = 0; (base != NULL) && (ino < sb->num_inodes); ino++) {
+		if (bitmap_test(base_bmp, ino) && !bitmap_test(bmp, ino)) {
+			if (!emit(A1FS_STREAM_DELETE, ino, 0, 0, NULL, 0)) return false;
+			ctx.deleted++;
+		}
+	}
+	for (a1fs_ino_t ino = 0; ino < sb->num_inodes; ino++) {
+		if (!bitmap_test(bmp, ino)) continue;
+		const a1fs_inode *base_inode = NULL;
+		if ((base != NULL) && bitmap_test(base_bmp, ino)) {
+			if (table[ino].generation <= base->generation) continue;
+			base_inode = &base_table[ino];
+		}
+		if (!send_inode(&ctx, ino, &table[ino], base_inode)) return false;
+	}
+	if (!emit(A1FS_STREAM_END, 0, 0, 0, NULL, 0)) return false;
+	if (fflush(stdout) != 0) {
+		perror("write");
+		return false;
+	}
+
+	if (opts->verbose) {
+		fprintf(stderr, "Sent %lu inodes and %lu bytes of data, deleted %lu inodes\n",
+		        ctx.inodes, ctx.bytes, ctx.deleted);
+	}
+	return true;
+}
+
+
+int main(int argc, char *argv[])
+{
+	send_opts opts = {0};// defaults are all 0
+	if (!parse_args(argc, argv, &opts)) {
+		// Invalid arguments, print help to stderr
+		print_help(stderr, argv[0]);
+		return 1;
+	}
+	if (opts.help) {
+		// Help requested, print it to stdout
+		print_help(stdout, argv[0]);
+		return 0;
+	}
+	if (isatty(STDOUT_FILENO)) {
+		fprintf(stderr, "Not writing a send stream to a terminal\n");
+		return 1;
+	}
+
+	// Map image file into memory
+	size_t size;
+	void *image = map_file(opts.img_path, A1FS_BLOCK_SIZE, &size);
+	if (image == NULL) return 1;
+
+	int ret = 1;
+	a1fs_opts fs_opts = { .img_path = opts.img_path };
+	fs_ctx fs = { .image = image, .size = size };
+	if (((a1fs_superblock*)image)->magic != A1FS_MAGIC) {
+		fprintf(stderr, "Image does not contain a1fs\n");
+		goto end;
+	}
+	if (!fs_ctx_init(&fs, image, size, &fs_opts)) {
+		fprintf(stderr, "Failed to initialize file system context\n");
+		goto end;
+	}
+
+	// Copied, since the list may change if the file system is mounted
+	a1fs_snapshot base_snap, target_snap;
+	const a1fs_snapshot *base = NULL;
+	int i = snapshot_find(&fs, opts.target);
+	if (i < 0) {
+		fprintf(stderr, "No snapshot named %s\n", opts.target);
+		goto destroy;
+	}
+	target_snap = snapshot_list(&fs)[i];
+	if (opts.base != NULL) {
+		if ((i = snapshot_find(&fs, opts.base)) < 0) {
+			fprintf(stderr, "No snapshot named %s\n", opts.base);
+			goto destroy;
+		}
+		base_snap = snapshot_list(&fs)[i];
+		base = &base_snap;
+		if (base->generation >= target_snap.generation) {
+			fprintf(stderr, "Snapshot %s is not older than %s\n", opts.base, opts.target);
+			goto destroy;
+		}
+	}
+	if (send_stream(&fs, &opts, base, &target_snap)) ret = 0;
+
+destroy:
+	fs_ctx_destroy(&fs);
+end:
+	munmap(image, size);
+	return ret;
+}
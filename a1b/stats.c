@@ -0,0 +1,254 @@
+/*
+ * This code is provided solely for the personal and private use of students
+ * taking the CSC369H course at the University of Toronto. Copying for purposes
+ * other than this use is expressly prohibited. All forms of distribution of
+ * this code, including but not limited to public repositories on GitHub,
+ * GitLab, Bitbucket, or any other online platform, whether as given or with
+ * any changes, are expressly prohibited.
+ *
+ * Authors: Alexey Khrabrov, Karen Reid
+ *
+ * All of the files in this directory and all subdirectories are:
+ * Copyright (c) 2019 Karen Reid
+ */
+
+/**
+ * CSC369 Assignment 1 - Runtime statistics implementation.
+ */
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+
+#include "stats.h"
+
+
+static const char *op_names[A1FS_OP_COUNT] = {
+	[A1FS_OP_STATFS]      = "statfs",
+	[A1FS_OP_GETATTR]     = "getattr",
+	[A1FS_OP_READDIR]     = "readdir",
+	[A1FS_OP_MKDIR]       = "mkdir",
+	[A1FS_OP_RMDIR]       = "rmdir",
+	[A1FS_OP_CREATE]      = "create",
+	[A1FS_OP_UNLINK]      = "unlink",
+	[A1FS_OP_RENAME]      = "rename",
+	[A1FS_OP_UTIMENS]     = "utimens",
+	[A1FS_OP_TRUNCATE]    = "truncate",
+	[A1FS_OP_OPEN]        = "open",
+	[A1FS_OP_READ]        = "read",
+	[A1FS_OP_WRITE]       = "write",
+	[A1FS_OP_RELEASE]     = "release",
+	[A1FS_OP_FLUSH]       = "flush",
+	[A1FS_OP_FSYNC]       = "fsync",
+	[A1FS_OP_SETXATTR]    = "setxattr",
+	[A1FS_OP_GETXATTR]    = "getxattr",
+	[A1FS_OP_LISTXATTR]   = "listxattr",
+	[A1FS_OP_REMOVEXATTR] = "removexattr",
+	[A1FS_OP_IOCTL]       = "ioctl",
+	[A1FS_OP_LOOKUP]      = "lookup",
+	[A1FS_OP_FORGET]      = "forget",
+	[A1FS_OP_SETATTR]     = "setattr",
+};
+
+static const char *counter_names[A1FS_STAT_COUNT] = {
+	[A1FS_STAT_BLOCKS_READ]      = "blocks_read",
+	[A1FS_STAT_BLOCKS_WRITTEN]   = "blocks_written",
+	[A1FS_STAT_BLOCKS_ALLOCATED] = "blocks_allocated",
+	[A1FS_STAT_BLOCKS_FREED]     = "blocks_freed",
+	[A1FS_STAT_MTIME_DEFERRED]   = "mtime_deferred",
+	[A1FS_STAT_MTIME_WRITTEN]    = "mtime_written",
+	[A1FS_STAT_CHECKSUM_ERRORS]  = "checksum_errors",
+};
+
+#define SUB_COUNT (1u << A1FS_STATS_SUB_BITS)
+
+
+/** Histogram bucket of a value: exact below SUB_COUNT, log-linear above. */
+static unsigned int bucket_of(uint64_t v)
+{
+	if (v < SUB_COUNT) return v;
+	unsigned int msb = 63 - __builtin_clzll(v);
+	unsigned int shift = msb - A1FS_STATS_SUB_BITS;
+	return ((shift + 1) << A1FS_STATS_SUB_BITS) + ((v >> shift) & (SUB_COUNT - 1));
+}
+
+/** Largest value that falls into a bucket. */
+static uint64_t bucket_max(unsigned int b)
+{
+	if (b < SUB_COUNT) return b;
+	unsigned int shift = (b >> A1FS_STATS_SUB_BITS) - 1;
+	uint64_t min = (uint64_t)(SUB_COUNT + (b & (SUB_COUNT - 1))) << shift;
+	return min + ((uint64_t)1 << shift) - 1;
+}
+
+/** Release the statistics of an exiting thread for reuse. */
+static void thread_exit(void *arg)
+{
+	a1fs_thread_stats *ts = (a1fs_thread_stats*)arg;
+	// The lock is taken by whoever reuses the set; in_use is only read
+	// under it
+	__atomic_store_n(&ts->in_use, false, __ATOMIC_RELEASE);
+}
+
+bool stats_init(a1fs_stats *stats)
+{
+	stats->threads = NULL;
+	if (pthread_mutex_init(&stats->lock, NULL) != 0) return false;
+	if (pthread_key_create(&stats->key, thread_exit) != 0) {
+		pthread_mutex_destroy(&stats->lock);
+		return false;
+	}
+	return true;
+}
+
+void stats_destroy(a1fs_stats *stats)
+{
+	pthread_key_delete(stats->key);
+	pthread_mutex_destroy(&stats->lock);
+	while (stats->threads != NULL) {
+		a1fs_thread_stats *next = stats->threads->next;
+		free(stats->threads);
+		stats->threads = next;
+	}
+}
+
+/** Get the statistics of the calling thread; NULL if out of memory. */
+static a1fs_thread_stats *thread_stats(a1fs_stats *stats)
+{
+	a1fs_thread_stats *ts = pthread_getspecific(stats->key);
+	if (ts != NULL) return ts;
+
+	pthread_mutex_lock(&stats->lock);
+	for (ts = stats->threads; ts != NULL; ts = ts->next) {
+		if (!__atomic_load_n(&ts->in_use, __ATOMIC_ACQUIRE)) break;
+	}
+	if (ts == NULL) {
+		ts = calloc(1, sizeof(*ts));
+		if (ts != NULL) {
+			ts->next = stats->threads;
+			stats->threads = ts;
+		}
+	}
+	if (ts != NULL) {
+		ts->in_use = true;
+		pthread_setspecific(stats->key, ts);
+	}
+	pthread_mutex_unlock(&stats->lock);
+	return ts;
+}
+
+// Only the owner thread writes a value, so a plain load and an atomic store
+// are enough to let reports read it concurrently
+static void add(uint64_t *p, uint64_t n)
+{
+	__atomic_store_n(p, *p + n, __ATOMIC_RELAXED);
+}
+
+static uint64_t load(const uint64_t *p)
+{
+	return __atomic_load_n(p, __ATOMIC_RELAXED);
+}
+
+uint64_t stats_now(void)
+{
+	struct timespec ts;
+	clock_gettime(CLOCK_MONOTONIC, &ts);
+	return ts.tv_sec * 1000000000ul + ts.tv_nsec;
+}
+
+void stats_record_op(a1fs_stats *stats, a1fs_stats_op op, uint64_t start_ns)
+{
+	uint64_t ns = stats_now() - start_ns;
+	a1fs_thread_stats *ts = thread_stats(stats);
+	if (ts == NULL) return;
+
+	add(&ts->hist[op][bucket_of(ns)], 1);
+	add(&ts->total_ns[op], ns);
+	if (ns > ts->max_ns[op]) __atomic_store_n(&ts->max_ns[op], ns, __ATOMIC_RELAXED);
+}
+
+const char *stats_op_name(a1fs_stats_op op)
+{
+	return op_names[op];
+}
+
+void stats_count(a1fs_stats *stats, a1fs_stats_counter counter, uint64_t n)
+{
+	a1fs_thread_stats *ts = thread_stats(stats);
+	if (ts != NULL) add(&ts->counters[counter], n);
+}
+
+/**
+ * Latency in us at a percentile of a histogram with count values. Bucket upper
+ * bounds are clamped to the largest value recorded.
+ */
+static double percentile(const uint64_t *hist, uint64_t count, uint64_t max,
+                         double p)
+{
+	uint64_t rank = (uint64_t)(count * p / 100.0);
+	if (rank >= count) rank = count - 1;
+	uint64_t seen = 0;
+	for (unsigned int b = 0; b < A1FS_STATS_BUCKETS; b++) {
+		seen += hist[b];
+		if (seen > rank) return ((bucket_max(b) < max) ? bucket_max(b) : max) / 1e3;
+	}
+	return 0.0;
+}
+
+char *stats_report(a1fs_stats *stats)
+{
+	uint64_t (*hist)[A1FS_STATS_BUCKETS] = calloc(A1FS_OP_COUNT, sizeof(*hist));
+	if (hist == NULL) return NULL;
+	uint64_t total_ns[A1FS_OP_COUNT] = {0};
+	uint64_t max_ns[A1FS_OP_COUNT] = {0};
+	uint64_t counters[A1FS_STAT_COUNT] = {0};
+
+	// Threads may record while the sets are summed up; the report is not an
+	// atomic snapshot, but every value in it is one that was recorded
+	pthread_mutex_lock(&stats->lock);
+	for (const a1fs_thread_stats *ts = stats->threads; ts != NULL; ts = ts->next) {
+		for (int op = 0; op < A1FS_OP_COUNT; op++) {
+			for (unsigned int b = 0; b < A1FS_STATS_BUCKETS; b++) {
+				hist[op][b] += load(&ts->hist[op][b]);
+			}
+			total_ns[op] += load(&ts->total_ns[op]);
+			uint64_t max = load(&ts->max_ns[op]);
+			if (max > max_ns[op]) max_ns[op] = max;
+		}
+		for (int c = 0; c < A1FS_STAT_COUNT; c++) counters[c] += load(&ts->counters[c]);
+	}
+	pthread_mutex_unlock(&stats->lock);
+
+	char *text = NULL;
+	size_t size;
+	FILE *f = open_memstream(&text, &size);
+	if (f == NULL) {
+		free(hist);
+		return NULL;
+	}
+
+	fprintf(f, "%-12s %12s %12s %10s %10s %10s %10s %10s\n", "operation", "count",
+	        "total_ms", "mean_us", "p50_us", "p99_us", "p999_us", "max_us");
+	for (int op = 0; op < A1FS_OP_COUNT; op++) {
+		uint64_t count = 0;
+		for (unsigned int b = 0; b < A1FS_STATS_BUCKETS; b++) count += hist[op][b];
+		if (count == 0) continue;
+		fprintf(f, "%-12s %12lu %12.3f %10.2f %10.2f %10.2f %10.2f %10.2f\n",
+		        op_names[op], count, total_ns[op] / 1e6, total_ns[op] / 1e3 / count,
+		        percentile(hist[op], count, max_ns[op], 50.0),
+		        percentile(hist[op], count, max_ns[op], 99.0),
+		        percentile(hist[op], count, max_ns[op], 99.9), max_ns[op] / 1e3);
+	}
+	fputc('\n', f);
+	for (int c = 0; c < A1FS_STAT_COUNT; c++) {
+		fprintf(f, "%-16s %lu\n", counter_names[c], counters[c]);
+	}
+
+	free(hist);
+	if (fclose(f) != 0) {
+		free(text);
+		return NULL;
+	}
+	return text;
+}
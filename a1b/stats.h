@@ -0,0 +1,158 @@
+/*
+ * This code is provided solely for the personal and private use of students
+ * taking the CSC369H course at the University of Toronto. Copying for purposes
+ * other than this use is expressly prohibited. All forms of distribution of
+ * this code, including but not limited to public repositories on GitHub,
+ * GitLab, Bitbucket, or any other online platform, whether as given or with
+ * any changes, are expressly prohibited.
+ *
+ * Authors: Alexey Khrabrov, Karen Reid
+ *
+ * All of the files in this directory and all subdirectories are:
+ * Copyright (c) 2019 Karen Reid
+ */
+
+/**
+ * CSC369 Assignment 1 - Runtime statistics header file.
+ *
+ * Per-operation latency histograms and block I/O counters. Every thread that
+ * runs FUSE callbacks records into its own set of histograms, so recording
+ * needs no locks or atomic read-modify-write operations; reports sum the sets
+ * of all threads. Histogram buckets are log-linear (as in HdrHistogram): each
+ * power of 2 is split into 2^A1FS_STATS_SUB_BITS buckets, which bounds the
+ * relative error of reported latencies to about 6%.
+ */
+
+#pragma once
+
+#include <pthread.h>
+#include <stdbool.h>
+#include <stddef.h>
+#include <stdint.h>
+
+
+/** Path of the virtual file that shows the statistics. */
+#define A1FS_STATS_PATH "/.a1fs_stats"
+
+/** Operations with latency histograms. */
+typedef enum a1fs_stats_op {
+	A1FS_OP_STATFS,
+	A1FS_OP_GETATTR,
+	A1FS_OP_READDIR,
+	A1FS_OP_MKDIR,
+	A1FS_OP_RMDIR,
+	A1FS_OP_CREATE,
+	A1FS_OP_UNLINK,
+	A1FS_OP_RENAME,
+	A1FS_OP_UTIMENS,
+	A1FS_OP_TRUNCATE,
+	A1FS_OP_OPEN,
+	A1FS_OP_READ,
+	A1FS_OP_WRITE,
+	A1FS_OP_RELEASE,
+	A1FS_OP_FLUSH,
+	A1FS_OP_FSYNC,
+	A1FS_OP_SETXATTR,
+	A1FS_OP_GETXATTR,
+	A1FS_OP_LISTXATTR,
+	A1FS_OP_REMOVEXATTR,
+	A1FS_OP_IOCTL,
+	// Low-level API only (a1fs_ll)
+	A1FS_OP_LOOKUP,
+	A1FS_OP_FORGET,
+	A1FS_OP_SETATTR,
+
+	A1FS_OP_COUNT
+} a1fs_stats_op;
+
+/** Event counters. */
+typedef enum a1fs_stats_counter {
+	/** Data blocks read by file reads. */
+	A1FS_STAT_BLOCKS_READ,
+	/** Data blocks written by file writes. */
+	A1FS_STAT_BLOCKS_WRITTEN,
+	/** Data blocks allocated. */
+	A1FS_STAT_BLOCKS_ALLOCATED,
+	/** Data blocks freed. */
+	A1FS_STAT_BLOCKS_FREED,
+	/** Modification time updates kept in memory with --lazytime. */
+	A1FS_STAT_MTIME_DEFERRED,
+	/** Pending modification times written to the inode table. */
+	A1FS_STAT_MTIME_WRITTEN,
+	/** Inode table blocks and directories that failed checksum verification. */
+	A1FS_STAT_CHECKSUM_ERRORS,
+
+	A1FS_STAT_COUNT
+} a1fs_stats_counter;
+
+/** log2 of the number of histogram buckets per power of 2. */
+#define A1FS_STATS_SUB_BITS 4
+
+/** Number of histogram buckets; enough for any 64-bit latency in ns. */
+#define A1FS_STATS_BUCKETS ((64 - A1FS_STATS_SUB_BITS + 1) << A1FS_STATS_SUB_BITS)
+
+/** Statistics recorded by one thread. Only that thread updates them. */
+typedef struct a1fs_thread_stats {
+	/** Latency histograms in ns. */
+	uint64_t hist[A1FS_OP_COUNT][A1FS_STATS_BUCKETS];
+	/** Total latency in ns. */
+	uint64_t total_ns[A1FS_OP_COUNT];
+	/** Maximum latency in ns. */
+	uint64_t max_ns[A1FS_OP_COUNT];
+	/** Event counters. */
+	uint64_t counters[A1FS_STAT_COUNT];
+
+	/**
+	 * Whether a thread owns this set. The sets of exited threads are kept
+	 * (their counts are part of the totals) and reused by new threads.
+	 */
+	bool in_use;
+	struct a1fs_thread_stats *next;
+
+} a1fs_thread_stats;
+
+/** Statistics of a mounted file system. */
+typedef struct a1fs_stats {
+	/** Per-thread statistics of the calling thread. */
+	pthread_key_t key;
+	/** All per-thread statistics sets. */
+	a1fs_thread_stats *threads;
+	/** Protects the threads list and the in_use flags. */
+	pthread_mutex_t lock;
+
+} a1fs_stats;
+
+
+/**
+ * Initialize statistics.
+ *
+ * @return  true on success; false on failure.
+ */
+bool stats_init(a1fs_stats *stats);
+
+/** Free the memory used by statistics. */
+void stats_destroy(a1fs_stats *stats);
+
+/** Get the current time in ns for measuring latencies. */
+uint64_t stats_now(void);
+
+/**
+ * Record the latency of an operation that started at start_ns (as returned by
+ * stats_now()).
+ */
+void stats_record_op(a1fs_stats *stats, a1fs_stats_op op, uint64_t start_ns);
+
+/** Name of an operation as shown in the report, e.g. "getattr". */
+const char *stats_op_name(a1fs_stats_op op);
+
+/** Add n to an event counter. */
+void stats_count(a1fs_stats *stats, a1fs_stats_counter counter, uint64_t n);
+
+/**
+ * Format a report of the statistics of all threads.
+ *
+ * @param stats  statistics.
+ * @return       a null-terminated report allocated with malloc() on success;
+ *               NULL if out of memory.
+ */
+char *stats_report(a1fs_stats *stats);
@@ -0,0 +1,120 @@
+/*
+ * This code is provided solely for the personal and private use of students
+ * taking the CSC369H course at the University of Toronto. Copying for purposes
+ * other than this use is expressly prohibited. All forms of distribution of
+ * this code, including but not limited to public repositories on GitHub,
+ * GitLab, Bitbucket, or any other online platform, whether as given or with
+ * any changes, are expressly prohibited.
+ *
+ * Authors: Alexey Khrabrov, Karen Reid
+ *
+ * All of the files in this directory and all subdirectories are:
+ * Copyright (c) 2019 Karen Reid
+ */
+
+
+/**
+ * CSC369 Assignment 1 - a1fs send stream format.
+ *
+ * A send stream (see send.c and receive.c) carries the changes between two
+ * snapshots of an a1fs file system: the "base" and the "target". Applied to a
+ * file system whose current state is a copy of the base, it turns that state
+ * into a copy of the target. A stream without a base carries the whole target
+ * and is applied to a freshly formatted file system.
+ *
+ * Changes are described per inode, and inodes keep their numbers, so that
+ * directory blocks are carried like any other file data. The stream starts
+ * with a header followed by records, each a record header and a payload. All
+ * numbers are in host byte order.
+ */
+
+#pragma once
+
+#include <stdint.h>
+
+#include "a1fs.h"
+
+
+/** Magic value that identifies a send stream. */
+#define A1FS_STREAM_MAGIC 0xC5C369A15E4D0001ul
+
+/** Send stream header. */
+typedef struct a1fs_stream_header {
+	/** Must match A1FS_STREAM_MAGIC. */
+	uint64_t magic;
+	/** Number of inodes in the source file system. */
+	uint32_t num_inodes;
+	uint32_t padding;
+	/** Name of the base snapshot; empty for a full stream. */
+	char base[A1FS_NAME_MAX];
+	/** Name of the target snapshot. */
+	char target[A1FS_NAME_MAX];
+
+} a1fs_stream_header;
+
+/** Send stream record types. */
+enum {
+	/** Free an inode and its data. No payload. */
+	A1FS_STREAM_DELETE,
+	/** Create or update an inode. Payload: a1fs_stream_inode. */
+	A1FS_STREAM_INODE,
+	/**
+	 * Write file data. Payload: count blocks starting at file block index, or
+	 * for a compressed file, A1FS_CLUSTER_SIZE bytes of cluster index.
+	 */
+	A1FS_STREAM_DATA,
+	/**
+	 * Make count blocks starting at file block index a hole, or zero cluster
+	 * index of a compressed file. No payload.
+	 */
+	A1FS_STREAM_HOLE,
+	/**
+	 * Replace the extended attributes of an inode. Payload: the in-inode xattr
+	 * area, followed by the xattr block if the inode has one.
+	 */
+	A1FS_STREAM_XATTR,
+	/** End of the stream. No payload. */
+	A1FS_STREAM_END,
+};
+
+/** Send stream record header. */
+typedef struct a1fs_stream_record {
+	/** A1FS_STREAM_* record type. */
+	uint32_t type;
+	/** Inode number. */
+	a1fs_ino_t ino;
+	/** First file block or cluster (A1FS_STREAM_DATA and A1FS_STREAM_HOLE). */
+	uint64_t index;
+	/** Number of blocks (A1FS_STREAM_DATA and A1FS_STREAM_HOLE). */
+	uint32_t count;
+	/** Payload size in bytes. */
+	uint32_t size;
+
+} a1fs_stream_record;
+
+/** Maximum number of blocks in one A1FS_STREAM_DATA record. */
+#define A1FS_STREAM_DATA_BLOCKS 256
+
+/** Maximum payload size of a record. */
+#define A1FS_STREAM_PAYLOAD_MAX (A1FS_STREAM_DATA_BLOCKS * A1FS_BLOCK_SIZE)
+
+/** Payload of an A1FS_STREAM_INODE record. */
+typedef struct a1fs_stream_inode {
+	/** File mode. */
+	mode_t mode;
+	/** Number of links. */
+	uint32_t links;
+	/** File size in bytes. */
+	uint64_t size;
+	/** Last modification timestamp. */
+	struct timespec mtime;
+	/** A1FS_INODE_COMPRESSED, if the file is compressed. */
+	uint32_t flags;
+	/**
+	 * Whether the data of the inode is to be dropped first: the inode is new
+	 * in the target, or was reused for a different kind of file. The data
+	 * records that follow are then relative to an empty file.
+	 */
+	uint32_t reset;
+
+} a1fs_stream_inode;
@@ -0,0 +1,122 @@
+/*
+ * This code is provided solely for the personal and private use of students
+ * taking the CSC369H course at the University of Toronto. Copying for purposes
+ * other than this use is expressly prohibited. All forms of distribution of
+ * this code, including but not limited to public repositories on GitHub,
+ * GitLab, Bitbucket, or any other online platform, whether as given or with
+ * any changes, are expressly prohibited.
+ *
+ * Authors: Alexey Khrabrov, Karen Reid
+ *
+ * All of the files in this directory and all subdirectories are:
+ * Copyright (c) 2019 Karen Reid
+ */
+
+/**
+ * CSC369 Assignment 1 - Operation trace recorder implementation.
+ */
+
+#include <pthread.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+
+#include "stats.h"
+#include "trace.h"
+
+
+/** Size of the buffer of records not written to the trace file yet. */
+#define TRACE_BUFFER_SIZE (1 << 20)
+
+struct a1fs_trace {
+	/** The trace file. */
+	FILE *file;
+	/** stats_now() time when recording started. */
+	uint64_t start_ns;
+	/** Whether recording stopped after a write error. */
+	bool failed;
+	/** Serializes the records of concurrent operations. */
+	pthread_mutex_t lock;
+
+};
+
+
+a1fs_trace *trace_open(const char *path)
+{
+	a1fs_trace *trace = calloc(1, sizeof(*trace));
+	if (trace == NULL) {
+		perror("calloc");
+		return NULL;
+	}
+	trace->file = fopen(path, "w");
+	if (trace->file == NULL) {
+		perror(path);
+		free(trace);
+		return NULL;
+	}
+	setvbuf(trace->file, NULL, _IOFBF, TRACE_BUFFER_SIZE);
+
+	struct timespec ts;
+	clock_gettime(CLOCK_REALTIME, &ts);
+	trace->start_ns = stats_now();
+	a1fs_trace_header header = {
+		.magic = A1FS_TRACE_MAGIC,
+		.start_time = ts.tv_sec * 1000000000ul + ts.tv_nsec,
+	};
+	if (fwrite(&header, sizeof(header), 1, trace->file) != 1) {
+		perror(path);
+		fclose(trace->file);
+		free(trace);
+		return NULL;
+	}
+	pthread_mutex_init(&trace->lock, NULL);
+	return trace;
+}
+
+void trace_record(a1fs_trace *trace, a1fs_trace_record *rec, uint64_t start_ns,
+                  const char *path, const char *name)
+{
+	uint64_t ns = stats_now() - start_ns;
+	size_t path_len = (path != NULL) ? strnlen(path, UINT16_MAX) : 0;
+	size_t name_len = (name != NULL) ? strnlen(name, UINT16_MAX) : 0;
+	rec->time = start_ns - trace->start_ns;
+	rec->latency = (ns < UINT32_MAX) ? ns : UINT32_MAX;
+	rec->path_len = path_len;
+	rec->name_len = name_len;
+	rec->padding = 0;
+
+	pthread_mutex_lock(&trace->lock);
+	if (!trace->failed &&
+	    ((fwrite(rec, sizeof(*rec), 1, trace->file) != 1) ||
+	     ((path_len > 0) && (fwrite(path, path_len, 1, trace->file) != 1)) ||
+	     ((name_len > 0) && (fwrite(name, name_len, 1, trace->file) != 1))))
+	{
+		perror("Trace write failed; recording stopped");
+		trace->failed = true;
+	}
+	pthread_mutex_unlock(&trace->lock);
+}
+
+void trace_close(a1fs_trace *trace)
+{
+	if ((fclose(trace->file) != 0) && !trace->failed) {
+		perror("Trace write failed");
+	}
+	pthread_mutex_destroy(&trace->lock);
+	free(trace);
+}
+
+int trace_read(FILE *f, a1fs_trace_record *rec, char *path, char *name)
+{
+	size_t n = fread(rec, 1, sizeof(*rec), f);
+	if (n == 0) return feof(f) ? 0 : -1;
+	if ((n != sizeof(*rec)) || (rec->op >= A1FS_OP_COUNT)) return -1;
+	if (((rec->path_len > 0) && (fread(path, rec->path_len, 1, f) != 1)) ||
+	    ((rec->name_len > 0) && (fread(name, rec->name_len, 1, f) != 1)))
+	{
+		return -1;
+	}
+	path[rec->path_len] = '\0';
+	name[rec->name_len] = '\0';
+	return 1;
+}
@@ -0,0 +1,147 @@
+/*
+ * This code is provided solely for the personal and private use of students
+ * taking the CSC369H course at the University of Toronto. Copying for purposes
+ * other than this use is expressly prohibited. All forms of distribution of
+ * this code, including but not limited to public repositories on GitHub,
+ * GitLab, Bitbucket, or any other online platform, whether as given or with
+ * any changes, are expressly prohibited.
+ *
+ * Authors: Alexey Khrabrov, Karen Reid
+ *
+ * All of the files in this directory and all subdirectories are:
+ * Copyright (c) 2019 Karen Reid
+ */
+
+/**
+ * CSC369 Assignment 1 - Operation trace format and recorder header file.
+ *
+ * With --trace, a1fs and a1fs_ll log every callback into a trace file: what
+ * was called on which file, with which range, when, how long it took and what
+ * it returned. File data and attribute values are not recorded. replay.a1fs
+ * replays a trace against an image or a mounted file system.
+ *
+ * A trace starts with a header followed by records, each a record header and
+ * the path and name bytes (not null-terminated). All numbers are in host byte
+ * order. Records are in the order in which the operations completed.
+ */
+
+#pragma once
+
+#include <stdbool.h>
+#include <stdint.h>
+#include <stdio.h>
+
+
+/** Magic value that identifies a trace. */
+#define A1FS_TRACE_MAGIC 0xC5C369A17AC50001ul
+
+/** Trace header. */
+typedef struct a1fs_trace_header {
+	/** Must match A1FS_TRACE_MAGIC. */
+	uint64_t magic;
+	/** Wall clock time when recording started, in ns since the Epoch. */
+	uint64_t start_time;
+
+} a1fs_trace_header;
+
+/** Bits of a1fs_trace_record.size for A1FS_OP_SETATTR. */
+enum {
+	/** The file was truncated to the size in offset. */
+	A1FS_TRACE_SET_SIZE  = 1,
+	/** The modification time was set. */
+	A1FS_TRACE_SET_MTIME = 2,
+};
+
+/**
+ * Trace record header.
+ *
+ * The meaning of offset and size depends on the operation:
+ *   read, write               file offset and size in bytes.
+ *   readdir                   offset is the directory offset; size is the
+ *                             buffer size (a1fs_ll only).
+ *   mkdir, create             offset is the mode; size is the inode number of
+ *                             the new entry (a1fs_ll only).
+ *   lookup                    size is the inode number of the entry.
+ *   forget                    size is the number of lookups dropped, or of
+ *                             inodes for a batch (then ino is 0).
+ *   open                      offset is the open flags.
+ *   truncate                  offset is the new size.
+ *   setattr                   offset is the new size; size is a mask of
+ *                             A1FS_TRACE_SET_* bits.
+ *   setxattr                  offset is the flags; size is the value size.
+ *   getxattr, listxattr       size is the buffer size.
+ *   ioctl                     offset is the command.
+ */
+typedef struct a1fs_trace_record {
+	/** Start time in ns since the start of recording. */
+	uint64_t time;
+	/** Operation-specific (see above). */
+	uint64_t offset;
+	/** Operation-specific (see above). */
+	uint64_t size;
+	/** Latency in ns (saturated). */
+	uint32_t latency;
+	/** Return value of the callback: >= 0 on success; -errno on error. */
+	int32_t result;
+	/** Inode number for a1fs_ll (the parent for name operations); 0 for a1fs. */
+	uint32_t ino;
+	/** ID of the calling process. */
+	uint32_t pid;
+	/** Operation; one of a1fs_stats_op. */
+	uint16_t op;
+	/** Length of the path that follows; 0 for a1fs_ll. */
+	uint16_t path_len;
+	/**
+	 * Length of the name that follows the path: the new path for rename, the
+	 * attribute name for xattr operations, or the entry name for a1fs_ll
+	 * operations on a directory entry.
+	 */
+	uint16_t name_len;
+	uint16_t padding;
+
+} a1fs_trace_record;
+
+
+/** Trace recorder. */
+typedef struct a1fs_trace a1fs_trace;
+
+/**
+ * Create a trace file and start recording.
+ *
+ * @param path  path to the trace file; an existing file is replaced.
+ * @return      the recorder on success; NULL on failure (reported on stderr).
+ */
+a1fs_trace *trace_open(const char *path);
+
+/**
+ * Append a record to the trace. Records are buffered in memory and written in
+ * large chunks. Safe to call from several threads.
+ *
+ * A write error is reported on stderr once, and recording then stops.
+ *
+ * @param trace     the recorder.
+ * @param rec       record header; time, latency, path_len, name_len and
+ *                  padding are set here.
+ * @param start_ns  start time of the operation (as returned by stats_now()).
+ * @param path      path of the file; may be NULL.
+ * @param name      name or second path (see a1fs_trace_record); may be NULL.
+ */
+void trace_record(a1fs_trace *trace, a1fs_trace_record *rec, uint64_t start_ns,
+                  const char *path, const char *name);
+
+/** Write the buffered records, close the trace file and free the recorder. */
+void trace_close(a1fs_trace *trace);
+
+/**
+ * Read the next record of a trace.
+ *
+ * @param f     trace file, positioned after the header or the previous record.
+ * @param rec   pointer to the record header that receives the result.
+ * @param path  buffer of at least UINT16_MAX + 1 bytes that receives the
+ *              null-terminated path.
+ * @param name  buffer of at least UINT16_MAX + 1 bytes that receives the
+ *              null-terminated name.
+ * @return      1 on success; 0 at the end of the trace; -1 if the trace is
+ *              truncated or malformed.
+ */
+int trace_read(FILE *f, a1fs_trace_record *rec, char *path, char *name);
@@ -0,0 +1,240 @@
+/*
+ * This code is provided solely for the personal and private use of students
+ * taking the CSC369H course at the University of Toronto. Copying for purposes
+ * other than this use is expressly prohibited. All forms of distribution of
+ * this code, including but not limited to public repositories on GitHub,
+ * GitLab, Bitbucket, or any other online platform, whether as given or with
+ * any changes, are expressly prohibited.
+ *
+ * Authors: Alexey Khrabrov, Karen Reid
+ *
+ * All of the files in this directory and all subdirectories are:
+ * Copyright (c) 2019 Karen Reid
+ */
+
+
+/**
+ * CSC369 Assignment 1 - io_uring block I/O implementation.
+ */
+
+#include <errno.h>
+#include <fcntl.h>
+#include <linux/io_uring.h>
+#include <string.h>
+#include <sys/mman.h>
+#include <sys/syscall.h>
+#include <unistd.h>
+
+#include "uring.h"
+
+
+/** Number of times the completion queue is checked before waiting in the kernel. */
+#define URING_SPIN 2000
+
+// No liburing dependency: the ring protocol is simple enough
+static int io_uring_setup(unsigned entries, struct io_uring_params *p)
+{
+	return syscall(SYS_io_uring_setup, entries, p);
+}
+
+static int io_uring_enter(int fd, unsigned to_submit, unsigned min_complete,
+                          unsigned flags)
+{
+	return syscall(SYS_io_uring_enter, fd, to_submit, min_complete, flags, NULL, 0);
+}
+
+static int io_uring_register(int fd, unsigned opcode, const void *arg,
+                             unsigned nr_args)
+{
+	return syscall(SYS_io_uring_register, fd, opcode, arg, nr_args);
+}
+
+/** Map the rings and the SQE array of a new io_uring. */
+static int uring_map(uring *ring, const struct io_uring_params *p)
+{
+	ring->sq_ring_size = p->sq_off.array + p->sq_entries * sizeof(unsigned);
+	ring->cq_ring_size = p->cq_off.cqes + p->cq_entries * sizeof(struct io_uring_cqe);
+	// Both rings are in one mapping on kernels that support it
+	bool single = p->features & IORING_FEAT_SINGLE_MMAP;
+	if (single && (ring->cq_ring_size > ring->sq_ring_size)) {
+		ring->sq_ring_size = ring->cq_ring_size;
+	}
+
+	ring->sq_ring = mmap(NULL, ring->sq_ring_size, PROT_READ | PROT_WRITE,
+	                     MAP_SHARED | MAP_POPULATE, ring->fd, IORING_OFF_SQ_RING);
+	if (ring->sq_ring == MAP_FAILED) return -errno;
+	ring->cq_ring = single ? ring->sq_ring
+	                       : mmap(NULL, ring->cq_ring_size, PROT_READ | PROT_WRITE,
+	                              MAP_SHARED | MAP_POPULATE, ring->fd, IORING_OFF_CQ_RING);
+	if (ring->cq_ring == MAP_FAILED) return -errno;
+	ring->sqes_size = p->sq_entries * sizeof(struct io_uring_sqe);
+	ring->sqes = mmap(NULL, ring->sqes_size, PROT_READ | PROT_WRITE,
+	                  MAP_SHARED | MAP_POPULATE, ring->fd, IORING_OFF_SQES);
+	if (ring->sqes == MAP_FAILED) return -errno;
+
+	void *sq = ring->sq_ring, *cq = ring->cq_ring;
+	ring->sq_head = sq + p->sq_off.head;
+	ring->sq_tail = sq + p->sq_off.tail;
+	ring->sq_mask = *(unsigned*)(sq + p->sq_off.ring_mask);
+	ring->sq_array = sq + p->sq_off.array;
+	ring->cq_head = cq + p->cq_off.head;
+	ring->cq_tail = cq + p->cq_off.tail;
+	ring->cq_mask = *(unsigned*)(cq + p->cq_off.ring_mask);
+	ring->cqes = cq + p->cq_off.cqes;
+	return 0;
+}
+
+int uring_init(uring *ring, const char *path)
+{
+	memset(ring, 0, sizeof(*ring));
+	ring->sq_ring = ring->cq_ring = ring->sqes = MAP_FAILED;
+	ring->file_fd = open(path, O_RDWR);
+	if (ring->file_fd < 0) {
+		ring->fd = -1;
+		return -errno;
+	}
+
+	struct io_uring_params p;
+	memset(&p, 0, sizeof(p));
+	ring->fd = io_uring_setup(URING_DEPTH, &p);
+	int ret = (ring->fd < 0) ? -errno : uring_map(ring, &p);
+	// Requests refer to the registered file by its index (0), which saves
+	// looking up and referencing the file on each of them
+	if ((ret == 0) && (io_uring_register(ring->fd, IORING_REGISTER_FILES,
+	                                     &ring->file_fd, 1) < 0))
+	{
+		ret = -errno;
+	}
+	if (ret != 0) uring_destroy(ring);
+	return ret;
+}
+
+void uring_destroy(uring *ring)
+{
+	if (ring->sqes != MAP_FAILED) munmap(ring->sqes, ring->sqes_size);
+	if ((ring->cq_ring != MAP_FAILED) && (ring->cq_ring != ring->sq_ring)) {
+		munmap(ring->cq_ring, ring->cq_ring_size);
+	}
+	if (ring->sq_ring != MAP_FAILED) munmap(ring->sq_ring, ring->sq_ring_size);
+	ring->sq_ring = ring->cq_ring = ring->sqes = MAP_FAILED;
+	if (ring->fd >= 0) close(ring->fd);
+	if (ring->file_fd >= 0) close(ring->file_fd);
+	ring->fd = ring->file_fd = -1;
+}
+
+/** Queue a request for a range; user_data is its index in the batch. */
+static void uring_queue(uring *ring, bool write, const uring_io *io, size_t index)
+{
+	unsigned tail = *ring->sq_tail;
+	unsigned i = tail & ring->sq_mask;
+	struct io_uring_sqe *sqe = &ring->sqes[i];
+	memset(sqe, 0, sizeof(*sqe));
+	sqe->opcode = write ? IORING_OP_WRITE : IORING_OP_READ;
+	sqe->flags = IOSQE_FIXED_FILE;
+	sqe->fd = 0;
+	sqe->addr = (uintptr_t)io->buf;
+	sqe->len = io->len;
+	sqe->off = io->offset;
+	sqe->user_data = index;
+	ring->sq_array[i] = i;
+	// The kernel must see the entry before the new tail
+	__atomic_store_n(ring->sq_tail, tail + 1, __ATOMIC_RELEASE);
+}
+
+/**
+ * Submit the queued requests.
+ *
+ * @param count  number of queued requests; receives the number submitted. The
+ *               requests that could not be submitted are dropped.
+ * @return       0 on success; -errno on failure.
+ */
+static int uring_submit(uring *ring, unsigned *count)
+{
+	unsigned left = *count;
+	int ret = 0;
+	while (left > 0) {
+		int n = io_uring_enter(ring->fd, left, 0, 0);
+		if (n < 0) {
+			if (errno == EINTR) continue;
+			ret = -errno;
+			break;
+		}
+		left -= n;
+	}
+	if (left > 0) {
+		__atomic_store_n(ring->sq_tail, *ring->sq_tail - left, __ATOMIC_RELEASE);
+	}
+	*count -= left;
+	return ret;
+}
+
+/**
+ * Get the next completion, polling the completion queue for a while before
+ * waiting for it in the kernel.
+ *
+ * @return  0 on success; -errno on failure.
+ */
+static int uring_wait(uring *ring, struct io_uring_cqe *cqe)
+{
+	unsigned head = *ring->cq_head;
+	for (int spin = 0; ; spin++) {
+		if (__atomic_load_n(ring->cq_tail, __ATOMIC_ACQUIRE) != head) break;
+		if ((spin >= URING_SPIN) &&
+		    (io_uring_enter(ring->fd, 0, 1, IORING_ENTER_GETEVENTS) < 0) &&
+		    (errno != EINTR))
+		{
+			return -errno;
+		}
+	}
+	*cqe = ring->cqes[head & ring->cq_mask];
+	// The entry is copied out before the kernel may reuse it
+	__atomic_store_n(ring->cq_head, head + 1, __ATOMIC_RELEASE);
+	return 0;
+}
+
+int uring_rw(uring *ring, bool write, uring_io *ios, size_t n)
+{
+	size_t next = 0;
+	unsigned inflight = 0, queued = 0;
+	int ret = 0;
+	while ((next < n) || (queued > 0) || (inflight > 0)) {
+		while ((next < n) && (inflight + queued < URING_DEPTH)) {
+			uring_queue(ring, write, &ios[next], next);
+			next++;
+			queued++;
+		}
+		if (queued > 0) {
+			int err = uring_submit(ring, &queued);
+			inflight += queued;
+			queued = 0;
+			if (err != 0) {
+				// Only wait for the requests already in flight
+				if (ret == 0) ret = err;
+				next = n;
+			}
+		}
+		if (inflight == 0) break;
+
+		struct io_uring_cqe cqe;
+		int err = uring_wait(ring, &cqe);
+		if (err != 0) return (ret != 0) ? ret : err;
+		inflight--;
+
+		uring_io *io = &ios[cqe.user_data];
+		if ((cqe.res <= 0) || (ret != 0)) {
+			if (ret == 0) ret = (cqe.res < 0) ? cqe.res : -EIO;
+			next = n;
+		} else if ((size_t)cqe.res < io->len) {
+			io->buf += cqe.res;
+			io->len -= cqe.res;
+			io->offset += cqe.res;
+			uring_queue(ring, write, io, cqe.user_data);
+			queued++;
+		} else {
+			io->buf += cqe.res;
+			io->len = 0;
+			io->offset += cqe.res;
+		}
+	}
+	return ret;
+}
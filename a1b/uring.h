@@ -0,0 +1,108 @@
+/*
+ * This code is provided solely for the personal and private use of students
+ * taking the CSC369H course at the University of Toronto. Copying for purposes
+ * other than this use is expressly prohibited. All forms of distribution of
+ * this code, including but not limited to public repositories on GitHub,
+ * GitLab, Bitbucket, or any other online platform, whether as given or with
+ * any changes, are expressly prohibited.
+ *
+ * Authors: Alexey Khrabrov, Karen Reid
+ *
+ * All of the files in this directory and all subdirectories are:
+ * Copyright (c) 2019 Karen Reid
+ */
+
+
+/**
+ * CSC369 Assignment 1 - io_uring block I/O header file.
+ *
+ * Reads and writes of several ranges of the image file are queued on an
+ * io_uring and submitted with one system call, so that the kernel works on all
+ * of them at once. With the mapping, each page fault on a cold page waits for
+ * its own read; on an NVMe device that serializes I/O the device could do in
+ * parallel.
+ *
+ * The I/O goes through the page cache like the mapping does, so both see the
+ * same data. Only the ring setup and submission system calls are used (no
+ * liburing dependency).
+ */
+
+#pragma once
+
+#include <stdbool.h>
+#include <stddef.h>
+#include <stdint.h>
+
+
+/** Number of requests in flight at most. */
+#define URING_DEPTH 64
+
+/** A read or write of a contiguous range of the image file. */
+typedef struct uring_io {
+	/** Data buffer. */
+	void *buf;
+	/** Number of bytes. */
+	size_t len;
+	/** Offset in the image file in bytes. */
+	uint64_t offset;
+
+} uring_io;
+
+/** io_uring instance; the image file is registered with it. */
+typedef struct uring {
+	/** io_uring file descriptor. */
+	int fd;
+	/** Image file descriptor. */
+	int file_fd;
+
+	/** Submission queue ring: head, tail, index mask and SQE index array. */
+	unsigned *sq_head;
+	unsigned *sq_tail;
+	unsigned sq_mask;
+	unsigned *sq_array;
+	/** Submission queue entries. */
+	struct io_uring_sqe *sqes;
+	/** Completion queue ring: head, tail, index mask and entries. */
+	unsigned *cq_head;
+	unsigned *cq_tail;
+	unsigned cq_mask;
+	struct io_uring_cqe *cqes;
+
+	/** Ring mappings, for munmap(). */
+	void *sq_ring;
+	size_t sq_ring_size;
+	void *cq_ring;
+	size_t cq_ring_size;
+	size_t sqes_size;
+
+} uring;
+
+/**
+ * Set up an io_uring for I/O on a file.
+ *
+ * @param ring  pointer to the ring to initialize.
+ * @param path  path to the file.
+ * @return      0 on success; -errno on failure (e.g. -ENOSYS or -EPERM if the
+ *              kernel doesn't support or allow io_uring).
+ */
+int uring_init(uring *ring, const char *path);
+
+/** Tear down an io_uring set up with uring_init(). */
+void uring_destroy(uring *ring);
+
+/**
+ * Read or write a batch of ranges of the file.
+ *
+ * Up to URING_DEPTH requests are kept in flight; a larger batch is submitted
+ * as earlier requests complete. Short reads and writes are resubmitted for the
+ * rest of the range. Completions are polled for a short while before waiting
+ * for them in the kernel.
+ *
+ * @param ring   the ring.
+ * @param write  whether to write the buffers to the file; read otherwise.
+ * @param ios    the ranges; advanced past the transferred data.
+ * @param n      number of ranges.
+ * @return       0 on success; -errno of the first failed request (-EIO if a
+ *               read hit EOF). The other requests are still completed.
+ */
+int uring_rw(uring *ring, bool write, uring_io *ios, size_t n);
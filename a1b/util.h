@@ -1,44 +1,66 @@
-/*
- * This code is provided solely for the personal and private use of students
- * taking the CSC369H course at the University of Toronto. Copying for purposes
- * other than this use is expressly prohibited. All forms of distribution of
- * this code, including but not limited to public repositories on GitHub,
- * GitLab, Bitbucket, or any other online platform, whether as given or with
- * any changes, are expressly prohibited.
- *
- * Authors: Alexey Khrabrov, Karen Reid
- *
- * All of the files in this directory and all subdirectories are:
- * Copyright (c) 2019 Karen Reid
- */
-
-/**
- * CSC369 Assignment 1 - Miscellaneous utility functions.
- */
-
-#pragma once
-
-#include <assert.h>
-#include <stdbool.h>
-#include <stddef.h>
-
-
-/** Check if x is a power of 2. */
-static inline bool is_powerof2(size_t x)
-{
-	return (x & (x - 1)) == 0;
-}
-
-/** Check if x is a multiple of alignment (which must be a power of 2). */
-static inline bool is_aligned(size_t x, size_t alignment)
-{
-	assert(is_powerof2(alignment));
-	return (x & (alignment - 1)) == 0;
-}
-
-/** Align x up to a multiple of alignment (which must be a power of 2). */
-static inline size_t align_up(size_t x, size_t alignment)
-{
-	assert(is_powerof2(alignment));
-	return (x + alignment - 1) & (~alignment + 1);
-}
+/*
+ * This code is provided solely for the personal and private use of students
+ * taking the CSC369H course at the University of Toronto. Copying for purposes
+ * other than this use is expressly prohibited. All forms of distribution of
+ * this code, including but not limited to public repositories on GitHub,
+ * GitLab, Bitbucket, or any other online platform, whether as given or with
+ * any changes, are expressly prohibited.
+ *
+ * Authors: Alexey Khrabrov, Karen Reid
+ *
+ * All of the files in this directory and all subdirectories are:
+ * Copyright (c) 2019 Karen Reid
+ */
+
+/**
+ * CSC369 Assignment 1 - Miscellaneous utility functions.
+ */
+
+#pragma once
+
+#include <assert.h>
+#include <stdbool.h>
+#include <stddef.h>
+#include <stdint.h>
+#include <stdlib.h>
+
+
+/** Check if x is a power of 2. */
+static inline bool is_powerof2(size_t x)
+{
+	return (x & (x - 1)) == 0;
+}
+
+/** Check if x is a multiple of alignment (which must be a power of 2). */
+static inline bool is_aligned(size_t x, size_t alignment)
+{
+	assert(is_powerof2(alignment));
+	return (x & (alignment - 1)) == 0;
+}
+
+/** Align x up to a multiple of alignment (which must be a power of 2). */
+static inline size_t align_up(size_t x, size_t alignment)
+{
+	assert(is_powerof2(alignment));
+	return (x + alignment - 1) & (~alignment + 1);
+}
+
+/**
+ * Parse a size in bytes with an optional K, M, G or T suffix (powers of 1024).
+ *
+ * @return  the size; 0 if the string is not a valid size.
+ */
+static inline uint64_t parse_size(const char *str)
+{
+	char *end;
+	uint64_t size = strtoull(str, &end, 10);
+	if (end == str) return 0;
+	switch (*end) {
+		case 'T': size <<= 10;// fall through
+		case 'G': size <<= 10;// fall through
+		case 'M': size <<= 10;// fall through
+		case 'K': size <<= 10; end++; break;
+		default: break;
+	}
+	return (*end == '\0') ? size : 0;
+}
@@ -0,0 +1,36 @@
+/*
+ * This code is provided solely for the personal and private use of students
+ * taking the CSC369H course at the University of Toronto. Copying for purposes
+ * other than this use is expressly prohibited. All forms of distribution of
+ * this code, including but not limited to public repositories on GitHub,
+ * GitLab, Bitbucket, or any other online platform, whether as given or with
+ * any changes, are expressly prohibited.
+ *
+ * Authors: Alexey Khrabrov, Karen Reid
+ *
+ * All of the files in this directory and all subdirectories are:
+ * Copyright (c) 2019 Karen Reid
+ */
+
+/**
+ * CSC369 Assignment 1 - xxHash (XXH64) hash function header file.
+ *
+ * A small implementation of the 64-bit xxHash algorithm; produces the same
+ * values as the reference XXH64().
+ */
+
+#pragma once
+
+#include <stddef.h>
+#include <stdint.h>
+
+
+/**
+ * Compute the XXH64 hash of a buffer.
+ *
+ * @param data  input data.
+ * @param size  input size in bytes.
+ * @param seed  hash seed.
+ * @return      64-bit hash value.
+ */
+uint64_t xxh64(const void *data, size_t size, uint64_t seed);